@@ -0,0 +1,72 @@
+#!/usr/bin/env lsh
+#
+# Compare the printf builtin with the external printf utility.
+#
+# Usage: lsh bench/printf.sh [count] [external-printf]
+#
+# Times a loop of count printf calls (100000 by default) that use the builtin,
+# then the same loop running the external utility (/usr/bin/printf by default).
+# An empty loop is timed first, so its cost can be subtracted from both. The
+# output of the printf calls goes to /dev/null.
+#
+# The external loop forks and execs once per call, so it takes a few minutes
+# at the default count.
+#
+
+count=${1:-100000}
+external=${2:-/usr/bin/printf}
+
+case "$(type printf)" in
+    *builtin*)
+        ;;
+    *)
+        echo "$0: printf is not a builtin in this shell" >&2
+        exit 1
+        ;;
+esac
+
+if [ ! -x "$external" ]
+then
+    echo "$0: $external: not an executable file" >&2
+    exit 1
+fi
+
+empty_loop()
+{
+    i=0
+    while [ $i -lt $count ]
+    do
+        i=$((i+1))
+    done
+}
+
+builtin_loop()
+{
+    i=0
+    while [ $i -lt $count ]
+    do
+        printf '%s %d\n' item $i
+        i=$((i+1))
+    done > /dev/null
+}
+
+external_loop()
+{
+    i=0
+    while [ $i -lt $count ]
+    do
+        "$external" '%s %d\n' item $i
+        i=$((i+1))
+    done > /dev/null
+}
+
+echo "empty loop, $count iterations:"
+time empty_loop
+
+echo
+echo "printf builtin, $count calls:"
+time builtin_loop
+
+echo
+echo "$external, $count calls:"
+time external_loop
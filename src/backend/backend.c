@@ -100,9 +100,14 @@ pid_t fork_child(void)
     int tries = 5;
     useconds_t usecs = 1;
     pid_t pid;
-    sigset_t sigset;
-    SIGNAL_BLOCK(SIGCHLD, sigset);
 
+    /* Don't let the child inherit (and output a second copy of) our buffered output */
+    fflush(stdout);
+
+    /*
+     * We don't need to block SIGCHLD here, as the handler only queues child statuses
+     * and never touches the jobs table (see drain_child_events() in jobs.c).
+     */
     while(tries--)
     {
         if((pid = fork()) < 0)
@@ -120,12 +125,66 @@ pid_t fork_child(void)
         }
         break;
     }
-    
-    SIGNAL_UNBLOCK(sigset);
+
+    /* the child shouldn't process its parent's child statuses */
+    if(pid == 0)
+    {
+        discard_child_events();
+    }
     return pid;
 }
 
 
+/*
+ * Call func in a background process, passing it arg and the write end of a pipe
+ * to which it writes its output. The work is done in a grandchild process, so
+ * that the shell doesn't get a SIGCHLD signal when the work is finished. We only
+ * wait on the intermediate child, which exits right after forking. SIGCHLD is
+ * blocked until we've waited on it, so that the SIGCHLD handler doesn't reap it
+ * before we do (and add it to the list of dead children, as if it were one of
+ * our jobs).
+ *
+ * Returns the read end of the pipe, or -1 on error.
+ */
+int spawn_pipe_reader(void (*func)(int fd, void *arg), void *arg)
+{
+    int fds[2];
+    sigset_t sigset;
+    if(pipe(fds) == -1)
+    {
+        return -1;
+    }
+
+    SIGNAL_BLOCK(SIGCHLD, sigset);
+    pid_t pid = fork_child();
+    if(pid < 0)
+    {
+        SIGNAL_UNBLOCK(sigset);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    else if(pid == 0)
+    {
+        close(fds[0]);
+        if(fork_child() == 0)
+        {
+            func(fds[1], arg);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    while(waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+    {
+        ;
+    }
+    SIGNAL_UNBLOCK(sigset);
+    return fds[0];
+}
+
+
 /*
  * Wait on the child process with the given pid until it changes status.
  * If the struct job_s *job is passed, wait for all processes in the job to finish,
@@ -152,9 +211,18 @@ int wait_on_child(pid_t pid, struct node_s *cmd, struct job_s *job)
     
     /* Create a new, empty sigset so that we'll wake up with any signal */
     int status = 0, res = 0;
-    sigset_t sigset;
+    sigset_t sigset, chldset, old_mask;
     sigemptyset(&sigset);
 
+    /*
+     * Block SIGCHLD while we check for our child's status, so that the signal
+     * can't arrive between the check and the call to sigsuspend() (which unblocks
+     * it), leaving us to sleep until some other signal wakes us up.
+     */
+    sigemptyset(&chldset);
+    sigaddset(&chldset, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chldset, &old_mask);
+
     waiting_pid = pid;
     
 _wait:
@@ -168,6 +236,7 @@ _wait:
         if(signal_received == SIGINT)
         {
             waiting_pid = 0;
+            sigprocmask(SIG_SETMASK, &old_mask, NULL);
             sigaction(SIGCHLD, &old_sigact, NULL);
             return 128;
         }
@@ -241,6 +310,7 @@ _wait:
     
     /* Execute any pending traps */
     waiting_pid = 0;
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
     do_pending_traps();
 
     sigaction(SIGCHLD, &old_sigact, NULL);
@@ -482,7 +552,9 @@ int do_exec_cmd(int argc, char **argv, char *use_path, int (*internal_cmd)(int,
 err:
     if(cmdname != argv[0])
     {
-        free_malloced_str(cmdname);
+        /* put back the original argument */
+        free_malloced_str(argv[1]);
+        argv[1] = cmdname;
     }
     return 0;
 }
@@ -1494,13 +1566,13 @@ int do_function_body(struct source_s *src, int argc, char **argv)
     /*
     int exttrap_saved = 0;
     */
-    struct trap_item_s *debug = NULL, *err = NULL, *ret = NULL /* , *ext = NULL */;
+    struct trap_overlay_s traps;
+    int reset = 0;
     if(!flag_set(func->flags, FLAG_FUNCTRACE))
     {
         if(!option_set('T'))
         {
-            debug = save_trap("DEBUG" );
-            ret   = save_trap("RETURN");
+            reset |= TRAP_OVERLAY_BIT(DEBUG_TRAP_NUM) | TRAP_OVERLAY_BIT(RETURN_TRAP_NUM);
             /*
             ext   = save_trap("EXIT"  );
             exttrap_saved = 1;
@@ -1509,9 +1581,10 @@ int do_function_body(struct source_s *src, int argc, char **argv)
 
         if(!option_set('E'))
         {
-            err = save_trap("ERR");
+            reset |= TRAP_OVERLAY_BIT(ERR_TRAP_NUM);
         }
     }
+    trap_overlay_push(&traps, reset);
 
     /* Execute the function */
     int res = do_compound_command(src, body, NULL);
@@ -1537,20 +1610,16 @@ int do_function_body(struct source_s *src, int argc, char **argv)
     */
     
     /*
-     * Restore saved traps. struct trap_item_s * memory is freed in the call.
-     * If the struct is null, nothing happens to the trap, so the following calls
-     * are safe, even NULL trap structs.
+     * Restore saved traps. This also discards any DEBUG, RETURN or ERR traps
+     * the function has set, if these were reset when we entered the function.
      */
-    restore_trap("DEBUG" , debug);
-    restore_trap("RETURN", ret  );
-    restore_trap("ERR"   , err  );
+    trap_overlay_pop(&traps, 0);
     /*
     restore_trap("EXIT"  , ext  );
     */
 
     /* 
-     * NOTE: The positional parameters will be restored when we pop the local
-     *       symbol table back in do_simple_command().
+     * NOTE: The positional parameters are restored when we pop the callframe.
      */
     
     callframe_popf();
@@ -1564,10 +1633,16 @@ int do_function_body(struct source_s *src, int argc, char **argv)
  * Free the list of arguments (argv) after we finish executing a command.
  * We handle the special case where a file was opened via process substitution.
  * In this case, we close that file (so it won't linger around the shell
- * without being used) before freeing the memory used to store the strings.
+ * without being used). The argument strings live in the argument list's string
+ * arena, which we free in one go. Builtins may replace arguments with malloc'd
+ * strings (see exec.c and jobs.c), so we free those separately.
  */
-static inline void free_argv(int argc, char **argv)
+static inline void free_argv(struct arg_list_s *args)
 {
+    int argc = args->argc;
+    char **argv = args->argv;
+    char *bufend = args->buf + args->buf_len;
+
     while(argc--)
     {
         /* Free the file we opened for process substitution in redirect.c */
@@ -1580,12 +1655,64 @@ static inline void free_argv(int argc, char **argv)
                 close(fd);
             }
         }
-        free_malloced_str(argv[argc]);
+
+        if(argv[argc] < args->buf || argv[argc] >= bufend)
+        {
+            free_malloced_str(argv[argc]);
+        }
     }
+    free(args->buf);
     free(argv);
 }
 
 
+/*
+ * Perform an array assignment word that appears before the command word. Unlike
+ * other variable assignments, which go to the command's local symbol table,
+ * array assignments are performed on the variable itself (which we add to the
+ * symbol table below the command's local symbol table if it doesn't exist).
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+static int do_array_assignment_word(char *word)
+{
+    char *p = word;
+    while(isalnum(*p) || *p == '_')
+    {
+        p++;
+    }
+
+    char *name = get_malloced_strl(word, 0, p-word);
+    if(!name)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "array assignment");
+        return 0;
+    }
+
+    struct symtab_entry_s *entry = get_symtab_entry(name);
+    if(!entry)
+    {
+        struct symtab_stack_s *stack = get_symtab_stack();
+        entry = add_to_any_symtab(name, stack->symtab_list[stack->symtab_count-2]);
+    }
+    free_malloced_str(name);
+
+    return do_array_assignment(entry, word);
+}
+
+
+/*
+ * Return 1 if cmd is the name of one of the builtins that accept array
+ * assignments as arguments, 0 otherwise.
+ */
+static inline int is_declaration_builtin(char *cmd)
+{
+    return strcmp(cmd, "declare") == 0 || strcmp(cmd, "local"   ) == 0 ||
+           strcmp(cmd, "typeset") == 0 || strcmp(cmd, "readonly") == 0 ||
+           strcmp(cmd, "export" ) == 0;
+}
+
+
 /*
  * Execute a simple command. This function processes the nodetree of the parsed command,
  * performing I/O redirections and variable assignments as indicated in the command's nodetree.
@@ -1616,14 +1743,8 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
     /* Then loop through the command and its arguments */
     struct node_s *child = node->first_child;
 
-    /* Arguments count */
-    int argc = 0;
-
-    /* Total alloc'd arguments count */
-    int targc = 0;
-
-    /* The arguments array */
-    char **argv = NULL;
+    /* The arguments list */
+    struct arg_list_s args = { 0, 0, NULL, NULL, 0, 0 };
     
     /*
      * The flags we'll use when word-expanding the command arguments. If the 
@@ -1671,11 +1792,8 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                                   (child2->val.chr == IO_FILE_GREAT) ? '>' : 0;
                         if(op && (s = redirect_proc(op, s)))
                         {
-                            arg = s;
-                            if(check_buffer_bounds(&argc, &targc, &argv))
-                            {
-                                argv[argc++] = arg;
-                            }
+                            arg_list_add(&args, s, strlen(s));
+                            free_malloced_str(s);
                             break;
                         }
                     }
@@ -1695,11 +1813,21 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                 /*
                  * Assignments after the command name is encountered can only take 
                  * effect if the keyword '-k' option is set. We know we haven't seen
-                 * the command word if argc is 0. If -k is not set, fall through to 
+                 * the command word if args.argc is 0. If -k is not set, fall through to 
                  * the default case.
                  */
-                if(!argc || option_set('k'))
+                if(!args.argc || option_set('k'))
                 {
+                    /* array assignments are handled differently (see above) */
+                    if(is_array_assignment(child->val.str))
+                    {
+                        if(!do_array_assignment_word(child->val.str))
+                        {
+                            assign_error = 1;
+                        }
+                        break;
+                    }
+
                     s = strchr(child->val.str, '=');
                     
                     int len = s-child->val.str;
@@ -1774,6 +1902,16 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                     break;
                 }
                 
+                /*
+                 * Array assignments passed to the declaration builtins are
+                 * passed as-is, and the builtin performs the assignment.
+                 */
+                if(is_array_assignment(child->val.str) && is_declaration_builtin(args.argv[0]))
+                {
+                    arg_list_add(&args, child->val.str, strlen(child->val.str));
+                    break;
+                }
+
                 /* 
                  * If the word is an assignment word that occurs after the 
                  * command name, we won't convert whitespace chars to 
@@ -1798,7 +1936,7 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                  * $[ ... ] is a deprecated form of integer arithmetic, similar 
                  * to (( ... )).
                  */
-                if(!argc)
+                if(!args.argc)
                 {
                     if(strncmp(s, "((", 2) == 0 || strncmp(s, "$[", 2) == 0)
                     {
@@ -1820,19 +1958,8 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                         /* Convert `((expr))` and `$[expr]` to `let "expr"` */
                         if(match)
                         {
-                            char c = *arg;
-                            (*arg) = '\0';
-                            if(check_buffer_bounds(&argc, &targc, &argv))
-                            {
-                                argv[argc++] = get_malloced_str("let");
-                            }
-
-                            if(check_buffer_bounds(&argc, &targc, &argv))
-                            {
-                                argv[argc++] = get_malloced_str(s+2);
-                            }
-                            
-                            (*arg) = c;
+                            arg_list_add(&args, "let", 3);
+                            arg_list_add(&args, s+2, arg-s-2);
                             break;
                         }
                     }
@@ -1858,79 +1985,48 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                     }
                 }
 
+                /*
+                 * The parser tells us if the word needs no expansion, or only
+                 * quote removal (see classify_word() in parser.c).
+                 */
+                if(flag_set(child->flags, NODE_FLAG_LITERAL_WORD) ||
+                   (flag_set(child->flags, NODE_FLAG_QUOTED_WORD) &&
+                    !flag_set(word_expand_flags, FLAG_REMOVE_QUOTES)))
+                {
+                    arg_list_add(&args, s, strlen(s));
+                }
+                else if(flag_set(child->flags, NODE_FLAG_QUOTED_WORD))
+                {
+                    arg_list_add_unquoted(&args, s);
+                }
                 /* Go POSIX style on the word */
-                struct word_s *w = word_expand(s, word_expand_flags);
-                struct word_s *w2 = w;
-                
-                /* We will get NULL if expansion fails */
-                if(!w)
+                else if(!word_expand_to_args(&args, s, word_expand_flags))
                 {
-                    if(argv)
-                    {
-                        free_argv(argc, argv);
-                    }
+                    /* We will get 0 if expansion fails */
+                    free_argv(&args);
                     set_option('f', saved_noglob);
                     /* Update the options string */
                     symtab_save_options();
                     return 0;
                 }
-
-                /* Add the words to the arguments list */
-                while(w2)
-                {
-                    /* 
-                     * POSIX says we should delete an empty word, unless the
-                     * original word had quoted characters.
-                     */
-#if 0
-                    if(w2->data[0] != '\0' || 
-                       flag_set(w2->flags, FLAG_WORD_HAD_QUOTES) ||
-                       flag_set(w2->flags, FLAG_WORD_HAD_DOUBLE_QUOTES))
-                    {
-#endif
-                        if(check_buffer_bounds(&argc, &targc, &argv))
-                        {
-                            arg = get_malloced_str(w2->data);
-                            argv[argc++] = arg;
-                        }
-#if 0
-                    }
-#endif
-                    
-                    w2 = w2->next;
-                }
-                
-                free_all_words(w);
         }
         child = child->next_sibling;
     }
 
-    /* Even if arc == 0, we need to alloc memory for argv */
-    if(check_buffer_bounds(&argc, &targc, &argv))
-    {
-        /* NULL-terminate the array */
-        argv[argc] = NULL;
-    }
     set_option('f', saved_noglob);
     
     /*
      * Interactive shells check for a directory passed as the command word (bash).
      * Similar to setting tcsh's 'implicitcd' variable.
      */
-    if(interactive_shell && argc == 1 && optionx_set(OPTION_AUTO_CD))
+    if(interactive_shell && args.argc == 1 && optionx_set(OPTION_AUTO_CD))
     {
         struct stat st;
-        if((stat(argv[0], &st) == 0) && S_ISDIR(st.st_mode))
+        if((stat(args.argv[0], &st) == 0) && S_ISDIR(st.st_mode) &&
+           (s = arg_list_add(&args, "cd", 2)))
         {
-            argc++;
-            if(check_buffer_bounds(&argc, &targc, &argv))
-            {
-                for(i = argc; i > 0; i--)
-                {
-                    argv[i] = argv[i-1];
-                }
-                argv[0] = get_malloced_str("cd");
-            }
+            args.argv[1] = args.argv[0];
+            args.argv[0] = s;
         }
     }
     
@@ -1941,31 +2037,32 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
      * zsh has other options when dealing with redirections that have empty commands names,
      * which can be found under the "Redirections with no command" section of zsh manpage.
      */
-    if(!argc && total_redirects > 1)
+    if(!args.argc && total_redirects > 1)
     {
         char *nullcmd = get_shell_varp("NULLCMD", NULL);
         if(nullcmd && *nullcmd)
         {
             s = word_expand_to_str(nullcmd, FLAG_PATHNAME_EXPAND|FLAG_REMOVE_QUOTES);
-            if(s && check_buffer_bounds(&argc, &targc, &argv))
+            if(s)
             {
-                argv[0] = get_malloced_str(s);
-                if(argv[0])
-                {
-                    argc++;
-                }
+                arg_list_add(&args, s, strlen(s));
                 free(s);
             }
         }
-        else if(check_buffer_bounds(&argc, &targc, &argv))
+        else
         {
-            argv[0] = get_malloced_str("cat");
-            if(argv[0])
-            {
-                argc++;
-            }
+            arg_list_add(&args, "cat", 3);
         }
     }
+
+    /* Even if argc == 0, we need to alloc memory for argv */
+    if(!args.argv && (args.argv = malloc(sizeof(char *))))
+    {
+        args.argv[0] = NULL;
+        args.argv_size = 1;
+    }
+    int argc = args.argc;
+    char **argv = args.argv;
     
     //int  builtin =  is_builtin(argv[0]);
     struct symtab_entry_s *entry;
@@ -1996,7 +2093,8 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
         }
         
         /* I/O redirection failure */
-        free_argv(argc, argv);
+        close_heredocs(io_files);
+        free_argv(&args);
         free_symtab(symtab_stack_pop());
         set_internal_exit_status(1);
         return 0;
@@ -2107,7 +2205,7 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
      */
     if(argc == 0)
     {
-        free_argv(argc, argv);
+        free_argv(&args);
         MERGE_GLOBAL_SYMTAB();
         return !assign_error;
     }
@@ -2158,6 +2256,8 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
         /* Perform I/O redirection, if any */
         if(total_redirects && !redirect_do(io_files, do_savestd, saved_fd))
         {
+            close_heredocs(io_files);
+            
             /* Restore standard streams */
             if(do_savestd)
             {
@@ -2175,7 +2275,7 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
                 EXIT_IF_NONINTERACTIVE();
             }
             
-            free_argv(argc, argv);
+            free_argv(&args);
             free_symtab(symtab_stack_pop());
             
             set_internal_exit_status(1);
@@ -2204,7 +2304,7 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
             }
             
             MERGE_GLOBAL_SYMTAB();
-            free_argv(argc, argv);
+            free_argv(&args);
 
             return res;
         }
@@ -2267,13 +2367,19 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
             }
 
             MERGE_GLOBAL_SYMTAB();
-            free_argv(argc, argv);
+            free_argv(&args);
             return i;
         }
     }
     
     /* ... and parent countinues over here ...    */
 
+    /* the child has its own copies of the here-documents we opened */
+    if(total_redirects)
+    {
+        close_heredocs(io_files);
+    }
+
     if(job)
     {
         /* Set the job's pgid if not yet set */
@@ -2336,7 +2442,7 @@ int do_simple_command(struct source_s *src, struct node_s *node, struct job_s *j
     }
     
     set_underscore_val(argv[argc-1], 0);    /* Last argument to previous command */
-    free_argv(argc, argv);
+    free_argv(&args);
     return 1;
 }
 
@@ -2364,7 +2470,13 @@ int do_command(struct source_s *src, struct node_s *node,
             return do_function_definition(node);
 
         case NODE_COMMAND:
-            return do_simple_command(src, node, job);
+            {
+                /* release the process substitutions when the command finishes */
+                int mark = proc_subst_mark();
+                int res = do_simple_command(src, node, job);
+                proc_subst_release(mark);
+                return res;
+            }
 
         case NODE_TIME:
             return time_builtin(src, node->first_child);
@@ -30,6 +30,7 @@
 
 int   do_exec_cmd(int argc, char **argv, char *use_path, int (*internal_cmd)(int, char **));
 pid_t fork_child(void);
+int   spawn_pipe_reader(void (*func)(int fd, void *arg), void *arg);
 int   wait_on_child(pid_t pid, struct node_s *cmd, struct job_s *job);
 // char *get_cmdstr(struct node_s *cmd);
 
@@ -61,22 +62,42 @@ int   continue_builtin(int argc, char **argv);
 // void SIGCHLD_handler(int signum);
 
 /* pattern.c */
+
+/* the matches of a pathname pattern (see open_glob_stream()) */
+struct glob_stream_s
+{
+    char  **paths;      /* matches not yet returned, kept as a heap */
+    size_t  count;      /* number of matches in the heap */
+    size_t  size;       /* allocated size of the paths array */
+    int     ascii;      /* sort in the C locale */
+};
+
 int   match_pattern(char *pattern, char *str);
 int   match_pattern_ext(char *pattern, char *str);
 int   match_filename(char *pattern, char *str, int print_err, int ignore);
 char **get_filename_matches(char *path, glob_t *matches);
 int   match_prefix(char *pattern, char *str, int longest);
 int   match_suffix(char *pattern, char *str, int longest);
+char *replace_pattern(char *pattern, char *str, char *rep, char anchor);
 int   has_glob_chars(char *p, size_t len);
 int   match_ignore(char *pattern, char *filename);
+int   is_glob_pattern(char *word);
+struct glob_stream_s *open_glob_stream(char *word);
+char *next_glob_match(struct glob_stream_s *stream);
+void  close_glob_stream(struct glob_stream_s *stream);
+void  flush_dir_cache(void);
 
 /* redirect.c */
 int   redirect_prep_node(struct node_s *child, struct io_file_s *io_files);
 int   init_redirect_list(struct io_file_s *io_files);
 int   redirect_prep_and_do(struct node_s *redirect_list, int *saved_fd);
 char *redirect_proc(char op, char *cmdline);
+int   proc_subst_mark(void);
+void  proc_subst_release(int mark);
 int   file_redirect_prep(struct node_s *node, struct io_file_s *io_file);
 int   heredoc_redirect_prep(struct node_s *node, struct io_file_s *io_file);
+int   heredoc_fd(char *buf, size_t len);
+void  close_heredocs(struct io_file_s *io_files);
 int   redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd);
 void  save_std(int fd, int *saved_fd);
 void  restore_stds(int *saved_fd);
@@ -126,11 +126,18 @@ int continue_builtin(int argc, char **argv)
  * of the $@ special parameter, which contains the current values of the
  * positional parameters.
  *
+ * If lazy is non-zero, pathname expansion is not performed. Instead, patterns
+ * are marked with FLAG_WORD_PATTERN. Words that need no expansions other than
+ * brace expansion and quote removal are left as they are, and marked with
+ * FLAG_WORD_BRACES. The caller expands those words
+ * when it reaches them (see next_loop_word() below).
+ *
  * Returns the string array on success, NULL if there's not enough memory
  * to store the words, or if the resultant word list is empty.
  */
-struct word_s *get_loop_wordlist(struct node_s *nodelist)
+struct word_s *get_loop_wordlist(struct node_s *nodelist, int lazy)
 {
+    int flags = FLAG_REMOVE_QUOTES|FLAG_FIELD_SPLITTING;
     struct word_s *w, *cur, *prev, *head = NULL, *tail = NULL;
     
     if(nodelist)
@@ -161,9 +168,8 @@ struct word_s *get_loop_wordlist(struct node_s *nodelist)
     else
     {
         /* Use the actual arguments to the script (i.e. "$@") */
-        int count = get_shell_vari("#", 0);
+        int count = pos_param_count();
         int i = 1;
-        char buf[32];
         
         if(!count)
         {
@@ -172,8 +178,7 @@ struct word_s *get_loop_wordlist(struct node_s *nodelist)
 
         while(i <= count)
         {
-            sprintf(buf, "%d", i);
-            char *p2 = get_shell_varp(buf, "");
+            char *p2 = get_pos_param(i);
             
             if((w = make_word(p2)) == NULL)
             {
@@ -197,23 +202,36 @@ struct word_s *get_loop_wordlist(struct node_s *nodelist)
     }
     
     /* Now go POSIX-style on those tokens */
+    flags |= lazy ? FLAG_PATHNAME_DEFER : FLAG_PATHNAME_EXPAND;
     cur  = head;
     tail = head;
     prev = NULL;
 
     while(cur)
     {
+        /*
+         * Brace expressions can be expanded lazily, one word at a time, unless the
+         * word needs expansions that depend on the shell's state (like $HOME for
+         * tilde expansion and the files that match a pattern), which must be done
+         * before the loop starts.
+         */
+        if(lazy && strchr(cur->data, '{') && !strpbrk(cur->data, "$`<>~*?[("))
+        {
+            cur->flags |= FLAG_WORD_BRACES;
+            prev = cur;
+            cur = cur->next;
+            continue;
+        }
+
         /* Then, word expansion */
-        w = word_expand(cur->data,
-              FLAG_PATHNAME_EXPAND|FLAG_REMOVE_QUOTES|FLAG_FIELD_SPLITTING);
+        w = word_expand(cur->data, flags);
 
         /* Null? remove this token from list */
         if(!w)
         {
             w = cur->next;
             /* Free this word struct */
-            free(cur->data);
-            free(cur);
+            free_word(cur);
             
             /* And remove it from the list */
             if(prev)
@@ -233,8 +251,7 @@ struct word_s *get_loop_wordlist(struct node_s *nodelist)
             /* Free this word struct */
             if(w != cur)
             {
-                free(cur->data);
-                free(cur);
+                free_word(cur);
             }
             
             /* And remove it from the list */
@@ -443,6 +460,235 @@ int do_for_loop2(struct source_s *src, struct node_s *node, struct node_s *redir
 }
 
 
+/*
+ * The words of a for loop. Brace expressions and patterns in the list are
+ * expanded one word at a time when the loop reaches them, instead of being
+ * expanded in advance. The matches of all the patterns in the list are found
+ * before the loop starts, as POSIX says the list is expanded before the first
+ * iteration (the loop's commands might create or remove files). Only the
+ * sorting and returning of the matches is deferred.
+ */
+/* how we expand the words we get from brace expansion in for loops */
+#define LAZY_WORDEXP_FLAGS  (FLAG_REMOVE_QUOTES|FLAG_FIELD_SPLITTING|FLAG_PATHNAME_DEFER)
+
+struct loop_words_s
+{
+    struct word_s *next;            /* next word in the list */
+    struct brace_gen_s *braces;     /* the brace expansion of the word we're expanding */
+    int    plain;                   /* brace expansion results need no more expansion */
+    struct word_s *fields;          /* the word expansion of a brace expansion result */
+    struct word_s *next_field;      /* next field to use from the above list */
+    struct glob_stream_s *stream;   /* the matches of the pattern we're expanding */
+    char  *path;                    /* the last match we returned */
+    int    failed;                  /* set if a pattern had no matches and failglob is set */
+    struct glob_stream_s **streams; /* the matches of the patterns in the list */
+    int    next_stream;             /* index of the next pattern's matches in the above */
+};
+
+
+/*
+ * Find the matches of the patterns in the for loop's word list, in the order in
+ * which the patterns appear in the list. If we can't allocate memory for the
+ * streams array, the patterns are matched when the loop reaches them.
+ */
+static void open_loop_patterns(struct loop_words_s *words)
+{
+    struct word_s *w;
+    int count = 0;
+
+    for(w = words->next; w; w = w->next)
+    {
+        if(flag_set(w->flags, FLAG_WORD_PATTERN))
+        {
+            count++;
+        }
+    }
+
+    if(!count || !(words->streams = malloc(count * sizeof(struct glob_stream_s *))))
+    {
+        return;
+    }
+
+    for(w = words->next, count = 0; w; w = w->next)
+    {
+        if(flag_set(w->flags, FLAG_WORD_PATTERN))
+        {
+            words->streams[count++] = open_glob_stream(w->data);
+        }
+    }
+}
+
+
+/*
+ * Get the next value of the for loop's index variable.
+ *
+ * Returns the value, which is valid until the next call, or NULL if there are
+ * no more words.
+ */
+static char *next_loop_word(struct loop_words_s *words)
+{
+    struct word_s *w, *next;
+    char *str;
+    int listed;
+
+    if(words->path)
+    {
+        free(words->path);
+        words->path = NULL;
+    }
+
+    while(1)
+    {
+        if(words->stream)
+        {
+            if((words->path = next_glob_match(words->stream)))
+            {
+                return words->path;
+            }
+            close_glob_stream(words->stream);
+            words->stream = NULL;
+        }
+
+        listed = 0;
+        if(words->next_field)
+        {
+            w = words->next_field;
+            words->next_field = w->next;
+        }
+        else
+        {
+            if(words->fields)
+            {
+                free_all_words(words->fields);
+                words->fields = NULL;
+            }
+
+            if(words->braces)
+            {
+                if(!(str = brace_next(words->braces)))
+                {
+                    brace_free(words->braces);
+                    words->braces = NULL;
+                    continue;
+                }
+
+                if(words->plain)
+                {
+                    return str;
+                }
+
+                words->fields = word_expand(str, LAZY_WORDEXP_FLAGS);
+                words->next_field = words->fields;
+                continue;
+            }
+
+            if(!(w = words->next))
+            {
+                return NULL;
+            }
+            words->next = w->next;
+            listed = 1;
+
+            if(flag_set(w->flags, FLAG_WORD_BRACES))
+            {
+                if(!(words->braces = brace_compile(w->data)))
+                {
+                    words->fields = word_expand(w->data, LAZY_WORDEXP_FLAGS);
+                    words->next_field = words->fields;
+                }
+                words->plain = !strpbrk(w->data, "'\"\\");
+                continue;
+            }
+        }
+
+        if(!flag_set(w->flags, FLAG_WORD_PATTERN))
+        {
+            return w->data;
+        }
+
+        if(listed && words->streams)
+        {
+            /* use the matches we found before the loop started */
+            words->stream = words->streams[words->next_stream];
+            words->streams[words->next_stream++] = NULL;
+        }
+        else
+        {
+            words->stream = open_glob_stream(w->data);
+        }
+        if(words->stream && words->stream->count)
+        {
+            continue;
+        }
+
+        /* no matches. remove the word (bash extension) */
+        if(optionx_set(OPTION_NULL_GLOB))
+        {
+            continue;
+        }
+
+        /* print error and bail out (bash extension) */
+        if(optionx_set(OPTION_FAIL_GLOB))
+        {
+            PRINT_ERROR(SHELL_NAME, "file globbing failed for %s", w->data);
+            words->failed = 1;
+            return NULL;
+        }
+
+        /* use the pattern itself, after removing quotes */
+        w->flags &= ~FLAG_WORD_PATTERN;
+        next = w->next;
+        w->next = NULL;
+        remove_quotes(w);
+        w->next = next;
+        return w->data;
+    }
+}
+
+
+/*
+ * Free the memory used by the for loop's words.
+ */
+static void free_loop_words(struct word_s *list, struct loop_words_s *words)
+{
+    if(words->stream)
+    {
+        close_glob_stream(words->stream);
+    }
+
+    if(words->path)
+    {
+        free(words->path);
+    }
+
+    if(words->braces)
+    {
+        brace_free(words->braces);
+    }
+
+    if(words->streams)
+    {
+        struct word_s *w;
+        int i = 0;
+        for(w = list; w; w = w->next)
+        {
+            if(flag_set(w->flags, FLAG_WORD_PATTERN))
+            {
+                if(words->streams[i])
+                {
+                    close_glob_stream(words->streams[i]);
+                }
+                i++;
+            }
+        }
+        free(words->streams);
+    }
+
+    free_all_words(words->fields);
+    free_all_words(list);
+}
+
+
 /* 
  * Execute the first (classic) form of 'for' loops, which is defined by POSIX:
  * 
@@ -493,7 +739,7 @@ int do_for_loop(struct source_s *src, struct node_s *node, struct node_s *redire
         }
     }
 
-    struct word_s *list = get_loop_wordlist(wordlist);
+    struct word_s *list = get_loop_wordlist(wordlist, 1);
     if(!list)
     {
         set_internal_exit_status(0);
@@ -505,9 +751,12 @@ int do_for_loop(struct source_s *src, struct node_s *node, struct node_s *redire
     }
     
     /* We should now be set at the first command inside the for loop */
-    int res = 0;
+    int res = 0, iterations = 0;
     char *index_name = index->val.str;
-    struct word_s *l = list;
+    struct loop_words_s words = { list, NULL, 0, NULL, NULL, NULL, NULL, 0, NULL, 0 };
+    char *val;
+
+    open_loop_patterns(&words);
 
     /* Get our index variable's symbol table entry */
     struct symtab_entry_s *entry = get_symtab_entry(index_name);
@@ -520,8 +769,8 @@ int do_for_loop(struct source_s *src, struct node_s *node, struct node_s *redire
     if(flag_set(entry->flags, FLAG_READONLY))
     {
         READONLY_ASSIGN_ERROR(SOURCE_NAME, index_name, "variable");
-        /* Set l to NULL so we won't enter the loop below */
-        l = NULL;
+        /* Set the list to NULL so we won't enter the loop below */
+        words.next = NULL;
         res = 0;
     }
     else
@@ -544,10 +793,11 @@ int do_for_loop(struct source_s *src, struct node_s *node, struct node_s *redire
      */
     trap_handler(DEBUG_TRAP_NUM);    
     
-    for( ; l; l = l->next)
+    while((val = next_loop_word(&words)))
     {
-        symtab_entry_setval(entry, l->data);
+        symtab_entry_setval(entry, val);
         res = do_do_group(src, commands, NULL);
+        iterations++;
 
         if(!res || return_set || signal_received == SIGINT)
         {
@@ -570,8 +820,20 @@ int do_for_loop(struct source_s *src, struct node_s *node, struct node_s *redire
         //res = 1;
     }
 
+    if(words.failed)
+    {
+        set_internal_exit_status(1);
+        res = 1;
+    }
+    else if(!iterations && !flag_set(entry->flags, FLAG_READONLY))
+    {
+        /* all the patterns expanded to nothing */
+        set_internal_exit_status(0);
+        res = 1;
+    }
+
     /* Free used memory */
-    free_all_words(list);
+    free_loop_words(list, &words);
     cur_loop_level--;
 
     if(redirect_list)
@@ -630,7 +892,7 @@ int do_select_loop(struct source_s *src, struct node_s *node, struct node_s *red
         }
     }
     
-    struct word_s *list = get_loop_wordlist(wordlist);
+    struct word_s *list = get_loop_wordlist(wordlist, 0);
     
     if(!list)
     {
@@ -30,6 +30,7 @@
 #include <fnmatch.h>
 #include <locale.h>
 #include <glob.h>
+#include <time.h>
 #include <sys/stat.h>
 #include "backend.h"
 #include "../builtins/setx.h"
@@ -301,7 +302,7 @@ memerr:
  */
 int match_prefix(char *pattern, char *str, int longest)
 {
-    if(!pattern || !str)
+    if(!pattern || !str || !*str)
     {
         return 0;
     }
@@ -395,6 +396,127 @@ int match_suffix(char *pattern, char *str, int longest)
 }
 
 
+/*
+ * Replace the longest substring of str that matches pattern with the string rep,
+ * as in the ${parameter/pattern/string} expansion. If anchor is '/', we replace
+ * all the matching substrings. If it is '#' or '%', the match must be at the
+ * beginning or the end of str, respectively.
+ *
+ * Returns the malloc'd result, or NULL in case of error.
+ */
+char *replace_pattern(char *pattern, char *str, char *rep, char anchor)
+{
+    struct dstring_s res;
+    size_t rep_len = strlen(rep);
+
+    if(!init_str(&res, strlen(str)+1))
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "pattern matching");
+        return NULL;
+    }
+
+    /* an empty pattern only matches at the beginning or the end of the string */
+    if(!*pattern)
+    {
+        if((anchor == '#' && !str_append(&res, rep, rep_len)) ||
+           !str_append(&res, str, strlen(str)) ||
+           (anchor == '%' && !str_append(&res, rep, rep_len)))
+        {
+            INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "pattern matching");
+            free_str(&res);
+        }
+        return res.buf_base;
+    }
+
+    char *p = shell_pattern_to_regex(pattern);
+    if(!p)
+    {
+        free_str(&res);
+        return NULL;
+    }
+
+    /* anchor the regex if needed */
+    char regstr[strlen(p)+5];
+    sprintf(regstr, "%s(%s)%s", (anchor == '#') ? "^" : "", p, (anchor == '%') ? "$" : "");
+    free(p);
+
+    int flags = REG_EXTENDED;
+    if(optionx_set(OPTION_NOCASE_MATCH))
+    {
+        flags |= REG_ICASE;
+    }
+
+    if(optionx_set(OPTION_GLOB_ASCII_RANGES))
+    {
+        setlocale(LC_ALL, "C");
+    }
+
+    regex_t regex;
+    int result = regcomp(&regex, regstr, flags);
+    if(result)
+    {
+        size_t length = regerror(result, &regex, NULL, 0);
+        char buffer[length];
+        (void) regerror(result, &regex, buffer, length);
+        PRINT_ERROR(SHELL_NAME, "regex match failed: %s", buffer);
+        free_str(&res);
+        goto fin;
+    }
+
+    /* regexec() gives us the leftmost, longest match */
+    regmatch_t match;
+    char *s = str;
+    int eflags = 0;
+    while(regexec(&regex, s, 1, &match, eflags) == 0)
+    {
+        if(!str_append(&res, s, match.rm_so) || !str_append(&res, rep, rep_len))
+        {
+            goto memerr;
+        }
+        s += match.rm_eo;
+
+        if(anchor != '/' || !*s)
+        {
+            break;
+        }
+
+        /* don't match the same empty string again */
+        if(match.rm_so == match.rm_eo)
+        {
+            if(!str_append(&res, s, 1))
+            {
+                goto memerr;
+            }
+            s++;
+        }
+        eflags = REG_NOTBOL;
+    }
+
+    if(!str_append(&res, s, strlen(s)))
+    {
+        goto memerr;
+    }
+    regfree(&regex);
+
+fin:
+    if(optionx_set(OPTION_GLOB_ASCII_RANGES))
+    {
+        setlocale(LC_ALL, "");
+    }
+    return res.buf_base;
+
+memerr:
+    regfree(&regex);
+    if(optionx_set(OPTION_GLOB_ASCII_RANGES))
+    {
+        setlocale(LC_ALL, "");
+    }
+    INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "pattern matching");
+    free_str(&res);
+    return NULL;
+}
+
+
 /*
  * Check if the string str matches the given pattern.
  * 'print_err' is a flag that tells us if we should output an error message 
@@ -767,6 +889,785 @@ char **get_filename_matches(char *pattern, glob_t *matches)
 }
 
 
+/*
+ * Directory listings we read while performing pathname expansion. Listings are
+ * kept until the end of the current command list (see flush_dir_cache()), so that
+ * loops which expand the same patterns over and over don't re-read the same
+ * directories. A listing is keyed by the directory's device and inode numbers,
+ * and is only reused if the directory's modification time didn't change.
+ */
+struct dir_listing_s
+{
+    dev_t   dev;
+    ino_t   ino;
+    struct  timespec mtime;
+    int     racy;           /* the dir was modified in the same second we read it */
+    int     busy;           /* the listing is being walked, don't free it */
+    size_t  count;          /* number of entries */
+    char  **names;          /* entry names (pointers into buf) */
+    unsigned char *types;   /* entry types (the d_type field of the dirent) */
+    char   *buf;
+    struct  dir_listing_s *next;
+};
+
+/* max number of directory listings we keep */
+#define DIR_CACHE_MAX       64
+
+static struct dir_listing_s *dir_cache = NULL;
+static int    dir_cache_count = 0;
+
+
+/*
+ * Free the memory used by a directory listing.
+ */
+static void free_dir_listing(struct dir_listing_s *listing)
+{
+    free(listing->names);
+    free(listing->types);
+    free(listing->buf);
+    free(listing);
+}
+
+
+/*
+ * Free the cached directory listings. Called when we finish executing a command
+ * list, as we don't want to keep (possibly huge) listings around between commands.
+ */
+void flush_dir_cache(void)
+{
+    struct dir_listing_s **lp = &dir_cache;
+
+    while(*lp)
+    {
+        struct dir_listing_s *l = *lp;
+        if(l->busy)
+        {
+            lp = &l->next;
+        }
+        else
+        {
+            *lp = l->next;
+            free_dir_listing(l);
+            dir_cache_count--;
+        }
+    }
+}
+
+
+/*
+ * Read the entries of the given directory, skipping dot and dot-dot.
+ *
+ * Returns the malloc'd listing, or NULL on error.
+ */
+static struct dir_listing_s *read_dir_listing(char *dir, struct stat *st)
+{
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+
+    if(!d)
+    {
+        return NULL;
+    }
+
+    struct dir_listing_s *listing = malloc(sizeof(struct dir_listing_s));
+    size_t *offsets = NULL, size = 0, buf_len = 0, buf_size = 0;
+
+    if(!listing)
+    {
+        closedir(d);
+        return NULL;
+    }
+
+    memset(listing, 0, sizeof(struct dir_listing_s));
+    listing->dev   = st->st_dev;
+    listing->ino   = st->st_ino;
+    listing->mtime = st->st_mtim;
+    listing->racy  = (st->st_mtim.tv_sec >= time(NULL));
+
+    while((ent = readdir(d)))
+    {
+        char *name = ent->d_name;
+        size_t len = strlen(name)+1;
+
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
+        }
+
+        if(listing->count == size)
+        {
+            size_t newsize = size ? size*2 : 64;
+            size_t *offsets2 = realloc(offsets, newsize*sizeof(size_t));
+            unsigned char *types2 = realloc(listing->types, newsize);
+
+            if(offsets2)
+            {
+                offsets = offsets2;
+            }
+
+            if(types2)
+            {
+                listing->types = types2;
+            }
+
+            if(!offsets2 || !types2)
+            {
+                goto memerr;
+            }
+            size = newsize;
+        }
+
+        if(buf_len+len > buf_size)
+        {
+            size_t newsize = buf_size ? buf_size*2 : 4096;
+            while(buf_len+len > newsize)
+            {
+                newsize *= 2;
+            }
+
+            char *buf2 = realloc(listing->buf, newsize);
+            if(!buf2)
+            {
+                goto memerr;
+            }
+            listing->buf = buf2;
+            buf_size = newsize;
+        }
+
+        memcpy(listing->buf+buf_len, name, len);
+        offsets[listing->count] = buf_len;
+#ifdef _DIRENT_HAVE_D_TYPE
+        listing->types[listing->count] = ent->d_type;
+#else
+        listing->types[listing->count] = DT_UNKNOWN;
+#endif
+        listing->count++;
+        buf_len += len;
+    }
+
+    closedir(d);
+
+    /* now that the buffer won't move, convert the offsets to pointers */
+    if(listing->count)
+    {
+        listing->names = malloc(listing->count*sizeof(char *));
+        if(!listing->names)
+        {
+            free(offsets);
+            free_dir_listing(listing);
+            return NULL;
+        }
+
+        size_t i;
+        for(i = 0; i < listing->count; i++)
+        {
+            listing->names[i] = listing->buf+offsets[i];
+        }
+    }
+
+    free(offsets);
+    return listing;
+
+memerr:
+    closedir(d);
+    free(offsets);
+    free_dir_listing(listing);
+    return NULL;
+}
+
+
+/*
+ * Get the listing of the given directory, either from the cache, or by reading
+ * the directory (and caching the listing).
+ *
+ * Returns the listing, or NULL if the directory can't be read.
+ */
+static struct dir_listing_s *get_dir_listing(char *dir)
+{
+    struct dir_listing_s *listing, *prev = NULL;
+    struct stat st;
+
+    if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        return NULL;
+    }
+
+    for(listing = dir_cache; listing; prev = listing, listing = listing->next)
+    {
+        if(listing->dev != st.st_dev || listing->ino != st.st_ino)
+        {
+            continue;
+        }
+
+        if(!listing->racy &&
+           listing->mtime.tv_sec  == st.st_mtim.tv_sec &&
+           listing->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            return listing;
+        }
+
+        /* the directory changed. remove the old listing */
+        if(!listing->busy)
+        {
+            if(prev)
+            {
+                prev->next = listing->next;
+            }
+            else
+            {
+                dir_cache = listing->next;
+            }
+            free_dir_listing(listing);
+            dir_cache_count--;
+        }
+        break;
+    }
+
+    if(!(listing = read_dir_listing(dir, &st)))
+    {
+        return NULL;
+    }
+
+    /* make room for the new listing by freeing the oldest unused ones */
+    if(dir_cache_count >= DIR_CACHE_MAX)
+    {
+        struct dir_listing_s **lp = &dir_cache;
+        int i = 0;
+
+        while(*lp)
+        {
+            struct dir_listing_s *l = *lp;
+            if(++i > DIR_CACHE_MAX/2 && !l->busy)
+            {
+                *lp = l->next;
+                free_dir_listing(l);
+                dir_cache_count--;
+            }
+            else
+            {
+                lp = &l->next;
+            }
+        }
+    }
+
+    listing->next = dir_cache;
+    dir_cache = listing;
+    dir_cache_count++;
+    return listing;
+}
+
+
+/*
+ * A pathname pattern is broken into its slash-separated components.
+ */
+struct glob_comp_s
+{
+    char *pat;      /* the component as a fnmatch() pattern, with quoted chars escaped */
+    char *lit;      /* the component with quotes removed */
+    int   glob;     /* non-zero if the component has unquoted pattern chars */
+};
+
+
+/*
+ * Break the given word (which may contain quoted chars) into its components.
+ * The components' strings are stored in a buffer that is returned in *bufp.
+ *
+ * Returns the malloc'd components array (the number of components is stored in
+ * *ncomps), or NULL if the word is not a pattern (or we ran out of memory).
+ */
+static struct glob_comp_s *split_glob_word(char *word, int *ncomps, char **bufp)
+{
+    size_t len = strlen(word);
+    int    n = 1, i = 0, glob = 0, bracket = 0;
+    char  *p, quote = 0;
+    int    extglob = optionx_set(OPTION_EXT_GLOB);
+
+    for(p = word; *p; p++)
+    {
+        if(*p == '/')
+        {
+            n++;
+        }
+    }
+
+    struct glob_comp_s *comps = malloc(n*sizeof(struct glob_comp_s));
+    char *buf = malloc(3*len+2*n);
+
+    if(!comps || !buf)
+    {
+        free(comps);
+        free(buf);
+        return NULL;
+    }
+
+    char *pat = buf, *lit = buf+2*len+n;
+
+#define ADD_QUOTED(c)                           \
+{                                               \
+    if(strchr("*?[]\\()|!@+", (c)))             \
+    {                                           \
+        *pat++ = '\\';                          \
+    }                                           \
+    *pat++ = (c);                               \
+    *lit++ = (c);                               \
+}
+
+    comps[0].pat = pat;
+    comps[0].lit = lit;
+    comps[0].glob = 0;
+
+    for(p = word; *p; p++)
+    {
+        char c = *p;
+
+        if(c == '/')
+        {
+            *pat++ = '\0';
+            *lit++ = '\0';
+            i++;
+            comps[i].pat = pat;
+            comps[i].lit = lit;
+            comps[i].glob = 0;
+            bracket = 0;
+            continue;
+        }
+
+        if(quote == '\'')
+        {
+            if(c == '\'')
+            {
+                quote = 0;
+            }
+            else
+            {
+                ADD_QUOTED(c);
+            }
+            continue;
+        }
+
+        if(c == '\\')
+        {
+            /* inside double quotes, backslash only quotes some chars */
+            if((quote == '"' && !strchr("$`\"\\\n", p[1])) || !p[1])
+            {
+                ADD_QUOTED(c);
+            }
+            else if(p[1] != '/')
+            {
+                p++;
+                ADD_QUOTED(*p);
+            }
+            continue;
+        }
+
+        if(quote == '"')
+        {
+            if(c == '"')
+            {
+                quote = 0;
+            }
+            else
+            {
+                ADD_QUOTED(c);
+            }
+            continue;
+        }
+
+        switch(c)
+        {
+            case '\'':
+            case '"':
+                quote = c;
+                continue;
+
+            case '*':
+            case '?':
+                comps[i].glob = 1;
+                break;
+
+            case '[':
+                bracket = 1;
+                break;
+
+            case ']':
+                if(bracket)
+                {
+                    comps[i].glob = 1;
+                }
+                break;
+
+            case '+':
+            case '@':
+            case '!':
+                if(extglob && p[1] == '(')
+                {
+                    comps[i].glob = 1;
+                }
+                break;
+        }
+
+        *pat++ = c;
+        *lit++ = c;
+    }
+
+#undef ADD_QUOTED
+
+    *pat = '\0';
+    *lit = '\0';
+
+    for(i = 0; i < n; i++)
+    {
+        glob |= comps[i].glob;
+    }
+
+    if(!glob)
+    {
+        free(comps);
+        free(buf);
+        return NULL;
+    }
+
+    *ncomps = n;
+    *bufp = buf;
+    return comps;
+}
+
+
+/*
+ * Check if the given word is a pathname pattern, i.e. if it has unquoted
+ * pattern chars.
+ *
+ * Returns 1 if the word is a pattern, 0 otherwise.
+ */
+int is_glob_pattern(char *word)
+{
+    char *buf;
+    int n;
+    struct glob_comp_s *comps = split_glob_word(word, &n, &buf);
+
+    if(!comps)
+    {
+        return 0;
+    }
+
+    free(comps);
+    free(buf);
+    return 1;
+}
+
+
+/*
+ * State of the directory walk we do to find the matches of a pattern.
+ */
+struct glob_walk_s
+{
+    struct glob_comp_s *comps;
+    int     ncomps;
+    int     flags;          /* fnmatch() flags */
+    char   *ignore;         /* $GLOBIGNORE */
+    char   *path;           /* the path we're building */
+    size_t  path_size;
+    struct  glob_stream_s *stream;
+};
+
+
+/*
+ * Make sure the walk's path buffer can hold len chars.
+ *
+ * Returns 1 on success, 0 if we ran out of memory.
+ */
+static int walk_path_size(struct glob_walk_s *walk, size_t len)
+{
+    if(len < walk->path_size)
+    {
+        return 1;
+    }
+
+    size_t newsize = walk->path_size ? walk->path_size : 256;
+    while(len >= newsize)
+    {
+        newsize *= 2;
+    }
+
+    char *path = realloc(walk->path, newsize);
+    if(!path)
+    {
+        return 0;
+    }
+
+    walk->path = path;
+    walk->path_size = newsize;
+    return 1;
+}
+
+
+/*
+ * Add the path we've built to the stream's matches.
+ */
+static void add_glob_match(struct glob_walk_s *walk, size_t len)
+{
+    struct glob_stream_s *stream = walk->stream;
+
+    if(walk->ignore && match_ignore(walk->ignore, walk->path))
+    {
+        return;
+    }
+
+    if(stream->count == stream->size)
+    {
+        size_t newsize = stream->size ? stream->size*2 : 32;
+        char **paths = realloc(stream->paths, newsize*sizeof(char *));
+        if(!paths)
+        {
+            return;
+        }
+        stream->paths = paths;
+        stream->size  = newsize;
+    }
+
+    char *path = malloc(len+1);
+    if(path)
+    {
+        memcpy(path, walk->path, len);
+        path[len] = '\0';
+        stream->paths[stream->count++] = path;
+    }
+}
+
+
+/*
+ * Match the i-th component of the pattern, given the path we've built so far
+ * (the first len chars of walk->path).
+ */
+static void glob_walk(struct glob_walk_s *walk, size_t len, int i)
+{
+    struct glob_comp_s *comp = &walk->comps[i];
+    int last = (i == walk->ncomps-1);
+
+    if(i)
+    {
+        if(!walk_path_size(walk, len+1))
+        {
+            return;
+        }
+        walk->path[len++] = '/';
+    }
+
+    if(!comp->glob)
+    {
+        size_t clen = strlen(comp->lit);
+        if(!walk_path_size(walk, len+clen))
+        {
+            return;
+        }
+
+        strcpy(walk->path+len, comp->lit);
+        len += clen;
+
+        if(!last)
+        {
+            glob_walk(walk, len, i+1);
+        }
+        else
+        {
+            struct stat st;
+            if(lstat(walk->path, &st) == 0)
+            {
+                add_glob_match(walk, len);
+            }
+        }
+        return;
+    }
+
+    /* list the directory we've reached so far */
+    walk->path[len] = '\0';
+    struct dir_listing_s *listing = get_dir_listing(len ? walk->path : ".");
+    if(!listing)
+    {
+        return;
+    }
+
+    size_t j;
+    listing->busy++;
+
+    for(j = 0; j < listing->count; j++)
+    {
+        char *name = listing->names[j];
+        int type = listing->types[j];
+
+        /* only directories can lead to the next component */
+        if(!last && type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN)
+        {
+            continue;
+        }
+
+        if(fnmatch(comp->pat, name, walk->flags) != 0)
+        {
+            continue;
+        }
+
+        size_t nlen = strlen(name);
+        if(!walk_path_size(walk, len+nlen))
+        {
+            break;
+        }
+        strcpy(walk->path+len, name);
+
+        if(last)
+        {
+            add_glob_match(walk, len+nlen);
+        }
+        else
+        {
+            glob_walk(walk, len+nlen, i+1);
+        }
+    }
+
+    listing->busy--;
+}
+
+
+/*
+ * Compare two paths in the order we return pathname expansion results.
+ */
+static int glob_cmp(struct glob_stream_s *stream, char *a, char *b)
+{
+    return stream->ascii ? strcmp(a, b) : strcoll(a, b);
+}
+
+
+/*
+ * Restore the heap property of the stream's paths, starting at index i.
+ */
+static void glob_sift_down(struct glob_stream_s *stream, size_t i)
+{
+    char **paths = stream->paths;
+    size_t n = stream->count;
+
+    while(1)
+    {
+        size_t min = i, l = 2*i+1, r = l+1;
+
+        if(l < n && glob_cmp(stream, paths[l], paths[min]) < 0)
+        {
+            min = l;
+        }
+
+        if(r < n && glob_cmp(stream, paths[r], paths[min]) < 0)
+        {
+            min = r;
+        }
+
+        if(min == i)
+        {
+            break;
+        }
+
+        char *tmp  = paths[i];
+        paths[i]   = paths[min];
+        paths[min] = tmp;
+        i = min;
+    }
+}
+
+
+/*
+ * Find the pathnames that match the given word (which can contain quoted chars).
+ * The matches are returned one at a time, in sorted order, by calling
+ * next_glob_match(). We don't sort the whole list upfront. Instead, we keep the
+ * matches in a heap, so that callers who iterate over the matches (such as for
+ * loops) can start working on the first match right away.
+ *
+ * Returns the malloc'd stream, or NULL if the word is not a pattern. If no files
+ * matched, the stream's count field is zero.
+ */
+struct glob_stream_s *open_glob_stream(char *word)
+{
+    struct glob_walk_s walk;
+    struct glob_stream_s *stream;
+    char *buf;
+
+    memset(&walk, 0, sizeof(struct glob_walk_s));
+
+    if(!(walk.comps = split_glob_word(word, &walk.ncomps, &buf)))
+    {
+        return NULL;
+    }
+
+    if(!(stream = malloc(sizeof(struct glob_stream_s))))
+    {
+        free(walk.comps);
+        free(buf);
+        return NULL;
+    }
+
+    memset(stream, 0, sizeof(struct glob_stream_s));
+    stream->ascii = optionx_set(OPTION_GLOB_ASCII_RANGES);
+
+    walk.stream = stream;
+    walk.ignore = get_shell_varp("GLOBIGNORE", NULL);
+    walk.flags  = 0;
+    if(!optionx_set(OPTION_DOT_GLOB   )) walk.flags |= FNM_PERIOD   ;
+    if( optionx_set(OPTION_NOCASE_GLOB)) walk.flags |= FNM_CASEFOLD ;
+    if( optionx_set(OPTION_EXT_GLOB   )) walk.flags |= FNM_EXTMATCH ;
+
+    /* Perform the match */
+    if(stream->ascii) setlocale(LC_ALL, "C");
+    if(walk_path_size(&walk, 0))
+    {
+        glob_walk(&walk, 0, 0);
+    }
+    if(stream->ascii) setlocale(LC_ALL, "");
+
+    free(walk.path);
+    free(walk.comps);
+    free(buf);
+
+    /* build the heap */
+    size_t i = stream->count/2;
+    while(i--)
+    {
+        glob_sift_down(stream, i);
+    }
+
+    return stream;
+}
+
+
+/*
+ * Get the next match from the stream.
+ *
+ * Returns the malloc'd match, or
+ * NULL if there are no more matches.
+ */
+char *next_glob_match(struct glob_stream_s *stream)
+{
+    if(!stream->count)
+    {
+        return NULL;
+    }
+
+    char *path = stream->paths[0];
+    stream->paths[0] = stream->paths[--stream->count];
+    glob_sift_down(stream, 0);
+    return path;
+}
+
+
+/*
+ * Free the memory used by the stream, including any matches we didn't return.
+ */
+void close_glob_stream(struct glob_stream_s *stream)
+{
+    while(stream->count)
+    {
+        free(stream->paths[--stream->count]);
+    }
+    free(stream->paths);
+    free(stream);
+}
+
+
 /*
  * Test filename against a colon-separated pattern field to determine if it 
  * matches one of the patterns in the field. Used when performing filename 
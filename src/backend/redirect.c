@@ -19,7 +19,7 @@
  *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
  */    
 
-#define _XOPEN_SOURCE   500     /* fdopen() and mkdtemp() */
+#define _GNU_SOURCE     /* fdopen(), mkdtemp(), memfd_create() and pipe2() */
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -27,7 +27,11 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h> 
@@ -54,17 +58,40 @@
  */
 int backup_fd[3] = { -1, -1, -1 };
 
+/* the lowest fd we use when saving the standard streams */
+#define SAVED_FD_MIN    10
+
+/*
+ * Return the stdio stream of the given standard stream fd.
+ */
+static FILE *std_stream(int fd)
+{
+    switch(fd)
+    {
+        case 0 : return stdin ;
+        case 1 : return stdout;
+        default: return stderr;
+    }
+}
+
+
 /*
  * If we are executing a builtin utility or a shell function, we need to save the
  * state of the standard streams so that we can restore them after the utility or
- * function finishes execution.
+ * function finishes execution. Only the streams that are actually redirected are
+ * saved. The saved copy is moved out of the way of the low fds the user might
+ * redirect, and is marked close-on-exec so that it doesn't leak into the commands
+ * we execute.
  */
 void save_std(int fd, int *saved_fd)
 {
-    fflush(stdin);
-    fflush(stdout);
-    fflush(stderr);
-    saved_fd[fd] = dup(fd);
+    /* already saved */
+    if(saved_fd[fd] >= 0)
+    {
+        return;
+    }
+    fflush(std_stream(fd));
+    saved_fd[fd] = fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
 }
 
 
@@ -74,26 +101,177 @@ void save_std(int fd, int *saved_fd)
  */
 void restore_stds(int *saved_fd)
 {
-    fflush(stdin);
-    fflush(stdout);
-    fflush(stderr);
     int i = 0;
     for( ; i < 3; i++)
     {
         if(saved_fd[i] >= 0)
         {
+            FILE *stream = std_stream(i);
+            fflush(stream);
             dup2(saved_fd[i], i);
             close(saved_fd[i]);
             saved_fd[i] = -1;
             
-            /* inform stdio lib about the change */
-            switch(i)
+            /*
+             * the fd number didn't change, so the stdio stream is still usable.
+             * we only need to clear the EOF and error flags the redirected file might
+             * have set. we don't freopen() the stream, as this would reopen (and
+             * truncate) the file the stream was originally writing to.
+             */
+            clearerr(stream);
+        }
+    }
+}
+
+
+/*
+ * Return 1 if the given redirection target word contains no chars that would be
+ * affected by word expansion, which means we can use the word as the pathname
+ * without expanding it, 0 otherwise.
+ */
+static int is_plain_word(char *word)
+{
+    return !strpbrk(word, "$`'\"\\*?[]~{}()#!@+");
+}
+
+
+/*
+ * Process substitutions of the commands being executed. For each substitution,
+ * we keep the pid of the process we forked, so that we can reap it when it exits,
+ * and the file we passed to the command (the fd of our end of the pipe, or the
+ * path of the FIFO), so that we can close it (or remove it) when the command
+ * finishes. Entries are added in the order commands are executed, so that
+ * proc_subst_release() only releases the substitutions of the command that
+ * just finished, not those of the command (for example, a shell function) that
+ * is executing it.
+ */
+struct proc_subst_s
+{
+    pid_t  pid;     /* process executing the substituted command, 0 if reaped */
+    int    fd;      /* the command's end of the pipe, -1 if closed */
+    char  *fifo;    /* the FIFO's path (only if we couldn't use a pipe) */
+};
+
+static struct proc_subst_s *proc_substs = NULL;
+static int    proc_subst_count = 0;
+static int    proc_subst_size  = 0;
+
+
+/*
+ * Return the directory under which we can access our open files by their fd
+ * numbers (/dev/fd/N), or NULL if the system doesn't provide one.
+ */
+static char *proc_subst_dir(void)
+{
+    static char *dir = NULL;
+    static int checked = 0;
+    
+    if(!checked)
+    {
+        struct stat st;
+        checked = 1;
+        if(stat("/dev/fd", &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            dir = "/dev/fd";
+        }
+        else if(stat("/proc/self/fd", &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            dir = "/proc/self/fd";
+        }
+    }
+    return dir;
+}
+
+
+/*
+ * Add a process substitution to the list.
+ */
+static void add_proc_subst(pid_t pid, int fd, char *fifo)
+{
+    if(proc_subst_count >= proc_subst_size)
+    {
+        int newsz = proc_subst_size ? proc_subst_size*2 : 8;
+        struct proc_subst_s *p = realloc(proc_substs, newsz * sizeof(struct proc_subst_s));
+        if(!p)
+        {
+            /* we'll leak the fd, but the command will still work */
+            return;
+        }
+        proc_substs = p;
+        proc_subst_size = newsz;
+    }
+    proc_substs[proc_subst_count].pid  = pid;
+    proc_substs[proc_subst_count].fd   = fd;
+    proc_substs[proc_subst_count].fifo = fifo ? get_malloced_str(fifo) : NULL;
+    proc_subst_count++;
+}
+
+
+/*
+ * Return a mark for the process substitutions list, which we pass to
+ * proc_subst_release() when the command we're about to execute finishes.
+ */
+int proc_subst_mark(void)
+{
+    return proc_subst_count;
+}
+
+
+/*
+ * Close the files of the process substitutions that were added after the given
+ * mark was taken, and reap the substituted processes that have exited.
+ */
+void proc_subst_release(int mark)
+{
+    int i, status;
+    
+    for(i = mark; i < proc_subst_count; i++)
+    {
+        if(proc_substs[i].fd >= 0)
+        {
+            close(proc_substs[i].fd);
+            proc_substs[i].fd = -1;
+        }
+        
+        if(proc_substs[i].fifo)
+        {
+            unlink(proc_substs[i].fifo);
+            free_malloced_str(proc_substs[i].fifo);
+            proc_substs[i].fifo = NULL;
+        }
+    }
+    
+    /*
+     * reap the processes that exited. if the process was already reaped by our
+     * SIGCHLD handler, waitpid() fails with ECHILD.
+     */
+    for(i = 0; i < proc_subst_count; i++)
+    {
+        if(proc_substs[i].pid > 0 && waitpid(proc_substs[i].pid, &status, WNOHANG) != 0)
+        {
+            proc_substs[i].pid = 0;
+        }
+    }
+    
+    /* remove the entries we're done with */
+    if(mark == 0)
+    {
+        int j = 0;
+        for(i = 0; i < proc_subst_count; i++)
+        {
+            if(proc_substs[i].pid > 0)
             {
-                case 0: freopen(NULL, "r", stdin); break;
-                case 1: freopen(NULL, "w", stdout); break;
-                case 2: freopen(NULL, "w", stderr); break;
+                proc_substs[j++] = proc_substs[i];
             }
         }
+        proc_subst_count = j;
+    }
+    else
+    {
+        while(proc_subst_count > mark && proc_substs[proc_subst_count-1].pid == 0)
+        {
+            proc_subst_count--;
+        }
     }
 }
 
@@ -101,19 +279,46 @@ void restore_stds(int *saved_fd)
 /*
  * Perform process substitution. the op parameter specifies the redirection operator to
  * apply to the process substitution, which can be '<' or '>'. The cmdline parameter
- * contains the command(s) to execute in the process. The tmpname parameter contains
- * the pathname of the file we'll use for the redirection.
+ * contains the command(s) to execute in the process. The process's end of the pipe
+ * is passed in fd, while our end of the pipe is passed in other_fd (or -1 if we are
+ * using a FIFO, in which case the process opens the FIFO, whose path is passed in fifo).
+ * 
+ * Returns the pid of the new process, -1 on error.
  */
-void redirect_proc_do(char *cmdline, char op, int fd)
+static pid_t redirect_proc_do(char *cmdline, char op, int fd, int other_fd, char *fifo)
 {
-    if(fork_child() == 0)
+    pid_t pid = fork_child();
+    if(pid == 0)
     {
         init_subshell();
         
-        int fd2 = (op == '<') ? 1 : 0;
-        close(fd2);
-        dup2(fd, fd2);
-        close(fd);
+        int i, fd2 = (op == '<') ? 1 : 0;
+        
+        /* we don't need the files of the other process substitutions */
+        for(i = 0; i < proc_subst_count; i++)
+        {
+            if(proc_substs[i].fd >= 0)
+            {
+                close(proc_substs[i].fd);
+            }
+        }
+        
+        if(other_fd >= 0)
+        {
+            close(other_fd);
+        }
+        
+        if(fifo && (fd = open(fifo, (op == '<') ? O_WRONLY : O_RDONLY)) < 0)
+        {
+            PRINT_ERROR(SHELL_NAME, "failed to open fifo: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if(fd != fd2)
+        {
+            dup2(fd, fd2);
+            close(fd);
+        }
         
         struct source_s src;
         src.buffer   = cmdline;
@@ -128,82 +333,81 @@ void redirect_proc_do(char *cmdline, char op, int fd)
 
         exit(exit_status);
     }
-    close(fd);
+    
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    return pid;
 }
 
 
 /*
- * Prepare for process substitution by opening a FIFO under /tmp/lsh, or if the
- * system doesn't support named FIFO's, create a regular pipe and use its file
- * descriptors in place of the FIFO. In the latter case, the pipe will be passed
- * to the process as a file named /dev/fdN, where N is the file descriptor number.
+ * Prepare for process substitution by creating a pipe, whose end we pass to the
+ * command as a file named /dev/fd/N (or /proc/self/fd/N), where N is the file
+ * descriptor number. If the system doesn't support this scheme, we use a FIFO
+ * under $TMPDIR/lsh instead.
  * 
- * Returns the pathname of the FIFO/pipe, so that we can pass it to the other end,
+ * Returns the pathname of the pipe/FIFO, so that we can pass it to the other end,
  * i.e. the command which will read from or write to the process we'll fork.
  */
 char *redirect_proc(char op, char *cmdline)
 {
-    char *tmpdir = get_shell_varp("TMPDIR", "/tmp");
-    int len = strlen(tmpdir);
-    char tmpname[len+12];
-    int tries = 100, fd;
+    int filedes[2];
+    pid_t pid;
+    
+    /* the command's end of the pipe */
+    int cmd_end = (op == '<') ? 0 : 1;
+    char *dir = proc_subst_dir();
     
-    while(tries--)
+    if(dir)
     {
-        sprintf(tmpname, "%s%clsh/fifo%d", tmpdir, '/', tries);
-        /* Try to perform process substitution via using a named pipe/fifo */
-        if(mkfifo(tmpname, 0600) != 0)
+        if(pipe2(filedes, O_CLOEXEC) != 0)
         {
-            if(errno == EEXIST)
-            {
-                continue;
-            }
-            /*
-             * If the system doesn't support named pipes, or another error occurred, such as
-             * insufficient disk space, try performing this via a regular pipe, whose path we'll
-             * pass as /dev/fd/filedes. If the system doesn't support this scheme, we won't be able
-             * to perform process substitution.
-             */
-            int filedes[2];
-            if(pipe(filedes) == 0)
-            {
-                char buf[16];
-                sprintf(buf, "/dev/fd/%d", filedes[(op == '<') ? 1 : 0]);
-                
-                struct stat st;
-                if(stat(buf, &st) == 0 && S_ISFIFO(st.st_mode))
-                {
-                    redirect_proc_do(cmdline, op, filedes[(op == '<') ? 1 : 0]);
-                    sprintf(buf, "/dev/fd/%d", filedes[(op == '<') ? 0 : 1]);
-                    return get_malloced_str(buf);
-                }
-                else
-                {
-                    PRINT_ERROR(SHELL_NAME, "error creating fifo: %s", 
-                                "system doesn't support `/dev/fd` file names");
-                    close(filedes[0]);
-                    close(filedes[1]);
-                    return NULL;
-                }
-            }
-            else
-            {
-                PRINT_ERROR(SHELL_NAME, "error creating fifo: %s", strerror(errno));
-                return NULL;
-            }
+            PRINT_ERROR(SHELL_NAME, "error creating pipe: %s", strerror(errno));
+            return NULL;
         }
         
-        if((fd = open(tmpname, O_RDWR)) == -1)
+        /* the command must inherit its end of the pipe */
+        fcntl(filedes[cmd_end], F_SETFD, 0);
+        
+        if((pid = redirect_proc_do(cmdline, op, filedes[1-cmd_end], filedes[cmd_end], NULL)) < 0)
         {
-            PRINT_ERROR(SHELL_NAME, "failed to open fifo: %s", strerror(errno));
+            close(filedes[cmd_end]);
             return NULL;
         }
         
-        redirect_proc_do(cmdline, op, fd);
+        char buf[32];
+        sprintf(buf, "%s/%d", dir, filedes[cmd_end]);
+        add_proc_subst(pid, filedes[cmd_end], NULL);
+        return get_malloced_str(buf);
+    }
+    
+    /*
+     * the system doesn't support /dev/fd file names. use a FIFO, which is removed
+     * when the command finishes.
+     */
+    static int fifo_count = 0;
+    char *tmpdir = get_shell_varp("TMPDIR", "/tmp");
+    char tmpname[strlen(tmpdir)+48];
+    
+    sprintf(tmpname, "%s/lsh", tmpdir);
+    mkdir(tmpname, 0700);
+    sprintf(tmpname, "%s/lsh/fifo%d.%d", tmpdir, (int)getpid(), fifo_count++);
+    if(mkfifo(tmpname, 0600) != 0)
+    {
+        PRINT_ERROR(SHELL_NAME, "error creating fifo: %s", strerror(errno));
+        return NULL;
+    }
+    
+    if((pid = redirect_proc_do(cmdline, op, -1, -1, tmpname)) < 0)
+    {
         unlink(tmpname);
-        return get_malloced_str(tmpname);
+        return NULL;
     }
-    return NULL;
+    
+    add_proc_subst(pid, -1, tmpname);
+    return get_malloced_str(tmpname);
 }
 
 
@@ -550,15 +754,25 @@ int redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd)
             }
             else if(path[0] != '\0')
             {
-                path = word_expand_to_str(path, FLAG_PATHNAME_EXPAND|FLAG_REMOVE_QUOTES);
-                if(!path)
+                /* targets with no special chars are used as-is */
+                char *expanded = NULL;
+                if(!flag_set(io_files[i].extra_flags, PLAIN_PATH_FLAG))
                 {
-                    PRINT_ERROR(SHELL_NAME, "failed to expand path: %s", io_files[i].path);
-                    return 0;
+                    path = expanded = word_expand_to_str(path, FLAG_PATHNAME_EXPAND|FLAG_REMOVE_QUOTES);
+                    if(!path)
+                    {
+                        PRINT_ERROR(SHELL_NAME, "failed to expand path: %s", io_files[i].path);
+                        return 0;
+                    }
                 }
 
+                /*
+                 * we only need to stat the file when opening it for writing, to check
+                 * the noclobber situation and fix the open mode of FIFOs.
+                 */
                 struct stat st;
-                if(stat(path, &st) == 0)
+                if((io_files[i].open_mode == MODE_WRITE || io_files[i].open_mode == MODE_APPEND) &&
+                   stat(path, &st) == 0)
                 {
                     if(S_ISREG(st.st_mode))
                     {
@@ -568,7 +782,7 @@ int redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd)
                             if(!flag_set(io_files[i].extra_flags, NOCLOBBER_FLAG))
                             {
                                 PRINT_ERROR(SHELL_NAME, "file already exists: %s", path);
-                                free(path);
+                                free(expanded);
                                 return 0;
                             }
                             io_files[i].open_mode |= O_EXCL;
@@ -640,7 +854,7 @@ int redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd)
                     {
                         PRINT_ERROR(SHELL_NAME, "failed to open `%s`: %s", 
                                     io_files[i].path, strerror(errno));
-                        free(path);
+                        free(expanded);
                         return 0;
                     }
                 }
@@ -655,7 +869,7 @@ int redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd)
                     dup2(fd, j);
                     close(fd);
                 }
-                free(path);
+                free(expanded);
             }
         }
         else if(io_files[i].duplicates >= 0)
@@ -688,6 +902,12 @@ int redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd)
                 return 0;
             }
 
+            /* n>&n is a no-op */
+            if(f->duplicates == j && !flag_set(f->extra_flags, CLOOPEN_FLAG))
+            {
+                continue;
+            }
+
             if(j <= 2 && do_savestd)
             {
                 save_std(j, saved_fd);
@@ -696,6 +916,7 @@ int redirect_do(struct io_file_s *io_files, int do_savestd, int *saved_fd)
             if(flag_set(f->extra_flags, CLOOPEN_FLAG))
             {
                 close(f->duplicates);
+                f->extra_flags &= ~HEREDOC_FLAG;
             }
         }
     } /* End for */
@@ -726,6 +947,7 @@ int redirect_prep_and_do(struct node_s *redirect_list, int *saved_fd)
             if(!redirect_prep_node(child, io_files))
             {
                 /* Bail out on redirection error */
+                close_heredocs(io_files);
                 return 0;
             }
         }
@@ -734,6 +956,7 @@ int redirect_prep_and_do(struct node_s *redirect_list, int *saved_fd)
     
     if(!redirect_do(io_files, 1, saved_fd))
     {
+        close_heredocs(io_files);
         return 0;
     }
     
@@ -860,6 +1083,10 @@ int file_redirect_prep(struct node_s *node, struct io_file_s *io_file)
             {
                 io_file->duplicates = -1;
                 io_file->path       = str;
+                if(is_plain_word(str))
+                {
+                    io_file->extra_flags |= PLAIN_PATH_FLAG;
+                }
                 return 1;
             }
         }
@@ -879,6 +1106,10 @@ int file_redirect_prep(struct node_s *node, struct io_file_s *io_file)
     {
         io_file->duplicates = -1;
         io_file->path       = str;
+        if(is_plain_word(str))
+        {
+            io_file->extra_flags |= PLAIN_PATH_FLAG;
+        }
     }
     
     return 1;
@@ -894,44 +1125,356 @@ invalid:
 
 
 /*
- * When preparing a here-document redirection, perform word expansion on the word
- * starting at *p and counting len characters.
- * This function calls the function passed in the third parameter to do the actual
- * expansion, then prints the expanded result to out, which should be a temp file.
+ * Here-documents are delivered to commands through pipes when the body fits in
+ * the pipe's buffer (so that writing the body never blocks), through in-memory
+ * files (memfd_create) for bigger bodies, and through temp files as a last resort.
+ */
+
+/* max size of a heredoc body we try to deliver through a pipe */
+#define HEREDOC_PIPE_MAX        65536
+
+/* number of non-expandable heredoc bodies we keep in in-memory files */
+#define HEREDOC_CACHE_SIZE      16
+
+/* max number of heredoc segments we pass to a single writev() call */
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define HEREDOC_IOV_MAX         IOV_MAX
+#else
+#define HEREDOC_IOV_MAX         64
+#endif
+
+struct heredoc_cache_s
+{
+    char  *body;    /* the heredoc body (we hold a reference to the string) */
+    int    fd;      /* in-memory file containing the body */
+    dev_t  dev;     /* device and inode of the in-memory file, so we can tell if */
+    ino_t  ino;     /*   the user has closed or replaced our fd */
+};
+
+static struct heredoc_cache_s heredoc_cache[HEREDOC_CACHE_SIZE];
+static int heredoc_cache_next = 0;
+
+
+/*
+ * Write the iovcnt buffers in iov to the given file descriptor, using as few
+ * writev() calls as possible. The iov array is not modified.
+ * 
+ * Returns 1 if all the bytes were written, 0 on error.
  */
-void heredoc_substitute_word(char *p, size_t len, char *(func)(char *), FILE *out)
+static int heredoc_writev(int fd, struct iovec *iov, int iovcnt)
 {
-    /* Extract the word to be substituted */
-    char *tmp = malloc(len+1);
+    struct iovec v[HEREDOC_IOV_MAX];
+    size_t off = 0;     /* bytes of iov[i] we've already written */
+    int i = 0, j, n;
     
-    if(!tmp)
+    while(i < iovcnt)
     {
-        char *p2 = p;
-        while(len--)
+        /* fill in the next batch of buffers */
+        for(n = 0, j = i; j < iovcnt && n < HEREDOC_IOV_MAX; j++, n++)
         {
-            fputc(*p2, out);
-            p2++;
+            v[n].iov_base = (char *)iov[j].iov_base + (j == i ? off : 0);
+            v[n].iov_len  = iov[j].iov_len - (j == i ? off : 0);
         }
-        return;
+        
+        ssize_t res = writev(fd, v, n);
+        if(res < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return 0;
+        }
+        
+        /* skip the buffers we've written */
+        while(i < iovcnt && (size_t)res >= iov[i].iov_len - off)
+        {
+            res -= iov[i].iov_len - off;
+            off  = 0;
+            i++;
+        }
+        off += res;
     }
+    return 1;
+}
+
+
+/*
+ * Return a file descriptor open for reading, from which the contents of the
+ * iovcnt buffers in iov (of total size len bytes) can be read.
+ * 
+ * Returns the file descriptor, or -1 on error.
+ */
+static int heredoc_fdv(struct iovec *iov, int iovcnt, size_t len)
+{
+    int fd, fds[2];
+    FILE *tmp;
     
-    strncpy(tmp, p, len);
-    tmp[len] = '\0';
+    /* small bodies go through a pipe */
+    if(len <= HEREDOC_PIPE_MAX && pipe(fds) == 0)
+    {
+        size_t pipe_sz = PIPE_BUF;
+#ifdef F_GETPIPE_SZ
+        int res = fcntl(fds[1], F_GETPIPE_SZ);
+        if(res > 0)
+        {
+            pipe_sz = res;
+        }
+#endif
+        if(len <= pipe_sz && heredoc_writev(fds[1], iov, iovcnt))
+        {
+            close(fds[1]);
+            return fds[0];
+        }
+        close(fds[0]);
+        close(fds[1]);
+    }
     
-    /* And expand it */
-    char *tmp2 = func(tmp);
+#ifdef MFD_CLOEXEC
+    /* bigger bodies go into an in-memory file */
+    if((fd = memfd_create("lsh-heredoc", MFD_CLOEXEC)) >= 0)
+    {
+        if(heredoc_writev(fd, iov, iovcnt) && lseek(fd, 0, SEEK_SET) == 0)
+        {
+            return fd;
+        }
+        close(fd);
+    }
+#endif
+    
+    /* and if all fails, use a temp file */
+    if(!(tmp = tmpfile()))
+    {
+        return -1;
+    }
+    fd = dup(fileno(tmp));
+    fclose(tmp);
+    if(fd >= 0 && (!heredoc_writev(fd, iov, iovcnt) || lseek(fd, 0, SEEK_SET) != 0))
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+
+/*
+ * Return a file descriptor open for reading, from which the len bytes in buf
+ * can be read.
+ * 
+ * Returns the file descriptor, or -1 on error.
+ */
+int heredoc_fd(char *buf, size_t len)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    return heredoc_fdv(&iov, 1, len);
+}
+
+
+#if defined(MFD_CLOEXEC) && defined(__linux__)
+
+/*
+ * Check that the fd of the given cache entry still refers to our in-memory file.
+ * The user might have closed the fd, or redirected another file to it (e.g. with
+ * `exec 10>file`). If the fd isn't ours anymore, drop the entry (without closing
+ * the fd, which isn't ours to close).
+ * 
+ * Returns 1 if the entry is valid, 0 otherwise.
+ */
+static int heredoc_cache_valid(int i)
+{
+    struct stat st;
+    if(fstat(heredoc_cache[i].fd, &st) == 0 &&
+       st.st_dev == heredoc_cache[i].dev && st.st_ino == heredoc_cache[i].ino)
+    {
+        return 1;
+    }
+    free_malloced_str(heredoc_cache[i].body);
+    heredoc_cache[i].body = NULL;
+    heredoc_cache[i].fd   = -1;
+    return 0;
+}
+
+#endif
+
+
+/*
+ * Return a file descriptor from which the given non-expandable heredoc body can
+ * be read. As the body never changes, we write it once to an in-memory file, and
+ * for each subsequent execution of the heredoc, we open a new file description
+ * of that file (so that each reader gets its own file offset). This saves us
+ * writing the body over and over again when a heredoc is used inside a loop.
+ * 
+ * Returns the file descriptor, or -1 on error.
+ */
+static int heredoc_cached_fd(char *body)
+{
+#if defined(MFD_CLOEXEC) && defined(__linux__)
+    char path[32];
+    int i, fd, fd2;
+    struct stat st;
     
-    if(tmp2 && tmp2 != INVALID_VAR)
+    /*
+     * heredoc bodies are stored in the strings buffer, so identical bodies share
+     * the same pointer, and the reference we hold keeps the pointer valid.
+     */
+    for(i = 0; i < HEREDOC_CACHE_SIZE; i++)
     {
-        fprintf(out, "%s", tmp2);
-        free(tmp2);
+        if(heredoc_cache[i].body == body)
+        {
+            if(!heredoc_cache_valid(i))
+            {
+                i = HEREDOC_CACHE_SIZE;
+            }
+            break;
+        }
+    }
+    
+    if(i == HEREDOC_CACHE_SIZE)
+    {
+        /* not cached. write the body to a new in-memory file */
+        size_t len = strlen(body);
+        if((fd = memfd_create("lsh-heredoc", MFD_CLOEXEC)) < 0)
+        {
+            return heredoc_fd(body, len);
+        }
+        
+        /*
+         * The cached fd stays open for the life of the shell, so move it out of
+         * the way of the low fds the user might redirect.
+         */
+        fd2 = fcntl(fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+        close(fd);
+        if(fd2 < 0)
+        {
+            return heredoc_fd(body, len);
+        }
+        fd = fd2;
+        
+        struct iovec iov = { .iov_base = body, .iov_len = len };
+        if(!heredoc_writev(fd, &iov, 1) || fstat(fd, &st) != 0)
+        {
+            close(fd);
+            return heredoc_fd(body, len);
+        }
+        
+        /* replace the oldest cache entry */
+        i = heredoc_cache_next;
+        heredoc_cache_next = (heredoc_cache_next+1) % HEREDOC_CACHE_SIZE;
+        if(heredoc_cache[i].body && heredoc_cache_valid(i))
+        {
+            close(heredoc_cache[i].fd);
+            free_malloced_str(heredoc_cache[i].body);
+        }
+        heredoc_cache[i].body = get_malloced_str(body);
+        heredoc_cache[i].fd   = fd;
+        heredoc_cache[i].dev  = st.st_dev;
+        heredoc_cache[i].ino  = st.st_ino;
+    }
+    
+    sprintf(path, "/proc/self/fd/%d", heredoc_cache[i].fd);
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0)
+    {
+        return fd;
+    }
+#endif
+    return heredoc_fd(body, strlen(body));
+}
+
+
+/*
+ * Close the here-document files that were opened while preparing the redirection
+ * list of a command, but were not consumed by redirect_do(). This is called by the
+ * parent shell after forking the child process that will execute the command, as
+ * well as when we bail out of the redirections on error.
+ */
+void close_heredocs(struct io_file_s *io_files)
+{
+    int i;
+    for(i = 0; i < FOPEN_MAX; i++)
+    {
+        if(io_files[i].duplicates >= 0 && flag_set(io_files[i].extra_flags, HEREDOC_FLAG))
+        {
+            close(io_files[i].duplicates);
+            io_files[i].duplicates   = -1;
+            io_files[i].extra_flags &= ~HEREDOC_FLAG;
+        }
+    }
+}
+
+
+/*
+ * Set the given io_file to read from the here-document opened on file descriptor fd.
+ * 
+ * Returns 1 on success, 0 on failure.
+ */
+static int heredoc_set_fd(struct io_file_s *io_file, int fd)
+{
+    if(fd < 0)
+    {
+        PRINT_ERROR(SHELL_NAME, "failed to create here-document: %s", strerror(errno));
+        return 0;
+    }
+    io_file->duplicates  = fd;
+    io_file->path        = NULL;
+    io_file->extra_flags = CLOOPEN_FLAG | HEREDOC_FLAG;
+    io_file->open_mode   = fcntl(fd, F_GETFL);
+    return 1;
+}
+
+
+/*
+ * Expand the given heredoc expansion segment, which was extracted from the heredoc
+ * body by split_heredoc().
+ * 
+ * Returns the malloc'd expanded string, or NULL if the word couldn't be expanded.
+ */
+static char *heredoc_expand_segment(char *word)
+{
+    char *(*func)(char *);
+    
+    if(*word == '`')
+    {
+        func = command_substitute;
     }
     else
     {
-        fprintf(out, "%s", tmp);
+        switch(word[1])
+        {
+            case '\'':
+                func = ansic_expand;
+                break;
+                
+            /*
+             * $[ ... ] is a deprecated form of integer arithmetic, similar to (( ... )).
+             */
+            case '[':
+                func = arithm_expand;
+                break;
+                
+            /*
+             * Arithmetic expansion $(()) or command substitution $().
+             */
+            case '(':
+                func = (word[2] == '(') ? arithm_expand : command_substitute;
+                break;
+                
+            default:
+                func = var_expand;
+                break;
+        }
+    }
+    
+    /* the expansion functions might modify the word, so we pass a copy */
+    char *tmp = __get_malloced_str(word);
+    if(!tmp)
+    {
+        return NULL;
     }
     
+    char *res = func(tmp);
     free(tmp);
+    return (res == INVALID_VAR) ? NULL : res;
 }
 
 
@@ -946,15 +1489,15 @@ int heredoc_redirect_prep(struct node_s *node, struct io_file_s *io_file)
         return 0;
     }
 
-    /* We implement here-documents as temp files */
     char *heredoc = child->val.str;
-    FILE *tmp = tmpfile();
-    if(!tmp)
+    
+    /* non-expandable heredoc bodies are used as-is */
+    if(node->val.chr == IO_HERE_NOEXPAND)
     {
-        return 0;
+        return heredoc_set_fd(io_file, heredoc_cached_fd(heredoc));
     }
-
-    /* Determine whether to word-expand the here-string or the heredoc body or not */
+    
+    /* word-expand the here-string */
     if(node->val.chr == IO_HERE_STR)
     {
         struct word_s *w = word_expand(heredoc, FLAG_REMOVE_QUOTES /* | FLAG_STRIP_VAR_ASSIGN | FLAG_EXPAND_VAR_ASSIGN */);
@@ -966,209 +1509,72 @@ int heredoc_redirect_prep(struct node_s *node, struct io_file_s *io_file)
 
         char *p = wordlist_to_str(w, WORDLIST_ADD_SPACES);
         free_all_words(w);
+        if(!p)
+        {
+            return 0;
+        }
         
-        fprintf(tmp, "%s\n", p);
+        size_t len = strlen(p);
+        struct iovec iov[2] = { { .iov_base = p, .iov_len = len }, { .iov_base = "\n", .iov_len = 1 } };
+        int fd = heredoc_fdv(iov, 2, len+1);
         free(p);
+        return heredoc_set_fd(io_file, fd);
     }
-    else if(node->val.chr == IO_HERE_NOEXPAND)
+    
+    /*
+     * Expand the heredoc body. The body was split by the parser into literal and
+     * expansion segments (see split_heredoc() in heredoc.c), so we only need to
+     * expand the expansion segments, and write everything out with writev().
+     */
+    if(!child->first_child && heredoc && *heredoc && !split_heredoc(child))
     {
-        fprintf(tmp, "%s", heredoc);
+        return 0;
     }
-    else
+    
+    int count = child->children, i = 0;
+    size_t len = 0;
+    struct iovec *iov = malloc((count ? count : 1) * sizeof(struct iovec));
+    char **expanded = malloc((count ? count : 1) * sizeof(char *));
+    if(!iov || !expanded)
     {
-        size_t len, i;
-        char *p = heredoc, *p2;
-        char c;
-        char *(*func)(char *);
-
-        do
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "expanding here-document");
+        if(iov)
         {
-            switch(*p)
-            {
-                case '\\':
-                    /* skip \\n */
-                    if(p[1] == '\n')
-                    {
-                        p++;
-                        break;
-                    }
-
-                    /* Skip backslash-quoted '`', '$' and '\' */
-                    if(p[1] == '`' || p[1] == '$' || p[1] == '\\')
-                    {
-                        p++;
-                    }
-                    fputc(*p, tmp);
-                    break;
-
-                case '`':
-                    /* Find the closing back quote */
-                    if((len = find_closing_quote(p, 0, 0)) == 0)
-                    {
-                        /* not found. print the ` and break */
-                        fputc(*p, tmp);
-                        break;
-                    }
-                    /* Otherwise, extract the command and substitute its output */
-                    heredoc_substitute_word(p, len+1, command_substitute, tmp);
-                    p += len;
-                    break;
-
-                /*
-                 * The $ sign might introduce:
-                 * - ANSI-C strings: $''
-                 * - arithmetic expansions (non-POSIX): $[]
-                 * - parameter expansions: ${var} or $var
-                 * - command substitutions: $()
-                 * - arithmetic expansions (POSIX): $(())
-                 */
-                case '$':
-                    c = p[1];
-                    switch(c)
-                    {
-                        /*
-                         * ANSI-C string
-                         */
-                        case '\'':
-                            /* Find the closing quote */
-                            if((len = find_closing_quote(p+1, 0, 1)) == 0)
-                            {
-                                /* Not found. Print the ' and break */
-                                fputc(*p, tmp);
-                                break;
-                            }
-                            /* Otherwise, extract the string and substitute its value */
-                            heredoc_substitute_word(p, len+2, ansic_expand, tmp);
-                            p += len;
-                            break;
-
-                    /*
-                     * $[ ... ] is a deprecated form of integer arithmetic, similar to (( ... )).
-                     */
-                        case '{':
-                        case '[':
-                            /* Find the closing quote */
-                            if((len = find_closing_brace(p+1, 0)) == 0)
-                            {
-                                /* Not found. Print the { or [ and break */
-                                fputc(*p, tmp);
-                                break;
-                            }
-                            /* Otherwise, extract the expression and substitute its value */
-                            func = (c == '[') ? arithm_expand : var_expand;
-                            heredoc_substitute_word(p, len+2, func, tmp);
-                            p += len;
-                            break;
-
-                        /*
-                         * Arithmetic expansion $(()) or command substitution $().
-                         */
-                        case '(':
-                            /* Check if we have one or two opening braces */
-                            i = 0;
-                            if(p[2] == '(')
-                            {
-                                i++;
-                            }
-                            /* Find the closing quote */
-                            if((len = find_closing_brace(p+1, 0)) == 0)
-                            {
-                                /* not found. print the ( and break */
-                                fputc(*p, tmp);
-                                break;
-                            }
-                            /*
-                             * Otherwise, extract the expression and substitute its value.
-                             * If we have one brace (i == 0), we'll perform command substitution.
-                             * Otherwise, arithmetic expansion.
-                             */
-                            func = i ? arithm_expand : command_substitute;
-                            heredoc_substitute_word(p, len+2, func, tmp);
-                            p += len;
-                            break;
-
-                        /*
-                         * Special variable substitution.
-                         */
-                        case '#':
-                            p++;
-                            /*
-                             * $#@ and $#* both give the same result as $# (ksh extension).
-                             */
-                            if(p[1] == '@' || p[1] == '*')
-                            {
-                                p++;
-                            }
-                            char p3[4];
-                            sprintf(p3, "$#");
-                            heredoc_substitute_word(p3, 2, var_expand, tmp);
-                            break;
-
-                        case '@':
-                        case '*':
-                        case '!':
-                        case '?':
-                        case '$':
-                        case '-':
-                        case '_':
-                        case '<':
-                        case '0':
-                        case '1':
-                        case '2':
-                        case '3':
-                        case '4':
-                        case '5':
-                        case '6':
-                        case '7':
-                        case '8':
-                        case '9':
-                            heredoc_substitute_word(p, 2, var_expand, tmp);
-                            p++;
-                            break;
-
-                        default:
-                            /* Var names must start with an alphabetic char or _ */
-                            if(!isalpha(p[1]) && p[1] != '_')
-                            {
-                                fputc(*p, tmp);
-                                break;
-                            }
-                            p2 = p+1;
-                            /* Get the end of the var name */
-                            while(*p2)
-                            {
-                                if(!isalnum(*p2) && *p2 != '_')
-                                {
-                                    break;
-                                }
-                                p2++;
-                            }
-                            /* Empty name */
-                            if(p2 == p+1)
-                            {
-                                fputc(*p, tmp);
-                                break;
-                            }
-                            /* Perform variable expansion */
-                            len = p2-p;
-                            heredoc_substitute_word(p, len, var_expand, tmp);
-                            p += len-1;
-                            break;
-                    }
-                    break;
-
-                default:
-                    fputc(*p, tmp);
-                    break;
-            }
-        } while(*(++p));
+            free(iov);
+        }
+        if(expanded)
+        {
+            free(expanded);
+        }
+        return 0;
     }
-
-    int fd = fileno(tmp);
-    rewind(tmp);
-    io_file->duplicates  = fd;
-    io_file->path        = NULL;
-    io_file->extra_flags = CLOOPEN_FLAG;
-    io_file->open_mode   = fcntl(fd, F_GETFL);
-    return 1;
+    
+    struct node_s *seg = child->first_child;
+    for( ; seg && i < count; seg = seg->next_sibling, i++)
+    {
+        char *s = seg->val.str;
+        expanded[i] = NULL;
+        if(seg->type == NODE_HEREDOC_EXPANSION && (expanded[i] = heredoc_expand_segment(s)))
+        {
+            s = expanded[i];
+        }
+        iov[i].iov_base = s;
+        iov[i].iov_len  = strlen(s);
+        len += iov[i].iov_len;
+    }
+    count = i;
+    
+    int fd = heredoc_fdv(iov, count, len);
+    
+    /* free used memory */
+    for(i = 0; i < count; i++)
+    {
+        if(expanded[i])
+        {
+            free(expanded[i]);
+        }
+    }
+    free(expanded);
+    free(iov);
+    return heredoc_set_fd(io_file, fd);
 }
@@ -24,653 +24,712 @@
 #include "include/cmd.h"
 #include "include/debug.h"
 
-char *add_pre_post(char *str, char *pre, char *post);
-char **get_brace_list(char *str, size_t end, size_t *count);
-char **get_letter_list(char *xs, char *ys, char *zs, size_t *count);
-char **get_num_list(char *xs, char *ys, char *zs, size_t *count);
-int add_to_list(char ***__list, char *p0, char *p1, size_t *list_count, size_t *list_size, int where);
-int remove_from_list(char **list, int i, size_t *list_count);
+/*
+ * A word containing brace expressions is compiled into a generator, which is
+ * a sequence of parts. Each part is either literal text, a number or letter range,
+ * or a comma-separated list whose items are generators themselves (so that brace
+ * expressions can be nested). The generator yields the cartesian product of its
+ * parts, one word at a time, with the leftmost part varying the slowest. This
+ * means we never have to keep the whole expansion in memory, unless our caller
+ * wants it as a list (see brace_expand() below).
+ */
+
+/* types of brace expression parts */
+#define BRACE_TEXT      1       /* literal text */
+#define BRACE_NUMS      2       /* number range, in the form {n1..n2[..step]} */
+#define BRACE_LETTERS   3       /* letter range, in the form {x..y[..step]} */
+#define BRACE_LIST      4       /* comma-separated list, in the form {a,b,...} */
+
+struct brace_part_s
+{
+    int     type;
+    char   *text;               /* BRACE_TEXT: the text (not '\0'-terminated) */
+    size_t  len;                /* BRACE_TEXT: the text's length */
+    long    first, step;        /* ranges: the first value and the step */
+    long    count, index;       /* ranges: number of values and the current value */
+    struct  brace_gen_s **alts; /* BRACE_LIST: the list items */
+    int     alt_count, alt;     /* BRACE_LIST: number of items and the current item */
+};
+
+struct brace_gen_s
+{
+    struct  brace_part_s *parts;
+    int     part_count;
+    int     started, done;
+    char   *buf;                /* the current word */
+    size_t  buf_len, buf_size;
+};
+
+static struct brace_gen_s *compile_braces(char *str, size_t len);
+
+
+/*
+ * Free the memory used by a brace expression generator.
+ */
+void brace_free(struct brace_gen_s *gen)
+{
+    int i, j;
+
+    for(i = 0; i < gen->part_count; i++)
+    {
+        struct brace_part_s *part = &gen->parts[i];
+        if(part->type == BRACE_LIST)
+        {
+            for(j = 0; j < part->alt_count; j++)
+            {
+                brace_free(part->alts[j]);
+            }
+            free(part->alts);
+        }
+    }
+
+    free(gen->parts);
+    free(gen->buf);
+    free(gen);
+}
 
 
 /*
- * Perform brace expansion, which converts constructs such as [1..10..2] to the string list
- * 1,3,5,7,9. Brace expansions can contain either a range (..) or a comma-separated list.
- * We convert the brace expression into a string array, which is then parsed for the other
- * word expansions.
+ * Add a part to the generator.
  *
- * Returns the list of brace-expanded words, NULL on error.
+ * Returns a pointer to the new part, or NULL if we ran out of memory.
  */
-char **brace_expand(char *str, size_t *count)
+static struct brace_part_s *add_part(struct brace_gen_s *gen, int type)
 {
-    /* Check the brace expansion option is set (bash) */
-    if(!option_set('B'))
+    struct brace_part_s *parts = realloc(gen->parts,
+                                         (gen->part_count+1)*sizeof(struct brace_part_s));
+    if(!parts)
     {
         return NULL;
     }
 
+    gen->parts = parts;
+    parts += gen->part_count++;
+    memset(parts, 0, sizeof(struct brace_part_s));
+    parts->type = type;
+    return parts;
+}
+
+
+/*
+ * Skip the quoted string or the $-expansion that starts at *p (and ends
+ * before end).
+ *
+ * Returns a pointer to the last char of the skipped string, or p if
+ * there's nothing to skip.
+ */
+static char *skip_quoted(char *p, char *end)
+{
+    char c = *p;
     size_t i;
-    char *p = str, c;
-    char **list = NULL, **list2;
-    size_t list_count = 0;
-    size_t list_size  = 0;
-    size_t list2_count = 0, j = 0;
-    
-loop:
-    while(*p)
+
+    switch(c)
     {
-        switch(*p)
-        {
-            /* Skip quoted strings */
-            case '\'':
-            case '"':
-            /* 
-             * Skip back-quoted strings (they will be expanded in a subshell 
-             * when we perform command substitution).
-             */
-            case '`':
-                c = *p;
-                while(*(++p) && *p != c)
-                {
-                    ;
-                }
-                break;
-                
-            /* Skip embedded command substitution, arithmetic expansion and variable expansion */
-            case '$':
-                switch(p[1])
+        case '\\':
+            return (p+1 < end) ? p+1 : p;
+
+        /*
+         * Skip quoted and back-quoted strings (the latter will be expanded in
+         * a subshell when we perform command substitution).
+         */
+        case '\'':
+        case '"':
+        case '`':
+            while(++p < end && *p != c)
+            {
+                if(*p == '\\' && c != '\'')
                 {
-                    /* We have a '${', '$(' or '$[' sequence */
-                    case '{':
-                    case '(':
-                    case '[':
-                        /* Add the opening brace and everything up to the closing brace to the buffer */
-                        i = find_closing_brace(++p, 0);
-                        p += i;
-                        break;
+                    p++;
                 }
-                break;
+            }
+            return (p < end) ? p : end-1;
 
-            /* Parse brace expression */
-            case '{':
-                /* Ignore escaped braces and variable expansion braces */
-                if(p > str && (p[-1] == '\\' || p[-1] == '$'))
+        /* Skip embedded command substitution, arithmetic expansion and variable expansion */
+        case '$':
+            if(p+1 < end && (p[1] == '{' || p[1] == '(' || p[1] == '['))
+            {
+                i = find_closing_brace(p+1, 0);
+                if(i && p+1+i < end)
                 {
-                    break;
+                    return p+1+i;
                 }
+            }
+            break;
+    }
 
-                /* Find the closing brace */
-                i = find_closing_brace(p, 0);
-                
-                /* Closing brace not found */
-                if(i == 0)
-                {
-                    break;
-                }
+    return p;
+}
 
-                /* Expand the brace list */
-                if((list2 = get_brace_list(p, i, &list2_count)))
-                {
-                    /* Get the prefix (the part before the opening brace) */
-                    char *pre = "";
-                    if(p > str)
-                    {
-                        pre = get_malloced_strl(str, 0, p-str);
-                    }
-
-                    /* Get the postfix (the part after the closing brace) */
-                    char *post = p+i+1;
-                    
-                    /*
-                     * Affix the parts before and after the brace expression to each item in the list.
-                     */
-                    for(i = 0; i < list2_count; i++)
-                    {
-                        list2[i] = add_pre_post(list2[i], pre, post);
-                    }
-                    
-                    /*
-                     * Remove the original string, containing the brace expression we've just expanded.
-                     */
-                    if(list)
-                    {
-                        remove_from_list(list, j, &list_count);
-                    }
-                    
-                    /*
-                     * Add the expanded items to the list.
-                     */
-                    for(i = 0; i < list2_count; i++)
-                    {
-                        char *item = list2[i];
-                        if(!add_to_list(&list, item, item+strlen(item), &list_count, &list_size, j+i))
-                        {
-                            goto err;
-                        }
-                    }
-                    
-                    /* Free temp memory */
-                    for(i = 0; i < list2_count; i++)
-                    {
-                        free_malloced_str(list2[i]);
-                    }
-                    free(list2);
-                    
-                    /* Continue parsing from the next item, after the one we've just parsed */
-                    p = list[j];
-                    str = p;
-                    goto loop;
-                }
-                break;
-        }
-        p++;
-    }
-    
-    if(list && j < list_count-1)
+
+/*
+ * Parse the decimal number of the given length.
+ *
+ * Returns 1 if the string is a valid number, 0 otherwise.
+ */
+static int get_range_num(char *str, size_t len, long *val)
+{
+    char buf[32];
+
+    if(!len || len >= sizeof(buf))
     {
-        p = list[++j];
-        str = p;
-        goto loop;
+        return 0;
     }
-    
-    (*count) = list_count;
-    return list;
-    
-err:
-    if(list)
+
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+
+    if(!isdigit(buf[(buf[0] == '-' || buf[0] == '+') ? 1 : 0]) || !is_num(buf))
     {
-        for(i = 0; i < list_count; i++)
-        {
-            free_malloced_str(list[i]);
-        }
-        free(list);
+        return 0;
     }
-    return NULL;
+
+    *val = atol(buf);
+    return 1;
 }
 
 
 /*
- * Affix the parts before and after the brace expression to each resultant string.
- * This is because a brace expression usually comes in the middle of a string, such
- * as "/usr/{local,include}", which gives us "/usr/local" and "/usr/include". In this
- * case, "/usr/" is the prefix, and the suffix is an empty string.
+ * Parse a range in the form x..y[..z], where the range starts at str and
+ * ends before end.
+ *
+ * Returns 1 if the range is valid, 0 otherwise.
  */
-char *add_pre_post(char *str, char *pre, char *post)
+static int parse_range(struct brace_gen_s *gen, char *str, char *end)
 {
-    char buf[strlen(pre)+strlen(str)+strlen(post)+1];
-    if(!*pre && !*post)
+    char *y = NULL, *z = NULL, *p;
+    long  first, last, step = 1;
+    int   type;
+
+    for(p = str; p+1 < end; p++)
     {
-        return str;
+        if(p[0] == '.' && p[1] == '.')
+        {
+            if(!y)
+            {
+                y = p+2;
+            }
+            else if(!z)
+            {
+                z = p+2;
+            }
+            else
+            {
+                return 0;
+            }
+            p++;
+        }
+    }
+
+    if(!y)
+    {
+        return 0;
+    }
+
+    size_t xlen = y-2-str;
+    size_t ylen = (z ? z-2 : end)-y;
+
+    if(z && !get_range_num(z, end-z, &step))
+    {
+        return 0;
     }
-    strcpy(buf, pre);
-    strcat(buf, str);
-    strcat(buf, post);
-    char *str2 = get_malloced_str(buf);
-    if(!str2)
+
+    /* Letter range in the form [x..y[..z]] */
+    if(xlen == 1 && ylen == 1 && isalpha(*str) && isalpha(*y))
+    {
+        type  = BRACE_LETTERS;
+        first = *str;
+        last  = *y;
+    }
+    /* Number range in the form [n1..n2[..step]] */
+    else if(get_range_num(str, xlen, &first) && get_range_num(y, ylen, &last))
     {
-        return str;
+        type  = BRACE_NUMS;
     }
-    free_malloced_str(str);
-    return str2;
+    else
+    {
+        return 0;
+    }
+
+    if(step < 0)
+    {
+        step = -step;
+    }
+    else if(step == 0)
+    {
+        step = 1;
+    }
+
+    struct brace_part_s *part = add_part(gen, type);
+    if(!part)
+    {
+        return 0;
+    }
+
+    part->first = first;
+    if(first <= last)
+    {
+        part->step  = step;
+        part->count = (last-first)/step + 1;
+    }
+    else
+    {
+        part->step  = -step;
+        part->count = (first-last)/step + 1;
+    }
+    return 1;
 }
 
+
 /*
- * Parse a brace expression and return the string array that results from expanding
- * the expression. The first char of str must be '{', and the char at str[end] must
- * be '}'. We store the number of strings in the resultant list in count, so the caller
- * knows how many items to process.
+ * Parse the brace expression that starts at str (which must be '{'), and ends
+ * at str[end] (which must be '}').
+ *
+ * Returns 1 if the expression is valid, 0 otherwise.
  */
-char **get_brace_list(char *str, size_t end, size_t *count)
+static int parse_brace(struct brace_gen_s *gen, char *str, size_t end)
 {
-    char *p0 = str+1;
-    char *p1 = p0;
-    char *p2 = str+end;
-    char c;
-    char **list = NULL, **list2 = NULL;
-    size_t list_count = 0, list2_count = 0;
-    size_t list_size  = 0;
-    int ob = 1, cb = 0;
-    size_t i;
-    
-    while(p1 <= p2)
+    char  *p, *p0 = str+1, *p2 = str+end;
+    struct brace_part_s *part = NULL;
+    char **items = NULL;
+    size_t *lens = NULL;
+    int    count = 0, i;
+    size_t j;
+
+    /* find the top-level commas */
+    for(p = p0; p <= p2; p++)
     {
-        switch(*p1)
+        switch(*p)
         {
-            /* Skip quoted strings */
-            case '\'':
-            case '"':
-                c = *p1;
-                while(*(++p1) && *p1 != c)
-                {
-                    ;
-                }
-                break;
-                
-            case '\\':
-                p1++;
-                break;
-                
-            /* Brace expressions can be nested, but we don't process nested expressions here */
+            /* nested brace expressions are parsed when we compile the items */
             case '{':
-                ob++;
-                i = find_closing_brace(p1, 0);
-                if(i == 0)
-                {
-                    break;
-                }
-                p1 += i;
-                cb++;
-                break;
-                
-            /*
-             * This explicitly is the very last '}'. others should be processed in the '{' case above.
-             */
-            case '}':
-                cb++;
-                /* Fall through */
-                
-            case ',':
-                if(p1 == p0 || p1[-1] == '\\')
+                j = find_closing_brace(p, 0);
+                if(j && p+j < p2)
                 {
-                    break;
-                }
-
-                if(!add_to_list(&list, p0, p1, &list_count, &list_size, list_count))
-                {
-                    goto err;
+                    p += j;
                 }
-                p0 = p1+1;
                 break;
 
-            case '.':
-                if(p1[1] != '.')
+            case '}':
+                if(p != p2)
                 {
                     break;
                 }
+                /* Fall through */
+                __attribute__((fallthrough));
 
-                /* Get the first number */
-                char *x, *y, *z = NULL;
-                x = get_malloced_strl(p0, 0, p1-p0);
-                if(!x)
+            case ',':
+                if(*p == '}' && !count)
                 {
-                    goto err;
+                    /* no commas, this might be a range */
+                    return parse_range(gen, p0, p2);
                 }
                 
-                p0 = p1+2;
-                if(!*p0)
-                {
-                    free_malloced_str(x);
-                    goto err;
-                }
+                char   **items2 = realloc(items, (count+1)*sizeof(char *));
+                size_t  *lens2  = realloc(lens , (count+1)*sizeof(size_t));
                 
-                /* Get the second number, after the '..' */
-                p1 = p0;
-                while(p1 < p2 && *p1 != '.')
+                if(items2)
                 {
-                    if(*p1 == '{')
-                    {
-                        i = find_closing_brace(p1, 0);
-                        p1 += i;
-                    }
-                    else if(*p1 == ',')
-                    {
-                        break;
-                    }
-                    p1++;
+                    items = items2;
                 }
 
-                if(*p1 && *p1 != '.' && *p1 != '}' && *p1 != ',')
+                if(lens2)
                 {
-                    free_malloced_str(x);
-                    goto err;
+                    lens = lens2;
                 }
-                
-                y = get_malloced_strl(p0, 0, p1-p0);
-                if(!y)
+
+                if(!items2 || !lens2)
                 {
-                    free_malloced_str(x);
                     goto err;
                 }
                 
-                /* Get the optional third number, after the '..' */
-                if(*p1 == '.')
-                {
-                    if(p1[1] != '.')
-                    {
-                        free_malloced_str(x);
-                        free_malloced_str(y);
-                        goto err;
-                    }
-                    
-                    p0 = p1+2;
-                    p1 = p2;
-                    z = get_malloced_strl(p0, 0, p1-p0);
-                    if(!z)
-                    {
-                        free_malloced_str(x);
-                        free_malloced_str(y);
-                        goto err;
-                    }
-                }
-                p0 = p1+1;
-                
-                /* Letter range in the form [x..y[..z]] */
-                if(isalpha(*x) && x[1] == '\0' && isalpha(*y) && y[1] == '\0')
-                {
-                    list2 = get_letter_list(x, y, z, &list2_count);
-                    if(!list2)
-                    {
-                        free_malloced_str(x);
-                        free_malloced_str(y);
-                        free_malloced_str(z);
-                        goto err;
-                    }
-                }
-                /* Number range in the form [n1..n2[..step]] */
-                else if(is_num(x) && is_num(y))
-                {
-                    /* If there's an optional step, check it's a number */
-                    if(z && !is_num(z))
-                    {
-                        free_malloced_str(x);
-                        free_malloced_str(y);
-                        free_malloced_str(z);
-                        goto err;
-                    }
-                    
-                    list2 = get_num_list(x, y, z, &list2_count);
-                    if(!list2)
-                    {
-                        free_malloced_str(x);
-                        free_malloced_str(y);
-                        free_malloced_str(z);
-                        goto err;
-                    }
-                }
-                else
-                {
-                    free_malloced_str(x);
-                    free_malloced_str(y);
-                    free_malloced_str(z);
-                    break;
-                }
-                
-                free_malloced_str(x);
-                free_malloced_str(y);
-                free_malloced_str(z);
-                
-                /* Add the sublist */
-                char **l = list2;
-                i = list2_count;
-                while(i--)
-                {
-                    char *item = *l;
-                    if(!add_to_list(&list, item, item+strlen(item), &list_count, &list_size, list_count))
-                    {
-                        goto err2;
-                    }
-                    l++;
-                }
-                
-                for(i = 0; i < list2_count; i++)
-                {
-                    free_malloced_str(list2[i]);
-                }
-                
-                free(list2);
-                list2 = NULL;
+                items[count] = p0;
+                lens[count++] = p-p0;
+                p0 = p+1;
+                break;
+
+            default:
+                p = skip_quoted(p, p2);
                 break;
         }
-        p1++;
     }
-    *count = list_count;
-    return list;
-    
-err2:
-    if(list2)
+
+    part = add_part(gen, BRACE_LIST);
+    if(!part || !(part->alts = malloc(count*sizeof(struct brace_gen_s *))))
     {
-        for(i = 0; i < list2_count; i++)
+        goto err;
+    }
+
+    for(i = 0; i < count; i++)
+    {
+        if(!(part->alts[i] = compile_braces(items[i], lens[i])))
         {
-            free_malloced_str(list2[i]);
+            goto err;
         }
-        free(list2);
+        part->alt_count++;
     }
-    
+
+    free(items);
+    free(lens);
+    return 1;
+
 err:
-    if(list)
+    if(part)
     {
-        for(i = 0; i < list_count; i++)
+        for(i = 0; i < part->alt_count; i++)
         {
-            free_malloced_str(list[i]);
+            brace_free(part->alts[i]);
         }
-        free(list);
+        free(part->alts);
+        gen->part_count--;
     }
-    return NULL;
+    free(items);
+    free(lens);
+    return 0;
 }
 
 
 /*
- * Get the letter range that is in the form [x..y[..z]].
+ * Compile the len chars of str into a brace expression generator.
  *
- * Returns a string list, or NULL in case of error.
+ * Returns the generator, or NULL if we ran out of memory.
  */
-char **get_letter_list(char *xs, char *ys, char *zs, size_t *count)
+static struct brace_gen_s *compile_braces(char *str, size_t len)
 {
-    char x = *xs, y = *ys;
-    int  z = zs ? atol(zs) : 1;
-    int  i = 0;
-    char l = x, **p;
-    char buf[4];
-    char **list = NULL;
-    *count = 0;
-    if(z < 0)
-    {
-        z = -z;
-    }
-    else if(z == 0)
+    struct brace_gen_s *gen = malloc(sizeof(struct brace_gen_s));
+    char *p = str, *end = str+len, *text = str;
+    size_t i;
+
+    if(!gen)
     {
-        z = 1;
+        return NULL;
     }
 
-    if(x <= y)
+    memset(gen, 0, sizeof(struct brace_gen_s));
+
+    for( ; p < end; p++)
     {
-        while(l <= y)
+        if(*p != '{')
         {
-            i++, l += z;
+            p = skip_quoted(p, end);
+            continue;
         }
-        list = malloc(i * sizeof(char *));
-        if(!list)
+
+        /* Find the closing brace */
+        i = find_closing_brace(p, 0);
+        if(!i || p+i >= end)
         {
+            continue;
+        }
+
+        /* the text before the brace expression */
+        int n = gen->part_count;
+        struct brace_part_s *part = add_part(gen, BRACE_TEXT);
+        if(!part)
+        {
+            brace_free(gen);
             return NULL;
         }
-        *count = i;
-        p = list;
-        while(i--)
+        part->text = text;
+        part->len  = p-text;
+
+        if(!parse_brace(gen, p, i))
         {
-            buf[0] = x; buf[1] = '\0';
-            *p = get_malloced_str(buf);
-            if(*p)
-            {
-                p++;
-            }
-            x += z;
+            /* not a valid brace expression, treat it as text */
+            gen->part_count = n;
+            continue;
         }
+
+        p += i;
+        text = p+1;
     }
-    else
+
+    struct brace_part_s *part = add_part(gen, BRACE_TEXT);
+    if(!part)
     {
-        while(l >= y)
-        {
-            i++, l -= z;
-        }
-        list = malloc(i * sizeof(char *));
-        if(!list)
-        {
-            return NULL;
-        }
-        *count = i;
-        p = list;
-        while(i--)
+        brace_free(gen);
+        return NULL;
+    }
+    part->text = text;
+    part->len  = end-text;
+
+    return gen;
+}
+
+
+/*
+ * Reset the generator, so that all its parts point to their first values.
+ */
+static void brace_reset(struct brace_gen_s *gen)
+{
+    int i;
+
+    for(i = 0; i < gen->part_count; i++)
+    {
+        struct brace_part_s *part = &gen->parts[i];
+        part->index = 0;
+        if(part->type == BRACE_LIST)
         {
-            buf[0] = x; buf[1] = '\0';
-            *p = get_malloced_str(buf);
-            if(*p)
-            {
-                p++;
-            }
-            x -= z;
+            part->alt = 0;
+            brace_reset(part->alts[0]);
         }
     }
-    return list;
 }
 
 
 /*
- * Get the number range that is in the form [n1..n2[..step]].
+ * Move the generator to its next value, starting with the rightmost part.
  *
- * Returns a string list, or NULL in case of error.
+ * Returns 1 on success, 0 if there are no more values.
  */
-char **get_num_list(char *xs, char *ys, char *zs, size_t *count)
+static int brace_advance(struct brace_gen_s *gen)
 {
-    long x = atol(xs), y = atol(ys);
-    long z = zs ? atol(zs) : 1;
-    long i = 0, l = x;
-    char **p;
-    char buf[32];
-    char **list = NULL;
-    *count = 0;
-    if(z < 0)
-    {
-        z = -z;
-    }
-    else if(z == 0)
-    {
-        z = 1;
-    }
-    
-    if(x <= y)
+    int i;
+
+    for(i = gen->part_count-1; i >= 0; i--)
     {
-        while(l <= y)
-        {
-            i++, l += z;
-        }
-        list = malloc(i * sizeof(char *));
-        if(!list)
+        struct brace_part_s *part = &gen->parts[i];
+        switch(part->type)
         {
-            return NULL;
-        }
-        *count = i;
-        p = list;
-        while(i--)
-        {
-            sprintf(buf, "%ld", x);
-            *p = get_malloced_str(buf);
-            if(*p)
-            {
-                p++;
-            }
-            x += z;
+            case BRACE_NUMS:
+            case BRACE_LETTERS:
+                if(++part->index < part->count)
+                {
+                    return 1;
+                }
+                part->index = 0;
+                break;
+
+            case BRACE_LIST:
+                if(brace_advance(part->alts[part->alt]))
+                {
+                    return 1;
+                }
+
+                if(++part->alt < part->alt_count)
+                {
+                    brace_reset(part->alts[part->alt]);
+                    return 1;
+                }
+
+                part->alt = 0;
+                brace_reset(part->alts[0]);
+                break;
         }
     }
-    else
+
+    return 0;
+}
+
+
+/*
+ * Append len chars from str to the generator's word buffer.
+ *
+ * Returns 1 on success, 0 if we ran out of memory.
+ */
+static int brace_append(struct brace_gen_s *gen, char *str, size_t len)
+{
+    if(gen->buf_len+len >= gen->buf_size)
     {
-        while(l >= y)
-        {
-            i++, l -= z;
-        }
-        list = malloc(i * sizeof(char *));
-        if(!list)
+        size_t newsz = gen->buf_size ? gen->buf_size : 64;
+        while(gen->buf_len+len >= newsz)
         {
-            return NULL;
+            newsz <<= 1;
         }
-        *count = i;
-        p = list;
-        while(i--)
+
+        char *buf = realloc(gen->buf, newsz);
+        if(!buf)
         {
-            sprintf(buf, "%ld", x);
-            *p = get_malloced_str(buf);
-            if(*p)
-            {
-                p++;
-            }
-            x -= z;
+            return 0;
         }
+        gen->buf = buf;
+        gen->buf_size = newsz;
     }
-    return list;
+
+    memcpy(gen->buf+gen->buf_len, str, len);
+    gen->buf_len += len;
+    gen->buf[gen->buf_len] = '\0';
+    return 1;
 }
 
 
 /*
- * Add a string to a string list. The string to be added starts at *p0 and ends at *p1.
- * list_size tells us the count of strings in the list, so that we can realloc the list
- * if the list_count reaches the list_size.
+ * Append the current value of the generator to the word buffer of the top-level
+ * generator (out).
  *
- * Returns 1 of the string is added successfully to the list, 0 in case of error.
- * list_count is incremented by 1.
+ * Returns 1 on success, 0 if we ran out of memory.
  */
-int add_to_list(char ***__list, char *p0, char *p1, size_t *list_count, size_t *list_size, int where)
+static int brace_emit(struct brace_gen_s *gen, struct brace_gen_s *out)
 {
-    char **list = *__list;
+    char buf[32];
     int i;
 
-    if(!list)
+    for(i = 0; i < gen->part_count; i++)
     {
-        list = malloc(8 * sizeof(char *));
-        if(!list)
+        struct brace_part_s *part = &gen->parts[i];
+        long val = part->first + part->index*part->step;
+        int res = 1;
+
+        switch(part->type)
         {
-            return 0;
+            case BRACE_TEXT:
+                res = brace_append(out, part->text, part->len);
+                break;
+
+            case BRACE_NUMS:
+                res = brace_append(out, buf, sprintf(buf, "%ld", val));
+                break;
+
+            case BRACE_LETTERS:
+                buf[0] = (char)val;
+                res = brace_append(out, buf, 1);
+                break;
+
+            case BRACE_LIST:
+                res = brace_emit(part->alts[part->alt], out);
+                break;
         }
-        (*list_size) = 8;
-    }
-    else if((*list_count) == (*list_size))
-    {
-        i = (*list_size) << 1;
-        list = realloc(list, i * sizeof(char *));
-        if(!list)
+
+        if(!res)
         {
             return 0;
         }
-        (*list_size) = i;
     }
 
-    char *str = get_malloced_strl(p0, 0, p1-p0);
-    if(!str)
+    return 1;
+}
+
+
+/*
+ * Compile the brace expressions in the given word into a generator. The generator
+ * keeps pointers into str, so str must not be freed before the generator is.
+ * Brace expressions can contain either a range, such as {1..10..2}, which gives us
+ * 1,3,5,7,9, or a comma-separated list. The parts before and after the brace
+ * expression are affixed to each resultant word, such as "/usr/{local,include}",
+ * which gives us "/usr/local" and "/usr/include".
+ *
+ * Returns the generator, or NULL if the word has no brace expressions (or if
+ * brace expansion is turned off).
+ */
+struct brace_gen_s *brace_compile(char *str)
+{
+    /* Check the brace expansion option is set (bash) */
+    if(!option_set('B') || !strchr(str, '{'))
     {
-        return 0;
+        return NULL;
     }
-    
-    /* Shift all items down (if needed) */
-    int k = (*list_count);
-    for(i = k; i > where; i--)
+
+    struct brace_gen_s *gen = compile_braces(str, strlen(str));
+    if(gen && gen->part_count == 1)
     {
-        list[i] = list[i-1];
+        /* only text, no brace expressions */
+        brace_free(gen);
+        return NULL;
     }
 
-    list[i] = str;
-    (*list_count) = (*list_count)+1;
-    (*__list) = list;
-    return 1;
+    return gen;
+}
+
+
+/*
+ * Get the next word from the generator. Empty words are skipped.
+ *
+ * Returns the word, which is valid until the next call, or NULL if there are
+ * no more words.
+ */
+char *brace_next(struct brace_gen_s *gen)
+{
+    do
+    {
+        if(gen->done)
+        {
+            return NULL;
+        }
+
+        if(!gen->started)
+        {
+            gen->started = 1;
+        }
+        else if(!brace_advance(gen))
+        {
+            gen->done = 1;
+            return NULL;
+        }
+
+        gen->buf_len = 0;
+        if(!brace_append(gen, "", 0) || !brace_emit(gen, gen))
+        {
+            gen->done = 1;
+            return NULL;
+        }
+
+        /*
+         * Quotes are still in the word, so an empty word can only come from empty
+         * (unquoted) list items, as in {a,}. Such words are removed, like bash does.
+         */
+    } while(gen->buf_len == 0);
+
+    return gen->buf;
 }
 
 
 /*
- * Remove the i-th string from the string list.
+ * Perform brace expansion, and return the resultant words as a list. This is
+ * only used when we need all the words at once, such as when we are building
+ * a command's argument list.
  *
- * Returns 1 of the string is successfully removed from the list, 0 in case of error.
- * list_count is decremented by 1.
+ * Returns the list of brace-expanded words, NULL on error.
  */
-int remove_from_list(char **list, int i, size_t *list_count)
+char **brace_expand(char *str, size_t *count)
 {
-    free_malloced_str(list[i]);
-    int j = i;
-    int k = (*list_count)-1;
+    struct brace_gen_s *gen = brace_compile(str);
+    char **list = NULL, *word;
+    size_t list_count = 0, list_size = 0;
 
-    for( ; j < k; j++)
+    if(!gen)
     {
-        list[j] = list[j+1];
+        return NULL;
     }
 
-    list[j] = NULL;
-    *list_count = k;
-    return 1;
+    while((word = brace_next(gen)))
+    {
+        if(list_count == list_size)
+        {
+            size_t newsz = list_size ? list_size*2 : 8;
+            char **list2 = realloc(list, newsz*sizeof(char *));
+            if(!list2)
+            {
+                goto err;
+            }
+            list = list2;
+            list_size = newsz;
+        }
+
+        if(!(list[list_count] = get_malloced_str(word)))
+        {
+            goto err;
+        }
+        list_count++;
+    }
+
+    brace_free(gen);
+
+    /* the braces expanded to nothing, as in {,} */
+    if(!list && !(list = malloc(sizeof(char *))))
+    {
+        return NULL;
+    }
+
+    (*count) = list_count;
+    return list;
+    
+err:
+    while(list_count--)
+    {
+        free_malloced_str(list[list_count]);
+    }
+    free(list);
+    brace_free(gen);
+    return NULL;
 }
 
 
@@ -30,6 +30,12 @@
 
 struct  alias_s aliases[MAX_ALIASES];
 
+/*
+ * Incremented every time an alias is defined or removed. Used to tell if a
+ * command string that was parsed earlier needs to be parsed again (see eval.c).
+ */
+unsigned long alias_generation = 0;
+
 #define UTILITY     "alias"
 
 /* Defined below */
@@ -121,6 +127,7 @@ void init_aliases(void)
 void unset_all_aliases(void)
 {
     int i = 0;
+    alias_generation++;
     for( ; i < MAX_ALIASES; i++)
     {
         if(aliases[i].name)
@@ -262,6 +269,7 @@ int set_alias(char *name, char *val)
         index = first_free;
     }
     i = index;
+    alias_generation++;
     
     /* Save the alias name */
     if(!aliases[i].name)
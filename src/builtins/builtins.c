@@ -222,10 +222,12 @@ struct builtin_s shell_builtins[] =
     {
         "declare", "declare variables and give them attributes",
         declare_builtin,       /* non-POSIX */
-        "%% [-hvfFgrxlut] [-p] [name=[value]...]",
+        "%% [-hvaAfFgrxlut] [-p] [name=[value]...]",
         "name        variable to which an attribute or value is set\n"
         "value       the value to give to the variable called name\n\n"
         "Options:\n"
+        "  -a        make each name an indexed array\n"
+        "  -A        make each name an associative array\n"
         "  -f        restrict output to shell functions\n"
         "  -F        don't print function definitions\n"
         "  -g        declare/modify variables at the global scope\n"
@@ -279,7 +281,11 @@ struct builtin_s shell_builtins[] =
         "%% [-hv] [argument ...]",
         "argument    can be one of the following:\n"
         "   symtab      will print the contents of the local symbol table\n"
-        "   vars        will print out the shell variable list (similar to `declare -p`)\n\n"
+        "   vars        will print out the shell variable list (similar to `declare -p`)\n"
+        "   redraw      will print the number of bytes and write calls the command line\n"
+        "                 editor used per keystroke\n"
+        "   children    will print statistics about the child statuses passed from the\n"
+        "                 SIGCHLD handler to the shell\n\n"
         "Options:\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
@@ -531,6 +537,22 @@ struct builtin_s shell_builtins[] =
         "  -q        do not output messages in case of error or no mail\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
+    {
+        "mapfile", "read lines from a file into an indexed array",
+        mapfile_builtin,       /* non-POSIX */
+        "%% [-hvt] [-d delim] [-n count] [-O origin] [-s count] [-u fd] [-C callback] [-c quantum] [array]",
+        "array       the indexed array to store lines in (MAPFILE by default)\n\n"
+        "Options:\n"
+        "  -C        evaluate callback every quantum lines, passing it the index and the line\n"
+        "  -c        the number of lines between calls to callback (5000 by default)\n"
+        "  -d        use the first char of delim, instead of newline, to terminate lines\n"
+        "  -n        read at most count lines (all lines if count is 0)\n"
+        "  -O        start assigning at index origin, instead of clearing the array first\n"
+        "  -s        discard the first count lines\n"
+        "  -t        remove the trailing delimiter from each line\n"
+        "  -u        read from file descriptor fd instead of standard input\n",
+        BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
+    },
     {
         "memusage", "show the shell's memory usage",
         memusage_builtin,       /* non-POSIX */
@@ -539,6 +561,7 @@ struct builtin_s shell_builtins[] =
         "  aliases             show the memory allocated for alias names and values\n"
         "  cmdbuf, cmdbuffer   show the memory allocated for the command line buffer\n"
         "  dirstack            show the memory allocated for the directory stack\n"
+        "  eval                show the memory allocated for the parsed eval strings cache\n"
         "  hash, hashtab       show the memory allocated for the commands hashtable\n"
         "  history             show the memory allocated for the command line history table\n"
         "  input               show the memory allocated for the currently executing translation unit\n"
@@ -588,6 +611,24 @@ struct builtin_s shell_builtins[] =
         "Options:\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
+    {
+        "parallel", "run a command on many items in parallel",
+        parallel_builtin,       /* non-POSIX */
+        "%% [-hvk] [-j N] command [args...] [::: item...]",
+        "command     the command to run for each item (can be a function, a builtin or\n"
+        "              an external command)\n"
+        "args        the arguments passed to the command. An argument that is exactly {}\n"
+        "              is replaced by the item, otherwise the item is passed as the last\n"
+        "              argument\n"
+        "item        the items to work on. If no ::: is given, the items are read from\n"
+        "              standard input, one item per line\n\n"
+        "Options:\n"
+        "  -j        run at most N items at the same time (default is the number of\n"
+        "              online processors)\n"
+        "  -k        keep the output of the items in the same order as the items\n\n"
+        "The exit status of each item is saved in the PARALLEL_STATUS array.\n",
+        BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
+    },
     {
         "popd", "pop directories off the stack and cd to them",
         popd_builtin,       /* non-POSIX */
@@ -612,6 +653,21 @@ struct builtin_s shell_builtins[] =
         "  -0        terminate each entry with NULL instead of a newline character\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
+    {
+        "printf", "write formatted output",
+        printf_builtin,       /* POSIX */
+        "%% [-v var] format [argument...]",
+        "format      a string containing plain chars, escape sequences and conversion\n"
+        "              specifications, each of which converts the next argument.\n"
+        "              The format is reused as needed to consume all the arguments.\n"
+        "argument    the values to be converted and printed\n\n"
+        "Options:\n"
+        "  -v        assign the output to the variable var instead of printing it\n\n"
+        "In addition to the C conversions (diouxXeEfFgGaAcs), the following are accepted:\n"
+        "  %b        expand the escape sequences in the argument\n"
+        "  %q        quote the argument so it can be reused as shell input\n",
+        BUILTIN_ENABLED,      /* don't print neither the -v nor the -h options */
+    },
     {
         "pushd", "push directories on the stack and cd to them",
         pushd_builtin,       /* non-POSIX */
@@ -668,6 +724,22 @@ struct builtin_s shell_builtins[] =
         "  -r        read from fd (instead of stdin)\n\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
+    {
+        "readarray", "read lines from a file into an indexed array",
+        mapfile_builtin,       /* non-POSIX */
+        "%% [-hvt] [-d delim] [-n count] [-O origin] [-s count] [-u fd] [-C callback] [-c quantum] [array]",
+        "array       the indexed array to store lines in (MAPFILE by default)\n\n"
+        "Options:\n"
+        "  -C        evaluate callback every quantum lines, passing it the index and the line\n"
+        "  -c        the number of lines between calls to callback (5000 by default)\n"
+        "  -d        use the first char of delim, instead of newline, to terminate lines\n"
+        "  -n        read at most count lines (all lines if count is 0)\n"
+        "  -O        start assigning at index origin, instead of clearing the array first\n"
+        "  -s        discard the first count lines\n"
+        "  -t        remove the trailing delimiter from each line\n"
+        "  -u        read from file descriptor fd instead of standard input\n",
+        BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
+    },
     {
         "readonly", "set the readonly attribute for variables",
         readonly_builtin,       /* POSIX */
@@ -787,6 +859,7 @@ struct builtin_s shell_builtins[] =
         "            means non-interactive shell):\n"
         "addsuffix          append space to file- and slash to dir-names on tab completion (tcsh)\n"
         "autocd             dirs passed as single-word commands are passed to 'cd' (bash int)\n"
+        "bracketpaste       insert pasted text in one go, using the terminal's bracketed paste mode\n"
         "cdable_vars        cd arguments can be variable names (bash)\n"
         "cdable-vars        same as the above\n"
         "checkhash          for hashed commands, check the file exists before exec'ing (bash)\n"
@@ -958,7 +1031,7 @@ struct builtin_s shell_builtins[] =
     {
         "typeset", "declare variables and give them attributes",
         declare_builtin,       /* non-POSIX */
-        "%% [-hvfFgrxlut] [-p] [name=[value]...]",
+        "%% [-hvaAfFgrxlut] [-p] [name=[value]...]",
         "For an explanation of all the options and arguments, run `help declare`\n",
         BUILTIN_ENABLED,      /* don't print neither the -v nor the -h options */
     },
@@ -1072,11 +1145,12 @@ struct builtin_s shell_builtins[] =
     {
         "wait", "await process completion",
         wait_builtin,       /* POSIX */
-        "%% [-hfnv] [pid...]",
+        "%% [-hfnv] [-p var] [pid...]",
         "pid...      process ID or Job ID to wait for\n\n"
         "Options:\n"
         "  -f        force jobs/processes to exit\n"
-        "  -n        wait for any job or process\n",
+        "  -n        wait for the first of the given jobs (or any job) to finish\n"
+        "  -p        assign the pid of the job that was waited for to var\n",
         BUILTIN_PRINT_HOPTION | BUILTIN_PRINT_VOPTION | BUILTIN_ENABLED,
     },
     { 
@@ -1236,6 +1310,9 @@ int do_builtin_internal(int (*builtin)(int, char **), int argc, char **argv)
     /* Execute the builtin */
     int res = builtin(argc, argv);
 
+    /* Write out the builtin's output in one go (see main()) */
+    fflush(stdout);
+
     /* Reset $OPTIND to its previous value */
     if(save)
     {
@@ -1266,13 +1343,17 @@ void disable_nonposix_builtins(void)
     LOCAL_BUILTIN.flags     &= ~BUILTIN_ENABLED;
     LOGOUT_BUILTIN.flags    &= ~BUILTIN_ENABLED;
     MAILCHECK_BUILTIN.flags &= ~BUILTIN_ENABLED;
+    MAPFILE_BUILTIN.flags   &= ~BUILTIN_ENABLED;
     MEMUSAGE_BUILTIN.flags  &= ~BUILTIN_ENABLED;
     NICE_BUILTIN.flags      &= ~BUILTIN_ENABLED;
     NOHUP_BUILTIN.flags     &= ~BUILTIN_ENABLED;
     NOTIFY_BUILTIN.flags    &= ~BUILTIN_ENABLED;
+    PARALLEL_BUILTIN.flags  &= ~BUILTIN_ENABLED;
     POPD_BUILTIN.flags      &= ~BUILTIN_ENABLED;
     PRINTENV_BUILTIN.flags  &= ~BUILTIN_ENABLED;
     PUSHD_BUILTIN.flags     &= ~BUILTIN_ENABLED;
+    READARRAY_BUILTIN.flags &= ~BUILTIN_ENABLED;
+    RECHO_BUILTIN.flags     &= ~BUILTIN_ENABLED;
     REPEAT_BUILTIN.flags    &= ~BUILTIN_ENABLED;
     SETENV_BUILTIN.flags    &= ~BUILTIN_ENABLED;
     SETX_BUILTIN.flags      &= ~BUILTIN_ENABLED;
@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <stddef.h>         /* size_t */
+#include <stdint.h>
 #include "../symtab/symtab.h"
 
 /* struct for builtin utilities */
@@ -113,6 +114,33 @@ int     push_cwd(char *utility);
 /* echo.c */
 void    do_echo(int v, int argc, char **argv, int flags);
 
+/* eval.c */
+/* number of parsed eval strings we keep */
+#define EVAL_CACHE_SIZE     32
+
+/* an entry in the cache of parsed eval strings */
+struct eval_cache_s
+{
+    char          *str;         /* the eval string */
+    uint32_t       hash;        /* hash of the eval string */
+    unsigned long  alias_gen;   /* value of alias_generation when we parsed the string */
+    int            aliases;     /* were aliases expanded when we parsed the string? */
+    int            busy;        /* number of evals currently executing this entry */
+    unsigned long  last_used;   /* when we last used this entry (for LRU eviction) */
+    struct node_s *trees;       /* the parsed nodetrees */
+};
+
+/* hit/miss statistics for the eval cache */
+struct eval_cache_stats_s
+{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+};
+
+extern  struct eval_cache_s eval_cache[];
+extern  struct eval_cache_stats_s eval_cache_stats;
+
 /* export.c */
 int     is_list_terminator(char *c);
 void    do_export_vars(int force_export_all);
@@ -192,14 +220,17 @@ int     let_builtin(int argc, char **argv);
 int     local_builtin(int argc, char **argv);
 int     logout_builtin(int argc, char **argv);
 int     mailcheck_builtin(int argc, char **argv);
+int     mapfile_builtin(int argc, char **argv);
 int     memusage_builtin(int argc, char **argv);
 int     newgrp_builtin(int argc, char **argv);
 int     nice_builtin(int argc, char **argv);
 int     notify_builtin(int argc, char **argv);
+int     parallel_builtin(int argc, char **argv);
 // int    print_system_date(void);
 int     pushd_builtin(int argc, char **argv);
 int     popd_builtin(int argc, char **argv);
 int     printenv_builtin(int argc, char **argv);
+int     printf_builtin(int argc, char **argv);
 int     pwd_builtin(int argc, char **argv);
 int     read_builtin(int argc, char **argv);
 // int    reboot(void);
@@ -287,42 +318,47 @@ int     times_builtin(int argc, char *argv[]);
 #define LOCAL_BUILTIN               shell_builtins[35]
 #define LOGOUT_BUILTIN              shell_builtins[36]
 #define MAILCHECK_BUILTIN           shell_builtins[37]
-#define MEMUSAGE_BUILTIN            shell_builtins[38]
-#define NEWGRP_BUILTIN              shell_builtins[39]
-#define NICE_BUILTIN                shell_builtins[40]
-#define NOHUP_BUILTIN               shell_builtins[41]
-#define NOTIFY_BUILTIN              shell_builtins[42]
-#define POPD_BUILTIN                shell_builtins[43]
-#define PRINTENV_BUILTIN            shell_builtins[44]
-#define PUSHD_BUILTIN               shell_builtins[45]
-#define PWD_BUILTIN                 shell_builtins[46]
-#define READ_BUILTIN                shell_builtins[47]
-#define READONLY_BUILTIN            shell_builtins[48]
-#define REPEAT_BUILTIN              shell_builtins[49]
-#define RETURN_BUILTIN              shell_builtins[50]
-#define SET_BUILTIN                 shell_builtins[51]
-#define SETENV_BUILTIN              shell_builtins[52]
-#define SETX_BUILTIN                shell_builtins[53]
-#define SHIFT_BUILTIN               shell_builtins[54]
-#define SHOPT_BUILTIN               shell_builtins[55]
-#define SOURCE_BUILTIN              shell_builtins[56]
-#define STOP_BUILTIN                shell_builtins[57]
-#define SUSPEND_BUILTIN             shell_builtins[58]
-#define TEST3_BUILTIN               shell_builtins[59]
-#define TIMES_BUILTIN               shell_builtins[60]
-#define TRAP_BUILTIN                shell_builtins[61]
-#define TRUE_BUILTIN                shell_builtins[62]
-#define TYPE_BUILTIN                shell_builtins[63]
-#define TYPESET_BUILTIN             shell_builtins[64]
-#define ULIMIT_BUILTIN              shell_builtins[65]
-#define UMASK_BUILTIN               shell_builtins[66]
-#define UNALIAS_BUILTIN             shell_builtins[67]
-#define UNLIMIT_BUILTIN             shell_builtins[68]
-#define UNSET_BUILTIN               shell_builtins[69]
-#define UNSETENV_BUILTIN            shell_builtins[70]
-#define VER_BUILTIN                 shell_builtins[71]
-#define WAIT_BUILTIN                shell_builtins[72]
-#define WHENCE_BUILTIN              shell_builtins[73]
+#define MAPFILE_BUILTIN             shell_builtins[38]
+#define MEMUSAGE_BUILTIN            shell_builtins[39]
+#define NEWGRP_BUILTIN              shell_builtins[40]
+#define NICE_BUILTIN                shell_builtins[41]
+#define NOHUP_BUILTIN               shell_builtins[42]
+#define NOTIFY_BUILTIN              shell_builtins[43]
+#define PARALLEL_BUILTIN            shell_builtins[44]
+#define POPD_BUILTIN                shell_builtins[45]
+#define PRINTENV_BUILTIN            shell_builtins[46]
+#define PRINTF_BUILTIN              shell_builtins[47]
+#define PUSHD_BUILTIN               shell_builtins[48]
+#define PWD_BUILTIN                 shell_builtins[49]
+#define READ_BUILTIN                shell_builtins[50]
+#define READARRAY_BUILTIN           shell_builtins[51]
+#define READONLY_BUILTIN            shell_builtins[52]
+#define RECHO_BUILTIN               shell_builtins[53]
+#define REPEAT_BUILTIN              shell_builtins[54]
+#define RETURN_BUILTIN              shell_builtins[55]
+#define SET_BUILTIN                 shell_builtins[56]
+#define SETENV_BUILTIN              shell_builtins[57]
+#define SETX_BUILTIN                shell_builtins[58]
+#define SHIFT_BUILTIN               shell_builtins[59]
+#define SHOPT_BUILTIN               shell_builtins[60]
+#define SOURCE_BUILTIN              shell_builtins[61]
+#define STOP_BUILTIN                shell_builtins[62]
+#define SUSPEND_BUILTIN             shell_builtins[63]
+#define TEST3_BUILTIN               shell_builtins[64]
+#define TIMES_BUILTIN               shell_builtins[65]
+#define TRAP_BUILTIN                shell_builtins[66]
+#define TRUE_BUILTIN                shell_builtins[67]
+#define TYPE_BUILTIN                shell_builtins[68]
+#define TYPESET_BUILTIN             shell_builtins[69]
+#define ULIMIT_BUILTIN              shell_builtins[70]
+#define UMASK_BUILTIN               shell_builtins[71]
+#define UNALIAS_BUILTIN             shell_builtins[72]
+#define UNLIMIT_BUILTIN             shell_builtins[73]
+#define UNSET_BUILTIN               shell_builtins[74]
+#define UNSETENV_BUILTIN            shell_builtins[75]
+#define VER_BUILTIN                 shell_builtins[76]
+#define WAIT_BUILTIN                shell_builtins[77]
+#define WHENCE_BUILTIN              shell_builtins[78]
 
 
 #endif
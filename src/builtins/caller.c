@@ -28,8 +28,9 @@
 /*
  * In this file, we handle the call stack. we don't actually implement a
  * full-blown call stack for function calls in here, we simply store the function
- * name, the name of the file in which the function was defined, and a pointer
- * to the previous function in the call stack (see the definition of 
+ * name, the name of the file in which the function was defined, the function's
+ * positional parameters (see params.c), and a pointer to the previous function
+ * in the call stack (see the definition of 
  * 'struct callframe_s' in ../cmd.h). The stack itself is a simple linked list.
  * The top of the stack represents the last function call (the function that is
  * currently executing), while the bottom of the stack is always the 'main'
@@ -57,6 +58,7 @@ struct callframe_s *callframe_new(char *funcname, char *srcfile, int lineno)
     cf->funcname = funcname ? get_malloced_str(funcname) : NULL;
     cf->srcfile  = srcfile ? get_malloced_str(srcfile) : NULL;
     cf->lineno   = lineno;
+    cf->pos_params = NULL;
     cf->prev     = NULL;
     return cf;
 }
@@ -159,6 +161,8 @@ void callframe_popf(void)
         free_malloced_str(cf->srcfile );
     }
     
+    /* and the function's (or dot script's) positional parameters */
+    free_local_pos_params(cf);
     free(cf);
 }
 
@@ -161,13 +161,13 @@ int coproc_builtin(struct source_s *src, struct node_s *cmd, struct node_s *copr
          */
         if(!option_set('T'))
         {
-            reset_trap("DEBUG");
-            reset_trap("RETURN");
+            reset_trap(DEBUG_TRAP_NUM);
+            reset_trap(RETURN_TRAP_NUM);
         }
         
         if(!option_set('E'))
         {
-            reset_trap("ERR");
+            reset_trap(ERR_TRAP_NUM);
         }
         
         /*
@@ -37,6 +37,7 @@
 void   purge_table(struct symtab_s *symtab, struct alpha_list_s *list, int flags);
 void   do_print_var(struct symtab_entry_s *entry, struct alpha_list_s *list, int print_formal);
 void   do_print_funcdef(struct symtab_entry_s *entry);
+static char *array_to_str(struct array_s *arr);
 
 
 /*
@@ -101,6 +102,8 @@ int do_declare(int argc, char **argv, int global)
     int print_flags = FLAG_PRINT_FUNCDEF | (global ? 0 : FLAG_PRINT_LOCAL);
     /* print values, unless a flag such as -i, -l, -r, -t, -u, -x is supplied */
     int print = 1;
+    /* make variables indexed (-a) or associative (-A) arrays */
+    enum symbol_type array_type = SYM_STR;
     
     /*
      * Process the options manually. We don't call parse_args() because we don't
@@ -136,6 +139,16 @@ int do_declare(int argc, char **argv, int global)
             {
                 switch(*p)
                 {
+                    case 'a':               /* make indexed arrays */
+                        array_type = plus ? SYM_STR : SYM_ARRAY;
+                        print = 0;
+                        break;
+
+                    case 'A':               /* make associative arrays */
+                        array_type = plus ? SYM_STR : SYM_ASSOC;
+                        print = 0;
+                        break;
+
                     case 'f':               /* restrict output to function names and definitions */
                         funcs = !plus;
                         print_flags |= FLAG_PRINT_FORMAL;
@@ -252,12 +265,15 @@ int do_declare(int argc, char **argv, int global)
     {
         /* is this a "name=value" string? */
         char *arg = argv[v];
-        char *equals = strchr(arg, '=');
+        char *equals = get_assignment_eq(arg) ? : strchr(arg, '=');
 
         /* if yes, get the value part */
         struct symtab_entry_s *entry;
         char *val = equals ? equals+1 : NULL;
         int append = (equals && equals[-1] == '+');
+
+        /* is it an array assignment of the form name[sub]=value or name=(...)? */
+        int array_assign = !funcs && is_array_assignment(arg);
     
         /* and the name part */
         size_t name_len = equals ? (size_t)(equals-arg) : strlen(arg);
@@ -270,6 +286,13 @@ int do_declare(int argc, char **argv, int global)
         {
             name_buf[name_len-1] = '\0';
         }
+
+        /* remove the subscript from the name */
+        char *sub_start = strchr(name_buf, '[');
+        if(array_assign && sub_start)
+        {
+            *sub_start = '\0';
+        }
         
         if(equals == arg)
         {
@@ -313,12 +336,38 @@ int do_declare(int argc, char **argv, int global)
         else
         {
             int flags = SET_FLAG_FORCE_NEW | (global ? SET_FLAG_GLOBAL : 0) |
-                        (append ? SET_FLAG_APPEND : 0);
+                        ((append && !array_assign) ? SET_FLAG_APPEND : 0);
 
-            if(do_set(name_buf, val, set_flags, unset_flags, flags) == NULL)
+            /* array assignments are performed after we set the attributes */
+            if((entry = do_set(name_buf, array_assign ? NULL : val,
+                               set_flags, unset_flags, flags)) == NULL)
             {
                 /* do_set() should have printed the error message */
                 res = 1;
+                continue;
+            }
+
+            if(array_type != SYM_STR)
+            {
+                if(entry->array && entry->val_type != array_type)
+                {
+                    PRINT_ERROR(utility, "cannot convert %s array `%s` to %s array",
+                                (entry->val_type == SYM_ASSOC) ? "associative" : "indexed", name_buf,
+                                (array_type == SYM_ASSOC) ? "associative" : "indexed");
+                    res = 1;
+                    continue;
+                }
+
+                if(!symtab_entry_make_array(entry, array_type == SYM_ASSOC))
+                {
+                    res = 1;
+                    continue;
+                }
+            }
+
+            if(array_assign && !do_array_assignment(entry, arg))
+            {
+                res = 1;
             }
         }
     }
@@ -516,6 +565,10 @@ void do_print_var(struct symtab_entry_s *entry, struct alpha_list_s *list, int p
         {
             sprintf(p2, "-f ");
         }
+        else if(entry->val_type == SYM_ARRAY || entry->val_type == SYM_ASSOC)
+        {
+            sprintf(p2, "-%c ", (entry->val_type == SYM_ARRAY) ? 'a' : 'A');
+        }
         else if(j == 0)
         {
             /*
@@ -528,7 +581,16 @@ void do_print_var(struct symtab_entry_s *entry, struct alpha_list_s *list, int p
     }
     
     /* if the entry is not a function, print the value */
-    if(entry->val_type == SYM_STR && entry->val)
+    if(entry->array)
+    {
+        char *val = array_to_str(entry->array);
+        p2 = alpha_list_make_str("%s%s=%s", prefix, entry->name, val ? val : "()");
+        if(val)
+        {
+            free(val);
+        }
+    }
+    else if(entry->val_type == SYM_STR && entry->val)
     {
         char *val = quote_val(entry->val, 1, 0);
         if(val)
@@ -562,6 +624,83 @@ void do_print_var(struct symtab_entry_s *entry, struct alpha_list_s *list, int p
 }
 
 
+/*
+ * Return a string representation of the array's elements, in the compound
+ * assignment format that can be used as input to the shell, i.e.
+ * ([index]="value" ...).
+ *
+ * Returns the malloc'd string, or NULL if we have insufficient memory.
+ */
+static char *array_to_str(struct array_s *arr)
+{
+    size_t pos = 0, len = 1, size = 64;
+    long index;
+    char *key, *val, *str = malloc(size), buf[32];
+    int assoc = flag_set(arr->flags, ARRAY_FLAG_ASSOC);
+
+    if(!str)
+    {
+        return NULL;
+    }
+    strcpy(str, "(");
+
+    while((val = array_next(arr, &pos, &index, &key)))
+    {
+        char *qkey = NULL, *qval = quote_val(val, 1, 0);
+        if(assoc)
+        {
+            /* quote keys that contain special chars */
+            qkey = strpbrk(key, " \t\n\"'\\$`[]=") ? quote_val(key, 1, 0) : NULL;
+        }
+        else
+        {
+            sprintf(buf, "%ld", index);
+        }
+
+        char *k = qkey ? qkey : assoc ? key : buf;
+        size_t need = len + strlen(k) + (qval ? strlen(qval) : 2) + 6;
+        if(need > size)
+        {
+            while(need > size)
+            {
+                size <<= 1;
+            }
+
+            char *str2 = realloc(str, size);
+            if(!str2)
+            {
+                free(str);
+                str = NULL;
+            }
+            str = str2;
+        }
+
+        if(str)
+        {
+            len += sprintf(str+len, "%s[%s]=%s", (len > 1) ? " " : "", k, qval ? qval : "\"\"");
+        }
+
+        if(qkey)
+        {
+            free(qkey);
+        }
+
+        if(qval)
+        {
+            free(qval);
+        }
+
+        if(!str)
+        {
+            return NULL;
+        }
+    }
+
+    strcpy(str+len, ")");
+    return str;
+}
+
+
 void do_print_funcdef(struct symtab_entry_s *entry)
 {
     if(entry->val)
@@ -37,6 +37,41 @@
  * explanation on how to use this utility.
  */
 
+/*
+ * Print the command line editor's output statistics, that is, how many bytes and
+ * write() calls the editor needed per keystroke since the shell started. This is
+ * useful for benchmarking screen redraws by replaying the same keystrokes on
+ * a terminal, then calling `dump redraw`.
+ */
+void dump_redraw_stats(void)
+{
+    unsigned long keys = redraw_stats.keys ? redraw_stats.keys : 1;
+    printf("keystrokes:  %lu\n", redraw_stats.keys);
+    printf("write calls: %lu (%.2f per keystroke)\n", redraw_stats.writes,
+           (double)redraw_stats.writes/keys);
+    printf("bytes:       %lu (%.2f per keystroke)\n", redraw_stats.bytes,
+           (double)redraw_stats.bytes/keys);
+}
+
+
+/*
+ * Print the statistics of the ring buffer the SIGCHLD handler uses to pass child
+ * statuses to the shell, that is, how many statuses were passed, how many didn't
+ * fit in the ring (and were collected later by calling waitpid()), and how full
+ * the ring has been.
+ */
+void dump_child_stats(void)
+{
+    struct child_event_stats_s stats;
+    get_child_event_stats(&stats);
+    printf("events:      %lu\n", stats.events);
+    printf("overflowed:  %lu\n", stats.dropped);
+    printf("ring size:   %lu\n", stats.size);
+    printf("max used:    %lu\n", stats.max_used);
+    printf("pending:     %lu\n", stats.pending);
+}
+
+
 int dump_builtin(int argc, char **argv)
 {
     int v = 1;
@@ -75,6 +110,14 @@ int dump_builtin(int argc, char **argv)
         {
             purge_vars(NULL, "dump", 0, 0);
         }
+        else if(strcmp(arg, "redraw") == 0)
+        {
+            dump_redraw_stats();
+        }
+        else if(strcmp(arg, "children") == 0)
+        {
+            dump_child_stats();
+        }
     }
     return 0;
 }
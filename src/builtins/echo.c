@@ -190,7 +190,7 @@ void do_echo(int v, int argc, char **argv, int flags)
         }
         else
         {
-            printf("%c", separator);
+            putchar(separator);
         }
 
         /* are escape sequences allowed? */
@@ -199,7 +199,7 @@ void do_echo(int v, int argc, char **argv, int flags)
             char *str = ansic_expand(argv[v]);
             if(str)
             {
-                printf("%s", str);
+                fputs(str, stdout);
                 free(str);
                 /*
                  * we have no way of knowing if ansic_expand() encountered the \c
@@ -214,13 +214,13 @@ void do_echo(int v, int argc, char **argv, int flags)
             }
             else
             {
-                printf("%s", argv[v]);
+                fputs(argv[v], stdout);
             }
         }
         /* print the arg as-is, without processing for possible escape sequences */
         else
         {
-            printf("%s", argv[v]);
+            fputs(argv[v], stdout);
         }
 
         /* the '\c' escape sequence terminates processing */
@@ -247,5 +247,5 @@ void do_echo(int v, int argc, char **argv, int flags)
         putchar(separator);
     }
     
-    fflush(stdout);
+    /* our output is flushed when we return (see do_builtin_internal()) */
 }
@@ -22,9 +22,122 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
 #include "builtins.h"
 #include "../include/cmd.h"
 #include "../backend/backend.h"
+#include "setx.h"
+#include "../parser/node.h"
+
+/*
+ * Scripts often eval the same strings over and over again, e.g. in loops. To
+ * avoid tokenizing and parsing the same string every time, we keep the nodetrees
+ * of the most recently eval'd strings in a small cache. An entry is only valid
+ * if the aliases haven't changed since we parsed the string, as alias
+ * substitution is done by the parser. When the cache is full, we evict the least
+ * recently used entry that isn't being executed.
+ */
+struct eval_cache_s eval_cache[EVAL_CACHE_SIZE];
+struct eval_cache_stats_s eval_cache_stats = { 0, 0, 0 };
+
+/* defined in string_hash.c */
+extern const uint32_t fnv1a_seed;
+extern uint32_t fnv1a(char *text, uint32_t hash);
+
+/* incremented every time we use a cache entry */
+static unsigned long eval_clock = 0;
+
+
+/*
+ * Free the cache entry's string and nodetrees.
+ */
+static void free_eval_cache_entry(struct eval_cache_s *entry)
+{
+    free(entry->str);
+    free_cmd_trees(entry->trees);
+    entry->str   = NULL;
+    entry->trees = NULL;
+}
+
+
+/*
+ * Search the cache for the given string, which was parsed while aliases were
+ * (or weren't) expanded, as indicated by 'aliases'.
+ *
+ * Returns the cache entry, or NULL if the string is not in the cache (or if
+ * the aliases changed since we parsed it).
+ */
+static struct eval_cache_s *eval_cache_lookup(char *str, uint32_t hash, int aliases)
+{
+    int i;
+    for(i = 0; i < EVAL_CACHE_SIZE; i++)
+    {
+        struct eval_cache_s *entry = &eval_cache[i];
+        if(entry->str && entry->hash == hash && entry->aliases == aliases &&
+           entry->alias_gen == alias_generation && strcmp(entry->str, str) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Add the given string and its nodetrees to the cache. If there is no free
+ * entry, we evict the least recently used entry. If all the entries are being
+ * executed, the nodetrees are freed.
+ */
+static void eval_cache_add(char *str, uint32_t hash, int aliases, struct node_s *trees)
+{
+    struct eval_cache_s *entry = NULL;
+    int i;
+    for(i = 0; i < EVAL_CACHE_SIZE; i++)
+    {
+        struct eval_cache_s *e = &eval_cache[i];
+        if(e->busy)
+        {
+            continue;
+        }
+
+        if(!e->str)
+        {
+            entry = e;
+            break;
+        }
+
+        /* entries parsed with old aliases are useless */
+        if(e->alias_gen != alias_generation)
+        {
+            free_eval_cache_entry(e);
+            entry = e;
+            break;
+        }
+
+        if(!entry || e->last_used < entry->last_used)
+        {
+            entry = e;
+        }
+    }
+
+    if(entry && entry->str)
+    {
+        free_eval_cache_entry(entry);
+        eval_cache_stats.evictions++;
+    }
+
+    if(!entry || !(entry->str = strdup(str)))
+    {
+        free_cmd_trees(trees);
+        return;
+    }
+
+    entry->hash      = hash;
+    entry->alias_gen = alias_generation;
+    entry->aliases   = aliases;
+    entry->last_used = ++eval_clock;
+    entry->trees     = trees;
+}
 
 
 /*
@@ -72,11 +185,68 @@ int eval_builtin(int argc, char **argv)
     src.srcname  = NULL;
     src.curline  = 1;
 
+    /*
+     * don't use the cache if the commands should be echoed, saved to the
+     * history list, or not executed at all, as these happen while parsing.
+     */
+    int use_cache = !option_set('v') && !option_set('n') && !option_set('d') &&
+                    !option_set('t') && !optionx_set(OPTION_SAVE_HIST);
+    int aliases = interactive_shell || optionx_set(OPTION_EXPAND_ALIASES);
+    uint32_t hash = 0;
+    struct eval_cache_s *entry = NULL;
+
+    if(use_cache)
+    {
+        hash = fnv1a(cmd, fnv1a_seed);
+        entry = eval_cache_lookup(cmd, hash, aliases);
+    }
+
     /* add a new entry to the callframe stack to reflect the new scope we're entering */
     callframe_push(callframe_new(argv[1], src.srcname, src.curline));
 
     /* execute the commands */
-    parse_and_execute(&src);
+    if(entry)
+    {
+        /* we've parsed this string before */
+        eval_cache_stats.hits++;
+        entry->last_used = ++eval_clock;
+        entry->busy++;
+        execute_cmd_trees(&src, entry->trees);
+        entry->busy--;
+    }
+    else if(use_cache)
+    {
+        eval_cache_stats.misses++;
+        unsigned long alias_gen = alias_generation;
+        struct node_s *trees = NULL, *tree;
+        parse_and_execute_keep(&src, &trees);
+
+        /*
+         * don't cache the string if the commands changed the aliases (which
+         * would affect how we parse the string), or if they define functions
+         * (the function definitions take their bodies from the nodetree).
+         */
+        for(tree = trees; tree; tree = tree->next_sibling)
+        {
+            if(has_node_type(tree, NODE_FUNCTION))
+            {
+                break;
+            }
+        }
+
+        if(trees && !tree && alias_gen == alias_generation)
+        {
+            eval_cache_add(cmd, hash, aliases, trees);
+        }
+        else
+        {
+            free_cmd_trees(trees);
+        }
+    }
+    else
+    {
+        parse_and_execute(&src);
+    }
 
     /* pop the callframe entry we've added to the stack */
     callframe_popf();
@@ -129,7 +129,7 @@ int exec_builtin(int argc, char **argv)
     /* replace arg[0] with the argument we were given with the -a option */
     if(arg0)
     {
-        free_malloced_str(argv[v]);
+        /* the old argument is freed by our caller (see free_argv() in backend.c) */
         argv[v] = get_malloced_str(arg0);
     }
 
@@ -148,7 +148,11 @@ int exec_builtin(int argc, char **argv)
         }
         
         sprintf(l, "-%s", argv[v]);
-        free_malloced_str(argv[v]);
+        if(arg0)
+        {
+            /* free the string we stored above */
+            free_malloced_str(argv[v]);
+        }
         argv[v] = get_malloced_str(l);
         free(l);
     }
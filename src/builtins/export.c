@@ -150,7 +150,7 @@ int process_var_attribs(char **args, int unexport, int funcs, int flag)
     {
         /* check if arg contains an equal sign */
         char *arg = *p;
-        char *equals  = strchr(arg, '=');
+        char *equals  = get_assignment_eq(arg) ? : strchr(arg, '=');
         
         /*
          *  Get the variable/function name. If there is an equal sign, the
@@ -170,6 +170,14 @@ int process_var_attribs(char **args, int unexport, int funcs, int flag)
             name_len--;
         }
 
+        /* remove the subscript of an array assignment from the name */
+        int array_assign = is_array_assignment(arg);
+        char *sub_start = strchr(name_buf, '[');
+        if(array_assign && sub_start)
+        {
+            *sub_start = '\0';
+        }
+
         if(!is_name(name_buf))
         {
             PRINT_ERROR(utility, "invalid name: %s", name_buf);
@@ -237,7 +245,20 @@ int process_var_attribs(char **args, int unexport, int funcs, int flag)
             {
                 /* get the value part */
                 char *val = equals ? equals+1 : NULL;
-                if(do_set(name_buf, val, flag, 0, append) == NULL)
+                if(array_assign)
+                {
+                    /* assign the array before it becomes readonly */
+                    struct symtab_entry_s *entry = do_set(name_buf, NULL, 0, 0, 0);
+                    if(!entry || !do_array_assignment(entry, arg))
+                    {
+                        res = 1;
+                    }
+                    else
+                    {
+                        entry->flags |= flag;
+                    }
+                }
+                else if(do_set(name_buf, val, flag, 0, append) == NULL)
                 {
                     res = 1;
                 }
@@ -122,7 +122,7 @@ int getopts_builtin(int argc, char **argv)
     /* no args? use positional params instead */
     if(argsc == 1)
     {
-        int count = get_shell_vari("#", 0);
+        int count = pos_param_count();
         /* we don't have any positional parameters. bail out */
         if(count <= 0)
         {
@@ -152,8 +152,7 @@ int getopts_builtin(int argc, char **argv)
             int i = 1;
             for( ; i <= count; i++)
             {
-                sprintf(buf, "%d", i);
-                args[i] = get_shell_varp(buf, "");
+                args[i] = get_pos_param(i);
             }
             
             /* NULL-terminate the array */
@@ -0,0 +1,373 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2024 (c)
+ *
+ *    file: mapfile.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "builtins.h"
+#include "../include/cmd.h"
+#include "../symtab/symtab.h"
+#include "../parser/parser.h"
+#include "../include/debug.h"
+
+#define UTILITY             "mapfile"
+
+/* size of the blocks we read from the input file */
+#define MAPFILE_BUFSZ       (64*1024)
+
+/* default number of lines between calls to the -C callback */
+#define DEFAULT_QUANTUM     5000
+
+
+#define CHECK_OPTION_HAS_ARG(c)                                 \
+if(!internal_optarg || internal_optarg == INVALID_OPTARG)       \
+{                                                               \
+    OPTION_REQUIRES_ARG_ERROR(UTILITY, c);                      \
+    return 2;                                                   \
+}
+
+
+/*
+ * Get the numeric argument of an option. The number can't be negative.
+ *
+ * Returns 1 on success, 0 if the argument is invalid.
+ */
+static int get_count(char *str, long *count)
+{
+    char *strend;
+    *count = strtol(str, &strend, 10);
+    if(*strend || strend == str || *count < 0)
+    {
+        PRINT_ERROR(UTILITY, "invalid count: %s", str);
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * Call the callback function (given to the -C option) with the index of the
+ * array element that is about to be assigned, and the element's value, as
+ * arguments (bash).
+ */
+static void do_callback(char *callback, long index, char *line)
+{
+    char buf[32];
+    char *val = quote_val(line, 1, 0);
+    sprintf(buf, "%ld", index);
+    do_builtin_internal(eval_builtin, 4,
+                        (char *[]){ "eval", callback, buf, val ? val : "\"\"", NULL });
+    if(val)
+    {
+        free(val);
+    }
+}
+
+
+/*
+ * The mapfile (and readarray) builtin utility (non-POSIX). Used to read lines
+ * from a file into an indexed array.
+ *
+ * Instead of reading one byte at a time, as the read builtin does, we read the
+ * input in large blocks and search each block for the delimiter with memchr(),
+ * which is much faster when loading large files. If we are asked to read a
+ * limited number of lines (the -n option), we must not consume input beyond the
+ * last line we read. If the input file is seekable, we seek back to the end of
+ * the last line when we're done. Otherwise, we read one byte at a time.
+ *
+ * Returns 0 on success, non-zero otherwise.
+ *
+ * See the manpage for the list of options and an explanation of what each option does.
+ * You can also run: `help mapfile` or `mapfile -h` from lsh prompt to see a short
+ * explanation on how to use this utility.
+ */
+
+int mapfile_builtin(int argc, char **argv)
+{
+    int v = 1, c;
+    int infd = 0, trim = 0;
+    char delim = '\n';
+    long max = 0, skip = 0, origin = -1, quantum = DEFAULT_QUANTUM;
+    char *callback = NULL, *strend;
+    char *name = "MAPFILE";
+
+    /****************************
+     * process the options
+     ****************************/
+    while((c = parse_args(argc, argv, "hvd:n:O:s:tu:C:c:", &v,
+                          FLAG_ARGS_ERREXIT|FLAG_ARGS_PRINTERR)) > 0)
+    {
+        switch(c)
+        {
+            case 'h':
+                print_help(argv[0], strcmp(argv[0], "readarray") == 0 ?
+                                    &READARRAY_BUILTIN : &MAPFILE_BUILTIN, 0);
+                return 0;
+
+            case 'v':
+                printf("%s", shell_ver);
+                return 0;
+
+            /* read upto the 1st char of internal_optarg, instead of newline */
+            case 'd':
+                CHECK_OPTION_HAS_ARG(c);
+                delim = *internal_optarg;
+                break;
+
+            /* max. number of lines to read */
+            case 'n':
+                CHECK_OPTION_HAS_ARG(c);
+                if(!get_count(internal_optarg, &max))
+                {
+                    return 2;
+                }
+                break;
+
+            /* the index at which we start assigning elements */
+            case 'O':
+                CHECK_OPTION_HAS_ARG(c);
+                if(!get_count(internal_optarg, &origin))
+                {
+                    return 2;
+                }
+                break;
+
+            /* number of lines to discard */
+            case 's':
+                CHECK_OPTION_HAS_ARG(c);
+                if(!get_count(internal_optarg, &skip))
+                {
+                    return 2;
+                }
+                break;
+
+            /* remove the delimiter from each line */
+            case 't':
+                trim = 1;
+                break;
+
+            /* alternate input file */
+            case 'u':
+                CHECK_OPTION_HAS_ARG(c);
+                infd = strtol(internal_optarg, &strend, 10);
+                if(*strend || fcntl(infd, F_GETFD, 0) == -1)
+                {
+                    PRINT_ERROR(UTILITY, "invalid file descriptor: %s", internal_optarg);
+                    return 2;
+                }
+                break;
+
+            /* function to call every quantum lines */
+            case 'C':
+                CHECK_OPTION_HAS_ARG(c);
+                callback = internal_optarg;
+                break;
+
+            /* number of lines between callback calls */
+            case 'c':
+                CHECK_OPTION_HAS_ARG(c);
+                if(!get_count(internal_optarg, &quantum) || quantum == 0)
+                {
+                    return 2;
+                }
+                break;
+        }
+    }
+
+    /* unknown option */
+    if(c == -1)
+    {
+        return 2;
+    }
+
+    if(v < argc)
+    {
+        name = argv[v];
+    }
+
+    if(!is_name(name))
+    {
+        PRINT_ERROR(UTILITY, "invalid array name: %s", name);
+        return 2;
+    }
+
+    /* get the array */
+    struct symtab_entry_s *entry = get_symtab_entry(name);
+    if(!entry && !(entry = add_to_symtab(name)))
+    {
+        return 1;
+    }
+
+    if(flag_set(entry->flags, FLAG_READONLY))
+    {
+        READONLY_ASSIGN_ERROR(UTILITY, name, "variable");
+        return 1;
+    }
+
+    if(entry->val_type == SYM_ASSOC)
+    {
+        PRINT_ERROR(UTILITY, "%s: not an indexed array", name);
+        return 1;
+    }
+
+    struct array_s *arr = symtab_entry_make_array(entry, 0);
+    if(!arr)
+    {
+        return 1;
+    }
+
+    /* unless we have an origin, the array is cleared before we assign to it */
+    if(origin < 0)
+    {
+        array_clear(arr);
+        origin = 0;
+    }
+
+    /*
+     * If we're reading a limited number of lines from an unseekable file, read
+     * one byte at a time so we don't consume any input after the last line.
+     */
+    int seekable = (lseek(infd, 0, SEEK_CUR) != -1);
+    size_t bufsz = (max && !seekable) ? 1 : MAPFILE_BUFSZ;
+
+    /*
+     * The input buffer. We keep the partial line at the end of each block, and
+     * move it to the start of the buffer before reading the next block. The
+     * extra byte is for the '\0' we add after each line.
+     */
+    size_t size = MAPFILE_BUFSZ, len = 0;
+    char *buf = malloc(size+1);
+    if(!buf)
+    {
+        INSUFFICIENT_MEMORY_ERROR(UTILITY, "input buffer");
+        return 1;
+    }
+
+    long index = origin, lines = 0;
+    int eof = 0, res = 0;
+    size_t start = 0, scan = 0;
+
+    while(!max || lines < max+skip)
+    {
+        char *p = memchr(buf+scan, delim, len-scan);
+        size_t end;
+
+        if(p)
+        {
+            end = p-buf+1;
+        }
+        else if(!eof)
+        {
+            /* no complete line in the buffer, move the partial line up and read more */
+            if(start)
+            {
+                memmove(buf, buf+start, len-start);
+                len  -= start;
+                start = 0;
+            }
+
+            if(len == size)
+            {
+                size_t newsz = size*2;
+                char *buf2 = realloc(buf, newsz+1);
+                if(!buf2)
+                {
+                    INSUFFICIENT_MEMORY_ERROR(UTILITY, "input buffer");
+                    res = 1;
+                    break;
+                }
+                buf  = buf2;
+                size = newsz;
+            }
+
+            scan = len;
+            ssize_t n = read(infd, buf+len, (bufsz == 1) ? 1 : size-len);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                PRINT_ERROR(UTILITY, "error reading input: %s", strerror(errno));
+                res = 1;
+                break;
+            }
+
+            if(n == 0)
+            {
+                eof = 1;
+            }
+            len += n;
+            continue;
+        }
+        else if(start < len)
+        {
+            /* the last line doesn't end in a delimiter */
+            end = len;
+        }
+        else
+        {
+            break;
+        }
+
+        /* we've got a line. skip it, or add it to the array */
+        if(lines++ >= skip)
+        {
+            char saved = buf[end];
+            size_t lineend = (trim && end > start && buf[end-1] == delim) ? end-1 : end;
+            buf[lineend] = '\0';
+
+            if(callback && (index-origin+1) % quantum == 0)
+            {
+                do_callback(callback, index, buf+start);
+
+                /* the callback might have changed the variable */
+                if(!(entry = get_symtab_entry(name)) || !(arr = symtab_entry_make_array(entry, 0)))
+                {
+                    res = 1;
+                    break;
+                }
+            }
+
+            if(!array_set(arr, index++, buf+start))
+            {
+                INSUFFICIENT_MEMORY_ERROR(UTILITY, "array element");
+                res = 1;
+                break;
+            }
+            buf[end] = saved;
+        }
+
+        start = scan = end;
+    }
+
+    /* give back the input we didn't use */
+    if(seekable && start < len)
+    {
+        lseek(infd, -(off_t)(len-start), SEEK_CUR);
+    }
+
+    free(buf);
+    return res;
+}
@@ -39,6 +39,7 @@ long long memusage_traps(long long *__res);
 long long memusage_aliases(long long *__res);
 long long memusage_history(long long *__res);
 long long memusage_dirstack(long long *res);
+long long memusage_eval_cache(long long *res);
 
 void print_mu_stack(int lengthy);
 void print_mu_hashtab(int lengthy);
@@ -50,6 +51,7 @@ void print_mu_cmdbuf(void);
 void print_mu_dirstack(int lengthy);
 void print_mu_vm(int lengthy);
 void print_mu_aliases(void);
+void print_mu_eval_cache(int lengthy);
 
 void output_size(long long __size);
 
@@ -122,6 +124,7 @@ int memusage_builtin(int argc, char **argv)
         print_mu_dirstack(lengthy);
         print_mu_aliases();
         print_mu_traps();
+        print_mu_eval_cache(lengthy);
         print_mu_inputbuf();
         print_mu_history();
         print_mu_cmdbuf();
@@ -172,6 +175,10 @@ int memusage_builtin(int argc, char **argv)
         {
             print_mu_aliases();
         }
+        else if(strcmp(arg, "eval") == 0)
+        {
+            print_mu_eval_cache(lengthy);
+        }
     }
     /* return success */
     return 0;
@@ -310,6 +317,32 @@ void print_mu_traps(void)
 }
 
 
+/*
+ * Print the memory used for the eval cache, and the cache's hit/miss counts.
+ */
+void print_mu_eval_cache(int lengthy)
+{
+    long long res[3];
+    long long i = memusage_eval_cache(res);
+    printf("* Parsed eval strings cache: ");
+    if(!lengthy)
+    {
+        output_size(i);
+        printf(" (%lu hits, %lu misses)\n", eval_cache_stats.hits, eval_cache_stats.misses);
+    }
+    else
+    {
+        printf("\n  - cached entries: %lld of %d", res[2], EVAL_CACHE_SIZE);
+        printf("\n  - eval strings: "); output_size(res[0]);
+        printf("\n  - nodetrees: "); output_size(res[1]);
+        printf("\n  - hits: %lu", eval_cache_stats.hits);
+        printf("\n  - misses: %lu", eval_cache_stats.misses);
+        printf("\n  - evictions: %lu", eval_cache_stats.evictions);
+        printf("\n");
+    }
+}
+
+
 /*
  * Print the memory used for the input buffer.
  */
@@ -566,6 +599,35 @@ long long memusage_node(struct node_s *node, long long *__res)
 }
 
 
+/*
+ * Calculate the memory used for the eval cache. res[0] is set to the memory
+ * used by the eval strings, res[1] to the memory used by the nodetrees, and
+ * res[2] to the number of cached strings.
+ */
+long long memusage_eval_cache(long long *res)
+{
+    int i;
+    res[0] = 0;
+    res[1] = 0;
+    res[2] = 0;
+    for(i = 0; i < EVAL_CACHE_SIZE; i++)
+    {
+        struct node_s *tree;
+        if(!eval_cache[i].str)
+        {
+            continue;
+        }
+        res[0] += strlen(eval_cache[i].str)+1;
+        for(tree = eval_cache[i].trees; tree; tree = tree->next_sibling)
+        {
+            res[1] += memusage_node(tree, NULL);
+        }
+        res[2]++;
+    }
+    return res[0]+res[1];
+}
+
+
 /*
  * Calculate the memory used for the trap strings.
  */
@@ -0,0 +1,763 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2024 (c)
+ *
+ *    file: parallel.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* required macro definition for sig*() functions */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include "builtins.h"
+#include "../include/cmd.h"
+#include "../include/sig.h"
+#include "../include/dstring.h"
+#include "../backend/backend.h"
+#include "../symtab/symtab.h"
+#include "../include/debug.h"
+
+#define UTILITY             "parallel"
+
+/* max number of children we run at the same time */
+#define MAX_PARALLEL_JOBS   512
+
+/* the array in which we save the exit status of each item */
+#define STATUS_ARRAY_NAME   "PARALLEL_STATUS"
+
+
+/*
+ * A slot holds a running child process. If the output is to be kept in order
+ * (the -k option), the child's stdout is connected to a pipe, and the slot is
+ * not free until the child has exited and we have read all of its output.
+ */
+struct slot_s
+{
+    pid_t pid;      /* the child's pid, 0 if the child has been reaped */
+    int   fd;       /* the read end of the child's output pipe, -1 if closed */
+    long  item;     /* the index of the item the child is working on */
+};
+
+/* the output of an item, saved until all the items before it are output */
+struct result_s
+{
+    struct dstring_s out;
+    int    done;
+};
+
+struct pool_s
+{
+    struct slot_s   *slots;
+    int             *free_slots;    /* stack of free slot indices */
+    int              nfree;
+    int              running;       /* number of slots in use */
+
+    /*
+     * Hash table that maps the pid of each running child to its slot, so that
+     * we can service a finished child without searching the slots.
+     */
+    pid_t           *map_pid;
+    int             *map_slot;
+    int              map_size;      /* power of 2 */
+
+    struct result_s *results;       /* only used with the -k option */
+    long             next_output;   /* the next item whose output we'll print */
+
+    struct array_s  *statuses;
+    long             failed;
+};
+
+
+/* dummy SIGCHLD handler, we only need the signal to interrupt pselect() */
+static void pool_SIGCHLD_handler(int signum)
+{
+    (void)signum;
+}
+
+
+static int map_index(struct pool_s *pool, pid_t pid)
+{
+    int i = (unsigned)pid & (pool->map_size-1);
+    while(pool->map_pid[i] && pool->map_pid[i] != pid)
+    {
+        i = (i+1) & (pool->map_size-1);
+    }
+    return i;
+}
+
+
+static void map_add(struct pool_s *pool, pid_t pid, int slot)
+{
+    int i = map_index(pool, pid);
+    pool->map_pid[i]  = pid;
+    pool->map_slot[i] = slot;
+}
+
+
+/*
+ * Return the slot of the child with the given pid, or -1 if the child is not
+ * one of ours.
+ */
+static int map_find(struct pool_s *pool, pid_t pid)
+{
+    int i = map_index(pool, pid);
+    return pool->map_pid[i] ? pool->map_slot[i] : -1;
+}
+
+
+/*
+ * Remove a pid from the hash table. Entries following the removed one are
+ * moved back, so that we don't need tombstones (the table is linearly probed).
+ */
+static void map_remove(struct pool_s *pool, pid_t pid)
+{
+    int mask = pool->map_size-1;
+    int i = map_index(pool, pid), j = i;
+    if(!pool->map_pid[i])
+    {
+        return;
+    }
+
+    while(1)
+    {
+        pool->map_pid[i] = 0;
+        while(1)
+        {
+            j = (j+1) & mask;
+            if(!pool->map_pid[j])
+            {
+                return;
+            }
+            int k = (unsigned)pool->map_pid[j] & mask;
+            /* move the entry at j back to i, unless its home lies cyclically in (i, j] */
+            if((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            {
+                continue;
+            }
+            break;
+        }
+        pool->map_pid[i]  = pool->map_pid[j];
+        pool->map_slot[i] = pool->map_slot[j];
+        i = j;
+    }
+}
+
+
+/*
+ * Read the items from the given file, one item per line.
+ *
+ * Returns the malloc'd items list, which is terminated by a NULL pointer. The
+ * items point into one buffer, which is returned in *buf. On error, NULL is
+ * returned.
+ */
+static char **read_items(int fd, char **buf, long *count)
+{
+    size_t size = 4096, len = 0;
+    char *b = malloc(size+1);
+    if(!b)
+    {
+        return NULL;
+    }
+
+    while(1)
+    {
+        if(len == size)
+        {
+            char *b2 = realloc(b, size*2+1);
+            if(!b2)
+            {
+                free(b);
+                return NULL;
+            }
+            b = b2;
+            size *= 2;
+        }
+
+        ssize_t n = read(fd, b+len, size-len);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)
+        {
+            break;
+        }
+        len += n;
+    }
+    b[len] = '\0';
+
+    long n = 0;
+    char *p;
+    for(p = b; p < b+len; p++)
+    {
+        if(*p == '\n')
+        {
+            n++;
+        }
+    }
+    if(len && b[len-1] != '\n')
+    {
+        n++;
+    }
+
+    char **items = malloc((n+1) * sizeof(char *));
+    if(!items)
+    {
+        free(b);
+        return NULL;
+    }
+
+    long i = 0;
+    for(p = b; p < b+len; i++)
+    {
+        char *nl = memchr(p, '\n', b+len-p);
+        items[i] = p;
+        if(!nl)
+        {
+            break;
+        }
+        *nl = '\0';
+        p = nl+1;
+    }
+    items[n] = NULL;
+    *buf = b;
+    *count = n;
+    return items;
+}
+
+
+/*
+ * Execute the command of an item in the child process. We never return.
+ */
+static void run_item(int cargc, char **cargv)
+{
+    struct builtin_s *builtin = is_builtin(cargv[0]);
+
+    if(strchr(cargv[0], '/') ||
+       (!(builtin && flag_set(builtin->flags, BUILTIN_ENABLED)) && !get_func(cargv[0])))
+    {
+        do_exec_cmd(cargc, cargv, NULL, NULL);
+
+        /* NOTE: we should NEVER come back here, unless there is error of course!! */
+        PRINT_ERROR(UTILITY, "failed to exec `%s`: %s", cargv[0], strerror(errno));
+        if(errno == ENOEXEC)
+        {
+            exit(EXIT_ERROR_NOEXEC);
+        }
+        if(errno == ENOENT)
+        {
+            exit(EXIT_ERROR_NOENT);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    /* a builtin or a function (functions need a source struct for the callframe) */
+    struct source_s src;
+    src.buffer   = cargv[0];
+    src.bufsize  = strlen(cargv[0]);
+    src.srctype  = SOURCE_FUNCTION;
+    src.curpos   = INIT_SRC_POS;
+    src.srcname  = NULL;
+    src.curline  = 1;
+    search_and_exec(&src, cargc, cargv, NULL, SEARCH_AND_EXEC_DOFUNC);
+
+    /* Execute the EXIT trap (if any) */
+    trap_handler(0);
+    exit(exit_status);
+}
+
+
+/*
+ * Print the output of the finished items, in the order of the items.
+ */
+static void output_results(struct pool_s *pool, long nitems)
+{
+    while(pool->next_output < nitems && pool->results[pool->next_output].done)
+    {
+        struct result_s *res = &pool->results[pool->next_output++];
+        if(res->out.buf_len)
+        {
+            fwrite(res->out.buf_base, 1, res->out.buf_len, stdout);
+            fflush(stdout);
+        }
+        free_str(&res->out);
+    }
+}
+
+
+/*
+ * Free a slot when its child has been reaped and its output pipe is closed.
+ */
+static void release_slot(struct pool_s *pool, int slot, long nitems)
+{
+    struct slot_s *s = &pool->slots[slot];
+    if(s->pid || s->fd >= 0)
+    {
+        return;
+    }
+
+    if(pool->results)
+    {
+        pool->results[s->item].done = 1;
+        output_results(pool, nitems);
+    }
+
+    pool->free_slots[pool->nfree++] = slot;
+    pool->running--;
+}
+
+
+/*
+ * Save the exit status of a finished child.
+ */
+static void child_exited(struct pool_s *pool, int slot, int status, long nitems)
+{
+    struct slot_s *s = &pool->slots[slot];
+    char buf[16];
+
+    if(WIFEXITED(status))
+    {
+        status = WEXITSTATUS(status);
+    }
+    else if(WIFSIGNALED(status))
+    {
+        status = WTERMSIG(status) + 128;
+    }
+
+    if(status)
+    {
+        pool->failed++;
+    }
+
+    sprintf(buf, "%d", status);
+    array_set(pool->statuses, s->item, buf);
+
+    map_remove(pool, s->pid);
+    s->pid = 0;
+    release_slot(pool, slot, nitems);
+}
+
+
+/*
+ * The parallel builtin utility (non-POSIX). Runs a command (which can be a shell
+ * function, a builtin or an external command) once for each input item, with
+ * at most N children running at the same time. The items are given on the
+ * command line after :::, or are read from standard input, one item per line.
+ * The item is passed as the last argument to the command, or replaces every {}
+ * argument if there is one.
+ *
+ * Returns 0 if all the items succeeded, otherwise the number of items that
+ * failed (101 if more than 100 items failed). The exit status of each item is
+ * saved in the PARALLEL_STATUS array.
+ *
+ * See the manpage for the list of options and an explanation of what each option does.
+ * You can also run: `help parallel` or `parallel -h` from lsh prompt to see a short
+ * explanation on how to use this utility.
+ */
+
+int parallel_builtin(int argc, char **argv)
+{
+    int v = 1, c, keep = 0;
+    long maxjobs = sysconf(_SC_NPROCESSORS_ONLN);
+    char *strend;
+
+    /****************************
+     * process the options
+     ****************************/
+    while((c = parse_args(argc, argv, "hvj:k", &v, FLAG_ARGS_ERREXIT|FLAG_ARGS_PRINTERR)) > 0)
+    {
+        switch(c)
+        {
+            case 'h':
+                print_help(argv[0], &PARALLEL_BUILTIN, 0);
+                return 0;
+
+            case 'v':
+                printf("%s", shell_ver);
+                return 0;
+
+            case 'j':
+                if(!internal_optarg || internal_optarg == INVALID_OPTARG)
+                {
+                    OPTION_REQUIRES_ARG_ERROR(UTILITY, c);
+                    return 2;
+                }
+                maxjobs = strtol(internal_optarg, &strend, 10);
+                if(*strend || maxjobs <= 0)
+                {
+                    PRINT_ERROR(UTILITY, "invalid number of jobs: %s", internal_optarg);
+                    return 2;
+                }
+                break;
+
+            case 'k':
+                keep = 1;
+                break;
+        }
+    }
+
+    /* unknown option */
+    if(c == -1)
+    {
+        return 2;
+    }
+
+    if(v >= argc || strcmp(argv[v], ":::") == 0)
+    {
+        MISSING_ARG_ERROR(UTILITY, "command name");
+        return 2;
+    }
+
+    if(maxjobs <= 0)
+    {
+        maxjobs = 1;
+    }
+    else if(maxjobs > MAX_PARALLEL_JOBS)
+    {
+        maxjobs = MAX_PARALLEL_JOBS;
+    }
+
+    /* get the command and the items */
+    int cargc = 0, braces = 0;
+    char **cargv = &argv[v];
+    while(v+cargc < argc && strcmp(cargv[cargc], ":::") != 0)
+    {
+        if(strcmp(cargv[cargc], "{}") == 0)
+        {
+            braces++;
+        }
+        cargc++;
+    }
+
+    char **items, *itembuf = NULL;
+    long nitems;
+    int items_from_stdin = (v+cargc >= argc);
+    if(items_from_stdin)
+    {
+        if(!(items = read_items(0, &itembuf, &nitems)))
+        {
+            INSUFFICIENT_MEMORY_ERROR(UTILITY, "reading items");
+            return 1;
+        }
+    }
+    else
+    {
+        items  = &argv[v+cargc+1];
+        nitems = argc-v-cargc-1;
+    }
+
+    /* the array in which we save the exit statuses */
+    struct symtab_entry_s *entry = get_symtab_entry(STATUS_ARRAY_NAME);
+    if(!entry)
+    {
+        entry = add_to_symtab(STATUS_ARRAY_NAME);
+    }
+
+    struct pool_s pool;
+    memset(&pool, 0, sizeof(struct pool_s));
+    if(!entry || !(pool.statuses = symtab_entry_make_array(entry, 0)))
+    {
+        if(itembuf)
+        {
+            free(itembuf);
+            free(items);
+        }
+        return 1;
+    }
+    array_clear(pool.statuses);
+
+    /* we don't need more slots than items */
+    if(maxjobs > nitems)
+    {
+        maxjobs = nitems ? nitems : 1;
+    }
+
+    pool.map_size = 1;
+    while(pool.map_size < maxjobs*2)
+    {
+        pool.map_size <<= 1;
+    }
+
+    /* the argument list we pass to each child */
+    int xargc = braces ? cargc : cargc+1;
+
+    pool.slots      = malloc(maxjobs * sizeof(struct slot_s));
+    pool.free_slots = malloc(maxjobs * sizeof(int));
+    pool.map_pid    = calloc(pool.map_size, sizeof(pid_t));
+    pool.map_slot   = malloc(pool.map_size * sizeof(int));
+    pool.results    = keep ? calloc(nitems ? nitems : 1, sizeof(struct result_s)) : NULL;
+    char **xargv    = malloc((xargc+1) * sizeof(char *));
+
+    int res = 0;
+    if(!pool.slots || !pool.free_slots || !pool.map_pid || !pool.map_slot ||
+       !xargv || (keep && !pool.results))
+    {
+        INSUFFICIENT_MEMORY_ERROR(UTILITY, "starting jobs");
+        res = 1;
+        goto fin;
+    }
+
+    for(c = 0; c < maxjobs; c++)
+    {
+        pool.slots[c].pid = 0;
+        pool.slots[c].fd  = -1;
+        pool.free_slots[c] = maxjobs-c-1;
+    }
+    pool.nfree = maxjobs;
+
+    /*
+     * We reap our children ourselves, with SIGCHLD blocked except while we're
+     * waiting in pselect(). The statuses of children that are not ours (such
+     * as background jobs) are handed over to notice_termination(), as our
+     * SIGCHLD handler would have done.
+     */
+    struct sigaction sigact, old_sigact;
+    sigset_t sigset, old_sigset;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigact.sa_handler = pool_SIGCHLD_handler;
+    sigaction(SIGCHLD, &sigact, &old_sigact);
+    SIGNAL_BLOCK(SIGCHLD, old_sigset);
+    sigset = old_sigset;
+    sigdelset(&sigset, SIGCHLD);
+
+    long next_item = 0;
+    int stop = 0;
+
+    while(1)
+    {
+        /* start as many items as we have free slots */
+        while(!stop && next_item < nitems && pool.nfree)
+        {
+            int slot = pool.free_slots[--pool.nfree], i;
+            struct slot_s *s = &pool.slots[slot];
+            int pipefd[2] = { -1, -1 };
+
+            for(i = 0; i < cargc; i++)
+            {
+                xargv[i] = (braces && strcmp(cargv[i], "{}") == 0) ? items[next_item] : cargv[i];
+            }
+            if(!braces)
+            {
+                xargv[i] = items[next_item];
+            }
+            xargv[xargc] = NULL;
+
+            if(keep && pipe(pipefd) == -1)
+            {
+                PRINT_ERROR(UTILITY, "failed to create pipe: %s", strerror(errno));
+                pool.free_slots[pool.nfree++] = slot;
+                stop = 1;
+                res = 1;
+                break;
+            }
+
+            pid_t pid = fork_child();
+            if(pid < 0)
+            {
+                PRINT_ERROR(UTILITY, "failed to fork: %s", strerror(errno));
+                if(keep)
+                {
+                    close(pipefd[0]);
+                    close(pipefd[1]);
+                }
+                pool.free_slots[pool.nfree++] = slot;
+                stop = 1;
+                res = 1;
+                break;
+            }
+            else if(pid == 0)
+            {
+                /* child process */
+                sigaction(SIGCHLD, &old_sigact, NULL);
+                sigprocmask(SIG_SETMASK, &old_sigset, NULL);
+                init_subshell();
+
+                /* unlike background jobs, our children can be interrupted with ^C */
+                set_signal_handler(SIGINT , SIG_DFL);
+                set_signal_handler(SIGQUIT, SIG_DFL);
+
+                if(keep)
+                {
+                    close(pipefd[0]);
+                    dup2(pipefd[1], 1);
+                    close(pipefd[1]);
+                }
+
+                /* we've read the items from stdin, there's nothing left there for the child */
+                if(items_from_stdin)
+                {
+                    int fd = open("/dev/null", O_RDONLY);
+                    if(fd > 0)
+                    {
+                        dup2(fd, 0);
+                        close(fd);
+                    }
+                }
+
+                run_item(xargc, xargv);
+            }
+
+            /* parent process */
+            if(keep)
+            {
+                close(pipefd[1]);
+                fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+            }
+            s->pid  = pid;
+            s->fd   = pipefd[0];
+            s->item = next_item++;
+            map_add(&pool, pid, slot);
+            pool.running++;
+        }
+
+        /* reap the children that have exited */
+        pid_t pid;
+        int status;
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            int slot = map_find(&pool, pid);
+            if(slot < 0)
+            {
+                notice_termination(pid, status, 1);
+            }
+            else
+            {
+                child_exited(&pool, slot, status, nitems);
+            }
+        }
+
+        if(!pool.running && (stop || next_item >= nitems))
+        {
+            break;
+        }
+
+        /* we can start another item */
+        if(!stop && next_item < nitems && pool.nfree)
+        {
+            continue;
+        }
+
+        /* wait for output or for a child to exit */
+        fd_set fds;
+        int maxfd = -1;
+        FD_ZERO(&fds);
+        if(keep)
+        {
+            for(c = 0; c < maxjobs; c++)
+            {
+                if(pool.slots[c].fd >= 0 && pool.slots[c].fd < FD_SETSIZE)
+                {
+                    FD_SET(pool.slots[c].fd, &fds);
+                    if(pool.slots[c].fd > maxfd)
+                    {
+                        maxfd = pool.slots[c].fd;
+                    }
+                }
+            }
+        }
+
+        if(pselect(maxfd+1, &fds, NULL, NULL, NULL, &sigset) < 0)
+        {
+            if(errno == EINTR && signal_received == SIGINT)
+            {
+                /* don't start any more items, but wait for the running ones */
+                stop = 1;
+                res = 128+SIGINT;
+            }
+            continue;
+        }
+
+        /*
+         * Collect the output of the children. Slot numbers have nothing to do with
+         * fd numbers, so check every slot.
+         */
+        for(c = 0; keep && c < maxjobs; c++)
+        {
+            struct slot_s *s = &pool.slots[c];
+            if(s->fd < 0 || s->fd >= FD_SETSIZE || !FD_ISSET(s->fd, &fds))
+            {
+                continue;
+            }
+
+            char buf[4096];
+            ssize_t n = read(s->fd, buf, sizeof(buf));
+            if(n > 0)
+            {
+                str_append(&pool.results[s->item].out, buf, n);
+            }
+            else if(n == 0 || errno != EINTR)
+            {
+                close(s->fd);
+                s->fd = -1;
+                release_slot(&pool, c, nitems);
+            }
+        }
+    }
+
+    SIGNAL_UNBLOCK(old_sigset);
+    sigaction(SIGCHLD, &old_sigact, NULL);
+
+    if(!res && pool.failed)
+    {
+        res = (pool.failed > 100) ? 101 : pool.failed;
+    }
+
+fin:
+    if(pool.results)
+    {
+        for( ; pool.next_output < nitems; pool.next_output++)
+        {
+            free_str(&pool.results[pool.next_output].out);
+        }
+        free(pool.results);
+    }
+    if(pool.slots)
+    {
+        free(pool.slots);
+    }
+    if(pool.free_slots)
+    {
+        free(pool.free_slots);
+    }
+    if(pool.map_pid)
+    {
+        free(pool.map_pid);
+    }
+    if(pool.map_slot)
+    {
+        free(pool.map_slot);
+    }
+    if(xargv)
+    {
+        free(xargv);
+    }
+    if(itembuf)
+    {
+        free(itembuf);
+        free(items);
+    }
+    return res;
+}
@@ -0,0 +1,730 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2024 (c)
+ *
+ *    file: printf.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "builtins.h"
+#include "../include/cmd.h"
+#include "../include/dstring.h"
+#include "../symtab/symtab.h"
+#include "../parser/parser.h"
+#include "../include/debug.h"
+
+#define UTILITY             "printf"
+
+/* flag returned by get_escape_char() when it finds the \c escape sequence */
+#define ESCAPE_STOP         256
+
+
+/*
+ * Output goes to stdout, unless the -v option is given, in which case it goes
+ * to this string buffer, to be assigned to the variable when we're done.
+ * Writes to stdout are buffered by stdio, and the buffer is flushed when the
+ * builtin returns (see do_builtin_internal()), so that each call to printf
+ * results in one write() call.
+ */
+static struct dstring_s *outvar = NULL;
+
+/* set if the \c escape sequence was found in a %b argument */
+static int stop_output = 0;
+
+/* the exit status (set to 1 if an argument couldn't be converted) */
+static int printf_res = 0;
+
+
+/*
+ * Output len bytes of str.
+ */
+static void out_str(char *str, size_t len)
+{
+    if(outvar)
+    {
+        str_append(outvar, str, len);
+    }
+    else
+    {
+        fwrite(str, 1, len, stdout);
+    }
+}
+
+
+/*
+ * Format and output the given value, using the printf-style format spec.
+ */
+static void out_fmt(char *spec, ...)
+{
+    va_list ap;
+    va_start(ap, spec);
+    if(outvar)
+    {
+        char buf[256];
+        va_list ap2;
+        va_copy(ap2, ap);
+        int len = vsnprintf(buf, sizeof(buf), spec, ap2);
+        va_end(ap2);
+        if(len < (int)sizeof(buf))
+        {
+            str_append(outvar, buf, len);
+        }
+        else
+        {
+            char *buf2 = malloc(len+1);
+            if(buf2)
+            {
+                vsnprintf(buf2, len+1, spec, ap);
+                str_append(outvar, buf2, len);
+                free(buf2);
+            }
+        }
+    }
+    else
+    {
+        vfprintf(stdout, spec, ap);
+    }
+    va_end(ap);
+}
+
+
+/*
+ * Convert the escape sequence starting at *s (the char after the backslash).
+ * If is_arg is non-zero, we are processing the argument of a %b conversion,
+ * where octal sequences are written as \0nnn and \c stops all output. In the
+ * format string, octal sequences are written as \nnn.
+ *
+ * Returns the converted char, or -1 if the sequence is not recognized (in which
+ * case the backslash is output as-is), or ESCAPE_STOP if we found \c. *s is
+ * updated to point to the char after the sequence.
+ */
+static int get_escape_char(char **s, int is_arg)
+{
+    char *p = *s;
+    int c = 0, i;
+
+    switch(*p)
+    {
+        case 'a' : c = '\a'  ; break;
+        case 'b' : c = '\b'  ; break;
+        case 'e' :
+        case 'E' : c = '\033'; break;
+        case 'f' : c = '\f'  ; break;
+        case 'n' : c = '\n'  ; break;
+        case 'r' : c = '\r'  ; break;
+        case 't' : c = '\t'  ; break;
+        case 'v' : c = '\v'  ; break;
+        case '\\': c = '\\'  ; break;
+        case '\'': c = '\''  ; break;
+        case '"' : c = '"'   ; break;
+
+        case 'c':
+            if(!is_arg)
+            {
+                return -1;
+            }
+            *s = p+1;
+            return ESCAPE_STOP;
+
+        case 'x':
+            /* up to two hex digits */
+            if(!isxdigit(p[1]))
+            {
+                return -1;
+            }
+            for(i = 0, p++; i < 2 && isxdigit(*p); i++, p++)
+            {
+                c = c*16 + (isdigit(*p) ? *p-'0' : tolower(*p)-'a'+10);
+            }
+            *s = p;
+            return c;
+
+        default:
+            if(*p < '0' || *p > '7')
+            {
+                return -1;
+            }
+            /* \0nnn in %b arguments, \nnn (or \0nnn) elsewhere */
+            if(is_arg && *p == '0')
+            {
+                p++;
+            }
+            for(i = 0; i < 3 && *p >= '0' && *p <= '7'; i++, p++)
+            {
+                c = c*8 + (*p-'0');
+            }
+            *s = p;
+            return c & 0xff;
+    }
+
+    *s = p+1;
+    return c;
+}
+
+
+/*
+ * Expand the escape sequences in the argument of a %b conversion.
+ *
+ * Returns the malloc'd expanded string, or NULL on insufficient memory.
+ * If we find the \c sequence, the string is cut short and stop_output is set.
+ */
+static char *expand_b_arg(char *arg, size_t *len)
+{
+    char *res = malloc(strlen(arg)+1), *p = res;
+    if(!res)
+    {
+        return NULL;
+    }
+
+    while(*arg)
+    {
+        if(*arg == '\\' && arg[1])
+        {
+            arg++;
+            int c = get_escape_char(&arg, 1);
+            if(c == ESCAPE_STOP)
+            {
+                stop_output = 1;
+                break;
+            }
+            else if(c < 0)
+            {
+                *p++ = '\\';
+            }
+            else
+            {
+                *p++ = c;
+            }
+        }
+        else
+        {
+            *p++ = *arg++;
+        }
+    }
+    *p = '\0';
+    *len = p-res;
+    return res;
+}
+
+
+/*
+ * Quote the argument of the %q conversion so that it can be reused as shell
+ * input. Chars that are special to the shell are backslash-escaped, while
+ * strings containing non-printable chars are double-quoted.
+ *
+ * Returns the malloc'd quoted string, or NULL on insufficient memory.
+ */
+static char *quote_arg(char *arg)
+{
+    char *p;
+    if(!*arg)
+    {
+        return __get_malloced_str("''");
+    }
+
+    for(p = arg; *p; p++)
+    {
+        if(!isprint((unsigned char)*p))
+        {
+            return quote_val(arg, 1, 0);
+        }
+    }
+
+    char *res = malloc(strlen(arg)*2 + 1), *p2 = res;
+    if(!res)
+    {
+        return NULL;
+    }
+    for(p = arg; *p; p++)
+    {
+        if(!isalnum((unsigned char)*p) && !strchr("_-+=./,:@%^", *p))
+        {
+            *p2++ = '\\';
+        }
+        *p2++ = *p;
+    }
+    *p2 = '\0';
+    return res;
+}
+
+
+/*
+ * If a numeric argument starts with a single or double quote, its value is the
+ * numeric value of the char following the quote (POSIX).
+ *
+ * Returns 1 if the string was a quoted char (and *val is set), 0 otherwise.
+ */
+static int quoted_char_val(char *arg, intmax_t *val)
+{
+    if(*arg == '\'' || *arg == '"')
+    {
+        *val = (unsigned char)arg[1];
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Report an error if the numeric argument wasn't converted completely.
+ */
+static void check_num_arg(char *arg, char *end)
+{
+    if(errno == ERANGE)
+    {
+        PRINT_ERROR(UTILITY, "%s: %s", arg, strerror(ERANGE));
+        printf_res = 1;
+    }
+    else if(end == arg || *end)
+    {
+        PRINT_ERROR(UTILITY, "%s: invalid number", arg);
+        printf_res = 1;
+    }
+}
+
+
+/*
+ * Convert the argument of a numeric conversion to a signed integer, an unsigned
+ * integer or a floating point number. A missing or empty argument is taken as 0.
+ * If the argument isn't a valid number, we print an error and use whatever
+ * leading part of it that was converted, and the exit status is set to 1.
+ */
+static intmax_t get_int_arg(char *arg)
+{
+    intmax_t val;
+    char *end;
+    if(!arg || !*arg)
+    {
+        return 0;
+    }
+    if(quoted_char_val(arg, &val))
+    {
+        return val;
+    }
+    errno = 0;
+    val = strtoimax(arg, &end, 0);
+    check_num_arg(arg, end);
+    return val;
+}
+
+
+static uintmax_t get_uint_arg(char *arg)
+{
+    intmax_t val;
+    uintmax_t uval;
+    char *end;
+    if(!arg || !*arg)
+    {
+        return 0;
+    }
+    if(quoted_char_val(arg, &val))
+    {
+        return (uintmax_t)val;
+    }
+    errno = 0;
+    uval = strtoumax(arg, &end, 0);
+    check_num_arg(arg, end);
+    return uval;
+}
+
+
+static long double get_float_arg(char *arg)
+{
+    intmax_t val;
+    long double dval;
+    char *end;
+    if(!arg || !*arg)
+    {
+        return 0;
+    }
+    if(quoted_char_val(arg, &val))
+    {
+        return (long double)val;
+    }
+    errno = 0;
+    dval = strtold(arg, &end);
+    check_num_arg(arg, end);
+    return dval;
+}
+
+
+/*
+ * Process the format string once, consuming arguments from argv, starting
+ * at index *v.
+ *
+ * Returns 1 if the format was processed, 0 if we found an invalid conversion
+ * spec (in which case we stop processing).
+ */
+static int do_format(char *format, int argc, char **argv, int *v)
+{
+    char *f = format;
+    char *start = f;
+
+    while(*f && !stop_output)
+    {
+        if(*f == '\\')
+        {
+            out_str(start, f-start);
+            f++;
+            int c = get_escape_char(&f, 0);
+            if(c < 0)
+            {
+                /* output unrecognized escape sequences as-is */
+                out_str("\\", 1);
+            }
+            else
+            {
+                char ch = c;
+                out_str(&ch, 1);
+            }
+            start = f;
+            continue;
+        }
+
+        if(*f != '%')
+        {
+            f++;
+            continue;
+        }
+
+        out_str(start, f-start);
+        f++;
+
+        if(*f == '%')
+        {
+            out_str("%", 1);
+            start = ++f;
+            continue;
+        }
+
+        /*
+         * Build the conversion spec we'll pass to the C library. The width and
+         * precision (which might be given as '*') are written as numbers.
+         */
+        char spec[64], *s = spec;
+        *s++ = '%';
+        while(*f && strchr("-+ #0", *f))
+        {
+            if(s < spec+8)
+            {
+                *s++ = *f;
+            }
+            f++;
+        }
+
+        if(*f == '*')
+        {
+            f++;
+            s += sprintf(s, "%d", (int)get_int_arg((*v < argc) ? argv[(*v)++] : NULL));
+        }
+        else
+        {
+            while(isdigit(*f) && s < spec+20)
+            {
+                *s++ = *f++;
+            }
+        }
+
+        if(*f == '.')
+        {
+            f++;
+            *s++ = '.';
+            if(*f == '*')
+            {
+                f++;
+                s += sprintf(s, "%d", (int)get_int_arg((*v < argc) ? argv[(*v)++] : NULL));
+            }
+            else
+            {
+                while(isdigit(*f) && s < spec+40)
+                {
+                    *s++ = *f++;
+                }
+            }
+        }
+
+        /* skip any length modifiers, we use our own */
+        while(*f && strchr("hlLjzt", *f))
+        {
+            f++;
+        }
+
+        char conv = *f;
+        if(!conv)
+        {
+            PRINT_ERROR(UTILITY, "`%s': missing format character", format);
+            return 0;
+        }
+        f++;
+        start = f;
+
+        char *arg = (*v < argc) ? argv[(*v)++] : NULL;
+
+        switch(conv)
+        {
+            case 'd':
+            case 'i':
+                strcpy(s, "jd");
+                out_fmt(spec, get_int_arg(arg));
+                break;
+
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                s[0] = 'j';
+                s[1] = conv;
+                s[2] = '\0';
+                out_fmt(spec, get_uint_arg(arg));
+                break;
+
+            case 'a':
+            case 'A':
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+                s[0] = 'L';
+                s[1] = conv;
+                s[2] = '\0';
+                out_fmt(spec, get_float_arg(arg));
+                break;
+
+            case 'c':
+            {
+                /* the first char of the argument (a NULL char if the argument is empty) */
+                char str[2] = { arg ? *arg : '\0', '\0' };
+                if(s == spec+1)
+                {
+                    out_str(str, arg ? 1 : 0);
+                    break;
+                }
+                strcpy(s, "s");
+                out_fmt(spec, str);
+                break;
+            }
+
+            case 's':
+                if(!arg)
+                {
+                    arg = "";
+                }
+                /* no flags, width or precision. output the string as-is */
+                if(s == spec+1)
+                {
+                    out_str(arg, strlen(arg));
+                    break;
+                }
+                strcpy(s, "s");
+                out_fmt(spec, arg);
+                break;
+
+            case 'b':
+            {
+                size_t len;
+                char *str = expand_b_arg(arg ? arg : "", &len);
+                if(!str)
+                {
+                    INSUFFICIENT_MEMORY_ERROR(UTILITY, "expanding argument");
+                    return 0;
+                }
+                if(s == spec+1)
+                {
+                    /* output as-is, including any NULL chars from \0 sequences */
+                    out_str(str, len);
+                }
+                else
+                {
+                    strcpy(s, "s");
+                    out_fmt(spec, str);
+                }
+                free(str);
+                break;
+            }
+
+            case 'q':
+            {
+                char *str = quote_arg(arg ? arg : "");
+                if(!str)
+                {
+                    INSUFFICIENT_MEMORY_ERROR(UTILITY, "quoting argument");
+                    return 0;
+                }
+                strcpy(s, "s");
+                out_fmt(spec, str);
+                free(str);
+                break;
+            }
+
+            default:
+                PRINT_ERROR(UTILITY, "`%c': invalid format character", conv);
+                return 0;
+        }
+    }
+
+    if(!stop_output)
+    {
+        out_str(start, f-start);
+    }
+    return 1;
+}
+
+
+/*
+ * Assign the output of printf to the variable given to the -v option. The
+ * variable can be an array element.
+ *
+ * Returns 1 on success, 0 on error.
+ */
+static int printf_set_var(char *name, char *val)
+{
+    char *sub_end = get_subscript_end(name), *sub_start = NULL;
+    if(sub_end && sub_end[1] == '\0')
+    {
+        sub_start = strchr(name, '[');
+        *sub_start = '\0';
+    }
+
+    int res = 0;
+    struct symtab_entry_s *entry = get_symtab_entry(name);
+    if(!entry)
+    {
+        entry = add_to_symtab(name);
+    }
+
+    if(!entry)
+    {
+        /* failed to add the variable */
+    }
+    else if(flag_set(entry->flags, FLAG_READONLY))
+    {
+        READONLY_ASSIGN_ERROR(UTILITY, name, "variable");
+    }
+    else if(sub_start)
+    {
+        *sub_end = '\0';
+        res = set_array_elem(entry, sub_start+1, val, 0);
+        *sub_end = ']';
+    }
+    else
+    {
+        symtab_entry_setval(entry, val);
+        res = 1;
+    }
+
+    if(sub_start)
+    {
+        *sub_start = '[';
+    }
+    return res;
+}
+
+
+/*
+ * The printf builtin utility (POSIX). Used to print formatted output.
+ * The format is reused as many times as needed to consume all the arguments.
+ *
+ * Returns 0 on success, non-zero otherwise.
+ *
+ * See the manpage for the list of options and an explanation of what each option does.
+ * You can also run: `help printf` from lsh prompt to see a short
+ * explanation on how to use this utility.
+ */
+
+int printf_builtin(int argc, char **argv)
+{
+    int v = 1;
+    char *varname = NULL;
+
+    /* process the options */
+    if(v < argc && strcmp(argv[v], "-v") == 0)
+    {
+        if(v+1 >= argc)
+        {
+            OPTION_REQUIRES_ARG_ERROR(UTILITY, 'v');
+            return 2;
+        }
+        varname = argv[v+1];
+        v += 2;
+
+        char *sub = get_subscript_end(varname);
+        if(sub ? (sub[1] != '\0') : !is_name(varname))
+        {
+            PRINT_ERROR(UTILITY, "invalid variable name: %s", varname);
+            return 2;
+        }
+    }
+
+    if(v < argc && strcmp(argv[v], "--") == 0)
+    {
+        v++;
+    }
+
+    if(v >= argc)
+    {
+        MISSING_ARG_ERROR(UTILITY, "format string");
+        return 2;
+    }
+
+    char *format = argv[v++];
+    struct dstring_s var_buf = { NULL, NULL, 0, 0 };
+    outvar = varname ? &var_buf : NULL;
+    stop_output = 0;
+    printf_res = 0;
+
+    if(!outvar)
+    {
+        clearerr(stdout);
+    }
+
+    /* reuse the format until all the arguments are consumed */
+    int v2;
+    do
+    {
+        v2 = v;
+        if(!do_format(format, argc, argv, &v))
+        {
+            printf_res = 1;
+            break;
+        }
+    } while(v < argc && v > v2 && !stop_output);
+
+    if(outvar)
+    {
+        if(!printf_set_var(varname, var_buf.buf_base ? var_buf.buf_base : ""))
+        {
+            printf_res = 1;
+        }
+        free_str(&var_buf);
+        outvar = NULL;
+    }
+    else if(ferror(stdout))
+    {
+        printf_res = 1;
+    }
+
+    /* our output is flushed when we return (see do_builtin_internal()) */
+    return printf_res;
+}
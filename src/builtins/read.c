@@ -49,10 +49,6 @@ if(!internal_optarg || internal_optarg == INVALID_OPTARG)       \
 
 struct stat stats;
 
-/* define in ../wordexp.c */
-extern void get_IFS_spaces_and_delims(char *IFS, char *IFS_space, char *IFS_delim);
-
-
 /*
  * Check if the given file descriptor fd is a FIFO (named pipe).
  */
@@ -178,14 +174,10 @@ int read_field_split(char *str, int var_count, char **var_names /* , int suppres
         return 1;
     }
     
-    /* get the IFS spaces and delimiters separately */
-    char IFS_space[64];
-    char IFS_delim[64];
-
-    get_IFS_spaces_and_delims(IFS, IFS_space, IFS_delim);
+    unsigned char *IFS_table = get_IFS_table(IFS);
 
     /* skip any leading whitespaces in the string */
-    str = skip_IFS_whitespace(str, IFS_space);
+    str = skip_IFS_whitespace(str, IFS_table);
     
     size_t len = strlen(str);
     char *p1 = str, *p2 = str;
@@ -208,7 +200,7 @@ int read_field_split(char *str, int var_count, char **var_names /* , int suppres
          * delimit the field if we have an IFS space or delimiter char, or if
          * we reached the end of the input string.
          */
-        if(chrcmp(*p2, IFS_space) || chrcmp(*p2, IFS_delim))
+        if(is_IFS_char(IFS_table, *p2))
         {
             /* copy the field text */
             size_t len2 = p2-p1;
@@ -220,26 +212,7 @@ int read_field_split(char *str, int var_count, char **var_names /* , int suppres
             last_delim = p2;
 
             /* skip trailing IFS spaces/delimiters */
-            p2 = skip_IFS_delim(p2, IFS_space, IFS_delim);
-#if 0
-            while(*p2 && is_IFS_char(*p2, IFS_space))
-            {
-                p2++;
-            }
-
-            while(*p2 && is_IFS_char(*p2, IFS_delim))
-            {
-                p2++;
-            }
-            
-            while(*p2 && is_IFS_char(*p2, IFS_space))
-            {
-                p2++;
-            }
-
-            /* prepare for the next field */
-            i++;
-#endif
+            p2 = skip_IFS_delim(p2, IFS_table);
             p1 = p2;
 
             /* stop parsing if we reached the last variable */
@@ -270,7 +243,7 @@ int read_field_split(char *str, int var_count, char **var_names /* , int suppres
             p1 = last_delim;
         }
         
-        p2 = skip_trailing_IFS_whitespace(p1, p2, IFS_space);
+        p2 = skip_trailing_IFS_whitespace(p1, p2, IFS_table);
         debug ("p1 = '%s', p2 = '%s'\n", p1, p2);
         len = p2-p1+1;
         
@@ -485,6 +458,9 @@ int read_builtin(int argc, char **argv)
         }
     }
     
+    /* make sure the user sees whatever we printed before we block for input */
+    fflush(stdout);
+
     /* turn on some flags if not reading from tty (bash) */
     reading_tty = isatty(infd);
     if(!reading_tty && (msg || echo_off))
@@ -600,11 +600,6 @@ int set_builtin(int argc, char **argv)
         return 0;
     }
 
-    int params = 0;
-    int old_count = pos_param_count();
-    char buf[32];
-    struct symtab_entry_s *entry;
-  
     /* parse options */
     for(i = 1; i < argc; i++)
     {
@@ -652,43 +647,9 @@ int set_builtin(int argc, char **argv)
     }
   
     /* set the positional parameters */
-    for( ; i < argc; i++)
-    {
-        sprintf(buf, "%d", ++params);
-        entry = add_to_symtab(buf);
-        symtab_entry_setval(entry, argv[i]);
-        /*
-         * if a dot script calls set to change the values of one or more 
-         * special parameters, the results should propagate to the rest of
-         * the shell, which means we need to remove the local flag.
-         */
-        entry->flags &= ~FLAG_LOCAL;
-    }
-    
-    /* set the positional parameters count */
-    if(params)
+    if(i < argc)
     {
-        entry = get_symtab_entry("#");
-        sprintf(buf, "%d", params);
-        symtab_entry_setval(entry, buf);
-        /* ditto */
-        entry->flags &= ~FLAG_LOCAL;
-    }
-    
-    /* set the rest of parameters to NULL */
-    if(old_count >= 0)
-    {
-        for( ; i < old_count; i++)
-        {
-            sprintf(buf, "%d", ++params);
-            entry = get_symtab_entry(buf);
-            if(entry)
-            {
-                symtab_entry_setval(entry, NULL);
-                /* ditto */
-                entry->flags &= ~FLAG_LOCAL;
-            }
-        }
+        set_pos_params(argc-i, &argv[i]);
     }
   
     //__asm__("xchg %%bx, %%bx"::);
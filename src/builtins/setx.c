@@ -51,6 +51,8 @@ optionx_list[] =
 {
     { "addsuffix"                   , OPTION_ADD_SUFFIX           },    /* similar to setting tcsh addsuffix variable */
     { "autocd"                      , OPTION_AUTO_CD              },
+    { "bracketpaste"                , OPTION_BRACKET_PASTE        },    /* our extension to use the terminal's bracketed
+                                                                           paste mode */
     { "caller_verbose"              , OPTION_CALLER_VERBOSE       },    /* similar to bash's shift-verbose option, except
                                                                            that it affects the 'caller' builtin */
     { "caller-verbose"              , OPTION_CALLER_VERBOSE       },
@@ -51,7 +51,7 @@ int shift_builtin(int argc, char **argv)
         return 1;
     }
     
-    int params = get_shell_vari("#", 0);
+    int params = pos_param_count();
     int shift = 1;
     if(argc >= 2)
     {
@@ -72,32 +72,6 @@ int shift_builtin(int argc, char **argv)
         }
     }
 
-    int i, j = 1+shift;
-    char buf[32];
-    struct symtab_entry_s *entry1, *entry2;
-    
-    for(i = 1; i <= params; i++, j++)
-    {
-        sprintf(buf, "%d", i);
-        entry1 = get_symtab_entry(buf);
-        if(!entry1)
-        {
-            entry1 = add_to_symtab(buf);
-        }
-
-        sprintf(buf, "%d", j);
-        entry2 = get_symtab_entry(buf);
-        if(!entry2)
-        {
-            symtab_entry_setval(entry1, NULL);
-        }
-        else
-        {
-            symtab_entry_setval(entry1, entry2->val);
-        }
-    }
-    
-    params -= shift;
-    set_shell_vari("#", params);
+    shift_pos_params(shift);
     return 0;
 }
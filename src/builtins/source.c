@@ -185,23 +185,23 @@ int do_source_script(char *utility, char *file, int argc, char **argv)
         free_malloced_str(path);
     }
     
-    /* set the new positional parameters */
-    set_local_pos_params(argc, argv);
-    
     /* reset the OPTIND variable */
     set_shell_varp("OPTIND", "1");
     set_shell_varp("OPTSUB", "0");
     
     /* save and reset the DEBUG trap if -T is not set (bash) */
-    struct trap_item_s *debug = NULL;
-    if(!option_set('T'))
-    {
-        debug = save_trap("DEBUG");
-    }
+    struct trap_overlay_s traps;
+    trap_overlay_push(&traps, option_set('T') ? 0 : TRAP_OVERLAY_BIT(DEBUG_TRAP_NUM));
     
     /* add a new entry to the callframe stack to reflect the new scope we're entering */
     callframe_push(callframe_new(file, src.srcname, src.curline));
 
+    /* set the new positional parameters, if any */
+    if(argc)
+    {
+        set_local_pos_params(argc, argv);
+    }
+
     /* now execute the dot script */
     set_internal_exit_status(0);
     parse_and_execute(&src);
@@ -210,29 +210,21 @@ int do_source_script(char *utility, char *file, int argc, char **argv)
     trap_handler(RETURN_TRAP_NUM);
 
     /* pop the callframe entry we've added to the stack */
+    if(argc)
+    {
+        keep_local_pos_params();
+    }
     callframe_popf();
     
     /*
      * If -T is not set and the dot script changed the DEBUG trap, keep the 
      * changes and free the old DEBUG trap. Otherwise, reset the trap (bash).
      */
-    struct trap_item_s *debug2 = get_trap_item("DEBUG");
-    if(debug2 && debug2->action_str)
-    {
-        if(debug->action_str)
-        {
-            free_malloced_str(debug->action_str);
-        }
-        free(debug);
-    }
-    else
-    {
-        restore_trap("DEBUG", debug);
-    }
+    trap_overlay_pop(&traps, TRAP_OVERLAY_BIT(DEBUG_TRAP_NUM));
     
     /* 
-     * NOTE: the positional parameters will be restored when we pop the local
-     *       symbol table back in do_simple_command().
+     * NOTE: the positional parameters were restored when we popped the
+     *       callframe above.
      */
 
     free(src.buffer);
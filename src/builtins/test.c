@@ -350,10 +350,11 @@ char *str_remove_quotes(char *str, int *was_quoted)
     remove_quotes(w);
     (*was_quoted) = flag_set(w->flags, FLAG_WORD_HAD_QUOTES);
     
-    char *str2 = w->data;
-    free(w);
+    /* the word's text lives in the word struct's memory block */
+    char *str2 = __get_malloced_str(w->data);
+    free_word(w);
     
-    return str2;
+    return str2 ? str2 : str;
 }
 
 #define STR_EQ      1
@@ -23,6 +23,7 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <signal.h>
 #include <errno.h>
@@ -32,6 +33,7 @@
 #include "../include/sig.h"
 #include "../symtab/string_hash.h"
 #include "../backend/backend.h"
+#include "../parser/node.h"
 #include "../include/debug.h"
 
 #define UTILITY             "trap"
@@ -91,96 +93,135 @@ void init_traps(void)
     int i = 0;
     for( ; i < TRAP_COUNT; i++)
     {
-        trap_table[i].action     = ACTION_DEFAULT;
-        trap_table[i].action_str = NULL          ;
+        trap_table[i].action      = ACTION_DEFAULT;
+        trap_table[i].action_str  = NULL          ;
     }
 }
 
 
 /*
- * Return the requested trap, resetting the trap action to the default action.
+ * Free the trap's action string.
  */
-struct trap_item_s *save_trap(char *name)
+void free_trap_action(struct trap_item_s *trap)
 {
-    /* get the trap struct */
-    struct trap_item_s *trap = get_trap_item(name);
-    if(!trap)
-    {
-        return NULL;
-    }
-    
-    /* get a copy of the trap */
-    struct trap_item_s *trap2 = malloc(sizeof(struct trap_item_s));
-    if(!trap2)
+    if(trap->action_str)
     {
-        return NULL;
+        free_malloced_str(trap->action_str);
+        trap->action_str = NULL;
     }
-    memcpy(trap2, trap, sizeof(struct trap_item_s));
-    
-    /* reset trap to default action */
-    trap->action = ACTION_DEFAULT;
-    trap->action_str = NULL;
-    
-    /* return the copy */
-    return trap2;
 }
 
 
 /*
- * Reset the requested trap to default action.
- * 
- * Returns 1 on success, 0 on error.
+ * Return 1 if the given trap is set (i.e. it is ignored or has an action string),
+ * 0 if it has the default action.
  */
-int reset_trap(char *name)
+static inline int trap_is_set(struct trap_item_s *trap)
 {
-    /* get the trap struct */
-    struct trap_item_s *trap = get_trap_item(name);
-    if(!trap)
-    {
-        return 0;
-    }
-    
-    /* free the old action string */
-    if(trap->action_str)
+    return (trap->action != ACTION_DEFAULT || trap->action_str);
+}
+
+
+/*
+ * Reset the special traps given in the 'traps' bitmap (see TRAP_OVERLAY_BIT)
+ * to their default action, saving the ones that are set in the overlay struct.
+ * Called when entering a function or a dot script. As most scripts don't set
+ * the DEBUG, RETURN or ERR traps, we don't copy anything unless the trap is
+ * actually set.
+ */
+void trap_overlay_push(struct trap_overlay_s *overlay, int traps)
+{
+    overlay->reset = traps;
+    overlay->saved = 0;
+
+    int n;
+    for(n = ERR_TRAP_NUM; n < TRAP_COUNT && traps; n++)
     {
-        free_malloced_str(trap->action_str);
+        int bit = TRAP_OVERLAY_BIT(n);
+        if(!(traps & bit))
+        {
+            continue;
+        }
+        traps &= ~bit;
+
+        struct trap_item_s *trap = &trap_table[n];
+        if(!trap_is_set(trap))
+        {
+            continue;
+        }
+
+        /* move the trap to the overlay and reset it to the default action */
+        memcpy(&overlay->traps[n-ERR_TRAP_NUM], trap, sizeof(struct trap_item_s));
+        overlay->saved |= bit;
+        trap->action      = ACTION_DEFAULT;
+        trap->action_str  = NULL;
     }
-    
-    /* reset trap to default action */
-    trap->action = ACTION_DEFAULT;
-    trap->action_str = NULL;
-    
-    /* return the copy */
-    return 1;
 }
 
 
 /*
- * Restore a previously saved trap, freeing the saved trap's memory.
+ * Restore the traps we reset in trap_overlay_push(), discarding any traps the
+ * function or dot script has set in the meantime. Traps in the 'keep' bitmap are
+ * kept if they were set to execute a command, in which case the saved trap is
+ * discarded instead.
  */
-void restore_trap(char *name, struct trap_item_s *saved)
+void trap_overlay_pop(struct trap_overlay_s *overlay, int keep)
 {
-    if(!saved)
+    int traps = overlay->reset;
+    int n;
+    for(n = ERR_TRAP_NUM; n < TRAP_COUNT && traps; n++)
     {
-        return;
+        int bit = TRAP_OVERLAY_BIT(n);
+        if(!(traps & bit))
+        {
+            continue;
+        }
+        traps &= ~bit;
+
+        struct trap_item_s *trap = &trap_table[n];
+        struct trap_item_s *saved = &overlay->traps[n-ERR_TRAP_NUM];
+        if((keep & bit) && trap->action_str)
+        {
+            if(overlay->saved & bit)
+            {
+                free_trap_action(saved);
+            }
+            continue;
+        }
+
+        if(trap_is_set(trap))
+        {
+            free_trap_action(trap);
+            trap->action = ACTION_DEFAULT;
+        }
+
+        if(overlay->saved & bit)
+        {
+            memcpy(trap, saved, sizeof(struct trap_item_s));
+        }
     }
-    
-    /* get the trap item */
-    struct trap_item_s *trap = get_trap_item(name);
-    if(!trap)
+    overlay->reset = 0;
+    overlay->saved = 0;
+}
+
+
+/*
+ * Reset the trap with the given number to default action.
+ */
+void reset_trap(int n)
+{
+    if(n < 0 || n >= TRAP_COUNT)
     {
         return;
     }
+
+    struct trap_item_s *trap = &trap_table[n];
     
     /* free the old action string */
-    if(trap->action_str)
-    {
-        free_malloced_str(trap->action_str);
-    }
+    free_trap_action(trap);
     
-    /* set the new trap */
-    memcpy(trap, saved, sizeof(struct trap_item_s));
-    free(saved);
+    /* reset trap to default action */
+    trap->action = ACTION_DEFAULT;
 }
 
 
@@ -227,6 +268,9 @@ void trap_handler(int signum)
          * us calling:
          *
          *       eval action
+         *
+         * As traps (especially DEBUG) can fire very often, eval keeps the parsed
+         * action in its cache, so that later firings don't parse it again.
          */
         char *argv[] = { "eval", trap->action_str, NULL };
         do_builtin_internal(eval_builtin, 2, argv);
@@ -681,11 +725,7 @@ int trap_builtin(int argc, char **argv)
         }
         
         /* remove the old action string and set the new one */
-        if(trap->action_str)
-        {
-            free_malloced_str(trap->action_str);
-            trap->action_str = NULL;
-        }
+        free_trap_action(trap);
 
         /* now set the trap action */
         switch(action)
@@ -32,6 +32,7 @@
 void unalias_all(void)
 {
     int i = 0;
+    alias_generation++;
     for( ; i < MAX_ALIASES; i++)
     {
         if(aliases[i].name)
@@ -112,6 +113,7 @@ int unalias_builtin(int argc, char **argv)
         i = alias_list_index(argv[v]);
         if(i >= 0)
         {
+            alias_generation++;
             free(aliases[i].name);
             aliases[i].name = NULL;
             
@@ -111,6 +111,31 @@ int unset_builtin(int argc, char **argv)
             continue;
         }
         
+        /* unset an array element */
+        char *sub_end = get_subscript_end(arg);
+        if(sub_end && sub_end[1] == '\0' && !funcs)
+        {
+            char *sub_start = strchr(arg, '[');
+            *sub_start = '\0';
+            *sub_end   = '\0';
+            struct symtab_entry_s *entry = get_symtab_entry(arg);
+            if(entry)
+            {
+                if(flag_set(entry->flags, FLAG_READONLY))
+                {
+                    UNSET_PRINT_ERROR(arg, "readonly variable");
+                    res = 1;
+                }
+                else
+                {
+                    unset_array_elem(entry, sub_start+1);
+                }
+            }
+            *sub_start = '[';
+            *sub_end   = ']';
+            continue;
+        }
+
         if(!is_name(arg))
         {
             UNSET_PRINT_ERROR(arg, "invalid name");
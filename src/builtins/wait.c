@@ -27,11 +27,14 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdio.h>
 #include <sys/wait.h>
 #include "builtins.h"
 #include "../include/cmd.h"
 #include "../include/sig.h"
 #include "../backend/backend.h"
+#include "../symtab/symtab.h"
+#include "../parser/parser.h"
 #include "../include/debug.h"
 
 #define UTILITY         "wait"
@@ -219,108 +222,202 @@ int wait_for_job(struct job_s *job, int force, int tty)
 
 
 /*
- * Wait for any child process and return it's exit status, or 0 if no child
- * processes are running. If wait_jobs is non-zero, wait for any job and return
- * it's exit status. If wait_jobs is zero, wait for all child processes and
- * return 0.
+ * Assign the given pid to the variable given to the -p option.
  */
-int wait_for_any(int force)
+static void set_pid_var(char *name, pid_t pid)
 {
-    int    res = 0;
-    struct job_s *job;
-    sigset_t sigset;
-    
-    force = force && option_set('m');
-    SIGNAL_BLOCK(SIGCHLD, sigset);
-    
-    /* Check for unreported dead jobs */
-    for(job = &jobs_table[0]; job < &jobs_table[MAX_JOBS]; job++)
+    char buf[32];
+    struct symtab_entry_s *entry = get_symtab_entry(name);
+    if(!entry && !(entry = add_to_symtab(name)))
     {
-        if(job->job_num != 0 && job->child_exits == job->proc_count)
+        return;
+    }
+
+    if(flag_set(entry->flags, FLAG_READONLY))
+    {
+        READONLY_ASSIGN_ERROR(UTILITY, name, "variable");
+        return;
+    }
+
+    sprintf(buf, "%d", pid);
+    symtab_entry_setval(entry, buf);
+}
+
+
+/*
+ * Check if any of the given jobs (or any child process, if pids is NULL) is
+ * still running. If one of the given jobs has already finished, it is returned
+ * in *done.
+ */
+static int children_running(pid_t *pids, int count, struct job_s **done)
+{
+    if(!pids)
+    {
+        siginfo_t info;
+        info.si_pid = 0;
+        if(waitid(P_ALL, 0, &info, WEXITED|WNOHANG|WNOWAIT) == -1)
         {
-            if(!NOTIFIED_JOB(job))
-            {
-                goto fin;
-            }
+            return 0;
         }
+
+        /*
+         * A child has exited, but we haven't got its status yet (maybe because
+         * its SIGCHLD arrived before we installed our handler). Get it now.
+         */
+        if(info.si_pid)
+        {
+            SIGCHLD_handler(SIGCHLD);
+        }
+        return 1;
     }
-    
-    SIGNAL_UNBLOCK(sigset);
-    
-    /* Wait for any child process */
-    for( ; ; )
+
+    int i, running = 0;
+    for(i = 0; i < count; i++)
     {
-        SIGNAL_BLOCK(SIGCHLD, sigset);
-        
-        /* Check there is a background job to wait for */
-        for(job = &jobs_table[0]; job < &jobs_table[MAX_JOBS]; job++)
+        struct job_s *job = get_job_by_any_pid(pids[i]);
+        if(!job)
         {
-            if(job->job_num != 0 && job->child_exits != job->proc_count && !FOREGROUND_JOB(job))
-            {
-                break;
-            }
+            continue;
         }
-        
-        /* No job available to wait for */
-        if(job == &jobs_table[MAX_JOBS])
+
+        if(job->child_exits == job->proc_count)
         {
-            SIGNAL_UNBLOCK(sigset);
-            return 127;
+            *done = job;
+            return 1;
         }
-        
-        SIGNAL_UNBLOCK(sigset);
-        
-        /* Wait for any child process to terminate */
-        errno = 0;
-        res = wait_for_pid(NULL, WAIT_ANY, force);
-        
-        if(errno == ECHILD)
+        running = 1;
+    }
+    return running;
+}
+
+
+/*
+ * Wait for the first of the given jobs to finish. The jobs are given as pids or
+ * job ids in argv, starting at argv[v]. If there are no arguments, wait for the
+ * first background job to finish. Finished jobs are taken from the completion
+ * queue (see jobs.c), in the order in which they finished, so that we don't need
+ * to search the jobs table for the finished job. If var is not NULL, the pid of
+ * the job's first process is assigned to the variable with the given name.
+ *
+ * Returns the exit status of the finished job, 127 if there are no jobs to wait
+ * for, or 128 if we're interrupted by a signal.
+ */
+int wait_for_any(int argc, char **argv, int v, char *var)
+{
+    int    res = 0, count = 0;
+    pid_t *pids = NULL;
+    struct job_s *job = NULL;
+    sigset_t sigset, waitset;
+
+    /* get the jobs we're going to wait for */
+    if(v < argc)
+    {
+        if(!(pids = malloc((argc-v) * sizeof(pid_t))))
         {
-            return res;
+            INSUFFICIENT_MEMORY_ERROR(UTILITY, "waiting for jobs");
+            return 1;
         }
-        
-#if 0
-        errno = 0;
-        if((pid = waitpid(-1, &res, 0)) < 0)
+
+        for( ; v < argc; v++)
         {
-            if(errno == EINTR)
+            char *arg = argv[v], *strend = NULL;
+            if(*arg == '%')
             {
-                if(signal_received != SIGCHLD)
+                job = get_job_by_jobid(get_jobid(arg));
+                if(!job)
                 {
-                    return wait_interrupted();
+                    INVALID_JOB_ERROR(UTILITY, arg);
+                    continue;
                 }
             }
-        }
-        else
-        {
-            if((job = get_job_by_jobid(pid)))
+            else
+            {
+                pid_t pid = strtol(arg, &strend, 10);
+                if(!isdigit(*arg) || *strend || pid == 0)
+                {
+                    PRINT_ERROR(UTILITY, "invalid pid: %s", arg);
+                    continue;
+                }
+
+                job = get_job_by_any_pid(pid);
+                if(!job)
+                {
+                    PRINT_ERROR(UTILITY, "process %d is not a child of this shell", pid);
+                    continue;
+                }
+            }
+
+            if(job->pids && job->proc_count)
             {
-                set_pid_exit_status(job, pid, res);
-                set_job_exit_status(job, pid, res);
+                pids[count++] = job->pids[0];
             }
         }
-#endif
-        
-        SIGNAL_BLOCK(SIGCHLD, sigset);
-        
-        /* Check if there is any finished job */
-        for(job = &jobs_table[0]; job < &jobs_table[MAX_JOBS]; job++)
+
+        if(!count)
         {
-            debug ("job->child_exits = %d, job->proc_count = %d\n", job->child_exits, job->proc_count);
-            if(job->job_num != 0 && job->child_exits == job->proc_count)
+            free(pids);
+            return 127;
+        }
+        job = NULL;
+    }
+
+    SIGNAL_BLOCK(SIGCHLD, sigset);
+    waitset = sigset;
+    sigdelset(&waitset, SIGCHLD);
+    waiting_pid = WAIT_ANY;
+
+    while(!(job = next_completed_job(pids, count)))
+    {
+        if(!children_running(pids, count, &job))
+        {
+            res = 127;
+            break;
+        }
+
+        if(job)
+        {
+            break;
+        }
+
+        /* wait for the next SIGCHLD (or any other signal) */
+        sigsuspend(&waitset);
+
+        if(signal_received && signal_received != SIGCHLD)
+        {
+            SIGNAL_UNBLOCK(sigset);
+            res = wait_interrupted();
+            if(pids)
             {
-                goto fin;
+                free(pids);
             }
+            return res;
         }
-        
-        SIGNAL_UNBLOCK(sigset);
     }
-    
-fin:
-    res = job->status;
-    set_exit_status(res);
-    remove_job(job);
+
+    waiting_pid = 0;
+
+    if(job)
+    {
+        if(var)
+        {
+            set_pid_var(var, job->pids[0]);
+        }
+
+        set_exit_status(job->status);
+        res = exit_status;
+        job->flags |= JOB_FLAG_NOTIFIED;
+        remove_job(job);
+    }
+
     SIGNAL_UNBLOCK(sigset);
+
+    /* execute any traps that were deferred while we were waiting */
+    do_pending_traps();
+
+    if(pids)
+    {
+        free(pids);
+    }
     return res;
 }
 
@@ -396,6 +493,7 @@ int wait_builtin(int argc, char **argv)
     pid_t  pid      = 0;
     int    wait_any = 0;
     int    force    = 0;
+    char  *var      = NULL;
     struct job_s *job;
     int    v = 1, c;
     int    tty = cur_tty_fd();
@@ -404,7 +502,7 @@ int wait_builtin(int argc, char **argv)
     /****************************
      * process the options
      ****************************/
-    while((c = parse_args(argc, argv, "hvnf", &v, FLAG_ARGS_PRINTERR)) > 0)
+    while((c = parse_args(argc, argv, "hvnfp:", &v, FLAG_ARGS_PRINTERR)) > 0)
     {
         switch(c)
         {
@@ -423,6 +521,20 @@ int wait_builtin(int argc, char **argv)
             case 'f':
                 force = 1;
                 break;
+                
+            case 'p':
+                if(!internal_optarg || internal_optarg == INVALID_OPTARG)
+                {
+                    OPTION_REQUIRES_ARG_ERROR(UTILITY, c);
+                    return 2;
+                }
+                var = internal_optarg;
+                if(!is_name(var))
+                {
+                    PRINT_ERROR(UTILITY, "invalid variable name: %s", var);
+                    return 2;
+                }
+                break;
         }
     }
 
@@ -442,9 +554,9 @@ int wait_builtin(int argc, char **argv)
     /* The -n flag is used. Wait for any job */
     if(wait_any)
     {
-        wait_for_any(force);
+        res = wait_for_any(argc, argv, v, var);
         sigaction(SIGCHLD, &old_sigact, NULL);
-        return exit_status;
+        return res;
     }
     
     /* No pid operands. Wait for all children */
@@ -477,6 +589,11 @@ int wait_builtin(int argc, char **argv)
                 continue;
             }
             
+            if(var && job->pids)
+            {
+                set_pid_var(var, job->pids[0]);
+            }
+            
             /* wait for all processes in job to exit */
             debug ("pid = %d\n", pid);
             wait_for_job(job, force, tty);
@@ -500,6 +617,11 @@ int wait_builtin(int argc, char **argv)
             }
             
             job = get_job_by_any_pid(pid);
+            
+            if(var)
+            {
+                set_pid_var(var, pid);
+            }
 
             /* restore the terminal attributes to what it was when the job was suspended, as zsh does */
             if(job && job->tty_attr)
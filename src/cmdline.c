@@ -80,11 +80,39 @@ timer_t   timerid        = 0;          /* id of the timer used to send SIGALRM *
 /* max EOFs before we exit */
 #define MAX_EOFS        10
 
-/* variables used by is_incomplete_cmd() function */
-static int open_cb    = 0, close_cb = 0;   /* count curly braces */
-static int open_rb    = 0, close_rb = 0;   /* count round brackets */
-static int quotes     = 0;                 /* count quotes */
-static int __heredocs = 0;                 /* count heredocs */
+/* set for heredocs introduced by '<<-', whose lines can be indented by tabs */
+static int heredoc_strip[FOPEN_MAX];
+
+/* length and allocated size of the incomplete_cmd buffer */
+static size_t incomplete_len  = 0;
+static size_t incomplete_size = 0;
+
+/* max nesting depth of quotes and brackets we remember */
+#define MAX_CMD_NESTING     64
+
+/*
+ * State used by is_incomplete_cmd(), which is saved at the end of each line, so
+ * that we only need to scan the new line when the user enters the next line of
+ * an incomplete command. Open quotes and brackets are kept in a stack, where
+ * the following chars are used in addition to the quote and bracket chars
+ * themselves: 'G' for the '{' of a brace group, and 'A' for '((' and '$(('.
+ */
+static struct
+{
+    char ctx[MAX_CMD_NESTING];          /* open quotes and brackets */
+    int  ctx_cases[MAX_CMD_NESTING];    /* open case commands when the bracket was opened */
+    int  depth;                         /* nesting depth (can exceed MAX_CMD_NESTING) */
+    int  op;                            /* next word is in the place of a command name */
+    int  ifs, fis;                      /* count keywords */
+    int  dos, dones;
+    int  cases, esacs;
+    int  loops;                         /* for, select, while and until */
+} cmd_state;
+
+static inline char top_ctx(void);
+static int is_incomplete_block(void);
+static int append_incomplete_cmd(char *line, size_t len);
+static void insert_pasted_text(int tty);
 
 
 /*
@@ -101,6 +129,7 @@ void kill_input(void)
     update_row_col();
     start_row    = get_terminal_row();
     start_col    = get_terminal_col();
+    redraw_reset();
 
     if(incomplete_cmd)
     {
@@ -198,7 +227,9 @@ void cmdline(void)
         term_canon(0);
 
         /* read the next command line */
+        bracketed_paste(1);
         cmd = read_cmd();
+        bracketed_paste(0);
 
         /* no input (EOF) */
         if(!cmd)
@@ -275,7 +306,7 @@ void init_cmdbuf(void)
 int ext_cmdbuf(char **cmdbuf, size_t *size, size_t howmuch)
 {
     size_t newsz = (*size) + howmuch;
-    char *newbuf = realloc(cmdbuf, newsz);
+    char *newbuf = realloc(*cmdbuf, newsz);
     
     if(!newbuf)
     {
@@ -308,6 +339,7 @@ char *read_cmd(void)
     
     start_row = get_terminal_row();
     start_col = get_terminal_col();
+    redraw_reset();
 
     /*
      * Get the number of consecutive EOFs to force exit. Default is 10 (bash)
@@ -355,12 +387,21 @@ char *read_cmd(void)
         /*
          * Check if we received a signal for which we have a trap set.
          * If so, clear the input buffer and reprint the prompt string.
+         * SIGCHLD is not one of those, and we get it whenever a command
+         * substitution in the prompt string finishes.
          */
         if(signal_received)
         {
-            kill_input();
-            signal_received = 0;
-            continue;
+            if(signal_received == SIGCHLD)
+            {
+                signal_received = 0;
+            }
+            else
+            {
+                kill_input();
+                signal_received = 0;
+                continue;
+            }
         }
         
         /*
@@ -410,6 +451,23 @@ char *read_cmd(void)
         
         eofs = 0;
 
+        /*
+         * Text pasted in bracketed paste mode is inserted in one go. If it ends
+         * in a newline, we accept the command line as if the user pressed ENTER.
+         */
+        if(c == PASTE_KEY)
+        {
+            insert_pasted_text(tty);
+            if(cmdbuf_end == 0 || cmdbuf[cmdbuf_end-1] != '\n' ||
+               cmdbuf_index != cmdbuf_end)
+            {
+                continue;
+            }
+            cmdbuf[--cmdbuf_end] = '\0';
+            cmdbuf_index = cmdbuf_end;
+            c = '\n';
+        }
+
         switch(c)
         {
             default:
@@ -590,37 +648,8 @@ char *read_cmd(void)
                 {
                     continue;
                 }
-                update_row_col();
                 
-                size_t old_row = terminal_row, old_col = terminal_col;
-                move_cur(start_row, start_col);
-                printf("%*s", (int)cmdbuf_end, " ");
-                char *p1 = cmdbuf+z;
-                char *p2 = cmdbuf+cmdbuf_index;
-                while((*p1++ = *p2++))
-                {
-                    ;
-                }
-                
-                int  diff = cmdbuf_index-z;
-                cmdbuf_index -= diff;
-                cmdbuf_end   -= diff;
-                move_cur(start_row, start_col);
-                printf("%s", cmdbuf);
-                
-                do
-                {
-                    if(old_col == 1)
-                    {
-                        old_col = VGA_WIDTH;
-                        old_row--;
-                    }
-                    else
-                    {
-                        old_col--;
-                    }
-                } while(--diff);
-                move_cur(old_row  , old_col);
+                do_backspace(cmdbuf_index-z);
                 break;
 
             case '\e':
@@ -647,10 +676,10 @@ char *read_cmd(void)
              ***********************************/
             case '\n':
             case '\r':
-                printf("\n");
+                redraw_finish();
                 /* perform history expansion on the line */
                 if(in_heredoc < 0 && option_set('H') &&
-                    (p = hist_expand(quotes, FLAG_HISTEXPAND_DO_BACKUP)))
+                    (p = hist_expand(incomplete_cmd ? top_ctx() : 0, FLAG_HISTEXPAND_DO_BACKUP)))
                 {
                     if(p == INVALID_HIST_EXPAND)
                     {
@@ -670,6 +699,7 @@ char *read_cmd(void)
                             update_row_col();
                             start_col = get_terminal_col();
                             start_row = get_terminal_row();
+                            redraw_reset();
                             continue;
                         }
                     }
@@ -678,21 +708,18 @@ char *read_cmd(void)
                         /* do not pass expanded line to the shell yet (bash) */
                         if(optionx_set(OPTION_HIST_VERIFY))
                         {
-                            clear_cmd(0);
                             strcpy(cmdbuf, p);
                             free_malloced_str(p);
-                            move_cur(start_row, start_col);
-                            output_cmd();
                             cmdbuf_end = strlen(cmdbuf);
                             cmdbuf_index = cmdbuf_end;
+                            redraw_cmdline();
                             break;
                         }
                         else
                         {
                             strcpy(cmdbuf, p);
                             free_malloced_str(p);
-                            output_cmd();
-                            printf("\n");
+                            printf("%s\n", cmdbuf);
                             cmdbuf_end = strlen(cmdbuf);
                             if(cmdbuf[cmdbuf_end-1] == '\n')
                             {
@@ -710,6 +737,11 @@ char *read_cmd(void)
                 {
                     c = 0;
                 }
+                else if(memchr(cmdbuf, '\n', cmdbuf_end))
+                {
+                    /* multi-line input, such as pasted text or a history entry */
+                    c = is_incomplete_block();
+                }
                 else
                 {
                     c = is_incomplete_cmd(incomplete_cmd ? 0 : 1);
@@ -724,35 +756,15 @@ char *read_cmd(void)
                 else if(c > 0)      /* incomplete command in the buffer */
                 {
                     print_prompt2();
-                    char *tmp = NULL;
-                    size_t sz = strlen(cmdbuf)+1;
-
-                    if(incomplete_cmd)
+                    if(append_incomplete_cmd(cmdbuf, strlen(cmdbuf)))
                     {
-                        sz += strlen(incomplete_cmd);
-                    }
-
-                    tmp = malloc(sz);
-                    if(tmp)
-                    {
-                        if(incomplete_cmd)
-                        {
-                            strcpy(tmp, incomplete_cmd);
-                            free(incomplete_cmd);
-                        }
-                        else
-                        {
-                            tmp[0] = '\0';
-                        }
-                        
-                        incomplete_cmd = tmp;
-                        strcat(incomplete_cmd, cmdbuf);
                         cmdbuf_end = 0;
                         cmdbuf[cmdbuf_end] = '\0';
                         cmdbuf_index = cmdbuf_end;
                         update_row_col();
                         start_col = get_terminal_col();
                         start_row = get_terminal_row();
+                        redraw_reset();
                         continue;
                     }
                 }
@@ -781,434 +793,677 @@ char *read_cmd(void)
 
 
 /*
- * After user presses ENTER, check if he entered a full command or not.
- *
- * Returns 1 if the command is incomplete, 0 if it is complete.
+ * Return the innermost open quote or bracket, or 0 if there is none.
  */
-int is_incomplete_cmd(int first_time)
+static inline char top_ctx(void)
 {
-    char   *cmd = cmdbuf;
-    size_t  cmd_len = strlen(cmd);
-    size_t  i = 0, j;
+    if(cmd_state.depth == 0 || cmd_state.depth > MAX_CMD_NESTING)
+    {
+        return 0;
+    }
+    return cmd_state.ctx[cmd_state.depth-1];
+}
 
-    /*
-     * if we are inside a here-document, check if the last entered line matches
-     * the here-document marker word, which signals the end of the here-document.
-     */
-    if(in_heredoc >= 0)
+
+/*
+ * Remember an open quote or bracket, along with the number of case commands
+ * that are open at this point (so we can tell a closing bracket from the ')'
+ * that ends a case pattern).
+ */
+static void push_ctx(char c)
+{
+    if(cmd_state.depth < MAX_CMD_NESTING)
     {
-        /* if no here-document mark is present, just wait for EOF by the user */
-        cmd[cmd_len-1] = '\0';
-        char *nl = strrchr(cmd, '\n');
-        cmd[cmd_len-1] = '\n';
-        if(!nl)
+        cmd_state.ctx[cmd_state.depth] = c;
+        cmd_state.ctx_cases[cmd_state.depth] = cmd_state.cases-cmd_state.esacs;
+    }
+    cmd_state.depth++;
+}
+
+
+/*
+ * Forget the innermost open quote or bracket.
+ */
+static inline void pop_ctx(void)
+{
+    if(cmd_state.depth)
+    {
+        cmd_state.depth--;
+    }
+}
+
+
+/*
+ * Check if the word at p is a reserved word. If so, update the keyword counts
+ * and return the length of the word. Otherwise return 0.
+ */
+static size_t check_keyword(char *p)
+{
+    static struct
+    {
+        char *name;
+        int   cmd;      /* 1 if the word is followed by a command */
+        int   which;    /* the count to update */
+    } keywords[] =
+    {
+        { "if"    , 1, 1 }, { "fi"    , 0, 2 }, { "do"    , 1, 3 },
+        { "done"  , 0, 4 }, { "case"  , 0, 5 }, { "esac"  , 0, 6 },
+        { "for"   , 0, 7 }, { "while" , 1, 7 }, { "until" , 1, 7 },
+        { "select", 0, 7 }, { "then"  , 1, 0 }, { "else"  , 1, 0 },
+        { "elif"  , 1, 0 },
+    };
+    int *counts[] =
+    {
+        NULL, &cmd_state.ifs, &cmd_state.fis, &cmd_state.dos, &cmd_state.dones,
+        &cmd_state.cases, &cmd_state.esacs, &cmd_state.loops,
+    };
+    size_t i, n = sizeof(keywords)/sizeof(keywords[0]);
+    
+    for(i = 0; i < n; i++)
+    {
+        size_t len = strlen(keywords[i].name);
+        if(strncmp(p, keywords[i].name, len) == 0)
         {
-            /* nothing on the line to compare to */
-            if(cmd_len == 1)
+            /* make sure the keyword is followed by a separator operator */
+            char c = p[len];
+            if(c && !isspace(c) && !strchr(";&|()<>", c))
             {
-                return 1;
+                continue;
             }
-            i = 0;
+            
+            if(counts[keywords[i].which])
+            {
+                (*counts[keywords[i].which])++;
+            }
+            cmd_state.op = keywords[i].cmd;
+            return len;
         }
-        else
+    }
+    return 0;
+}
+
+
+/*
+ * Save the delimiter word of the here-document whose operator ('<<' or '<<-')
+ * ends at cmd[i]. Quotes are removed from the word, as the body is terminated by
+ * the unquoted word.
+ * 
+ * Returns the index of the last char of the word, or 0 on error.
+ */
+static size_t save_heredoc_mark(char *cmd, size_t i, int strip)
+{
+    size_t j, k = 0;
+    char quote = 0;
+    
+    /*
+     * Strictly speaking, POSIX says the heredoc word should come directly
+     * after the '<<' or '<<-' operator, with no intervening spaces.
+     * As most users will eventually enter a space between the word and
+     * the operator for readability, we'll accept this behavior in here.
+     */
+    while(cmd[i] == ' ' || cmd[i] == '\t')
+    {
+        i++;
+    }
+    
+    if(cmd[i] == '\0' || cmd[i] == '\n')
+    {
+        PRINT_ERROR(SHELL_NAME, "missing heredoc delimiter word after << or <<-");
+        return 0;
+    }
+    
+    if(heredocs >= FOPEN_MAX)
+    {
+        PRINT_ERROR(SHELL_NAME, "maximum number of heredocs reached (%d)", FOPEN_MAX);
+        return 0;
+    }
+    
+    for(j = i; cmd[j]; j++)
+    {
+        if(cmd[j] == quote)
         {
-            i =  nl - cmd + 1;
+            quote = 0;
         }
-        /* heredoc delimiter match */
-        if(strcmp(cmd+i, heredoc_mark[in_heredoc]) == 0)
+        else if(!quote && (cmd[j] == '\'' || cmd[j] == '"'))
         {
-            /* move on to the next heredoc, if any */
-            if(++in_heredoc < heredocs)
-            {
-                return 1;
-            }
-            in_heredoc = -1;
-            return 0;
+            quote = cmd[j];
+        }
+        else if(!quote && (isspace(cmd[j]) || strchr(";&|<>()", cmd[j])))
+        {
+            break;
+        }
+    }
+    
+    char *mark = malloc(j-i+2);
+    if(!mark)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "save heredoc delimiter word");
+        return 0;
+    }
+    
+    for( ; i < j; i++)
+    {
+        if(cmd[i] == quote)
+        {
+            quote = 0;
+        }
+        else if(!quote && (cmd[i] == '\'' || cmd[i] == '"'))
+        {
+            quote = cmd[i];
+        }
+        else if(cmd[i] == '\\' && quote != '\'' && i+1 < j)
+        {
+            mark[k++] = cmd[++i];
         }
         else
         {
-            return 1;
+            mark[k++] = cmd[i];
         }
     }
-
-    if(first_time)
+    mark[k++] = '\n';
+    mark[k  ] = '\0';
+    
+    if(heredoc_mark[heredocs])
+    {
+        free(heredoc_mark[heredocs]);
+    }
+    heredoc_mark [heredocs] = mark;
+    heredoc_strip[heredocs] = strip;
+    
+    /* the next lines belong to this heredoc, unless we're in an earlier one */
+    if(in_heredoc < 0)
     {
-        open_cb    = 0;
-        close_cb   = 0;
-        open_rb    = 0;
-        close_rb   = 0;
-        quotes     = 0;
-        __heredocs = 0;
+        in_heredoc = heredocs;
     }
+    heredocs++;
+    return j-1;
+}
 
-    if(cmd_len >= 2)
+
+/*
+ * Scan a line of input, updating the checker's state.
+ *
+ * Returns 1 if the line ends in an escaped newline, 0 if the line was scanned,
+ * -1 on error.
+ */
+static int scan_line(char *cmd, size_t cmd_len)
+{
+    size_t i, len;
+    char prev = '\n', c, t;
+    
+    for(i = 0; i < cmd_len; prev = cmd[i++])
     {
-        if(cmd[cmd_len-2] == '\\' && cmd[cmd_len-1] == '\n')
+        c = cmd[i];
+        t = top_ctx();
+        
+        /* nothing is special inside single quotes, except the closing quote */
+        if(t == '\'')
         {
-            /* check if the '\' is escaped itself */
-            char *p2 = cmd+cmd_len-2;
-            char *p1 = p2;
-            while(p1 >= cmd && *p1 == '\\')
+            if(c == '\'')
             {
-                p1--;
+                pop_ctx();
             }
-            /*
-             * Check how many consecutive backslashes we have. If we have
-             * an even number, the backslashes escape each other and the
-             * newline is not escaped, so we return the input line.
-             * If we have an odd number, the last backslash escapes the
-             * newline character and so we continue reading input.
-             */
-            if((p2-p1) % 2)
+            continue;
+        }
+        
+        if(c == '\\')
+        {
+            /* an escaped newline means the command continues on the next line */
+            if(cmd[i+1] == '\n' && i+2 == cmd_len)
             {
                 return 1;
             }
+            i++;
+            cmd_state.op = 0;
+            continue;
         }
-    }
-
-    int endme = 0;
-    
-    do
-    {
-        switch(cmd[i])
+        
+        /* $( $(( and ${ are recognized everywhere but in single quotes */
+        if(c == '$' && (cmd[i+1] == '(' || cmd[i+1] == '{'))
         {
-            case '{':
-                if(quotes == '\'')
+            i++;
+            if(cmd[i] == '(' && cmd[i+1] == '(')
+            {
+                i++;
+                push_ctx('A');
+            }
+            else
+            {
+                push_ctx(cmd[i]);
+                cmd_state.op = (cmd[i] == '(');
+            }
+            continue;
+        }
+        
+        switch(t)
+        {
+            case '"':
+                if(c == '"')
                 {
-                    break;
+                    pop_ctx();
                 }
+                else if(c == '`')
+                {
+                    push_ctx(c);
+                }
+                continue;
                 
-                open_cb++;
-                j = find_closing_brace(cmd+i, (quotes == '"') ? 1 : 0);
-                if(j == 0)  /* closing brace not found */
+            case '`':
+                if(c == '`')
                 {
-                    endme = 1;
+                    pop_ctx();
                 }
-                else
+                else if(c == '\'' || c == '"')
                 {
-                    close_cb++;
+                    push_ctx(c);
                 }
+                continue;
+                
+            case '{':               /* ${parameter} expansion */
+            case 'A':               /* $(( arithmetic expansion */
+                if(c == '\'' || c == '"' || c == '`')
+                {
+                    push_ctx(c);
+                }
+                else if(t == '{' && c == '}')
+                {
+                    pop_ctx();
+                }
+                else if(t == 'A' && c == ')' && cmd[i+1] == ')')
+                {
+                    i++;
+                    pop_ctx();
+                }
+                else if(t == 'A' && c == '(')
+                {
+                    push_ctx(c);
+                }
+                continue;
+        }
+        
+        /* we are outside quotes and expansions, or in a brace group or subshell */
+        switch(c)
+        {
+            case '\n':
+                cmd_state.op = 1;
                 break;
                 
-            case '(':
-                if(quotes == '\'')
+            case ' ':
+            case '\t':
+                break;
+                
+            case ';':
+            case '&':
+            case '|':
+                /* remember we have a separator operator, after which we can have a keyword */
+                cmd_state.op = 1;
+                break;
+                
+            case '\'':
+            case '"':
+            case '`':
+                push_ctx(c);
+                cmd_state.op = 0;
+                break;
+                
+            case '#':
+                /* skip comments */
+                if(strchr(" \t\n;&|()", prev))
                 {
-                    break;
+                    i = cmd_len-1;
                 }
+                cmd_state.op = 0;
+                break;
                 
-                open_rb++ ;
-                j = find_closing_brace(cmd+i, (quotes == '"') ? 1 : 0);
-                if(j == 0)  /* closing brace not found */
+            case '(':
+                /* (( introduces an arithmetic command */
+                if(cmd[i+1] == '(')
                 {
-                    endme = 1;
+                    i++;
+                    push_ctx('A');
+                    cmd_state.op = 0;
                 }
                 else
                 {
-                    close_rb++;
+                    push_ctx(c);
+                    cmd_state.op = 1;
                 }
                 break;
                 
-            case '\'':
-                /* single quotes has no effect inside double quotes */
-                if(quotes == '"')
+            case ')':
+                if(t == '(' &&
+                   cmd_state.ctx_cases[cmd_state.depth-1] == cmd_state.cases-cmd_state.esacs)
                 {
-                    break;
+                    pop_ctx();
+                    /* the '()' in a function definition is followed by the body */
+                    cmd_state.op = (prev == '(');
                 }
-                /* end of a partially started single-quoted string */
-                else if(quotes == '\'')
+                else
                 {
-                    quotes = 0;
-                    break;
+                    /* the end of a case pattern is followed by a command */
+                    cmd_state.op = (cmd_state.cases > cmd_state.esacs);
                 }
+                break;
                 
-                while(++i < cmd_len)
+            case '{':
+                /* '{' is a reserved word only if it is a word on its own */
+                if(strchr(" \t\n;&|()", prev) && (!cmd[i+1] || isspace(cmd[i+1])))
                 {
-                    if(cmd[i] == '\'')
-                    {
-                        break;
-                    }
+                    push_ctx('G');
+                    cmd_state.op = 1;
                 }
-                
-                /* closing quote not found */
-                if(cmd[i] != '\'')
+                else
                 {
-                    endme = 1;
-                    quotes = '\'';
+                    cmd_state.op = 0;
                 }
                 break;
                 
-            case '\\':
-                /* backslash has no effect inside single quotes */
-                if(quotes != '\'')
+            case '}':
+                if(t == 'G' && strchr(" \t\n;&", prev) &&
+                   (!cmd[i+1] || isspace(cmd[i+1]) || strchr(";&|)<>", cmd[i+1])))
                 {
-                    i++;
+                    pop_ctx();
                 }
+                cmd_state.op = 0;
                 break;
                 
-            case '"':
-            case '`':
-                /* double and back quotes have no effect inside single quotes */
-                if(quotes == '\'')
+            case '<':
+                cmd_state.op = 0;
+                if(cmd[i+1] != '<')
                 {
                     break;
                 }
-                /* end of a partially started quoted string */
-                else if(quotes == cmd[i])
+                i += 2;
+                /* <<< introduces here-strings (non-POSIX extension) */
+                if(cmd[i] == '<')
                 {
-                    quotes = 0;
                     break;
                 }
-
-                j = find_closing_quote(cmd+i, (quotes == '"') ? 1 : 0, 0);
-                if(j == 0)  /* closing quote not found */
+                
+                /* here-document redirection operators are '<<' and '<<-', according to POSIX */
+                if(cmd[i] == '-')
                 {
-                    endme = 1;
+                    i++;
+                    len = save_heredoc_mark(cmd, i, 1);
                 }
                 else
                 {
-                    quotes = cmd[i];
+                    len = save_heredoc_mark(cmd, i, 0);
                 }
-                break;
-
-            case '<':
-                if(quotes)
+                
+                if(len == 0)
                 {
-                    break;
+                    return -1;
                 }
-
-                if(cmd[i+1] == '<')
+                i = len;
+                break;
+                
+            default:
+                /* check for keywords (must be preceded by a separator operator) */
+                if(cmd_state.op && isalpha(c) && (len = check_keyword(cmd+i)))
                 {
-                    i += 2;
-                    /* <<< introduces here-strings (non-POSIX extension) */
-                    if(i < cmd_len && cmd[i] == '<')
-                    {
-                        break;
-                    }
-                    
-                    if(in_heredoc == -1)
-                    {
-                        in_heredoc = 0;
-                    }
-                    
-                    /* here-document redirection operators are '<<' and '<<-', according to POSIX */
-                    if(i < cmd_len && cmd[i] == '-')
-                    {
-                        i++;
-                    }
-                    
-                    /*
-                     * Strictly speaking, POSIX says the heredoc word should come directly
-                     * after the '<<' or '<<-' operator, with no intervening spaces.
-                     * As most users will eventually enter a space between the word and
-                     * the operator for readability, we'll accept this behavior in here.
-                     */
-                    while(isspace(cmd[i]))
-                    {
-                        i++;
-                    }
-                    
-                    if(cmd[i] == '\0')
-                    {
-                        PRINT_ERROR(SHELL_NAME, "missing heredoc delimiter word after << or <<-");
-                        return -1;
-                    }
-                    
-                    if(!heredoc_mark[__heredocs])
-                    {
-                        size_t j = i;
-                        while(cmd[j] && !isspace(cmd[j]) && cmd[j] != ';' && cmd[j] != '&')
-                        {
-                            j++;
-                        }
-                        heredoc_mark[__heredocs] = malloc(j-i+1);
-                        
-                        if(!heredoc_mark[__heredocs])
-                        {
-                            INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "save heredoc delimiter word");
-                            return -1;
-                        }
-                        
-                        strncpy(heredoc_mark[__heredocs], cmd+i, j-i);
-                        heredoc_mark[__heredocs][j-i  ] = '\n';
-                        heredoc_mark[__heredocs][j-i+1] = '\0';
-                    }
-                    heredocs++;
-                    __heredocs++;
+                    i += len-1;
+                    break;
                 }
+                cmd_state.op = 0;
                 break;
         }
-        
-        if(endme)
-        {
-            break;
-        }
-    } while(++i < cmd_len);
+    }
+    return 0;
+}
+
 
-    if(quotes)
+/*
+ * Check the saved state to see if the command is complete.
+ *
+ * Returns 1 if the command is incomplete, 0 if it is complete.
+ */
+static int cmd_state_incomplete(void)
+{
+    /* unclosed quotes, brackets or heredocs */
+    if(cmd_state.depth || in_heredoc >= 0)
     {
         return 1;
     }
-    if(open_cb && (open_cb != close_cb))
+    
+    /*
+     * check we don't have a for, while or until without a do-done group, and that
+     * every opening keyword is closed. we don't complain about extra closing
+     * keywords, and leave it to the parser to report the error.
+     */
+    if(cmd_state.loops > cmd_state.dos    || cmd_state.dos   > cmd_state.dones ||
+       cmd_state.ifs   > cmd_state.fis    || cmd_state.cases > cmd_state.esacs)
     {
         return 1;
     }
-    if(open_rb && (open_rb != close_rb))
+    return 0;
+}
+
+
+/*
+ * After user presses ENTER, check if he entered a full command or not.
+ * 
+ * We don't re-scan the previous lines of an incomplete command. Instead, the
+ * scanner's state (open quotes and brackets, pending heredocs and keyword counts)
+ * is saved at the end of each line, and the scan resumes from that state when the
+ * user enters the next line, so each line is scanned only once.
+ *
+ * Returns 1 if the command is incomplete, 0 if it is complete, -1 on error.
+ */
+int is_incomplete_cmd(int first_time)
+{
+    char   *cmd = cmdbuf;
+    size_t  cmd_len = strlen(cmd);
+    size_t  i = 0;
+
+    if(first_time)
     {
-        return 1;
+        memset(&cmd_state, 0, sizeof(cmd_state));
+        cmd_state.op = 1;
     }
+
+    /*
+     * if we are inside a here-document, check if the last entered line matches
+     * the here-document marker word, which signals the end of the here-document.
+     */
     if(in_heredoc >= 0)
     {
+        /* if no here-document mark is present, just wait for EOF by the user */
+        cmd[cmd_len-1] = '\0';
+        char *nl = strrchr(cmd, '\n');
+        cmd[cmd_len-1] = '\n';
+        if(!nl)
+        {
+            /* nothing on the line to compare to */
+            if(cmd_len == 1)
+            {
+                return 1;
+            }
+            i = 0;
+        }
+        else
+        {
+            i =  nl - cmd + 1;
+        }
+        
+        /* <<- strips leading tabs from the heredoc lines */
+        if(heredoc_strip[in_heredoc])
+        {
+            while(cmd[i] == '\t')
+            {
+                i++;
+            }
+        }
+        
+        /* heredoc delimiter match */
+        if(strcmp(cmd+i, heredoc_mark[in_heredoc]) == 0)
+        {
+            /* move on to the next heredoc, if any */
+            if(++in_heredoc < heredocs)
+            {
+                return 1;
+            }
+            in_heredoc = -1;
+            /* the command might continue after the heredoc */
+            return cmd_state_incomplete();
+        }
         return 1;
     }
+
+    int res = scan_line(cmd, cmd_len);
+    if(res)
+    {
+        return res;
+    }
+    return cmd_state_incomplete();
+}
+
+
+/*
+ * Add the given line to the incomplete command. The buffer is extended in
+ * big chunks, so that we don't have to reallocate it (and copy the previous
+ * lines) for every new line.
+ * 
+ * Returns 1 on success, 0 on failure.
+ */
+static int append_incomplete_cmd(char *line, size_t len)
+{
+    if(!incomplete_cmd)
+    {
+        incomplete_len  = 0;
+        incomplete_size = 0;
+    }
     
-    /* quick and dirty check for some important constructs (for, until, while loops, ...) */
-    cmd = incomplete_cmd ? incomplete_cmd : cmdbuf;
-    /* count the number of keywords we have on the line */
-    int dos = 0, ifs = 0, cases = 0;
-    int dones = 0, fis = 0, esacs = 0;
-    int loops = 0;
-    /* pointer to one of the above indices */
-    int *index = NULL;
-    /* flag to tell us if a keyword starts after a separator operator */
-    int op = 1;
-    /* pointer to the end of a keyword in input */
-    char *iend = NULL;
-    char *p, *p2;
-
-check:
-    p = cmd;
-    while(*p)
+    if(incomplete_len+len >= incomplete_size)
     {
-        switch(*p)
+        size_t newsz = incomplete_size ? incomplete_size : CMD_BUF_SIZE;
+        while(incomplete_len+len >= newsz)
         {
-            case ' ':
-            case '\t':
-                p++;
-                break;
+            newsz <<= 1;
+        }
+        
+        char *tmp = realloc(incomplete_cmd, newsz);
+        if(!tmp)
+        {
+            INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "save command line");
+            return 0;
+        }
+        incomplete_cmd  = tmp;
+        incomplete_size = newsz;
+    }
+    
+    memcpy(incomplete_cmd+incomplete_len, line, len);
+    incomplete_len += len;
+    incomplete_cmd[incomplete_len] = '\0';
+    return 1;
+}
 
-            case '\r':
-            case '\n':
-            case '&':
-            case ';':
-            case '|':
-                /* remember we have a separator operator, after which we can have a keyword */
-                op = 1;
-                p++;
-                break;
 
-            case '"':
-            case '\'':
-            case '`':
-                /* skip quoted strings */
-                p2 = p+1;
-                while(*p2 && *p2 != *p)
-                {
-                    p2++;
-                }
-                /* skip the closing quote */
-                if(*p2 == *p)
-                {
-                    p2++;
-                }
-                op = 0;
-                p = p2;
-                break;
+/*
+ * Check if the command buffer, which contains more than one line (such as when
+ * the user pastes a block of text), holds a complete command. We check the lines
+ * one at a time, as we do when the user types them, but without printing $PS2
+ * or redrawing anything between lines.
+ *
+ * On return, all but the last line are added to incomplete_cmd, and the command
+ * buffer holds the last line.
+ *
+ * Returns 1 if the command is incomplete, 0 if it is complete, -1 on error.
+ */
+static int is_incomplete_block(void)
+{
+    size_t len = strlen(cmdbuf);
+    char *block = malloc(len+1);
+    if(!block)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "check command");
+        return -1;
+    }
+    memcpy(block, cmdbuf, len+1);
 
-            default:
-                /* check for keywords */
-                if(isalpha(*p) && op)
-                {
-                    if(strncmp(p, "done", 4) == 0)
-                    {
-                        index = &dones;
-                        iend = p+4;
-                    }
-                    else if(strncmp(p, "do", 2) == 0)
-                    {
-                        index = &dos;
-                        iend = p+2;
-                    }
-                    else if(strncmp(p, "if", 2) == 0)
-                    {
-                        index = &ifs;
-                        iend = p+2;
-                    }
-                    else if(strncmp(p, "fi", 2) == 0)
-                    {
-                        index = &fis;
-                        iend = p+2;
-                    }
-                    else if(strncmp(p, "case", 4) == 0)
-                    {
-                        index = &cases;
-                        iend = p+4;
-                    }
-                    else if(strncmp(p, "esac", 4) == 0)
-                    {
-                        index = &esacs;
-                        iend = p+4;
-                    }
-                    else if(strncmp(p, "for", 3) == 0)
-                    {
-                        index = &loops;
-                        iend = p+3;
-                    }
-                    else if(strncmp(p, "while", 5) == 0 || strncmp(p, "until", 5) == 0)
-                    {
-                        index = &loops;
-                        iend = p+5;
-                    }
-                    else
-                    {
-                        index = NULL;
-                    }
-                }
-                else
-                {
-                    index = NULL;
-                }
-                
-                /*
-                 *  check if we've got a keyword (must be preceded by a separator
-                 *  operator or start of line).
-                 */
-                if(index)
-                {
-                    if(op)
-                    {
-                        /* make sure it is followed by a separator operator */
-                        if(!*iend || isspace(*iend) || *iend == '&' || *iend == ';' || *iend == '|')
-                        {
-                            (*index) += 1;
-                        }
-                    }
-                    p = iend;
-                }
-                else
-                {
-                    p++;
-                }
-                op = 0;
-                break;
+    int res = 0;
+    int first_time = incomplete_cmd ? 0 : 1;
+    char *line = block, *end = block+len, *nl;
+    
+    while(line < end)
+    {
+        nl = memchr(line, '\n', end-line);
+        if(!nl)
+        {
+            nl = end-1;
+        }
+        
+        /* add the previous line to the incomplete command */
+        if(line > block && !append_incomplete_cmd(cmdbuf, strlen(cmdbuf)))
+        {
+            res = -1;
+            break;
+        }
+        
+        memcpy(cmdbuf, line, nl-line+1);
+        cmdbuf[nl-line+1] = '\0';
+        res = is_incomplete_cmd(first_time);
+        if(res < 0)
+        {
+            break;
         }
+        first_time = 0;
+        line = nl+1;
     }
-    /* check the rest of the line */
-    if(cmd == incomplete_cmd)
+
+    free(block);
+    return res;
+}
+
+
+/*
+ * Insert text pasted by the user in bracketed paste mode into the command buffer,
+ * at the cursor position. Carriage returns are converted to newlines.
+ */
+static void insert_pasted_text(int tty)
+{
+    size_t len = 0;
+    char *text = get_pasted_text(tty, &len);
+    if(!text)
     {
-        cmd = cmdbuf;
-        goto check;
+        return;
     }
-    /* check we don't have a for, while or until without a do-done group */
-    if(loops && (!dos || !dones))
+    
+    char *p;
+    for(p = text; p < text+len; p++)
     {
-        return 1;
+        if(*p == '\r')
+        {
+            /* \r\n becomes \n */
+            if(p[1] == '\n')
+            {
+                memmove(p, p+1, text+len-p);
+                len--;
+            }
+            else
+            {
+                *p = '\n';
+            }
+        }
     }
-    /* check we have a balanced number of keywords (which can be zero) */
-    if((dos != dones) || (ifs != fis) || (cases != esacs))
+    
+    /* leave room for the newline and '\0' we add when the user presses ENTER */
+    if(cmdbuf_end+len+2 >= cmdbuf_size)
     {
-        return 1;
+        if(!ext_cmdbuf(&cmdbuf, &cmdbuf_size, cmdbuf_end+len+2-cmdbuf_size+CMD_BUF_SIZE))
+        {
+            INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "pasted text");
+            free(text);
+            return;
+        }
     }
-    return 0;
+    
+    memmove(cmdbuf+cmdbuf_index+len, cmdbuf+cmdbuf_index, cmdbuf_end-cmdbuf_index+1);
+    memcpy(cmdbuf+cmdbuf_index, text, len);
+    cmdbuf_index += len;
+    cmdbuf_end   += len;
+    free(text);
+    redraw_cmdline();
 }
 
 
@@ -1224,9 +1479,6 @@ size_t glue_cmd_pieces(void)
     {
         return cmdbuf_len;
     }
-    size_t incomplete_len = strlen(incomplete_cmd);
-    char tmp[cmdbuf_len+1];
-    strcpy(tmp, cmdbuf);
     if((cmdbuf_len+incomplete_len) >= cmdbuf_size)
     {
         /* TODO: not enough memory. we should react better to this error */
@@ -1235,9 +1487,13 @@ size_t glue_cmd_pieces(void)
             return 0;
         }
     }
-    strcpy(cmdbuf, incomplete_cmd);
-    strcat(cmdbuf, tmp);
+    /* move the last line up and put the previous lines before it */
+    memmove(cmdbuf+incomplete_len, cmdbuf, cmdbuf_len+1);
+    memcpy(cmdbuf, incomplete_cmd, incomplete_len);
     free(incomplete_cmd);
-    incomplete_cmd = NULL;
-    return cmdbuf_len+incomplete_len;
+    incomplete_cmd  = NULL;
+    cmdbuf_len     += incomplete_len;
+    incomplete_len  = 0;
+    incomplete_size = 0;
+    return cmdbuf_len;
 }
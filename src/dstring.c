@@ -82,6 +82,10 @@ int str_append(struct dstring_s *string, char *str, size_t str_len)
     else if((string->buf_len + str_len) >= string->buf_size)
     {
         size_t newsz = string->buf_size * 2;
+        while((string->buf_len + str_len) >= newsz)
+        {
+            newsz *= 2;
+        }
         char *newbuf = realloc(string->buf_base, newsz);
         
         if(!newbuf)
@@ -90,7 +94,7 @@ int str_append(struct dstring_s *string, char *str, size_t str_len)
         }
         
         string->buf_base = newbuf;
-        string->buf_size *= 2;
+        string->buf_size = newsz;
         string->buf_ptr = string->buf_base + string->buf_len;
     }
     
@@ -532,6 +532,12 @@ int extract_heredocs(struct source_s *src, struct node_s *cmd, int heredoc_count
         child->first_child->val_type = VAL_STR;
         free(body);
         
+        /* pre-split expandable bodies, so we don't rescan them on each execution */
+        if(child->val.chr == IO_HERE_EXPAND && !split_heredoc(child->first_child))
+        {
+            return 0;
+        }
+        
         /* skip to the first newline char after the heredoc body */
         p = p2;
         while(*p && *p != '\n')
@@ -559,3 +565,201 @@ int extract_heredocs(struct source_s *src, struct node_s *cmd, int heredoc_count
     tokenize(src);
     return 1;
 }
+
+
+/*
+ * Add a segment of the given node type and text to the body of a heredoc.
+ * 
+ * Returns 1 on success, 0 on error.
+ */
+static int add_heredoc_segment(struct node_s *body, enum node_type_e type, char *str, size_t len)
+{
+    struct node_s *seg = new_node(type);
+    if(!seg)
+    {
+        return 0;
+    }
+    seg->val_type = VAL_STR;
+    seg->val.str = get_malloced_strl(str, 0, len);
+    seg->lineno = body->lineno;
+    add_child_node(body, seg);
+    return 1;
+}
+
+
+/*
+ * Split the body of an expandable heredoc into literal and expansion segments,
+ * which we add as child nodes of the body node. Literal segments are NODE_VAR
+ * nodes that contain the text with the backslash escapes removed, while expansion
+ * segments are NODE_HEREDOC_EXPANSION nodes that contain the word to be expanded
+ * (a command substitution, or a parameter, arithmetic or ANSI-C expansion). This
+ * way, the body is scanned once when the heredoc is parsed, and executing the
+ * heredoc only involves expanding the expansion segments.
+ * 
+ * Returns 1 on success, 0 on error.
+ */
+int split_heredoc(struct node_s *body)
+{
+    char *p = body->val.str, *p2, *word;
+    size_t len, adv;
+    
+    if(!p || !*p)
+    {
+        return 1;
+    }
+    
+    /* literal text is collected here (it's never longer than the body) */
+    char *lit = malloc(strlen(p)+1);
+    size_t lit_len = 0;
+    if(!lit)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "storing here-document");
+        return 0;
+    }
+    
+    while(*p)
+    {
+        /* the word to expand (if any), and the number of chars to skip over */
+        word = p;
+        len  = 0;
+        adv  = 0;
+        switch(*p)
+        {
+            case '\\':
+                /* skip \\n */
+                if(p[1] == '\n')
+                {
+                    p++;
+                    break;
+                }
+
+                /* Skip backslash-quoted '`', '$' and '\' */
+                if(p[1] == '`' || p[1] == '$' || p[1] == '\\')
+                {
+                    p++;
+                }
+                lit[lit_len++] = *p;
+                break;
+
+            case '`':
+                /* Find the closing back quote */
+                if((len = find_closing_quote(p, 0, 0)) == 0)
+                {
+                    break;
+                }
+                len++;
+                break;
+
+            /*
+             * The $ sign might introduce:
+             * - ANSI-C strings: $''
+             * - arithmetic expansions (non-POSIX): $[]
+             * - parameter expansions: ${var} or $var
+             * - command substitutions: $()
+             * - arithmetic expansions (POSIX): $(())
+             */
+            case '$':
+                switch(p[1])
+                {
+                    case '\'':
+                        /* Find the closing quote */
+                        if((len = find_closing_quote(p+1, 0, 1)) != 0)
+                        {
+                            len += 2;
+                        }
+                        break;
+
+                    case '{':
+                    case '[':
+                    case '(':
+                        /* Find the closing brace */
+                        if((len = find_closing_brace(p+1, 0)) != 0)
+                        {
+                            len += 2;
+                        }
+                        break;
+
+                    case '#':
+                        /*
+                         * $#@ and $#* both give the same result as $# (ksh extension).
+                         */
+                        word = "$#";
+                        len  = 2;
+                        adv  = (p[2] == '@' || p[2] == '*') ? 3 : 2;
+                        break;
+
+                    case '@':
+                    case '*':
+                    case '!':
+                    case '?':
+                    case '$':
+                    case '-':
+                    case '_':
+                    case '<':
+                    case '0':
+                    case '1':
+                    case '2':
+                    case '3':
+                    case '4':
+                    case '5':
+                    case '6':
+                    case '7':
+                    case '8':
+                    case '9':
+                        len = 2;
+                        break;
+
+                    default:
+                        /* Var names must start with an alphabetic char or _ */
+                        if(!isalpha(p[1]) && p[1] != '_')
+                        {
+                            break;
+                        }
+                        p2 = p+1;
+                        /* Get the end of the var name */
+                        while(*p2 && (isalnum(*p2) || *p2 == '_'))
+                        {
+                            p2++;
+                        }
+                        len = p2-p;
+                        break;
+                }
+                
+                if(!len)
+                {
+                    lit[lit_len++] = *p;
+                }
+                break;
+
+            default:
+                lit[lit_len++] = *p;
+                break;
+        }
+        
+        if(len)
+        {
+            /* add the literal text before the expansion, then the expansion itself */
+            if((lit_len && !add_heredoc_segment(body, NODE_VAR, lit, lit_len)) ||
+               !add_heredoc_segment(body, NODE_HEREDOC_EXPANSION, word, len))
+            {
+                free(lit);
+                return 0;
+            }
+            lit_len = 0;
+            p += adv ? adv : len;
+        }
+        else
+        {
+            p++;
+        }
+    }
+    
+    /* add the trailing literal text */
+    if(lit_len && !add_heredoc_segment(body, NODE_VAR, lit, lit_len))
+    {
+        free(lit);
+        return 0;
+    }
+    free(lit);
+    return 1;
+}
@@ -42,6 +42,7 @@
 #define PRINT_ERROR(UTILITY, FORMAT, ...)               \
 do                                                      \
 {                                                       \
+    fflush(stdout);                                     \
     fprintf(stderr, "%s: %s: " FORMAT "\n",             \
             SOURCE_NAME, UTILITY, ##__VA_ARGS__);       \
 } while(0)
@@ -82,6 +83,8 @@ do                                                      \
 /* I/O file redirection extra flags (for io_file_s->extra_flags field) */
 #define NOCLOBBER_FLAG                  (1 << 0)    /* no-clobber (force creating a new file) */
 #define CLOOPEN_FLAG                    (1 << 1)    /* close-on-open (used when duplicating fds) */
+#define HEREDOC_FLAG                    (1 << 2)    /* fd holds a here-document we opened */
+#define PLAIN_PATH_FLAG                 (1 << 3)    /* path needs no word expansion */
 
 /* default file creation mask */
 #define FILE_MASK                       (S_IROTH|S_IWOTH|S_IRGRP|S_IWGRP|S_IRUSR|S_IWUSR)
@@ -168,6 +171,9 @@ do                                                      \
 #define DEBUG_TRAP_NUM                  34
 #define RETURN_TRAP_NUM                 35
 
+/* bit used by struct trap_overlay_s to mark one of the special traps above */
+#define TRAP_OVERLAY_BIT(n)             (1 << ((n)-ERR_TRAP_NUM))
+
 /* flags for the job_s structure's flags field */
 /* job is running in the foreground */
 #define JOB_FLAG_FORGROUND              (1 << 0)
@@ -201,17 +207,31 @@ do                                                      \
 /* the word had quotes before we called remove_quotes() on it */
 #define FLAG_WORD_HAD_QUOTES            (1 << 0)
 #define FLAG_WORD_HAD_DOUBLE_QUOTES     (1 << 1)
+/* the word is a pathname we got from pathname expansion (no quotes to remove) */
+#define FLAG_WORD_PATHNAME              (1 << 2)
+/* the word is a pattern whose pathname expansion was deferred */
+#define FLAG_WORD_PATTERN               (1 << 3)
+/* the word's brace expansion was deferred */
+#define FLAG_WORD_BRACES                (1 << 4)
 
 /* values of the add_spaces parameter of wordlist_to_str() */
 #define WORDLIST_ADD_SPACES             1
 #define WORDLIST_NO_SPACES              0
 
+/* char classes in the $IFS table returned by get_IFS_table() */
+#define IFS_SPACE                       (1 << 0)    /* $IFS whitespace char */
+#define IFS_DELIM                       (1 << 1)    /* other $IFS char */
+#define IFS_SPECIAL                     (1 << 2)    /* '\0', quote or backslash */
+#define is_IFS_char(table, c)           ((table)[(unsigned char)(c)] & (IFS_SPACE|IFS_DELIM))
+
 /* word expansion flags for the word_expand() function */
 #define FLAG_PATHNAME_EXPAND            (1 << 0)
 #define FLAG_REMOVE_QUOTES              (1 << 1)
 #define FLAG_FIELD_SPLITTING            (1 << 2)
 #define FLAG_STRIP_VAR_ASSIGN           (1 << 3)
 #define FLAG_EXPAND_VAR_ASSIGN          (1 << 4)
+/* mark patterns instead of expanding them (see get_loop_wordlist() in loops.c) */
+#define FLAG_PATHNAME_DEFER             (1 << 5)
 /* just a handy shortcut */
 #define FLAG_WORDEXP_ALL                (FLAG_PATHNAME_EXPAND | \
                                          FLAG_REMOVE_QUOTES |   \
@@ -303,6 +323,21 @@ struct word_s
     struct word_s *next;
 };
 
+/*
+ * The argument list of a simple command. The argument strings are stored one
+ * after the other in one string arena, and argv points into the arena (see
+ * word_expand_to_args() in wordexp.c).
+ */
+struct arg_list_s
+{
+    int     argc;               /* number of arguments */
+    int     argv_size;          /* number of alloc'd entries in argv */
+    char  **argv;               /* the arguments vector */
+    char   *buf;                /* the string arena */
+    size_t  buf_len;            /* number of used bytes in the arena */
+    size_t  buf_size;           /* number of alloc'd bytes in the arena */
+};
+
 /* struct for history list entries */
 struct histent_s
 {
@@ -329,14 +364,44 @@ struct io_file_s
 };
 
 /* struct to represent callframes */
+/*
+ * struct to hold a set of positional parameters. The struct, the params array
+ * and the strings are allocated in one block (see new_pos_params() in params.c).
+ */
+struct pos_params_s
+{
+    int    count  ;     /* the number of positional parameters ($#) */
+    int    changed;     /* set if the params were changed by `set` */
+    char **params ;     /* the positional parameters $1..$count */
+};
+
 struct callframe_s
 {
     char  *funcname;
     char  *srcfile ;
     int    lineno  ;
+    struct pos_params_s *pos_params;    /* NULL if we use the caller's params */
     struct callframe_s *prev;
 };
 
+/* struct to count the command line editor's terminal output */
+struct redraw_stats_s
+{
+    unsigned long keys  ;       /* keys read from the terminal */
+    unsigned long writes;       /* write() calls we made */
+    unsigned long bytes ;       /* bytes we wrote */
+};
+
+/* struct to report the statistics of the SIGCHLD ring buffer (see jobs.c) */
+struct child_event_stats_s
+{
+    unsigned long events  ;     /* child statuses the SIGCHLD handler saved */
+    unsigned long dropped ;     /* times the handler found the ring full */
+    unsigned long size    ;     /* current size of the ring */
+    unsigned long max_used;     /* max number of statuses waiting in the ring */
+    unsigned long pending ;     /* statuses waiting in the ring now */
+};
+
 /* struct for directory stack entries */
 struct dirstack_ent_s
 {
@@ -353,12 +418,28 @@ struct trap_item_s
     char *action_str;
 };
 
+/*
+ * struct to hold the special traps (ERR, CHLD, DEBUG and RETURN) that are
+ * reset when we enter a function or dot script, so we can restore them when
+ * we leave. A trap is only copied to the overlay if it was set on entry.
+ */
+struct trap_overlay_s
+{
+    /* bitmap of the traps that were reset on entry (see TRAP_OVERLAY_BIT) */
+    int   reset     ;
+    /* bitmap of the traps that were set on entry and are saved in traps[] */
+    int   saved     ;
+    /* the saved traps, indexed by trap number minus ERR_TRAP_NUM */
+    struct trap_item_s traps[TRAP_COUNT-ERR_TRAP_NUM];
+};
+
 
 /************************************
  * definitions of shell variables.
  ************************************/
 
 extern  struct    alias_s aliases[MAX_ALIASES];     /* alias.c */
+extern  unsigned  long alias_generation;            /* alias.c */
 extern  char      prompt[];                         /* prompt.c */
 extern  int       startup_finished;                 /* initsh.c */
 extern  size_t    terminal_row, terminal_col;       /* cmdline.c */
@@ -398,6 +479,7 @@ extern  int       HISTSIZE;
 extern  char      default_hist_filename[];
 extern  int       executing_trap;                       /* builtins/trap.c */
 extern  char     *cwd;                                  /* builtins/cd.c */
+extern  struct    redraw_stats_s redraw_stats;          /* redraw.c */
 
 
 /***********************************************
@@ -432,6 +514,12 @@ char   *read_cmd(void);
 int     is_incomplete_cmd(int first_time);
 size_t  glue_cmd_pieces(void);
 
+/* redraw.c */
+void    redraw_reset(void);
+void    redraw_cmdline(void);
+void    redraw_flush(void);
+void    redraw_finish(void);
+
 /* strbuf.c */
 void    init_str_hashtable(void);
 char   *__get_malloced_str(char *str);
@@ -445,6 +533,7 @@ int     get_screen_size(void);
 void    move_cur(int row, int col);
 void    clear_screen(void);
 void    set_terminal_color(int FG, int BG);
+void    bracketed_paste(int on);
 void    update_row_col(void);
 size_t  get_terminal_row(void);
 size_t  get_terminal_col(void);
@@ -498,14 +587,19 @@ char   *pos_params_expand(char *tmp, int in_double_quotes);
 struct  word_s *word_expand(char *orig_word, int flags);
 struct  word_s *word_expand_one_word(char *orig_word, int flags);
 char   *word_expand_to_str(char *word, int flags);
+int     word_expand_to_args(struct arg_list_s *args, char *orig_word, int flags);
+char   *arg_list_add(struct arg_list_s *args, char *str, size_t len);
+char   *arg_list_add_unquoted(struct arg_list_s *args, char *str);
 char   *wordlist_to_str(struct word_s *word, int add_spaces);
+void    free_word(struct word_s *word);
 void    free_all_words(struct word_s *first);
 struct  word_s *make_word(char *word);
-// void    skip_IFS_whitespace(char **__str, char *__IFS);
-char   *skip_IFS_whitespace(char *str, char *IFS);
-char   *skip_trailing_IFS_whitespace(char *str, char *strend, char *IFS);
-char   *skip_IFS_delim(char *str, char *IFS_space, char *IFS_delim);
-char   *skip_trailing_IFS_delim(char *str, char *strend, char *IFS_space, char *IFS_delim);
+struct  word_s *make_wordl(char *str, size_t len);
+unsigned char *get_IFS_table(char *IFS);
+char   *skip_IFS_whitespace(char *str, unsigned char *IFS_table);
+char   *skip_trailing_IFS_whitespace(char *str, char *strend, unsigned char *IFS_table);
+char   *skip_IFS_delim(char *str, unsigned char *IFS_table);
+char   *skip_trailing_IFS_delim(char *str, char *strend, unsigned char *IFS_table);
 // int     is_IFS_char(char c, char *IFS);
 
 char   *tilde_expand(char *s);
@@ -518,9 +612,14 @@ struct  word_s *field_split(char *str);
 
 /* shunt.c */
 char   *arithm_expand(char *__expr);
+char   *arithm_expand_recursive(char *str);
 int     get_ndigit(char c, int base, int *result);
 
 /* braceexp.c */
+struct  brace_gen_s;
+struct  brace_gen_s *brace_compile(char *str);
+char   *brace_next(struct brace_gen_s *gen);
+void    brace_free(struct brace_gen_s *gen);
 char  **brace_expand(char *str, size_t *count);
 int     is_num(char *str);
 
@@ -537,14 +636,21 @@ int     is_special_param(char *var_name);
 char   *get_all_pos_params_str(char which, int quoted);
 char   *get_pos_params_str(char which, int quoted, int offset, int count);
 int     pos_param_count(void);
-struct  symtab_entry_s *get_pos_param(int i);
+char   *get_pos_param(int i);
+void    set_pos_params(int count, char **params);
+void    shift_pos_params(int n);
 void    set_exit_status(int status);
 void    set_internal_exit_status(int status);
 void    reset_pos_params(void);
 void    set_local_pos_params(int count, char **params);
+void    free_local_pos_params(struct callframe_s *cf);
+void    keep_local_pos_params(void);
 
 /* main.c */
 int     parse_and_execute(struct source_s *src);
+int     parse_and_execute_keep(struct source_s *src, struct node_s **trees);
+int     execute_cmd_trees(struct source_s *src, struct node_s *trees);
+void    free_cmd_trees(struct node_s *trees);
 int     read_file(char *filename, struct source_s *src);
 
 /* builtins/exit.c */
@@ -583,6 +689,7 @@ void    init_alpha_list(struct alpha_list_s *list);
 void    free_alpha_list(struct alpha_list_s *list);
 void    print_alpha_list(struct alpha_list_s *list);
 void    add_to_alpha_list(struct alpha_list_s *list, char *str);
+void    sort(char *list[], int count);
 char   *alpha_list_make_str(const char *fmt, ...);
 
 /* jobs.c */
@@ -610,6 +717,11 @@ void    add_pid_to_job(struct job_s *job, pid_t pid);
 void    print_status_message(struct job_s *job, pid_t pid, int status, int output_pid, FILE *out);
 void    remove_dead_jobs(void);
 void    clear_deadlist(void);
+struct  job_s *next_completed_job(pid_t *pids, int count);
+int     queue_child_event(pid_t pid, int status);
+void    drain_child_events(void);
+void    discard_child_events(void);
+void    get_child_event_stats(struct child_event_stats_s *stats);
 
 /* builtins/set.c */
 int     option_set(char which);
@@ -626,9 +738,10 @@ void    do_posix(int on);
 void    init_traps(void);
 void    reset_nonignored_traps(void);
 void    trap_handler(int signum);
-struct  trap_item_s *save_trap(char *name);
-int     reset_trap(char *name);
-void    restore_trap(char *name, struct trap_item_s *saved);
+void    trap_overlay_push(struct trap_overlay_s *overlay, int traps);
+void    trap_overlay_pop(struct trap_overlay_s *overlay, int keep);
+void    reset_trap(int n);
+void    free_trap_action(struct trap_item_s *trap);
 struct  trap_item_s *get_trap_item(char *trap);
 void    block_traps(void);
 void    unblock_traps(void);
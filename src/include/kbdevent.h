@@ -67,6 +67,7 @@ extern char using_con;
 #define NUM_KEY         1029
 #define DEL_KEY         1030
 #define RIGHT_KEY       1031
+#define PASTE_KEY       1032
 
 #define BACKSPACE_KEY   '\b'
 #define TAB_KEY         '\t'
@@ -91,5 +92,6 @@ extern char VLNEXT_KEY;
 /* kbdevent2.c */
 int  rawon(void);
 int  get_next_key(int tty);
+char *get_pasted_text(int tty, size_t *len);
 
 #endif
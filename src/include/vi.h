@@ -23,8 +23,6 @@
 #define LSH_VI
 
 /* vi_keys.c */
-void clear_cmd(int startat);
-void output_cmd(void);
 void do_insert(char c);
 void do_kill_key(void);
 void do_del_key(int count);
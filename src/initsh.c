@@ -481,7 +481,6 @@ void initsh(char **argv)
     /* init shell variables */
     init_shell_vars(pw->pw_name, pw->pw_gid, argv[0]);
   
-    setbuf(stdout, NULL);
     ALT_MASK   = 0; 
     CTRL_MASK  = 0; 
     SHIFT_MASK = 0;
@@ -787,6 +786,8 @@ int parse_shell_args(int argc, char **argv, struct source_s *src)
     set_optionx(OPTION_SHIFT_VERBOSE       , 1);
     /* clear the screen on startup */
     set_optionx(OPTION_CLEAR_SCREEN        , 1);
+    /* insert pasted text in one go */
+    set_optionx(OPTION_BRACKET_PASTE       , 1);
     /* automatically add '/' and ' ' as suffix when doing filename completions */
     set_optionx(OPTION_ADD_SUFFIX          , 1);
     /* recognize only executables during filename completion */
@@ -804,7 +805,6 @@ int parse_shell_args(int argc, char **argv, struct source_s *src)
     /* now read command-line options */
     struct symtab_entry_s *entry;
     int    i             = 1;
-    int    param         = 0;
     int    expect_cmdstr = 0;
     int    islogin       = 0;
     char   end_loop      = 0;
@@ -1049,19 +1049,11 @@ int parse_shell_args(int argc, char **argv, struct source_s *src)
         }
     }
 
-    /* parse the arguments, if any, adding them as positional parameters */
-    char buf[32];
-    for( ; i < argc; i++)
+    /* the rest of the arguments, if any, are the positional parameters */
+    if(i < argc)
     {
-        sprintf(buf, "%d", ++param);
-        entry = add_to_symtab(buf);
-        symtab_entry_setval(entry, argv[i]);
+        set_pos_params(argc-i, &argv[i]);
     }
-    
-    /* save the positional parameters count in $# */
-    entry = add_to_symtab("#");
-    sprintf(buf, "%d", param);
-    symtab_entry_setval(entry, buf);
 
     /* if not an interactive shell ... */
     if(!interactive_shell)
@@ -33,9 +33,11 @@
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
+#include <stdatomic.h>
 #include "include/cmd.h"
 #include "include/sig.h"
 #include "builtins/builtins.h"
+#include "builtins/setx.h"
 #include "backend/backend.h"
 #include "symtab/symtab.h"
 #include "error/error.h"
@@ -65,22 +67,347 @@ int prev_job     = 0;
 #define OUTPUT_STATUS_PIDS_ONLY     (1 << 3)    /* output only the job process ids */
 #define OUTPUT_STATUS_VERBOSE       (1 << 4)    /* output verbose info about the job */
 
-/* 
- * struct to hold the list of dead process whose status hasn't been added to
- * the jobs table yet.
- */
-struct
+/* struct to hold the pid and status of a child process that changed status */
+struct child_event_s
 {
     pid_t pid;
     int   status;
-} deadlist[32];
+};
+
+/* 
+ * List of dead processes whose status hasn't been added to the jobs table yet.
+ * The list is only accessed from the shell's main flow (never from a signal
+ * handler), so we can grow it as needed.
+ */
+struct child_event_s *deadlist = NULL;
+
+/* allocated size of the deadlist */
+int deadlist_size = 0;
 
-/* max number of deadlist members */
-#define DEADLIST_MAX    32
+/* initial size of the deadlist */
+#define DEADLIST_INITIAL_SIZE       32
 
 /* current index in the deadlist */
 int listindex = 0;
 
+/*
+ * Ring buffer in which the SIGCHLD handler saves the pids and statuses of the
+ * child processes it reaps, to be processed later by drain_child_events(). The
+ * handler is the only producer, and the shell's main flow is the only consumer,
+ * so the ring needs no locks: the handler writes an entry before advancing the
+ * tail, and we read an entry before advancing the head. The head and tail are
+ * free-running counters, and the ring size is a power of 2.
+ *
+ * The ring is grown by the consumer (with SIGCHLD blocked for the copy) when it
+ * gets more than half full. If the ring is full, the handler leaves the rest of
+ * the children unreaped and counts a dropped event, and we reap them ourselves
+ * when we next drain the ring, so that no status is lost.
+ */
+#define CHILD_RING_INITIAL_SIZE     64
+#define CHILD_RING_MAX_SIZE         (64*1024)
+
+struct child_event_s  child_ring_initial[CHILD_RING_INITIAL_SIZE];
+struct child_event_s *child_ring = child_ring_initial;
+unsigned int child_ring_size = CHILD_RING_INITIAL_SIZE;
+
+atomic_uint   child_ring_head     = 0;
+atomic_uint   child_ring_tail     = 0;
+atomic_int    child_ring_overflow = 0;      /* set if the handler left children unreaped */
+atomic_ulong  child_events_total  = 0;
+atomic_ulong  child_events_dropped = 0;
+unsigned long child_ring_max_used  = 0;
+
+/*
+ * Index of the pids of the processes in the jobs table, so that we can find the
+ * job of a child process without searching the whole table. This is an open
+ * addressing hash table that maps each pid to the job's slot in jobs_table[].
+ * The SIGCHLD handler searches the index, so we only modify it with SIGCHLD
+ * blocked.
+ */
+struct pid_index_s
+{
+    pid_t pid;
+    int   slot;
+};
+
+struct pid_index_s *pid_index = NULL;
+int pid_index_size  = 0;        /* power of 2 */
+int pid_index_count = 0;
+
+/* set if we failed to grow the index, in which case we search the jobs table */
+int pid_index_failed = 0;
+
+/*
+ * Queue of the background jobs that finished execution, in the order in which
+ * they finished. Used by `wait -n` to get the next finished job without searching
+ * the jobs table. Entries of jobs that have since been removed from the jobs table
+ * (for example, after we reported them as done) are skipped when we read the
+ * queue, and dropped when the queue fills up. As there can't be more than
+ * MAX_JOBS finished jobs in the table, the queue never overflows.
+ */
+struct completion_s
+{
+    pid_t pid;          /* the pid of the job's first process */
+    int   job_num;      /* the job's number, in case the pid was reused */
+};
+
+#define COMPLETION_QUEUE_SIZE   (MAX_JOBS+1)
+
+struct completion_s completion_queue[COMPLETION_QUEUE_SIZE];
+int completion_head  = 0;
+int completion_count = 0;
+
+
+/*
+ * Return the index at which the given pid is stored in the pid index, or the
+ * index of the empty entry where it should be added.
+ */
+static int pid_index_find(pid_t pid)
+{
+    int i = (unsigned)pid & (pid_index_size-1);
+    while(pid_index[i].pid && pid_index[i].pid != pid)
+    {
+        i = (i+1) & (pid_index_size-1);
+    }
+    return i;
+}
+
+
+/*
+ * Double the size of the pid index. Called with SIGCHLD blocked.
+ * 
+ * Returns 1 on success, 0 on failure.
+ */
+static int pid_index_grow(void)
+{
+    int i, oldsize = pid_index_size;
+    struct pid_index_s *old = pid_index;
+    struct pid_index_s *new = calloc(oldsize ? oldsize*2 : 64, sizeof(struct pid_index_s));
+    if(!new)
+    {
+        return 0;
+    }
+
+    pid_index = new;
+    pid_index_size = oldsize ? oldsize*2 : 64;
+    for(i = 0; i < oldsize; i++)
+    {
+        if(old[i].pid)
+        {
+            pid_index[pid_index_find(old[i].pid)] = old[i];
+        }
+    }
+
+    if(old)
+    {
+        free(old);
+    }
+    return 1;
+}
+
+
+/*
+ * Add the pid of a process in the jobs table's given slot to the pid index.
+ * Called with SIGCHLD blocked.
+ */
+static void pid_index_add(pid_t pid, int slot)
+{
+    if((pid_index_count+1)*2 > pid_index_size && !pid_index_grow())
+    {
+        pid_index_failed = 1;
+        return;
+    }
+
+    int i = pid_index_find(pid);
+    if(!pid_index[i].pid)
+    {
+        pid_index_count++;
+    }
+    pid_index[i].pid  = pid;
+    pid_index[i].slot = slot;
+}
+
+
+/*
+ * Remove a pid from the pid index. Entries following the removed one are moved
+ * back, so that we don't need tombstones. Called with SIGCHLD blocked.
+ */
+static void pid_index_remove(pid_t pid)
+{
+    if(!pid_index_size)
+    {
+        return;
+    }
+
+    int mask = pid_index_size-1;
+    int i = pid_index_find(pid), j = i;
+    if(!pid_index[i].pid)
+    {
+        return;
+    }
+    pid_index_count--;
+
+    while(1)
+    {
+        pid_index[i].pid = 0;
+        while(1)
+        {
+            j = (j+1) & mask;
+            if(!pid_index[j].pid)
+            {
+                return;
+            }
+            int k = (unsigned)pid_index[j].pid & mask;
+            /* leave the entry at j alone if its home lies cyclically in (i, j] */
+            if((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            {
+                continue;
+            }
+            break;
+        }
+        pid_index[i] = pid_index[j];
+        i = j;
+    }
+}
+
+
+/*
+ * Add (if add is non-zero) or remove the pids of the processes of the given job,
+ * which is in the jobs table, to/from the pid index.
+ */
+static void index_job(struct job_s *job, int add)
+{
+    int i;
+    sigset_t sigset;
+    if(!job->pids || job < &jobs_table[0] || job >= &jobs_table[MAX_JOBS])
+    {
+        return;
+    }
+
+    SIGNAL_BLOCK(SIGCHLD, sigset);
+    for(i = 0; i < job->proc_count; i++)
+    {
+        if(job->pids[i])
+        {
+            if(add)
+            {
+                pid_index_add(job->pids[i], job-jobs_table);
+            }
+            else
+            {
+                pid_index_remove(job->pids[i]);
+            }
+        }
+    }
+    SIGNAL_UNBLOCK(sigset);
+}
+
+
+/*
+ * Check if a completion queue entry still refers to a finished job in the jobs
+ * table. Returns the job if so, NULL otherwise.
+ */
+static struct job_s *completed_job(struct completion_s *c)
+{
+    struct job_s *job = get_job_by_any_pid(c->pid);
+    if(job && job->job_num == c->job_num && job->child_exits == job->proc_count)
+    {
+        return job;
+    }
+    return NULL;
+}
+
+
+/*
+ * Add a finished background job to the completion queue. Called when the job's
+ * last process exits, which might happen in the SIGCHLD handler.
+ */
+static void queue_completion(struct job_s *job)
+{
+    int i, j;
+    if(completion_count == COMPLETION_QUEUE_SIZE)
+    {
+        /* drop the entries of the jobs that are not in the jobs table anymore */
+        for(i = 0, j = 0; i < COMPLETION_QUEUE_SIZE; i++)
+        {
+            struct completion_s *c = &completion_queue[(completion_head+i) % COMPLETION_QUEUE_SIZE];
+            if(completed_job(c))
+            {
+                completion_queue[(completion_head+j++) % COMPLETION_QUEUE_SIZE] = *c;
+            }
+        }
+        completion_count = j;
+
+        if(completion_count == COMPLETION_QUEUE_SIZE)
+        {
+            return;
+        }
+    }
+
+    i = (completion_head+completion_count++) % COMPLETION_QUEUE_SIZE;
+    completion_queue[i].pid     = job->pids[0];
+    completion_queue[i].job_num = job->job_num;
+}
+
+
+/*
+ * Get the background job that finished first and is not yet waited for, and
+ * remove it from the completion queue. If pids is not NULL, only the jobs whose
+ * first process's pid is one of the count pids in the list are considered.
+ * Should be called with SIGCHLD blocked.
+ *
+ * Returns the job, or NULL if none of the jobs has finished.
+ */
+struct job_s *next_completed_job(pid_t *pids, int count)
+{
+    int i, j;
+    drain_child_events();
+    for(i = 0; i < completion_count; i++)
+    {
+        struct completion_s *c = &completion_queue[(completion_head+i) % COMPLETION_QUEUE_SIZE];
+        struct job_s *job = completed_job(c);
+
+        if(!job)
+        {
+            /* stale entry. pop it if it's at the head of the queue */
+            if(i == 0)
+            {
+                completion_head = (completion_head+1) % COMPLETION_QUEUE_SIZE;
+                completion_count--;
+                i--;
+            }
+            continue;
+        }
+
+        if(pids)
+        {
+            for(j = 0; j < count; j++)
+            {
+                if(pids[j] == c->pid)
+                {
+                    break;
+                }
+            }
+
+            if(j == count)
+            {
+                continue;
+            }
+        }
+
+        /* remove the entry, moving the ones after it up */
+        for(j = i+1; j < completion_count; j++)
+        {
+            completion_queue[(completion_head+j-1) % COMPLETION_QUEUE_SIZE] =
+                completion_queue[(completion_head+j) % COMPLETION_QUEUE_SIZE];
+        }
+        completion_count--;
+        return job;
+    }
+
+    return NULL;
+}
+
 
 /*
  * Update the job table entry with the exit status of the process with the
@@ -100,6 +427,7 @@ void add_pid_to_job(struct job_s *job, pid_t pid)
         job->pgid = pid;
         job->pids[0] = pid;
         job->proc_count = 1;
+        index_job(job, 1);
         return;
     }
     
@@ -119,6 +447,7 @@ void add_pid_to_job(struct job_s *job, pid_t pid)
         {
             job->pids[i] = pid;
             job->proc_count++;
+            index_job(job, 1);
             break;
         }
     }
@@ -380,6 +709,210 @@ void clear_deadlist(void)
 }
 
 
+/*
+ * Save the status of a child process reaped by the SIGCHLD handler in the ring
+ * buffer. Called from the signal handler, so we only use async-signal-safe
+ * operations here.
+ * 
+ * Returns 1 if there is room in the ring for another status, 0 if the ring is
+ * full. If pid is 0, we only check for room.
+ */
+int queue_child_event(pid_t pid, int status)
+{
+    unsigned int head = atomic_load_explicit(&child_ring_head, memory_order_acquire);
+    unsigned int tail = atomic_load_explicit(&child_ring_tail, memory_order_relaxed);
+
+    if(tail-head >= child_ring_size)
+    {
+        /* the children we leave unreaped will be reaped in drain_child_events() */
+        atomic_store_explicit(&child_ring_overflow, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&child_events_dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    if(pid)
+    {
+        child_ring[tail & (child_ring_size-1)].pid    = pid;
+        child_ring[tail & (child_ring_size-1)].status = status;
+        atomic_store_explicit(&child_ring_tail, tail+1, memory_order_release);
+        atomic_fetch_add_explicit(&child_events_total, 1, memory_order_relaxed);
+    }
+    return 1;
+}
+
+
+/*
+ * Double the size of the ring buffer. The entries are copied with SIGCHLD blocked,
+ * so that the handler doesn't add to the ring while we're moving it.
+ */
+static void grow_child_ring(void)
+{
+    unsigned int newsize = child_ring_size*2;
+    struct child_event_s *newring = malloc(newsize * sizeof(struct child_event_s));
+    if(!newring)
+    {
+        return;
+    }
+
+    sigset_t sigset;
+    SIGNAL_BLOCK(SIGCHLD, sigset);
+
+    unsigned int head = atomic_load_explicit(&child_ring_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&child_ring_tail, memory_order_relaxed);
+    unsigned int i;
+    for(i = 0; head+i != tail; i++)
+    {
+        newring[i] = child_ring[(head+i) & (child_ring_size-1)];
+    }
+
+    struct child_event_s *oldring = child_ring;
+    child_ring = newring;
+    child_ring_size = newsize;
+    atomic_store_explicit(&child_ring_head, 0, memory_order_relaxed);
+    atomic_store_explicit(&child_ring_tail, i, memory_order_relaxed);
+
+    SIGNAL_UNBLOCK(sigset);
+
+    if(oldring != child_ring_initial)
+    {
+        free(oldring);
+    }
+}
+
+
+/*
+ * Update the jobs table with the status of a child process, as we used to do
+ * in the SIGCHLD handler. last_stopped is set to the job number of the last
+ * stopped job.
+ */
+static void process_child_event(pid_t pid, int status, int *last_stopped)
+{
+    notice_termination(pid, status, 1);
+    struct job_s *job = get_job_by_any_pid(pid);
+
+    if(job)
+    {
+        if(WIFSTOPPED(job->status))
+        {
+            *last_stopped = job->job_num;
+        }
+        else if(job->child_exits == job->proc_count && *last_stopped == job->job_num)
+        {
+            *last_stopped = 0;
+        }
+    }
+}
+
+
+/*
+ * Process the child status changes the SIGCHLD handler saved in the ring buffer,
+ * and reap any children it left unreaped because the ring was full. Called from
+ * the shell's main flow, never from a signal handler.
+ *
+ * As processing a status might execute the CHLD trap, which might call us
+ * again, we re-read the head of the ring for every entry.
+ */
+void drain_child_events(void)
+{
+    int changed = 0, last_stopped = 0, status;
+    unsigned int head, tail;
+    pid_t pid;
+
+    head = atomic_load_explicit(&child_ring_head, memory_order_relaxed);
+    tail = atomic_load_explicit(&child_ring_tail, memory_order_acquire);
+    if(tail-head > child_ring_max_used)
+    {
+        child_ring_max_used = tail-head;
+    }
+
+    /* grow the ring if it was getting full */
+    if(((tail-head)*2 > child_ring_size ||
+        atomic_load_explicit(&child_ring_overflow, memory_order_relaxed)) &&
+       child_ring_size < CHILD_RING_MAX_SIZE)
+    {
+        grow_child_ring();
+    }
+
+    while(1)
+    {
+        head = atomic_load_explicit(&child_ring_head, memory_order_relaxed);
+        tail = atomic_load_explicit(&child_ring_tail, memory_order_acquire);
+        if(head == tail)
+        {
+            break;
+        }
+
+        struct child_event_s event = child_ring[head & (child_ring_size-1)];
+        atomic_store_explicit(&child_ring_head, head+1, memory_order_release);
+        process_child_event(event.pid, event.status, &last_stopped);
+        changed = 1;
+    }
+
+    /* reap the children the handler couldn't save */
+    if(atomic_exchange_explicit(&child_ring_overflow, 0, memory_order_relaxed))
+    {
+        while((pid = waitpid(-1, &status, WUNTRACED|WCONTINUED|WNOHANG)) > 0)
+        {
+            process_child_event(pid, status, &last_stopped);
+            changed = 1;
+        }
+    }
+
+    if(changed)
+    {
+        struct job_s *job = last_stopped ? get_job_by_jobid(last_stopped) : NULL;
+        if(job)
+        {
+            set_cur_job(job);
+        }
+        else
+        {
+            reset_cur_job();
+        }
+
+        /* tcsh extensions */
+        if(optionx_set(OPTION_LIST_JOBS_LONG))
+        {
+            jobs_builtin(2, (char *[]){ "jobs", "-l", NULL });
+        }
+        else if(optionx_set(OPTION_LIST_JOBS))
+        {
+            jobs_builtin(1, (char *[]){ "jobs", NULL });
+        }
+
+        /* in tcsh, special alias jobcmd is run before running commands and when jobs change state */
+        run_alias_cmd("jobcmd");
+    }
+}
+
+
+/*
+ * Discard the child statuses we inherited from our parent shell. Called in the
+ * child process after fork(), as the statuses belong to our parent's children.
+ */
+void discard_child_events(void)
+{
+    atomic_store_explicit(&child_ring_head,
+                          atomic_load_explicit(&child_ring_tail, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&child_ring_overflow, 0, memory_order_relaxed);
+    listindex = 0;
+}
+
+
+/*
+ * Get the statistics of the ring buffer (printed by `dump children`).
+ */
+void get_child_event_stats(struct child_event_stats_s *stats)
+{
+    stats->events   = atomic_load(&child_events_total);
+    stats->dropped  = atomic_load(&child_events_dropped);
+    stats->size     = child_ring_size;
+    stats->max_used = child_ring_max_used;
+    stats->pending  = atomic_load(&child_ring_tail)-atomic_load(&child_ring_head);
+}
+
+
 /*
  * Check for POSIX list terminators: ';', '\n', and '&'.
  * 
@@ -816,8 +1349,10 @@ int replace_and_run(int startat, int argc, char **argv)
                 continue;
             }
             
-            /* free the old arg and store the modified one in its place */
-            free_malloced_str(argv[i]);
+            /*
+             * store the modified arg in place of the old one, which is freed
+             * by our caller (see free_argv() in backend.c).
+             */
             argv[i] = p;
         }
     }
@@ -1056,6 +1591,9 @@ int jobs_builtin(int argc, char **argv)
  */
 void check_on_children(void)
 {
+    /* get the statuses the SIGCHLD handler has collected */
+    drain_child_events();
+    
     /* check for children who died while we were away */
     int i, status = 0;
     for(i = 0; i < listindex; i++)
@@ -1100,8 +1638,15 @@ void check_on_children(void)
         struct job_s *job = get_job_by_any_pid(pid);
         if(job)
         {
-            //set_pid_exit_status(job, pid, status);
+            set_pid_exit_status(job, pid, status);
             set_job_exit_status(job, pid, status);
+
+            if((WIFEXITED(status) || WIFSIGNALED(status)) &&
+               job->child_exits == job->proc_count && !FOREGROUND_JOB(job))
+            {
+                queue_completion(job);
+            }
+
             /* report job status only if the last command finished execution */
             if(job->child_exits == job->proc_count)
             {
@@ -1166,8 +1711,32 @@ void notice_termination(pid_t pid, int status, int add_to_deadlist)
         }
         
         /* zombie not found. add a new entry */
-        if(i == listindex && listindex < DEADLIST_MAX)
+        if(i == listindex)
         {
+            if(listindex == deadlist_size)
+            {
+                int newsize = deadlist_size ? deadlist_size*2 : DEADLIST_INITIAL_SIZE;
+                struct child_event_s *newlist = realloc(deadlist, newsize * sizeof(struct child_event_s));
+                if(newlist)
+                {
+                    deadlist = newlist;
+                    deadlist_size = newsize;
+                }
+            }
+
+            /*
+             * if the list is full, drop the oldest entry, as the caller is more
+             * likely to be waiting for the newest one (see wait_on_child()).
+             */
+            if(listindex == deadlist_size)
+            {
+                if(!listindex)
+                {
+                    return;
+                }
+                memmove(&deadlist[0], &deadlist[1], (listindex-1) * sizeof(struct child_event_s));
+                listindex--;
+            }
             deadlist[listindex].pid    = pid;
             deadlist[listindex].status = status;
             listindex++;
@@ -1213,6 +1782,13 @@ void notice_termination(pid_t pid, int status, int add_to_deadlist)
         set_pid_exit_status(job, pid, status);
         set_job_exit_status(job, pid, status);
 
+        /* let `wait -n` know the job is done */
+        if((WIFEXITED(status) || WIFSIGNALED(status)) &&
+           job->child_exits == job->proc_count && !FOREGROUND_JOB(job))
+        {
+            queue_completion(job);
+        }
+
         if(CONTROLLED_JOB(job))
         {
             /*
@@ -1247,6 +1823,9 @@ void notice_termination(pid_t pid, int status, int add_to_deadlist)
  */
 int rip_dead(pid_t pid)
 {
+    /* get the statuses the SIGCHLD handler has collected */
+    drain_child_events();
+    
     /* the deadlist is empty */
     if(!listindex)
     {
@@ -1262,10 +1841,9 @@ int rip_dead(pid_t pid)
             int status = deadlist[i].status;
 
             /* shift down by one */
-            for( ; i < listindex; i++)
+            for( ; i < listindex-1; i++)
             {
-                deadlist[i].pid    = deadlist[i+1].pid;
-                deadlist[i].status = deadlist[i+1].status;
+                deadlist[i] = deadlist[i+1];
             }
 
             deadlist[i].pid    = 0;
@@ -1295,6 +1873,21 @@ struct job_s *get_job_by_any_pid(pid_t pid)
     }
 
     struct job_s *job;
+    if(pid_index_count)
+    {
+        int i = pid_index_find(pid);
+        if(pid_index[i].pid)
+        {
+            return &jobs_table[pid_index[i].slot];
+        }
+    }
+
+    /* the pid is not in the index. search the table if we failed to index some pids */
+    if(!pid_index_failed)
+    {
+        return NULL;
+    }
+
     for(job = &jobs_table[0]; job < &jobs_table[MAX_JOBS]; job++)
     {
         int i;
@@ -1522,6 +2115,7 @@ struct job_s *add_job(struct job_s *new_job)
             job->job_num = ++jnum;
             new_job->job_num = jnum;
             total_jobs++;
+            index_job(job, 1);
 
             /* set $! and the current job if that is a background job */
             set_cur_job(job);
@@ -1625,6 +2219,7 @@ int remove_job(struct job_s *job)
     int last_suspended = 0;
     
     /* free the job's memory */
+    index_job(job, 0);
     free_job(job, 0);
 
     /* if this is the current job, bring on the prev job to be current */
@@ -1643,6 +2238,8 @@ int remove_job(struct job_s *job)
         }
         
         memcpy(job, job2, sizeof(struct job_s));
+        /* point the job's pids to the job's new slot */
+        index_job(job, 1);
         job2->job_num     = 0;
         job2->commandstr  = NULL;
         job2->proc_count  = 0;
@@ -1674,6 +2271,12 @@ int remove_job(struct job_s *job)
     
     total_jobs--;
     
+    /* all the jobs are gone, we can try the pid index again */
+    if(!total_jobs)
+    {
+        pid_index_failed = 0;
+    }
+    
     return res;
 };
 
@@ -19,6 +19,9 @@
  *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Macro definitions needed to use memmem() */
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -50,6 +53,22 @@ char INTR_KEY  ;
 char EOF_KEY   ;
 char VLNEXT_KEY;
 
+/*
+ * Bytes we read from the terminal but haven't processed yet. This happens when
+ * the user types (or pastes) more text after the end of a bracketed paste.
+ */
+static char  *pushback_buf   = NULL;
+static size_t pushback_size  = 0;
+static size_t pushback_start = 0;
+static size_t pushback_end   = 0;
+
+/* the sequence the terminal sends at the end of a bracketed paste */
+#define PASTE_END       "\x1b[201~"
+#define PASTE_END_LEN   6
+
+/* how many read timeouts (each is VTIME tenths of a second) before we give up on a paste */
+#define PASTE_MAX_IDLE  20
+
 
 /*
  * Turn the raw mode on.
@@ -112,6 +131,138 @@ int rawon(void)
 }
 
 
+/*
+ * Read one byte from the terminal, or from the pushback buffer if it has any
+ * unprocessed bytes.
+ * 
+ * Returns 1 if a byte was read, 0 on timeout and -1 on error.
+ */
+static int read_key_byte(int tty, char *c)
+{
+    if(pushback_start < pushback_end)
+    {
+        *c = pushback_buf[pushback_start++];
+        return 1;
+    }
+    return read(tty, c, 1);
+}
+
+
+/*
+ * Save the given bytes in the pushback buffer, so that the next calls to
+ * get_next_key() will return them. The buffer is extended as needed, as the
+ * user might type (or queue) any number of keys after a paste.
+ */
+static void pushback_bytes(char *s, size_t len)
+{
+    if(len > pushback_size)
+    {
+        char *buf = realloc(pushback_buf, len);
+        if(!buf)
+        {
+            /* keep what we can */
+            len = pushback_size;
+        }
+        else
+        {
+            pushback_buf  = buf;
+            pushback_size = len;
+        }
+    }
+    if(len)
+    {
+        memcpy(pushback_buf, s, len);
+    }
+    pushback_start = 0;
+    pushback_end   = len;
+}
+
+
+/*
+ * Read the text the user pasted in bracketed paste mode, after get_next_key()
+ * has returned PASTE_KEY. We read the terminal in big chunks until we see the
+ * end-of-paste sequence, instead of processing the text one key at a time.
+ * The length of the text is stored in *len.
+ * 
+ * Returns the malloc'd text (which the caller must free), or NULL on error.
+ */
+char *get_pasted_text(int tty, size_t *len)
+{
+    size_t size = 1024, end = 0, scan = 0;
+    int idle = 0;
+    char *buf;
+    
+    /* make room for the pushed back bytes, if any */
+    while(size < pushback_end-pushback_start)
+    {
+        size <<= 1;
+    }
+    buf = malloc(size);
+    
+    if(!buf)
+    {
+        return NULL;
+    }
+    
+    /* take whatever is in the pushback buffer first */
+    if(pushback_start < pushback_end)
+    {
+        end = pushback_end-pushback_start;
+        memcpy(buf, pushback_buf+pushback_start, end);
+        pushback_start = pushback_end = 0;
+    }
+    
+    while(1)
+    {
+        char *p = memmem(buf+scan, end-scan, PASTE_END, PASTE_END_LEN);
+        if(p)
+        {
+            /* save anything that came after the end of the paste */
+            pushback_bytes(p+PASTE_END_LEN, buf+end-(p+PASTE_END_LEN));
+            end = p-buf;
+            break;
+        }
+        /* the end sequence might straddle two reads */
+        scan = (end > PASTE_END_LEN) ? end-PASTE_END_LEN+1 : 0;
+        
+        if(end == size)
+        {
+            char *buf2 = realloc(buf, size << 1);
+            if(!buf2)
+            {
+                free(buf);
+                return NULL;
+            }
+            buf = buf2;
+            size <<= 1;
+        }
+        
+        ssize_t nread = read(tty, buf+end, size-end);
+        if(nread > 0)
+        {
+            end += nread;
+            idle = 0;
+        }
+        else if((nread == 0 || errno == EAGAIN) && ++idle < PASTE_MAX_IDLE)
+        {
+            continue;
+        }
+        else if(nread < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            /* the terminal never sent the end sequence, use what we've got */
+            break;
+        }
+    }
+    
+    *len = end;
+    return buf;
+}
+
+
 /*
  * Return the next key press from the terminal.
  */
@@ -120,7 +271,12 @@ int get_next_key(int tty)
     CTRL_MASK = 0;
     int nread;
     char c;
-    while((nread = read(tty, &c, 1)) != 1)
+
+    /* bring the screen up to date before we wait for the next key */
+    redraw_flush();
+    redraw_stats.keys++;
+
+    while((nread = read_key_byte(tty, &c)) != 1)
     {
         if(nread == -1 && errno != EAGAIN)
         {
@@ -131,11 +287,11 @@ int get_next_key(int tty)
     if(c == '\x1b')
     {
         char seq[3];        
-        if(read(tty, &seq[0], 1) != 1)
+        if(read_key_byte(tty, &seq[0]) != 1)
         {
             return '\x1b';
         }
-        if(read(tty, &seq[1], 1) != 1)
+        if(read_key_byte(tty, &seq[1]) != 1)
         {
             return '\x1b';
         }
@@ -144,7 +300,7 @@ int get_next_key(int tty)
         {
             if(seq[1] >= '0' && seq[1] <= '9')
             {
-                if(read(tty, &seq[2], 1) != 1)
+                if(read_key_byte(tty, &seq[2]) != 1)
                 {
                     return '\x1b';
                 }
@@ -180,11 +336,11 @@ int get_next_key(int tty)
                 }
                 else if(seq[2] == ';')
                 {
-                    if(read(tty, &seq[1], 1) != 1)
+                    if(read_key_byte(tty, &seq[1]) != 1)
                     {
                         return '\x1b';
                     }
-                    if(read(tty, &seq[1], 1) != 1)
+                    if(read_key_byte(tty, &seq[1]) != 1)
                     {
                         return '\x1b';
                     }
@@ -225,13 +381,31 @@ int get_next_key(int tty)
                 }                
                 else if(seq[1] == '1' || seq[1] == '2')
                 {
-                    if(read(tty, &seq[1], 1) != 1)
+                    char c2 = seq[1];
+                    if(read_key_byte(tty, &seq[1]) != 1)
                     {
                         return '\x1b';
                     }
+                    
+                    /* start (ESC [200~) and end (ESC [201~) of bracketed paste */
+                    if(c2 == '2' && seq[2] == '0' && (seq[1] == '0' || seq[1] == '1'))
+                    {
+                        c2 = seq[1];
+                        if(read_key_byte(tty, &seq[1]) != 1)
+                        {
+                            return '\x1b';
+                        }
+                        if(seq[1] == '~')
+                        {
+                            /* a stray end sequence is ignored */
+                            return (c2 == '0') ? PASTE_KEY : 0;
+                        }
+                        return 0;
+                    }
+                    
                     if(seq[1] == ';')
                     {
-                        if(read(tty, &seq[1], 1) != 1)
+                        if(read_key_byte(tty, &seq[1]) != 1)
                         {
                             return '\x1b';
                         }
@@ -240,7 +414,7 @@ int get_next_key(int tty)
                     
                     if(seq[1] != '~')
                     {
-                        if(read(tty, &seq[1], 1) != 1)
+                        if(read_key_byte(tty, &seq[1]) != 1)
                         {
                             return '\x1b';
                         }
@@ -61,6 +61,14 @@ extern int   norc;             /* if set, do not load rc scripts */
 /* defined below */
 long read_pipe(FILE *f, char **str);
 
+/*
+ * The buffer of our standard output. Builtin utilities print their output to the
+ * buffer, which is written out in one go when the utility finishes (see
+ * do_simple_command()), instead of once per line (or per printf() call).
+ */
+#define STDOUT_BUFSZ        (64*1024)
+static char stdout_buf[STDOUT_BUFSZ];
+
 
 /*
  * Main shell entry point.
@@ -69,6 +77,13 @@ int main(int argc, char **argv)
 {
     setlocale(LC_ALL, "");
 
+    /*
+     * Fully buffer stdout, even if it is a terminal. The buffer is flushed after
+     * each builtin utility and each command line, before we fork a child process,
+     * and before we print an error message to stderr.
+     */
+    setvbuf(stdout, stdout_buf, _IOFBF, STDOUT_BUFSZ);
+
     /* init global symbol table */
     init_symtab();
 
@@ -381,10 +396,15 @@ void do_history_and_print(struct source_s *src, struct node_s *cmd_tree)
 
 /*
  * Parse and execute the translation unit we have in the passed source_s struct.
+ * If 'trees' is not NULL, the nodetrees are not freed after execution. Instead,
+ * they are chained via their next_sibling pointers and returned in *trees, so
+ * that the caller can execute them again by calling execute_cmd_trees(). If we
+ * didn't parse and execute the whole translation unit (for example, because of
+ * a parsing error or a return statement), *trees is set to NULL.
  * 
  * Returns 1.
  */
-int parse_and_execute(struct source_s *src)
+static int __parse_and_execute(struct source_s *src, struct node_s **trees)
 {
     /* prologue */
     struct token_s *old_current_token = dup_token(get_current_token());
@@ -408,8 +428,15 @@ int parse_and_execute(struct source_s *src)
     int i = src->curpos;
     int res = 1;             /* the result of parsing/executing */
     char *p;
+    struct node_s *first = NULL, *last = NULL;
+    int complete = 1;
     struct token_s *tok = tokenize(src);
 
+    if(trees)
+    {
+        *trees = NULL;
+    }
+
     /* skip any leading comments/newlines */
     while(tok->type != TOKEN_EOF)
     {
@@ -587,6 +614,7 @@ int parse_and_execute(struct source_s *src)
         if(option_set('n') && !interactive_shell)
         {
             free_node_tree(cmd);
+            complete = 0;
             tok = get_current_token();
             continue;
         }
@@ -604,8 +632,24 @@ int parse_and_execute(struct source_s *src)
         }
         tok = get_current_token();
 
-        /* free the nodetree */
-        free_node_tree(cmd);
+        /* free the nodetree, or keep it if the caller asked for it */
+        if(trees)
+        {
+            if(last)
+            {
+                last->next_sibling = cmd;
+            }
+            else
+            {
+                first = cmd;
+            }
+            last = cmd;
+        }
+        else
+        {
+            free_node_tree(cmd);
+        }
+        flush_dir_cache();
         fflush(stdout);
         fflush(stderr);
 
@@ -657,6 +701,19 @@ int parse_and_execute(struct source_s *src)
         src->wstart = src->curpos-(tok->text_len);
     }
 
+    /* give the caller the nodetrees, but only if we've got all of them */
+    if(trees)
+    {
+        if(res && complete)
+        {
+            *trees = first;
+        }
+        else
+        {
+            free_cmd_trees(first);
+        }
+    }
+
     /* don't leave any hanging token structs */
     free_token(get_current_token());
     free_token(get_previous_token());
@@ -693,6 +750,101 @@ int parse_and_execute(struct source_s *src)
 }
 
 
+/*
+ * Parse and execute the translation unit we have in the passed source_s struct.
+ * 
+ * Returns 1.
+ */
+int parse_and_execute(struct source_s *src)
+{
+    return __parse_and_execute(src, NULL);
+}
+
+
+/*
+ * Same as parse_and_execute(), except that the nodetrees are returned in
+ * *trees instead of being freed after execution (see __parse_and_execute()).
+ * 
+ * Returns 1.
+ */
+int parse_and_execute_keep(struct source_s *src, struct node_s **trees)
+{
+    return __parse_and_execute(src, trees);
+}
+
+
+/*
+ * Execute the list of nodetrees we got from parse_and_execute_keep(). The source_s
+ * struct should be the one we passed to parse_and_execute_keep().
+ *
+ * Returns 1 if the commands were executed, 0 if we bailed out.
+ */
+int execute_cmd_trees(struct source_s *src, struct node_s *trees)
+{
+    int res = 1, i;
+    struct node_s *cmd;
+
+    /* same as parse_and_execute() */
+    req_continue   = 0;
+    req_break      = 0;
+    cur_loop_level = 0;
+    save_std(0, backup_fd);
+    save_std(1, backup_fd);
+    save_std(2, backup_fd);
+
+    for(cmd = trees; cmd; cmd = cmd->next_sibling)
+    {
+        if(!do_list(src, cmd, NULL) && interactive_shell)
+        {
+            /* failed to execute command. bail out if we're interactive */
+            res = 0;
+            break;
+        }
+
+        flush_dir_cache();
+        fflush(stdout);
+        fflush(stderr);
+
+        /* we've got a return statement */
+        if(return_set)
+        {
+            return_set = 0;
+            res = 0;
+            break;
+        }
+    }
+
+    /* discard the backup streams */
+    for(i = 0; i < 3; i++)
+    {
+        if(backup_fd[i] >= 0)
+        {
+            close(backup_fd[i]);
+            backup_fd[i] = -1;
+        }
+    }
+
+    /* reset the received signal flag */
+    signal_received = 0;
+
+    return res;
+}
+
+
+/*
+ * Free the list of nodetrees we got from parse_and_execute_keep().
+ */
+void free_cmd_trees(struct node_s *trees)
+{
+    while(trees)
+    {
+        struct node_s *next = trees->next_sibling;
+        free_node_tree(trees);
+        trees = next;
+    }
+}
+
+
 /*
  * Read a file (presumably a script file) and initialize the
  * source_s struct so that we can parse and execute the file.
@@ -22,8 +22,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include "include/cmd.h"
 #include "symtab/symtab.h"
+#include "builtins/builtins.h"
 #include "include/debug.h"
 
 /* the exit status of the last command executed */
@@ -94,49 +96,154 @@ void set_internal_exit_status(int status)
 
 
 /*
- * Reset the positional parameters by setting the value of each parameter to
- * NULL, followed by setting the value of $# to zero.
+ * The positional parameters are not stored in the symbol table. Instead, each
+ * function call (and each dot script invoked with arguments) gets its own
+ * vector of parameters, which we attach to the callframe we push on the call
+ * stack. Callframes that don't have their own parameters (e.g. eval and traps)
+ * use the parameters of the frame below them, and the bottom of the stack uses
+ * the shell's global parameters. When a frame is popped off the stack, its
+ * parameters go with it, and the caller's parameters become visible again.
  */
-void reset_pos_params(void)
+static struct pos_params_s  no_params = { 0, 0, NULL };
+static struct pos_params_s *shell_pos_params = &no_params;
+
+
+/*
+ * Allocate a new set of positional parameters, holding copies of the 'count'
+ * strings in 'params'. Everything is allocated in one block, so that the
+ * parameters can be freed by calling free() on the returned struct.
+ *
+ * Returns the new struct, or NULL on error.
+ */
+static struct pos_params_s *new_pos_params(int count, char **params)
 {
-    /* unset all positional params */
-    struct symtab_entry_s *hash = get_symtab_entry("#");
+    size_t len = sizeof(struct pos_params_s) + (count+1)*sizeof(char *);
+    int i;
 
-    if(hash && hash->val)
+    for(i = 0; i < count; i++)
     {
-        int params = atoi(hash->val);
+        len += strlen(params[i])+1;
+    }
 
-        if(params != 0)
-        {
-            int  j;
-            char buf[32];
+    struct pos_params_s *pp = malloc(len);
+    if(!pp)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "set positional parameters");
+        return NULL;
+    }
 
-            for(j = 1; j <= params; j++)
-            {
-                sprintf(buf, "%d", j);
-                struct symtab_entry_s *entry = get_symtab_entry(buf);
+    pp->count   = count;
+    pp->changed = 0;
+    pp->params  = (char **)(pp+1);
 
-                if(entry && entry->val)
-                {
-                    symtab_entry_setval(entry, NULL);
-                }
-            }
+    char *p = (char *)(pp->params+count+1);
+    for(i = 0; i < count; i++)
+    {
+        size_t len2 = strlen(params[i])+1;
+        memcpy(p, params[i], len2);
+        pp->params[i] = p;
+        p += len2;
+    }
+    pp->params[count] = NULL;
+
+    return pp;
+}
+
+
+/*
+ * Return a pointer to the place where the current positional parameters are
+ * stored, which is either the top-most callframe that has its own parameters,
+ * or the shell's global parameters.
+ */
+static struct pos_params_s **cur_pos_params(void)
+{
+    struct callframe_s *cf = get_cur_callframe();
+    while(cf)
+    {
+        if(cf->pos_params)
+        {
+            return &cf->pos_params;
         }
+        cf = cf->prev;
+    }
+    return &shell_pos_params;
+}
+
+
+/*
+ * Free a set of positional parameters.
+ */
+static void free_pos_params(struct pos_params_s *pp)
+{
+    if(pp && pp != &no_params)
+    {
+        free(pp);
+    }
+}
+
+
+/*
+ * Set the values of positional parameters $1 to $count in the current scope,
+ * replacing the old parameters. This is what `set --` does.
+ */
+void set_pos_params(int count, char **params)
+{
+    struct pos_params_s **ppp = cur_pos_params();
+    struct pos_params_s *pp = new_pos_params(count, params);
+    if(pp)
+    {
+        pp->changed = 1;
+        free_pos_params(*ppp);
+        *ppp = pp;
+    }
+}
+
+
+/*
+ * Reset the positional parameters by removing all the parameters in the
+ * current scope, which sets $# to zero.
+ */
+void reset_pos_params(void)
+{
+    set_pos_params(0, NULL);
+}
+
+
+/*
+ * Shift the positional parameters in the current scope to the left by n.
+ * The caller should check that n is not greater than $#.
+ */
+void shift_pos_params(int n)
+{
+    struct pos_params_s *pp = *cur_pos_params();
+    if(n <= 0 || pp == &no_params)
+    {
+        return;
+    }
 
-        symtab_entry_setval(hash, "0");
+    if(n > pp->count)
+    {
+        n = pp->count;
     }
+
+    /* the strings stay where they are, we only move the pointers */
+    memmove(pp->params, pp->params+n, (pp->count-n+1)*sizeof(char *));
+    pp->count -= n;
 }
 
 
 /*
- * Return the symbol table entry for positional parameter i,
- * which is the value of shell variable $i.
+ * Return the value of positional parameter i, or NULL if there is no such
+ * parameter.
  */
-struct symtab_entry_s *get_pos_param(int i)
+char *get_pos_param(int i)
 {
-    char buf[16];
-    sprintf(buf, "%d", i);
-    return get_symtab_entry(buf);
+    struct pos_params_s *pp = *cur_pos_params();
+    if(i < 1 || i > pp->count)
+    {
+        return NULL;
+    }
+    return pp->params[i-1];
 }
 
 
@@ -208,15 +315,13 @@ int is_special_param(char *name)
 
 
 /*
- * Return the positional parameter count, which we get from the shell variable $#.
+ * Return the positional parameter count ($#).
  */
 int pos_param_count(void)
 {
-    return get_shell_vari("#", -1);
+    return (*cur_pos_params())->count;
 }
 
-char  buf[32];
-
 /*
     Excerpt from POSIX:
 $@
@@ -239,13 +344,24 @@ $*
     first character does not exist, so the parameter values are concatenated.
 */
 
+/*
+ * Return the value of positional parameter i, or "" if it's not set. Parameter
+ * 0 is $0, which is used by ${@:0} and ${*:0}.
+ */
+static char *pos_param_val(int i)
+{
+    char *val = i ? get_pos_param(i) : get_shell_varp("0", NULL);
+    return val ? val : "";
+}
+
+
 /*
  * Return the values of all positional parameters, NULL if there is none.
  */
 char *get_all_pos_params_str(char which, int quoted)
 {
     /* get the count of positional parameters */
-    int pos_params_count = get_shell_varl("#", 0);
+    int pos_params_count = pos_param_count();
 
     if(pos_params_count <= 0)
     {
@@ -314,9 +430,7 @@ char *get_pos_params_str(char which, int quoted, int offset, int count)
     
     while(i < last)
     {
-        sprintf(buf, "%d", i);
-        
-        size_t len2 = strlen(get_shell_varp(buf, ""));
+        size_t len2 = strlen(pos_param_val(i));
         
         if(quoted)
         {
@@ -340,10 +454,7 @@ char *get_pos_params_str(char which, int quoted, int offset, int count)
     
     while(i < last)
     {
-        sprintf(buf, "%d", i);
-        
-        char *p2 = get_shell_varp(buf, "");
-        len = strlen(p2);
+        char *p2 = pos_param_val(i);
         
         while((*p1++ = *p2++))
         {
@@ -378,72 +489,60 @@ char *get_pos_params_str(char which, int quoted, int offset, int count)
 
 
 /*
- * Set the values of positional parameters $1 to $count. If the new paramer
- * count is less than the old parameter count, positional parameters $count+1
- * to $oldcount are set to NULL. We set all of these parameters in the local
- * symbol table, so that when a dot script or shell function returns, we pop
- * the local symbol table off the stack, and those parameters resume the values
- * they had before we entered the script/function.
+ * Give the current callframe its own positional parameters $1 to $count. When
+ * the dot script or shell function returns, we pop the callframe off the stack,
+ * and the caller's parameters resume the values they had before we entered the
+ * script/function. The callframe must have been pushed before calling us.
  */
 void set_local_pos_params(int count, char **params)
 {
-    int  i;
-    char buf[32];
-    struct symtab_entry_s *entry;
-    struct symtab_s *st = get_local_symtab();
-
-    /* sanity check */
-    if(!count || !params || !*params)
+    struct callframe_s *cf = get_cur_callframe();
+    if(!cf)
     {
+        set_pos_params(count, params);
         return;
     }
 
-    /* set arguments $1...$count */
-    for(i = 1; i <= count; i++)
+    struct pos_params_s *pp = count ? new_pos_params(count, params) : &no_params;
+    if(pp)
     {
-        sprintf(buf, "%d", i);
-        entry = add_to_any_symtab(buf, st);
-        
-        if(entry)
-        {
-            symtab_entry_setval(entry, params[i-1]);
-            entry->flags = FLAG_LOCAL | FLAG_READONLY;
-        }
+        free_pos_params(cf->pos_params);
+        cf->pos_params = pp;
     }
-    
-    /*
-     * overshadow the rest of the parameters, if any, so that the user cannot
-     * access them behind our back.
-     */
-    entry = get_symtab_entry("#");
-    if(entry && entry->val)
-    {
-        int old_count = atoi(entry->val);
-        
-        if(old_count > 0)
-        {
-            for( ; i <= old_count; i++)
-            {
-                sprintf(buf, "%d", i);
-                entry = add_to_any_symtab(buf, st);
-                
-                if(entry)
-                {
-                    entry->flags = FLAG_LOCAL | FLAG_READONLY;
-                }
-            }
-        }
-    }
-    
-    /* set our new param $# */
-    entry = add_to_any_symtab("#", st);
-    
-    if(entry)
+}
+
+
+/*
+ * If the dot script that's about to return changed its positional parameters
+ * by calling set, pass the new parameters to the caller (bash). Otherwise, the
+ * caller's parameters are restored when we pop the dot script's callframe.
+ */
+void keep_local_pos_params(void)
+{
+    struct callframe_s *cf = get_cur_callframe();
+    if(!cf || !cf->pos_params || !cf->pos_params->changed)
     {
-        sprintf(buf, "%d", count);
-        symtab_entry_setval(entry, buf);
-        entry->flags = FLAG_LOCAL | FLAG_READONLY;
+        return;
     }
+
+    struct pos_params_s *pp = cf->pos_params;
+    cf->pos_params = NULL;
+
+    /* now this gets us the caller's parameters */
+    struct pos_params_s **ppp = cur_pos_params();
+    free_pos_params(*ppp);
+    *ppp = pp;
+}
+
+
+/*
+ * Free the positional parameters of a callframe that's being popped off the
+ * call stack.
+ */
+void free_local_pos_params(struct callframe_s *cf)
+{
+    free_pos_params(cf->pos_params);
+    cf->pos_params = NULL;
 }
 
 
@@ -111,6 +111,36 @@ struct node_s *last_child(struct node_s *parent)
 }
 
 
+/*
+ * Check if the nodetree contains a node of the given type.
+ * 
+ * Returns 1 if a node of the type is found, 0 otherwise.
+ */
+int has_node_type(struct node_s *node, enum node_type_e type)
+{
+    if(!node)
+    {
+        return 0;
+    }
+
+    if(node->type == type)
+    {
+        return 1;
+    }
+
+    struct node_s *child = node->first_child;
+    while(child)
+    {
+        if(has_node_type(child, type))
+        {
+            return 1;
+        }
+        child = child->next_sibling;
+    }
+    return 0;
+}
+
+
 /*
  * Set the node's value to the given integer value.
  */
@@ -230,6 +260,7 @@ char *get_node_type_str(enum node_type_e type)
         case NODE_UNTIL            : return "NODE_UNTIL"           ;
         case NODE_IO_FILE          : return "NODE_IO_FILE"         ;
         case NODE_IO_HERE          : return "NODE_IO_HERE"         ;
+        case NODE_HEREDOC_EXPANSION: return "NODE_HEREDOC_EXPANSION";
         case NODE_IO_REDIRECT      : return "NODE_IO_REDIRECT"     ;
         case NODE_IO_REDIRECT_LIST : return "NODE_IO_REDIRECT_LIST";
         case NODE_ASSIGNMENT       : return "NODE_ASSIGNMENT"      ;
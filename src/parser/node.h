@@ -36,6 +36,7 @@ enum node_type_e
     NODE_IO_REDIRECT,       /* single I/O redirection (file or heredoc) */
     NODE_IO_FILE,           /* file I/O redirection */
     NODE_IO_HERE,           /* heredoc I/O redirection */
+    NODE_HEREDOC_EXPANSION, /* word to be expanded in a heredoc body */
     NODE_BANG,              /* bang '!' keyword */
     NODE_PIPE,              /* pipeline */
     NODE_LIST,              /* list (sequential or asynchronous) */
@@ -107,8 +108,17 @@ struct node_s
                                                  * pointers to prev/next siblings
                                                  */
     int    lineno;              /* line number where the node's token was encountered */
+    int    flags;               /* node flags (see below) */
 };
 
+/*
+ * flags for the node_s flags field. The parser sets these for the words of
+ * simple commands, so that the backend can skip word expansion for words that
+ * don't need it (see classify_word() in parser.c).
+ */
+#define NODE_FLAG_LITERAL_WORD      (1 << 0)    /* word needs no expansion */
+#define NODE_FLAG_QUOTED_WORD       (1 << 1)    /* word needs quote removal only */
+
 /*
  * functions to manipulate node structs.
  */
@@ -126,5 +136,6 @@ void    dump_node_tree(struct node_s *func_body, int level);
 void    free_node_tree(struct node_s *node);
 char   *cmd_nodetree_to_str(struct node_s *node, int is_root);
 struct  node_s *last_child(struct node_s *parent);
+int     has_node_type(struct node_s *node, enum node_type_e type);
 
 #endif
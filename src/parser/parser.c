@@ -800,8 +800,11 @@ struct node_s *parse_term(struct token_s *tok, enum token_type_e stop_at)
         /* skip optional newlines */
         skip_newline_tokens2();
 
-        /* stop if the current token is the list terminator */
-        if(is_token_of_type(tok, stop_at))
+        /*
+         * stop if the current token is the list terminator, unless the list ends
+         * in '&', which we need to remember so the list is run in the background.
+         */
+        if(is_token_of_type(tok, stop_at) && type != TOKEN_AND)
         {
             return node;
         }
@@ -812,7 +815,7 @@ struct node_s *parse_term(struct token_s *tok, enum token_type_e stop_at)
     }
 
     /* reached EOF */
-    if(tok->type == TOKEN_EOF)
+    if(tok->type == TOKEN_EOF && type != TOKEN_AND)
     {
         return node;
     }
@@ -1576,6 +1579,46 @@ int read_complete_line(struct source_s *src, char **cmd /* , char **heredocs */)
 }
 
 
+/*
+ * Classify a simple command's word according to the word expansions it needs.
+ * A word that has no chars that can start an expansion (or a brace, tilde,
+ * dirstack or pathname expansion) doesn't need any. If the word has quote
+ * chars, it only needs quote removal. The checks are conservative: we only
+ * need to be sure we don't skip an expansion word_expand() would perform.
+ *
+ * Returns NODE_FLAG_LITERAL_WORD, NODE_FLAG_QUOTED_WORD, or 0 if the word
+ * needs full word expansion.
+ */
+static int classify_word(char *word)
+{
+    int flags = NODE_FLAG_LITERAL_WORD;
+
+    for( ; *word; word++)
+    {
+        switch(*word)
+        {
+            case '$':
+            case '`':
+            case '~':
+            case '=':
+            case '*':
+            case '?':
+            case '[':
+            case '{':
+            case '(':
+                return 0;
+
+            case '\'':
+            case '"':
+            case '\\':
+                flags = NODE_FLAG_QUOTED_WORD;
+                break;
+        }
+    }
+    return flags;
+}
+
+
 /* 
  * Parse the simple command that starts with the given token.
  * 
@@ -1791,6 +1834,7 @@ loop:
         }
         set_node_val_str(word, tok->text);
         word->lineno = tok->lineno;
+        word->flags = classify_word(word->val.str);
         add_child_node(cmd, word);
         
         if(!first)
@@ -101,6 +101,7 @@ char          *heredoc_end(char *start, char *delim, char last_char);
 char          *last_heredoc_end(char *start, int heredoc_count, char **heredoc_delims, char last_char);
 int            heredoc_delim(char *orig_cmd, int *expand, char **__delim, char **__delim_end);
 int            extract_heredocs(struct source_s *src, struct node_s *cmd, int heredoc_count);
+int            split_heredoc(struct node_s *body);
 int            next_cmd_word(char **start, char **end, int do_braces);
 
 /* flag to indicate a parsing error */
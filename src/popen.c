@@ -75,13 +75,13 @@ void init_subshell(void)
      */
     if(!option_set('T'))
     {
-        reset_trap("DEBUG");
-        reset_trap("RETURN");
+        reset_trap(DEBUG_TRAP_NUM);
+        reset_trap(RETURN_TRAP_NUM);
     }
 
     if(!option_set('E'))
     {
-        reset_trap("ERR");
+        reset_trap(ERR_TRAP_NUM);
     }
     
     /*
@@ -29,10 +29,15 @@
 #define _GNU_SOURCE         /* basename() */
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <time.h>
 #include <sys/param.h>
+#include <sys/wait.h>
 #include "include/cmd.h"
 #include "symtab/symtab.h"
 #include "backend/backend.h"
@@ -52,6 +57,51 @@ char *weekday[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
 char *month[]   = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul",
                     "Sep", "Oct", "Nov", "Dec" };
 
+/* types of segments in a compiled prompt string */
+#define SEG_TEXT            1       /* literal text */
+#define SEG_ESCAPE          2       /* escape sequence, such as \w or %d */
+#define SEG_EXPAND          3       /* quoted string or parameter expansion */
+#define SEG_CMDSUB          4       /* command substitution */
+
+/* what the value of an escape sequence depends on */
+#define DEP_NONE            0       /* the value never changes */
+#define DEP_TIME            (1 << 0)
+#define DEP_PWD             (1 << 1)
+#define DEP_HIST            (1 << 2)
+#define DEP_ALWAYS          (1 << 3)/* evaluate every time */
+
+/* options in effect when a prompt string was compiled */
+#define PROMPT_FLAG_PERCENT (1 << 0)
+#define PROMPT_FLAG_BANG    (1 << 1)
+
+/* a segment of a compiled prompt string */
+struct prompt_seg_s
+{
+    int    type;                    /* one of the SEG_* types above */
+    int    deps;                    /* for escape sequences, one of the DEP_* flags above */
+    char  *var;                     /* shell variable an escape sequence depends on */
+    char  *text;                    /* the segment's part of the prompt string */
+    char  *val;                     /* the segment's last value */
+    char  *key;                     /* the inputs the value was calculated from */
+    int    fd;                      /* pipe to read command substitution output from */
+    char  *out;                     /* command substitution output, read so far */
+    size_t out_len;
+};
+
+/* a compiled prompt string */
+struct compiled_prompt_s
+{
+    char  *src;                     /* the original prompt string */
+    int    flags;                   /* PROMPT_FLAG_* options used when compiling */
+    int    seg_count;
+    struct prompt_seg_s *segs;
+};
+
+/* cache of recently used prompt strings ($PS0-$PS4) */
+#define PROMPT_CACHE_SIZE   5
+static struct compiled_prompt_s prompt_cache[PROMPT_CACHE_SIZE];
+static int prompt_cache_next = 0;
+
 /*
  * Return 1 if char c is an octal digit, 0 otherwise.
  */
@@ -74,14 +124,25 @@ static inline int is_octal(char c)
  */
 int get_ttyname(int rem_prefix)
 {
+    /* the terminal doesn't change while we run, so we only need to get its name once */
+    static char *tty_name = NULL;
     int k = cur_tty_fd();
     if(k >= 0)
     {
-        char *s = ttyname(k);
-        if(!s)
+        if(!tty_name)
         {
-            return 0;
+            char *s = ttyname(k);
+            if(!s)
+            {
+                return 0;
+            }
+            tty_name = __get_malloced_str(s);
+            if(!tty_name)
+            {
+                return 0;
+            }
         }
+        char *s = tty_name;
        
         if(rem_prefix)
         {
@@ -107,6 +168,28 @@ int get_ttyname(int rem_prefix)
 }
 
 
+/*
+ * Return the hostname. We call gethostname() once, and save the result for
+ * subsequent prompts.
+ */
+static char *get_hostname(void)
+{
+    static char host[MAXHOSTNAMELEN+1];
+    static int  have_host = 0;
+    
+    if(!have_host)
+    {
+        if(gethostname(host, MAXHOSTNAMELEN) != 0)
+        {
+            host[0] = '\0';
+        }
+        host[MAXHOSTNAMELEN] = '\0';
+        have_host = 1;
+    }
+    return host;
+}
+
+
 /*
  * Get the current working directory name, formatted properly as required by the
  * different escape sequences. This function parses POSIX \w and \W escape sequences,
@@ -210,24 +293,16 @@ int get_date(char *fmt, struct tm *now)
 
 
 /*
- * Evaluate a prompt string, substituting both POSIX '\' and zsh '%' escape
- * sequences, then performing word expansion on the prompt.
- * 
- * Result is the malloc'd word-expanded prompt string.
+ * Substitute both POSIX '\' and zsh '%' escape sequences in the given prompt
+ * string (or part thereof). The result is stored in the prompt buffer.
  */
-char *evaluate_prompt(char *PS)
+static void expand_escapes(char *PS, struct tm *now)
 {
-    if(!PS)
-    {
-        return NULL;
-    }
     prompt[0] = '\0';
     size_t i = 0, j = 0, PS_len = strlen(PS);
     int k;
-    time_t tim = time(NULL);
-    struct tm *now = gmtime(&tim);
     /* temporary storage buffers for the loop below */
-    char host[MAXHOSTNAMELEN];
+    char *host;
     char buf[32];
     char *user, *pwd = get_shell_varp("PWD", NULL);
     char *s, c;
@@ -403,7 +478,7 @@ char *evaluate_prompt(char *PS)
                     case 'h': ;
                         if((c == '\\' && PS[i] == 'h') || (c == '%' && PS[i] == 'm'))
                         {
-                            gethostname(host, MAXHOSTNAMELEN);
+                            host = get_hostname();
                             if(strchr(host, '.'))
                             {
                                 char *p = host;
@@ -436,7 +511,7 @@ char *evaluate_prompt(char *PS)
                     case 'H':
                         if((c == '\\' && PS[i] == 'H') || (c == '%' && PS[i] == 'M'))
                         {
-                            gethostname(host, MAXHOSTNAMELEN);
+                            host = get_hostname();
                             strcat(prompt, host);
                             j += strlen(host);
                         }
@@ -899,23 +974,691 @@ char *evaluate_prompt(char *PS)
                 break;
         }
     } while(++i < PS_len);
+}
+
+
+/*
+ * Evaluate a prompt string (or part thereof), substituting escape sequences,
+ * then performing word expansion on the result.
+ * 
+ * Result is the malloc'd word-expanded string.
+ */
+static char *render_text(char *PS, struct tm *now)
+{
+    expand_escapes(PS, now);
+    
+    /* word expansion might evaluate another prompt string, so don't pass it our buffer */
+    char *str = __get_malloced_str(prompt);
+    if(!str)
+    {
+        return NULL;
+    }
     
     /*
      * now go POSIX-style on the prompt. that means parameter expansion,
      * command substitution, arithmetic expansion, and quote removal (but
      * don't remove whitespace chars).
      */
-    struct word_s *w = word_expand_one_word(prompt, 0);
+    struct word_s *w = word_expand_one_word(str, 0);
     if(w)
     {
         /* perform pathname expansion and quote removal */
         struct word_s *wordlist = pathnames_expand(w);
         char *res = wordlist_to_str(wordlist, WORDLIST_NO_SPACES);
         free_all_words(wordlist);
-        return res ? : __get_malloced_str(prompt);
+        if(res)
+        {
+            free(str);
+            return res;
+        }
+    }
+    return str;
+}
+
+
+/*
+ * Return the length of the escape sequence that starts at PS[i].
+ */
+static size_t escape_len(char *PS, size_t i)
+{
+    char *p = PS+i;
+    
+    if(p[0] == '!')
+    {
+        return (p[1] == '!') ? 2 : 1;
+    }
+    
+    if(p[1] == '\0')
+    {
+        return 1;
+    }
+    
+    /* \D{format} */
+    if(p[1] == 'D' && p[2] == '{')
+    {
+        char *p2 = strchr(p+3, '}');
+        return p2 ? (size_t)(p2-p+1) : 2;
+    }
+    
+    /* \[ ... \] */
+    if(p[1] == '[')
+    {
+        char *p2 = strstr(p+2, "\\]");
+        return p2 ? (size_t)(p2-p+2) : strlen(p);
     }
-    return __get_malloced_str(prompt);
-    //return word_expand_to_str(prompt);
+    
+    /* \NNN */
+    if(is_octal(p[1]))
+    {
+        if(!is_octal(p[2]))
+        {
+            return 2;
+        }
+        return is_octal(p[3]) ? 4 : 3;
+    }
+    return 2;
+}
+
+
+/*
+ * Return the things the value of an escape sequence depends on. The introducing
+ * char (\\, % or !) is passed in c, the escape char in e. If the value depends on
+ * a shell variable, its name is stored in *var.
+ */
+static int escape_deps(char c, char e, char **var)
+{
+    *var = NULL;
+    
+    if(c == '!')
+    {
+        return DEP_HIST;
+    }
+    
+    switch(e)
+    {
+        case 'c':
+        case 'C':
+        case '.':
+        case '~':
+        case '/':
+            return (c == '%') ? DEP_PWD : DEP_NONE;
+            
+        case 'd':
+            return (c == '%') ? DEP_PWD : DEP_TIME;
+            
+        case 'w':
+        case 'W':
+            return (c == '%') ? DEP_TIME : DEP_PWD;
+            
+        case 'D':
+        case 't':
+        case 'T':
+        case '@':
+        case 'A':
+            return DEP_TIME;
+            
+        case '*':
+            return (c == '%') ? DEP_TIME : DEP_NONE;
+            
+        case 'h':
+            return (c == '%') ? DEP_HIST : DEP_NONE;
+            
+        case '#':
+            return (c == '%') ? DEP_NONE : DEP_HIST;
+            
+        case '!':
+            return DEP_HIST;
+            
+        case 'i':
+        case 'I':
+            *var = (c == '%') ? "LINENO" : NULL;
+            return DEP_NONE;
+            
+        case 'L':
+            *var = (c == '%') ? "SHLVL" : NULL;
+            return DEP_NONE;
+            
+        case '?':
+            *var = (c == '%') ? "?" : NULL;
+            return DEP_NONE;
+            
+        case 's':
+            *var = "0";
+            return DEP_NONE;
+            
+        case 'n':
+            *var = (c == '%') ? "USER" : NULL;
+            return DEP_NONE;
+            
+        case 'u':
+            *var = "USER";
+            return DEP_NONE;
+            
+        case '$':
+            *var = "PROMPTCHARS";
+            return DEP_NONE;
+            
+        /* \a rings the bell, \j counts jobs, %N and %x depend on the call stack */
+        case 'a':
+        case 'j':
+        case 'N':
+        case 'x':
+            return DEP_ALWAYS;
+    }
+    
+    /* hostname, tty name, shell version, and literal chars */
+    return DEP_NONE;
+}
+
+
+/*
+ * Return the length of the part of the prompt string that starts at PS[i] and
+ * needs word expansion, which is a quoted string, a parameter expansion, or
+ * a command substitution.
+ */
+static size_t expansion_len(char *PS, size_t i)
+{
+    char *p = PS+i;
+    size_t j;
+    
+    if(p[0] == '$')
+    {
+        if(p[1] == '(' || p[1] == '{')
+        {
+            j = find_closing_brace(p+1, 0);
+            return j ? j+2 : strlen(p);
+        }
+        
+        j = 1;
+        if(isalpha(p[1]) || p[1] == '_')
+        {
+            while(isalnum(p[j]) || p[j] == '_')
+            {
+                j++;
+            }
+        }
+        else if(p[1])
+        {
+            /* special parameter */
+            j++;
+        }
+        return j;
+    }
+    
+    /* quoted string or backquoted command substitution */
+    j = find_closing_quote(p, 0, 0);
+    return j ? j+1 : strlen(p);
+}
+
+
+/*
+ * Free the memory used by a compiled prompt string.
+ */
+static void free_compiled_prompt(struct compiled_prompt_s *cp)
+{
+    int i;
+    for(i = 0; i < cp->seg_count; i++)
+    {
+        struct prompt_seg_s *seg = &cp->segs[i];
+        if(seg->fd >= 0)
+        {
+            close(seg->fd);
+        }
+        if(seg->text)
+        {
+            free(seg->text);
+        }
+        if(seg->val)
+        {
+            free(seg->val);
+        }
+        if(seg->key)
+        {
+            free(seg->key);
+        }
+        if(seg->out)
+        {
+            free(seg->out);
+        }
+    }
+    if(cp->segs)
+    {
+        free(cp->segs);
+    }
+    if(cp->src)
+    {
+        free(cp->src);
+    }
+    memset(cp, 0, sizeof(struct compiled_prompt_s));
+}
+
+
+/*
+ * Add a segment to a compiled prompt string.
+ * 
+ * Returns 1 on success, 0 on failure.
+ */
+static int add_prompt_seg(struct compiled_prompt_s *cp, int type, char *text, size_t len)
+{
+    struct prompt_seg_s *segs = realloc(cp->segs, (cp->seg_count+1)*sizeof(struct prompt_seg_s));
+    if(!segs)
+    {
+        return 0;
+    }
+    cp->segs = segs;
+    
+    struct prompt_seg_s *seg = &segs[cp->seg_count];
+    memset(seg, 0, sizeof(struct prompt_seg_s));
+    seg->fd   = -1;
+    seg->type = type;
+    seg->text = malloc(len+1);
+    if(!seg->text)
+    {
+        return 0;
+    }
+    memcpy(seg->text, text, len);
+    seg->text[len] = '\0';
+    cp->seg_count++;
+    
+    if(type == SEG_TEXT)
+    {
+        seg->val = __get_malloced_str(seg->text);
+        return seg->val ? 1 : 0;
+    }
+    
+    if(type == SEG_ESCAPE)
+    {
+        seg->deps = escape_deps(text[0], text[1], &seg->var);
+    }
+    return 1;
+}
+
+
+/*
+ * Compile a prompt string, by breaking it into segments of literal text, escape
+ * sequences and word expansions, so that each segment can be evaluated (and its
+ * value cached) on its own.
+ * 
+ * Returns 1 on success, 0 on failure.
+ */
+static int compile_prompt(struct compiled_prompt_s *cp, char *PS, int flags)
+{
+    size_t i = 0, len;
+    int type;
+    
+    cp->src = __get_malloced_str(PS);
+    cp->flags = flags;
+    if(!cp->src)
+    {
+        return 0;
+    }
+    
+    while(PS[i])
+    {
+        char c = PS[i];
+        if(c == '\\' || (c == '%' && (flags & PROMPT_FLAG_PERCENT)) ||
+                         (c == '!' && (flags & PROMPT_FLAG_BANG   )))
+        {
+            type = SEG_ESCAPE;
+            len  = escape_len(PS, i);
+        }
+        else if(c == '$' || c == '`' || c == '"' || c == '\'')
+        {
+            len  = expansion_len(PS, i);
+            type = SEG_EXPAND;
+            
+            /* check for command substitution (but not arithmetic expansion) */
+            char *p = PS+i, *p2 = PS+i+len;
+            for( ; p < p2; p++)
+            {
+                if(*p == '`' || (p[0] == '$' && p[1] == '(' && p[2] != '('))
+                {
+                    type = SEG_CMDSUB;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            type = SEG_TEXT;
+            len  = strcspn(PS+i, "\\%!$`\"'");
+            if(len == 0)
+            {
+                len = 1;
+            }
+        }
+        
+        if(!add_prompt_seg(cp, type, PS+i, len))
+        {
+            free_compiled_prompt(cp);
+            return 0;
+        }
+        i += len;
+    }
+    return 1;
+}
+
+
+/*
+ * Return a string describing the current values of the things a segment's value
+ * depends on. If the string is the same as the last time we evaluated the segment,
+ * we don't need to evaluate it again.
+ * 
+ * Returns the malloc'd string, or NULL in case of error.
+ */
+static char *get_seg_key(struct prompt_seg_s *seg, time_t tim)
+{
+    char buf[64];
+    char *pwd = "", *home = "", *val = "";
+    
+    sprintf(buf, "%ld\1%d\1", (seg->deps & DEP_TIME) ? (long)tim : 0L,
+                               (seg->deps & DEP_HIST) ? cmd_history_end : 0);
+    if(seg->deps & DEP_PWD)
+    {
+        pwd  = get_shell_varp("PWD" , "");
+        home = get_shell_varp("HOME", "");
+    }
+    if(seg->var)
+    {
+        val = get_shell_varp(seg->var, "");
+    }
+    
+    char *key = malloc(strlen(buf)+strlen(pwd)+strlen(home)+strlen(val)+3);
+    if(key)
+    {
+        sprintf(key, "%s%s\1%s\1%s", buf, pwd, home, val);
+    }
+    return key;
+}
+
+
+/*
+ * Return the timeout (in milliseconds) for evaluating command substitutions in
+ * the prompt string, which is taken from $PROMPT_TIMEOUT. Zero means there is
+ * no timeout.
+ */
+static int get_prompt_timeout(void)
+{
+    char *s = get_shell_varp("PROMPT_TIMEOUT", NULL);
+    if(!s || !*s)
+    {
+        return 0;
+    }
+    
+    char *strend = NULL;
+    long timeout = strtol(s, &strend, 10);
+    if(*strend || timeout < 0 || timeout > INT_MAX)
+    {
+        return 0;
+    }
+    return (int)timeout;
+}
+
+
+/*
+ * Return the number of milliseconds elapsed since the given time.
+ */
+static long msecs_since(struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec-start->tv_sec)*1000) + ((now.tv_nsec-start->tv_nsec)/1000000);
+}
+
+
+struct render_arg_s
+{
+    char      *text;
+    struct tm *now;
+};
+
+
+/*
+ * Render the given prompt text and write the result to fd. This function runs in
+ * the background process started by render_async().
+ */
+static void render_to_fd(int fd, void *arg)
+{
+    struct render_arg_s *render_arg = arg;
+    char *s = render_text(render_arg->text, render_arg->now);
+    if(s)
+    {
+        char *p = s;
+        size_t len = strlen(s);
+        while(len)
+        {
+            ssize_t res = write(fd, p, len);
+            if(res < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            p   += res;
+            len -= res;
+        }
+    }
+}
+
+
+/*
+ * Evaluate a segment that contains command substitution in the background. If
+ * the result isn't ready in timeout milliseconds, we keep showing the segment's
+ * last value, and check for the result again the next time the prompt is printed.
+ */
+static void render_async(struct prompt_seg_s *seg, int timeout, struct tm *now)
+{
+    if(seg->fd < 0)
+    {
+        struct render_arg_s arg = { seg->text, now };
+        int fd = spawn_pipe_reader(render_to_fd, &arg);
+        if(fd < 0)
+        {
+            return;
+        }
+        seg->fd = fd;
+        seg->out_len = 0;
+    }
+    
+    /* collect the output */
+    struct timespec start;
+    struct pollfd pfd = { .fd = seg->fd, .events = POLLIN };
+    long remaining = timeout;
+    char buf[1024];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    while(remaining >= 0 && poll(&pfd, 1, remaining) > 0)
+    {
+        ssize_t res = read(seg->fd, buf, sizeof(buf));
+        if(res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        
+        if(res <= 0)
+        {
+            /* finished (or failed). the output is the segment's new value */
+            close(seg->fd);
+            seg->fd = -1;
+            if(seg->val)
+            {
+                free(seg->val);
+            }
+            seg->val = seg->out ? seg->out : __get_malloced_str("");
+            seg->out = NULL;
+            seg->out_len = 0;
+            return;
+        }
+        
+        char *out = realloc(seg->out, seg->out_len+res+1);
+        if(!out)
+        {
+            return;
+        }
+        memcpy(out+seg->out_len, buf, res);
+        seg->out = out;
+        seg->out_len += res;
+        seg->out[seg->out_len] = '\0';
+        
+        remaining = timeout-msecs_since(&start);
+    }
+}
+
+
+/*
+ * Bring the value of a prompt segment up to date.
+ */
+static void update_prompt_seg(struct prompt_seg_s *seg, time_t tim, struct tm *now)
+{
+    char *val;
+    int timeout;
+    
+    switch(seg->type)
+    {
+        case SEG_TEXT:
+            return;
+            
+        case SEG_ESCAPE:
+            if(!(seg->deps & DEP_ALWAYS))
+            {
+                char *key = get_seg_key(seg, tim);
+                if(key && seg->key && seg->val && strcmp(key, seg->key) == 0)
+                {
+                    free(key);
+                    return;
+                }
+                if(seg->key)
+                {
+                    free(seg->key);
+                }
+                seg->key = key;
+            }
+            break;
+            
+        case SEG_CMDSUB:
+            if((timeout = get_prompt_timeout()) > 0)
+            {
+                render_async(seg, timeout, now);
+                return;
+            }
+            break;
+    }
+    
+    if((val = render_text(seg->text, now)))
+    {
+        if(seg->val)
+        {
+            free(seg->val);
+        }
+        seg->val = val;
+    }
+}
+
+
+/*
+ * Return the compiled version of the given prompt string, compiling it if it
+ * is not in the cache.
+ * 
+ * Returns NULL if the string cannot be compiled.
+ */
+static struct compiled_prompt_s *get_compiled_prompt(char *PS)
+{
+    int i, flags = 0;
+    
+    if(optionx_set(OPTION_PROMPT_PERCENT))
+    {
+        flags |= PROMPT_FLAG_PERCENT;
+    }
+    
+    if(optionx_set(OPTION_PROMPT_BANG))
+    {
+        flags |= PROMPT_FLAG_BANG;
+    }
+    
+    for(i = 0; i < PROMPT_CACHE_SIZE; i++)
+    {
+        struct compiled_prompt_s *cp = &prompt_cache[i];
+        if(cp->src && cp->flags == flags && strcmp(cp->src, PS) == 0)
+        {
+            return cp;
+        }
+    }
+    
+    /* replace the oldest entry in the cache */
+    struct compiled_prompt_s *cp = &prompt_cache[prompt_cache_next];
+    prompt_cache_next = (prompt_cache_next+1) % PROMPT_CACHE_SIZE;
+    free_compiled_prompt(cp);
+    
+    return compile_prompt(cp, PS, flags) ? cp : NULL;
+}
+
+
+/*
+ * Evaluate a prompt string, substituting both POSIX '\' and zsh '%' escape
+ * sequences, then performing word expansion on the prompt.
+ * 
+ * Prompt strings are compiled into segments, and the value of each segment is
+ * cached, so that we only need to re-evaluate the segments whose inputs have
+ * changed since the prompt was last printed.
+ * 
+ * Result is the malloc'd word-expanded prompt string.
+ */
+char *evaluate_prompt(char *PS)
+{
+    static int nesting = 0;
+    
+    if(!PS)
+    {
+        return NULL;
+    }
+
+    time_t tim = time(NULL);
+    struct tm now;
+    localtime_r(&tim, &now);
+    
+    /*
+     * a prompt string can refer to another prompt string (via ${var@P}). only the
+     * outermost one is compiled, so that we don't modify the cache while using it.
+     */
+    struct compiled_prompt_s *cp = nesting ? NULL : get_compiled_prompt(PS);
+    if(!cp)
+    {
+        return render_text(PS, &now);
+    }
+    
+    int i;
+    size_t len = 0;
+    
+    nesting++;
+    for(i = 0; i < cp->seg_count; i++)
+    {
+        update_prompt_seg(&cp->segs[i], tim, &now);
+        if(cp->segs[i].val)
+        {
+            len += strlen(cp->segs[i].val);
+        }
+    }
+    nesting--;
+    
+    char *res = malloc(len+1);
+    if(!res)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "evaluate prompt");
+        return NULL;
+    }
+    
+    res[0] = '\0';
+    char *p = res;
+    for(i = 0; i < cp->seg_count; i++)
+    {
+        if(cp->segs[i].val)
+        {
+            p = stpcpy(p, cp->segs[i].val);
+        }
+    }
+    return res;
 }
 
 /*
@@ -944,6 +1687,13 @@ void repeat_first_char(char *PS)
  */
 void do_print_prompt(char *which)
 {
+    /*
+     * The prompt goes to stderr, which is unbuffered, while stdout is fully
+     * buffered (see main.c). Flush stdout so that anything printed before the
+     * prompt (like the list of completions) appears before it.
+     */
+    fflush(stdout);
+
     struct symtab_entry_s *entry = get_symtab_entry(which);
     char *PS = entry->val;      /* getenv(which); */
     if(!PS || PS[0] == '\0')
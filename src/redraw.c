@@ -0,0 +1,499 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2024 (c)
+ *
+ *    file: redraw.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "include/cmd.h"
+#include "include/debug.h"
+
+/*
+ * The command line editor doesn't write to the terminal directly. Instead, the
+ * editing functions (in vi_keys.c, vi.c, tab.c and cmdline.c) modify the command
+ * buffer and call redraw_cmdline(). We keep a copy of the text we last drew on
+ * the screen (our screen model), and when the terminal is about to be read for the
+ * next key, redraw_flush() compares the model with the command buffer, and emits
+ * the minimal set of escape sequences and characters to bring the screen up to
+ * date. All output is gathered in one buffer and written in one write() call, so
+ * we get one write per keystroke, no matter how many editing functions the key
+ * invoked.
+ */
+
+/* defined in cmdline.c */
+extern size_t start_row;
+extern size_t start_col;
+
+/* the text we last drew on the screen */
+static char   *scr_text   = NULL;
+static size_t  scr_len    = 0;
+static size_t  scr_size   = 0;
+
+/*
+ * The real cursor position, as a row offset (from start_row) and a 1-based column.
+ * If the last char we wrote landed in the last column, the terminal keeps the cursor
+ * in that column until the next char is written (the 'pending wrap' state), in
+ * which case we can't use relative cursor movements.
+ */
+static size_t  cur_row    = 0;
+static size_t  cur_col    = 1;
+static int     cur_wrap   = 0;
+
+/* set when the command buffer changed and the screen needs updating */
+static int     dirty      = 0;
+
+/* the output buffer */
+static char   *obuf       = NULL;
+static size_t  obuf_len   = 0;
+static size_t  obuf_size  = 0;
+
+/* output statistics (printed by `dump redraw`) */
+struct redraw_stats_s redraw_stats = { 0, 0, 0 };
+
+
+/*
+ * Append len bytes from str to the output buffer.
+ */
+static void out_str(char *str, size_t len)
+{
+    if(obuf_len+len >= obuf_size)
+    {
+        size_t newsz = obuf_size ? obuf_size : 256;
+        while(obuf_len+len >= newsz)
+        {
+            newsz <<= 1;
+        }
+
+        char *newbuf = realloc(obuf, newsz);
+        if(!newbuf)
+        {
+            return;
+        }
+        obuf      = newbuf;
+        obuf_size = newsz;
+    }
+    memcpy(obuf+obuf_len, str, len);
+    obuf_len += len;
+}
+
+
+/*
+ * Append an escape sequence with the given numeric argument and final char.
+ */
+static void out_esc(size_t n, char final)
+{
+    char buf[32];
+    int len;
+    if(n == 1)
+    {
+        len = sprintf(buf, "\e[%c", final);
+    }
+    else
+    {
+        len = sprintf(buf, "\e[%zu%c", n, final);
+    }
+    out_str(buf, len);
+}
+
+
+/*
+ * Write out the output buffer with one write() call (unless the write is
+ * interrupted or partial).
+ */
+static void out_flush(void)
+{
+    /* don't let our output overtake anything printed via stdio */
+    fflush(stdout);
+
+    if(!obuf_len)
+    {
+        return;
+    }
+
+    char *p = obuf;
+    size_t len = obuf_len;
+    while(len)
+    {
+        ssize_t res = write(fileno(stdout), p, len);
+        redraw_stats.writes++;
+        if(res < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        p   += res;
+        len -= res;
+    }
+    redraw_stats.bytes += obuf_len;
+    obuf_len = 0;
+}
+
+
+/*
+ * Calculate the screen position at which the char at index 'n' of string 's'
+ * would be printed, given the string starts at start_col. The row is returned as
+ * an offset from start_row, while the column is 1-based.
+ */
+static void text_pos(char *s, size_t n, size_t *row, size_t *col)
+{
+    size_t r = 0, c = start_col, i;
+    for(i = 0; i < n; i++)
+    {
+        unsigned char ch = s[i];
+        if(ch == '\n')
+        {
+            r++;
+            c = 1;
+            continue;
+        }
+        else if(ch == '\t')
+        {
+            c = (((c-1)/8)+1)*8 + 1;
+        }
+        else if((ch & 0xC0) == 0x80)
+        {
+            /* UTF-8 continuation bytes take no screen space of their own */
+            continue;
+        }
+        else
+        {
+            c++;
+        }
+
+        if(c > VGA_WIDTH)
+        {
+            r++;
+            c = 1;
+        }
+    }
+    *row = r;
+    *col = c;
+}
+
+
+/*
+ * Account for the terminal scrolling the screen up when we wrote (or moved) to
+ * a row below the last screen row.
+ */
+static void scrolled_to(size_t row)
+{
+    if(start_row+row > VGA_HEIGHT)
+    {
+        size_t diff = start_row+row-VGA_HEIGHT;
+        start_row = (start_row > diff) ? start_row-diff : 1;
+    }
+}
+
+
+/*
+ * Move the cursor to the given row offset and column.
+ */
+static void move_to(size_t row, size_t col)
+{
+    if(!cur_wrap && row == cur_row)
+    {
+        if(col < cur_col)
+        {
+            if(cur_col-col == 1)
+            {
+                out_str("\b", 1);
+            }
+            else
+            {
+                out_esc(cur_col-col, 'D');
+            }
+        }
+        else if(col > cur_col)
+        {
+            out_esc(col-cur_col, 'C');
+        }
+    }
+    else if(start_row+row > VGA_HEIGHT)
+    {
+        /*
+         * The target row is below the screen, which happens when the cursor
+         * sits after the last char of a line that exactly fills the screen
+         * width. Scroll the screen by outputting newlines on the last row.
+         */
+        size_t n = start_row+row-VGA_HEIGHT;
+        char buf[32];
+        out_str(buf, sprintf(buf, "\e[%zu;1H", VGA_HEIGHT));
+        while(n--)
+        {
+            out_str("\n", 1);
+        }
+        scrolled_to(row);
+        if(col != 1)
+        {
+            out_esc(col-1, 'C');
+        }
+    }
+    else
+    {
+        char buf[48];
+        out_str(buf, sprintf(buf, "\e[%zu;%zuH", start_row+row, col));
+    }
+    cur_row  = row;
+    cur_col  = col;
+    cur_wrap = 0;
+}
+
+
+/*
+ * Write out the chars from index 'from' to index 'to' of string 's', and
+ * update our idea of where the cursor is. We clear the rest of the screen line
+ * before each newline char, as the line might contain text we drew earlier.
+ */
+static void write_text(char *s, size_t from, size_t to)
+{
+    size_t i, start = from;
+    for(i = from; i < to; i++)
+    {
+        if(s[i] == '\n')
+        {
+            out_str(s+start, i-start);
+            out_str("\e[K\n", 4);
+            start = i+1;
+        }
+    }
+    out_str(s+start, to-start);
+
+    if(to == from)
+    {
+        return;
+    }
+
+    size_t row, col;
+    text_pos(s, to, &row, &col);
+    if(s[to-1] != '\n' && col == 1 && row)
+    {
+        /* the last char landed in the last column */
+        cur_row  = row-1;
+        cur_col  = VGA_WIDTH;
+        cur_wrap = 1;
+    }
+    else
+    {
+        cur_row  = row;
+        cur_col  = col;
+        cur_wrap = 0;
+    }
+    scrolled_to(cur_row);
+}
+
+
+/*
+ * Return 1 if all the chars in the given range occupy exactly one screen
+ * column each, 0 otherwise.
+ */
+static int simple_text(char *s, size_t from, size_t to)
+{
+    for( ; from < to; from++)
+    {
+        unsigned char c = s[from];
+        if(c < ' ' || c > '~')
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*
+ * Save a copy of the command buffer as our screen model.
+ */
+static void save_model(char *s, size_t len)
+{
+    if(len >= scr_size)
+    {
+        size_t newsz = len+1;
+        char *newbuf = realloc(scr_text, newsz);
+        if(!newbuf)
+        {
+            /* force a full redraw next time */
+            scr_len = 0;
+            return;
+        }
+        scr_text = newbuf;
+        scr_size = newsz;
+    }
+    memcpy(scr_text, s, len);
+    scr_text[len] = '\0';
+    scr_len = len;
+}
+
+
+/*
+ * Reset the screen model. Called after the prompt is printed and start_row and
+ * start_col point to the place where the command line starts on the screen.
+ * The screen is assumed to be empty after that point.
+ */
+void redraw_reset(void)
+{
+    scr_len  = 0;
+    cur_row  = 0;
+    cur_col  = start_col;
+    cur_wrap = 0;
+    dirty    = 0;
+    terminal_row = start_row;
+    terminal_col = start_col;
+}
+
+
+/*
+ * Mark the command line as changed. The screen will be updated the next time
+ * redraw_flush() is called, which happens before we read the next key, so that
+ * all the changes a single key makes are written out together.
+ */
+void redraw_cmdline(void)
+{
+    dirty = 1;
+}
+
+
+/*
+ * Compare the command buffer with our screen model, and bring the screen up to
+ * date by outputting only the parts that changed. The cursor is then moved to the
+ * position of cmdbuf_index.
+ */
+static void redraw_diff(void)
+{
+    char  *s    = cmdbuf;
+    size_t len  = cmdbuf_end;
+    size_t pre  = 0, suf = 0;
+    size_t row, col;
+
+    /* find the common prefix */
+    while(pre < len && pre < scr_len && s[pre] == scr_text[pre])
+    {
+        pre++;
+    }
+
+    if(pre < len || pre < scr_len)
+    {
+        /* find the common suffix */
+        while(suf < len-pre && suf < scr_len-pre &&
+              s[len-suf-1] == scr_text[scr_len-suf-1])
+        {
+            suf++;
+        }
+
+        size_t oldmid = scr_len-pre-suf;
+        size_t newmid = len-pre-suf;
+        size_t maxlen = (len > scr_len) ? len : scr_len;
+
+        text_pos(s, pre, &row, &col);
+        move_to(row, col);
+
+        if(start_col+maxlen < VGA_WIDTH &&
+           simple_text(s, 0, len) && simple_text(scr_text, 0, scr_len))
+        {
+            /*
+             * The whole line fits on one screen row. If there is text after the
+             * change, use the terminal's insert and delete char functions to shift
+             * it, so that we only output the chars that actually changed. If the
+             * change is at the end of the line, there is nothing to shift, so we
+             * just write the new chars and clear whatever is left of the old ones.
+             */
+            if(suf && newmid > oldmid)
+            {
+                out_esc(newmid-oldmid, '@');
+            }
+            out_str(s+pre, newmid);
+            if(newmid < oldmid)
+            {
+                if(suf)
+                {
+                    out_esc(oldmid-newmid, 'P');
+                }
+                else
+                {
+                    out_str("\e[K", 3);
+                }
+            }
+            cur_col += newmid;
+        }
+        else
+        {
+            size_t orow, ocol;
+            text_pos(scr_text, scr_len, &orow, &ocol);
+            write_text(s, pre, len);
+            text_pos(s, len, &row, &col);
+            /* clear whatever is left of the old text */
+            if(orow > row || (orow == row && ocol > col))
+            {
+                if(cur_wrap)
+                {
+                    move_to(row, col);
+                }
+                out_str("\e[J", 3);
+            }
+        }
+        save_model(s, len);
+    }
+
+    /* now position the cursor */
+    text_pos(s, cmdbuf_index, &row, &col);
+    if(row != cur_row || col != cur_col || cur_wrap)
+    {
+        move_to(row, col);
+    }
+    terminal_row = start_row+cur_row;
+    terminal_col = cur_col;
+}
+
+
+/*
+ * Update the screen if the command buffer changed since the last time we were
+ * called, and write out any pending output.
+ */
+void redraw_flush(void)
+{
+    if(dirty)
+    {
+        dirty = 0;
+        redraw_diff();
+    }
+    out_flush();
+}
+
+
+/*
+ * Move the cursor past the end of the command line and output a newline. Called
+ * when the user presses ENTER.
+ */
+void redraw_finish(void)
+{
+    cmdbuf_index = cmdbuf_end;
+    dirty = 1;
+    redraw_flush();
+    out_str("\n", 1);
+    out_flush();
+    cur_row++;
+    cur_col  = 1;
+    cur_wrap = 0;
+    scrolled_to(cur_row);
+}
@@ -402,26 +402,13 @@ void set_token_type(struct token_s *tok)
                 /* if it contains =, check if its an assignment word */
                 if(strchr(tok->text, '='))
                 {
-                    t = TOKEN_ASSIGNMENT_WORD;
-                    char *p = tok->text;
                     /*
                      * if assignment word, chars before the '=' must be alphanumeric or '_', as this
-                     * refers to the variable name to which we're assigning a value.
+                     * refers to the variable name to which we're assigning a value. The name can
+                     * be followed by an array subscript, and the '=' can be preceded by a '+'
+                     * (bash's extended assignment).
                      */
-                    while(*++p != '=')
-                    {
-                        if(!isalnum(*p) && *p != '_')
-                        {
-                            /* this is included to support bash's extended assignment by using += */
-                            if(*p == '+' && p[1] == '=')
-                            {
-                                continue;
-                            }
-                            /* non-alphanumeric or '_' chars before '=' means its not an assignment word */
-                            t = TOKEN_WORD;
-                            break;
-                        }
-                    }
+                    t = get_assignment_eq(tok->text) ? TOKEN_ASSIGNMENT_WORD : TOKEN_WORD;
                 }
                 else
                 {
@@ -944,6 +931,30 @@ struct token_s *tokenize(struct source_s *src)
             
             case '(':
             case ')':
+                /*
+                 * if the brace follows the '=' of an assignment word, we have a compound
+                 * array assignment of the form name=(...), which we add to the token.
+                 */
+                if(nc == '(' && tok_bufindex > 0 && tok_buf[tok_bufindex-1] == '=')
+                {
+                    tok_buf[tok_bufindex] = '\0';
+                    if(get_assignment_eq(tok_buf) == tok_buf+tok_bufindex-1)
+                    {
+                        i = find_closing_brace(src->buffer+src->curpos, 0);
+                        if(i == 0)
+                        {
+                            /* closing brace not found */
+                            return &eof_token;
+                        }
+                        add_to_buf(nc);
+                        while(i--)
+                        {
+                            add_to_buf(next_char(src));
+                        }
+                        break;
+                    }
+                }
+
                 /* if the brace delimits the current token, delimit it */
                 if(tok_bufindex > 0)
                 {
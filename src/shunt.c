@@ -112,6 +112,36 @@ char *arithm_expand_recursive(char *str)
  * such as bitwise AND and OR, addition, subtraction, etc.
  */
 
+long str_long_value(char *str)
+{
+    if(!str)
+    {
+        return 0;
+    }
+
+    /*
+     * try to get a numeric value from the variable.. if that doesn't
+     * work, try to arithmetically evaluate the string.
+     */
+    char *strend;
+    long val = strtol(str, &strend, 10);
+    if(!*strend)
+    {
+        return val;
+    }
+    
+    char *s = arithm_expand_recursive(str);
+    if(!s)
+    {
+        error = 1;
+        return 0;
+    }
+    
+    val = strtol(s, NULL, 10);
+    free(s);
+    return val;
+}
+
 long long_value(struct stack_item_s *a)
 {
     /* for binary operators, bail out the 2nd operand if the first raised error */
@@ -126,30 +156,7 @@ long long_value(struct stack_item_s *a)
     }
     else if(a->type == ITEM_VAR_PTR)
     {
-        if(a->ptr->val)
-        {
-            /*
-             * try to get a numeric value from the variable.. if that doesn't
-             * work, try to arithmetically evaluate the string.
-             */
-            char *strend;
-            long val = strtol(a->ptr->val, &strend, 10);
-            if(!*strend)
-            {
-                return val;
-            }
-            
-            char *s = arithm_expand_recursive(a->ptr->val);
-            if(!s)
-            {
-                error = 1;
-                return 0;
-            }
-            
-            val = strtol(s, NULL, 10);
-            free(s);
-            return val;
-        }
+        return str_long_value(a->ptr->val);
     }
     return 0;
 }
@@ -1210,6 +1217,69 @@ long get_num(char *s, int *char_count)
 }
 
 
+/*
+ * Positional parameters and $# are not kept in the symbol table (see params.c),
+ * so we can't use get_var() for them. If s starts with one of them, e.g. $1,
+ * ${10} or $#, store the parameter's numeric value in *val and return 1.
+ * Otherwise return 0.
+ */
+int get_pos_param_operand(char *s, int *char_count, long *val)
+{
+    char *ss = s;
+    int has_braces = 0;
+
+    if(*ss++ != '$')
+    {
+        return 0;
+    }
+
+    has_braces = (*ss == '{');
+    if(has_braces)
+    {
+        ss++;
+    }
+
+    char *s2 = ss;
+    int n = -1;
+    if(*s2 == '#')
+    {
+        s2++;
+    }
+    else
+    {
+        while(isdigit(*s2))
+        {
+            s2++;
+        }
+
+        /* $0 lives in the symbol table */
+        if(s2 == ss || (s2 == ss+1 && *ss == '0'))
+        {
+            return 0;
+        }
+        n = atoi(ss);
+    }
+
+    if(has_braces)
+    {
+        if(*s2 != '}')
+        {
+            return 0;
+        }
+        s2++;
+    }
+    else if(valid_name_char(*s2))
+    {
+        /* not a positional parameter */
+        return 0;
+    }
+
+    (*val) = (n < 0) ? pos_param_count() : str_long_value(get_pos_param(n));
+    (*char_count) = s2-s;
+    return 1;
+}
+
+
 /*
  * Extract a shell variable name operand from the beginning of chars.
  */
@@ -1339,6 +1409,7 @@ char *arithm_expand(char *orig_expr)
     struct  op_s startop = { 'X', 0, ASSOC_NONE, 0, 0, NULL };    /* dummy operator to mark start */
     struct  op_s *op     = NULL;
     int     n1, n2;
+    long    pval;
     struct  op_s *lastop = &startop;
     
     /*
@@ -1541,6 +1612,17 @@ char *arithm_expand(char *orig_expr)
                 lastop = NULL;
                 expr += i+2;
             }
+            else if(get_pos_param_operand(tstart, &n2, &pval))
+            {
+                /* positional parameter */
+                CHECK_ERR_FLAG();
+                DISCARD_COMMA();
+                push_numstackl(pval);
+                CHECK_ERR_FLAG();
+                tstart = NULL;
+                lastop = NULL;
+                expr += n2;
+            }
             else if(valid_name_char(*expr))
             {
                 /* variable name */
@@ -1609,6 +1691,11 @@ char *arithm_expand(char *orig_expr)
             CHECK_ERR_FLAG();
             push_numstackl(n1);
         }
+        else if(get_pos_param_operand(tstart, &n2, &pval))
+        {
+            CHECK_ERR_FLAG();
+            push_numstackl(pval);
+        }
         else if(valid_name_char(*tstart))
         {
             push_numstackv(get_var(tstart, &n2));
@@ -275,62 +275,27 @@ void SIGWINCH_handler(int signum)
 
 /*
  * Signal handler for SIGCHLD (child status change signal).
+ *
+ * We only reap the children and save their statuses in a ring buffer, as
+ * updating the jobs table involves calling functions that are not
+ * async-signal-safe (such as malloc() and stdio). The statuses are processed
+ * later in drain_child_events() (see jobs.c).
  */
 void SIGCHLD_handler(int signum)
 {
-    int pid, status, save_errno = errno;
-    struct job_s *job, *last_stopped = NULL;
+    int status, save_errno = errno;
+    pid_t pid;
 
-    status = 0;
-    
-    while(1)
+    /* if the ring is full, leave the rest of the children for drain_child_events() */
+    while(queue_child_event(0, 0))
     {
-        status = 0;
         pid = waitpid(-1, &status, WUNTRACED|WCONTINUED|WNOHANG);
-        //if(WIFEXITED(status)) status = WEXITSTATUS(status);
-
         if(pid <= 0)
         {
             break;
         }
-        
-        notice_termination(pid, status, 1);
-        job = get_job_by_any_pid(pid);
-        
-        if(job)
-        {
-            if(WIFSTOPPED(job->status))
-            {
-                last_stopped = job;
-            }
-            else if(job->child_exits == job->proc_count && last_stopped == job)
-            {
-                last_stopped = NULL;
-            }
-        }
-    }
-    
-    if(last_stopped)
-    {
-        set_cur_job(last_stopped);
-    }
-    else
-    {
-        reset_cur_job();
-    }
-    
-    /* tcsh extensions */
-    if(optionx_set(OPTION_LIST_JOBS_LONG))
-    {
-        jobs_builtin(2, (char *[]){ "jobs", "-l", NULL });
-    }
-    else if(optionx_set(OPTION_LIST_JOBS))
-    {
-        jobs_builtin(1, (char *[]){ "jobs", NULL });
+        queue_child_event(pid, status);
     }
-    
-    /* in tcsh, special alias jobcmd is run before running commands and when jobs change state */
-    run_alias_cmd("jobcmd");
 
     errno = save_errno;
     signal_received = signum;
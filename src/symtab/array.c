@@ -0,0 +1,1262 @@
+/*
+ *    Programmed By: Mohammed Isam Mohammed [mohammed_isam1984@yahoo.com]
+ *    Copyright 2024 (c)
+ *
+ *    file: array.c
+ *    This file is part of the Layla Shell project.
+ *
+ *    Layla Shell is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Layla Shell is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Layla Shell.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../include/cmd.h"
+#include "../include/debug.h"
+#include "symtab.h"
+
+/*
+ * Indexed arrays start in the 'dense' format, where element i is stored in
+ * vals[i]. If we are asked to set an element whose index is far beyond the
+ * last used slot (e.g. `arr[1000000]=x` on a small array), we switch to the
+ * 'sparse' format, where we keep a list of (index, value) pairs sorted by index.
+ * Appending to the end of a sparse array is cheap, as is appending to a dense one.
+ *
+ * Associative arrays keep their elements in insertion order in the entries list.
+ * The buckets table maps a key's hash to the index of its entry, using open
+ * addressing with linear probing. Unset elements stay in the entries list (with
+ * a NULL key) until the list is compacted when we need to grow it.
+ */
+
+/* how far past the last used slot we can set an element before going sparse */
+#define ARRAY_MAX_GAP           1024
+
+/* initial sizes */
+#define ARRAY_INIT_SIZE         8
+#define ASSOC_INIT_BUCKETS      16
+
+/* an empty bucket in an associative array's buckets table */
+#define ASSOC_EMPTY_BUCKET      -1
+
+/* defined in string_hash.c */
+extern const uint32_t fnv1a_seed;
+extern uint32_t fnv1a(char *text, uint32_t hash);
+
+
+/*
+ * Create a new, empty array.
+ *
+ * Returns the new array, or NULL if we have insufficient memory.
+ */
+struct array_s *new_array(int assoc)
+{
+    struct array_s *arr = malloc(sizeof(struct array_s));
+    if(!arr)
+    {
+        return NULL;
+    }
+    memset(arr, 0, sizeof(struct array_s));
+    arr->flags = assoc ? ARRAY_FLAG_ASSOC : 0;
+    return arr;
+}
+
+
+/*
+ * Free all the elements of the array, leaving the array empty.
+ */
+void array_clear(struct array_s *arr)
+{
+    size_t i;
+
+    if(!arr)
+    {
+        return;
+    }
+
+    if(flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        for(i = 0; i < arr->used; i++)
+        {
+            if(arr->entries[i].key)
+            {
+                free_malloced_str(arr->entries[i].key);
+                free_malloced_str(arr->entries[i].val);
+            }
+        }
+        free(arr->entries);
+        free(arr->buckets);
+        arr->entries  = NULL;
+        arr->buckets  = NULL;
+        arr->nbuckets = 0;
+    }
+    else if(flag_set(arr->flags, ARRAY_FLAG_SPARSE))
+    {
+        for(i = 0; i < arr->used; i++)
+        {
+            free_malloced_str(arr->items[i].val);
+        }
+        free(arr->items);
+        arr->items  = NULL;
+        arr->flags &= ~ARRAY_FLAG_SPARSE;
+    }
+    else
+    {
+        for(i = 0; i < arr->used; i++)
+        {
+            if(arr->vals[i])
+            {
+                free_malloced_str(arr->vals[i]);
+            }
+        }
+        free(arr->vals);
+        arr->vals = NULL;
+    }
+
+    arr->count = 0;
+    arr->size  = 0;
+    arr->used  = 0;
+}
+
+
+/*
+ * Free the memory used by an array and its elements.
+ */
+void free_array(struct array_s *arr)
+{
+    if(arr)
+    {
+        array_clear(arr);
+        free(arr);
+    }
+}
+
+
+/*
+ * Search a sparse array for the element with the given index.
+ *
+ * Returns the position of the element in the items list if found, otherwise
+ * the position where an element with that index should be inserted. The found
+ * flag tells the caller which is the case.
+ */
+static size_t sparse_find(struct array_s *arr, long index, int *found)
+{
+    size_t lo = 0, hi = arr->used;
+
+    /* most lookups and insertions happen at the end of the array */
+    if(hi && arr->items[hi-1].index < index)
+    {
+        *found = 0;
+        return hi;
+    }
+
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi-lo)/2;
+        long i = arr->items[mid].index;
+        if(i == index)
+        {
+            *found = 1;
+            return mid;
+        }
+        else if(i < index)
+        {
+            lo = mid+1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    *found = 0;
+    return lo;
+}
+
+
+/*
+ * Convert a dense indexed array to the sparse format.
+ *
+ * Returns 1 on success, 0 if we have insufficient memory.
+ */
+static int make_sparse(struct array_s *arr)
+{
+    size_t size = arr->count+ARRAY_INIT_SIZE, i, j;
+    struct array_item_s *items = malloc(size * sizeof(struct array_item_s));
+    if(!items)
+    {
+        return 0;
+    }
+
+    for(i = 0, j = 0; i < arr->used; i++)
+    {
+        if(arr->vals[i])
+        {
+            items[j].index = i;
+            items[j].val   = arr->vals[i];
+            j++;
+        }
+    }
+
+    free(arr->vals);
+    arr->vals   = NULL;
+    arr->items  = items;
+    arr->size   = size;
+    arr->used   = j;
+    arr->flags |= ARRAY_FLAG_SPARSE;
+    return 1;
+}
+
+
+/*
+ * Return the value of the element with the given index in an indexed array,
+ * or NULL if the element is not set.
+ */
+char *array_get(struct array_s *arr, long index)
+{
+    if(!arr || index < 0 || flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return NULL;
+    }
+
+    if(flag_set(arr->flags, ARRAY_FLAG_SPARSE))
+    {
+        int found;
+        size_t i = sparse_find(arr, index, &found);
+        return found ? arr->items[i].val : NULL;
+    }
+
+    return ((size_t)index < arr->used) ? arr->vals[index] : NULL;
+}
+
+
+/*
+ * Set the value of the element with the given index in an indexed array.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int array_set(struct array_s *arr, long index, char *val)
+{
+    if(!arr || index < 0 || flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return 0;
+    }
+
+    if(!val)
+    {
+        val = "";
+    }
+
+    /* go sparse if the new element is too far from the other elements */
+    if(!flag_set(arr->flags, ARRAY_FLAG_SPARSE) &&
+       (size_t)index >= arr->used+ARRAY_MAX_GAP && !make_sparse(arr))
+    {
+        return 0;
+    }
+
+    if(flag_set(arr->flags, ARRAY_FLAG_SPARSE))
+    {
+        int found;
+        size_t i = sparse_find(arr, index, &found);
+        if(found)
+        {
+            free_malloced_str(arr->items[i].val);
+            arr->items[i].val = get_malloced_str(val);
+            return 1;
+        }
+
+        if(arr->used == arr->size)
+        {
+            size_t size = arr->size ? arr->size*2 : ARRAY_INIT_SIZE;
+            struct array_item_s *items = realloc(arr->items, size * sizeof(struct array_item_s));
+            if(!items)
+            {
+                return 0;
+            }
+            arr->items = items;
+            arr->size  = size;
+        }
+
+        if(i < arr->used)
+        {
+            memmove(&arr->items[i+1], &arr->items[i],
+                    (arr->used-i) * sizeof(struct array_item_s));
+        }
+        arr->items[i].index = index;
+        arr->items[i].val   = get_malloced_str(val);
+        arr->used++;
+        arr->count++;
+        return 1;
+    }
+
+    if((size_t)index >= arr->size)
+    {
+        size_t size = arr->size ? arr->size*2 : ARRAY_INIT_SIZE;
+        while(size <= (size_t)index)
+        {
+            size *= 2;
+        }
+
+        char **vals = realloc(arr->vals, size * sizeof(char *));
+        if(!vals)
+        {
+            return 0;
+        }
+        memset(vals+arr->size, 0, (size-arr->size) * sizeof(char *));
+        arr->vals = vals;
+        arr->size = size;
+    }
+
+    if(arr->vals[index])
+    {
+        free_malloced_str(arr->vals[index]);
+    }
+    else
+    {
+        arr->count++;
+    }
+    arr->vals[index] = get_malloced_str(val);
+
+    if((size_t)index >= arr->used)
+    {
+        arr->used = index+1;
+    }
+    return 1;
+}
+
+
+/*
+ * Unset the element with the given index in an indexed array.
+ */
+void array_unset(struct array_s *arr, long index)
+{
+    if(!arr || index < 0 || flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return;
+    }
+
+    if(flag_set(arr->flags, ARRAY_FLAG_SPARSE))
+    {
+        int found;
+        size_t i = sparse_find(arr, index, &found);
+        if(found)
+        {
+            free_malloced_str(arr->items[i].val);
+            arr->used--;
+            memmove(&arr->items[i], &arr->items[i+1],
+                    (arr->used-i) * sizeof(struct array_item_s));
+            arr->count--;
+        }
+        return;
+    }
+
+    if((size_t)index < arr->used && arr->vals[index])
+    {
+        free_malloced_str(arr->vals[index]);
+        arr->vals[index] = NULL;
+        arr->count--;
+
+        /* shrink the used part of the vector if we removed the last element */
+        while(arr->used && !arr->vals[arr->used-1])
+        {
+            arr->used--;
+        }
+    }
+}
+
+
+/*
+ * Return the highest index used in an indexed array, or -1 if the array is empty.
+ */
+long array_last_index(struct array_s *arr)
+{
+    if(!arr || !arr->count || flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return -1;
+    }
+
+    if(flag_set(arr->flags, ARRAY_FLAG_SPARSE))
+    {
+        return arr->items[arr->used-1].index;
+    }
+
+    return arr->used-1;
+}
+
+
+/*
+ * Search an associative array for the given key.
+ *
+ * Returns the bucket that contains the key's entry if found, otherwise the
+ * empty bucket where the key should be added.
+ */
+static size_t assoc_find(struct array_s *arr, char *key, uint32_t hash)
+{
+    size_t mask = arr->nbuckets-1;
+    size_t i = hash & mask;
+
+    while(arr->buckets[i] != ASSOC_EMPTY_BUCKET)
+    {
+        struct assoc_item_s *e = &arr->entries[arr->buckets[i]];
+        if(e->hash == hash && e->key && strcmp(e->key, key) == 0)
+        {
+            break;
+        }
+        i = (i+1) & mask;
+    }
+    return i;
+}
+
+
+/*
+ * Rebuild an associative array's buckets table with the given number of buckets,
+ * dropping unset elements from the entries list.
+ *
+ * Returns 1 on success, 0 if we have insufficient memory.
+ */
+static int assoc_rehash(struct array_s *arr, size_t nbuckets)
+{
+    /* keep the load factor below 2/3 */
+    size_t size = nbuckets*2/3;
+    int *buckets = malloc(nbuckets * sizeof(int));
+    if(!buckets)
+    {
+        return 0;
+    }
+
+    size_t i, j;
+    for(i = 0, j = 0; i < arr->used; i++)
+    {
+        if(arr->entries[i].key)
+        {
+            arr->entries[j++] = arr->entries[i];
+        }
+    }
+    arr->used = j;
+
+    if(size != arr->size)
+    {
+        struct assoc_item_s *entries = realloc(arr->entries, size * sizeof(struct assoc_item_s));
+        if(!entries)
+        {
+            free(buckets);
+            return 0;
+        }
+        arr->entries = entries;
+        arr->size    = size;
+    }
+
+    free(arr->buckets);
+    arr->buckets  = buckets;
+    arr->nbuckets = nbuckets;
+
+    for(i = 0; i < nbuckets; i++)
+    {
+        buckets[i] = ASSOC_EMPTY_BUCKET;
+    }
+
+    for(i = 0; i < arr->used; i++)
+    {
+        buckets[assoc_find(arr, arr->entries[i].key, arr->entries[i].hash)] = i;
+    }
+    return 1;
+}
+
+
+/*
+ * Return the value of the element with the given key in an associative array,
+ * or NULL if the element is not set.
+ */
+char *assoc_get(struct array_s *arr, char *key)
+{
+    if(!arr || !key || !arr->count || !flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return NULL;
+    }
+
+    int i = arr->buckets[assoc_find(arr, key, fnv1a(key, fnv1a_seed))];
+    return (i == ASSOC_EMPTY_BUCKET) ? NULL : arr->entries[i].val;
+}
+
+
+/*
+ * Set the value of the element with the given key in an associative array.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int assoc_set(struct array_s *arr, char *key, char *val)
+{
+    if(!arr || !key || !flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return 0;
+    }
+
+    if(!val)
+    {
+        val = "";
+    }
+
+    uint32_t hash = fnv1a(key, fnv1a_seed);
+    size_t b;
+
+    if(arr->nbuckets)
+    {
+        b = assoc_find(arr, key, hash);
+        if(arr->buckets[b] != ASSOC_EMPTY_BUCKET)
+        {
+            struct assoc_item_s *e = &arr->entries[arr->buckets[b]];
+            free_malloced_str(e->val);
+            e->val = get_malloced_str(val);
+            return 1;
+        }
+    }
+
+    /* grow the table (or compact it, if we have many unset elements) */
+    if(arr->used == arr->size)
+    {
+        size_t nbuckets = ASSOC_INIT_BUCKETS;
+        if(arr->nbuckets)
+        {
+            nbuckets = arr->nbuckets;
+            if(arr->count >= arr->size/2)
+            {
+                nbuckets *= 2;
+            }
+        }
+
+        if(!assoc_rehash(arr, nbuckets))
+        {
+            return 0;
+        }
+    }
+
+    b = assoc_find(arr, key, hash);
+    arr->buckets[b] = arr->used;
+    arr->entries[arr->used].key  = get_malloced_str(key);
+    arr->entries[arr->used].val  = get_malloced_str(val);
+    arr->entries[arr->used].hash = hash;
+    arr->used++;
+    arr->count++;
+    return 1;
+}
+
+
+/*
+ * Unset the element with the given key in an associative array.
+ */
+void assoc_unset(struct array_s *arr, char *key)
+{
+    if(!arr || !key || !arr->count || !flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        return;
+    }
+
+    int i = arr->buckets[assoc_find(arr, key, fnv1a(key, fnv1a_seed))];
+    if(i != ASSOC_EMPTY_BUCKET)
+    {
+        /*
+         * We leave the bucket pointing to the entry, so that we don't break the
+         * probe sequence of other keys. The entry is dropped when we rehash.
+         */
+        free_malloced_str(arr->entries[i].key);
+        free_malloced_str(arr->entries[i].val);
+        arr->entries[i].key = NULL;
+        arr->entries[i].val = NULL;
+        arr->count--;
+    }
+}
+
+
+/*
+ * Iterate over the elements of an array, in index order for indexed arrays, or
+ * insertion order for associative arrays. The caller should set *pos to 0 before
+ * the first call. The element's index (or key) is returned in index (or key),
+ * if they are not NULL.
+ *
+ * Returns the element's value, or NULL if there are no more elements.
+ */
+char *array_next(struct array_s *arr, size_t *pos, long *index, char **key)
+{
+    size_t i = *pos;
+
+    if(!arr)
+    {
+        return NULL;
+    }
+
+    if(flag_set(arr->flags, ARRAY_FLAG_ASSOC))
+    {
+        for( ; i < arr->used; i++)
+        {
+            if(arr->entries[i].key)
+            {
+                *pos = i+1;
+                if(key)
+                {
+                    *key = arr->entries[i].key;
+                }
+                return arr->entries[i].val;
+            }
+        }
+    }
+    else if(flag_set(arr->flags, ARRAY_FLAG_SPARSE))
+    {
+        if(i < arr->used)
+        {
+            *pos = i+1;
+            if(index)
+            {
+                *index = arr->items[i].index;
+            }
+            return arr->items[i].val;
+        }
+    }
+    else
+    {
+        for( ; i < arr->used; i++)
+        {
+            if(arr->vals[i])
+            {
+                *pos = i+1;
+                if(index)
+                {
+                    *index = i;
+                }
+                return arr->vals[i];
+            }
+        }
+    }
+
+    *pos = i;
+    return NULL;
+}
+
+
+/*
+ * Turn the given symbol table entry into an indexed or associative array. A
+ * string value becomes the array's first element (with index 0, or key "0").
+ *
+ * Returns the array, or NULL if we have insufficient memory.
+ */
+struct array_s *symtab_entry_make_array(struct symtab_entry_s *entry, int assoc)
+{
+    if(entry->array)
+    {
+        return entry->array;
+    }
+
+    struct array_s *arr = new_array(assoc);
+    if(!arr)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "array");
+        return NULL;
+    }
+
+    if(entry->val)
+    {
+        if(assoc)
+        {
+            assoc_set(arr, "0", entry->val);
+        }
+        else
+        {
+            array_set(arr, 0, entry->val);
+        }
+        free_malloced_str(entry->val);
+        entry->val = NULL;
+    }
+
+    entry->array = arr;
+    entry->val_type = assoc ? SYM_ASSOC : SYM_ARRAY;
+    return arr;
+}
+
+
+/*
+ * Free the given entry's array and turn it back into a string variable.
+ */
+void symtab_entry_free_array(struct symtab_entry_s *entry)
+{
+    if(entry->array)
+    {
+        free_array(entry->array);
+        entry->array = NULL;
+    }
+
+    if(entry->val_type == SYM_ARRAY || entry->val_type == SYM_ASSOC)
+    {
+        entry->val_type = SYM_STR;
+    }
+}
+
+
+/*****************************************
+ * Functions for working with shell arrays.
+ *****************************************/
+
+/*
+ * If str starts with an array element reference of the form name[subscript],
+ * return a pointer to the ']' that closes the subscript. Otherwise return NULL.
+ */
+char *get_subscript_end(char *str)
+{
+    char *p = str;
+    if(!isalpha(*p) && *p != '_')
+    {
+        return NULL;
+    }
+
+    while(isalnum(*p) || *p == '_')
+    {
+        p++;
+    }
+
+    if(*p != '[')
+    {
+        return NULL;
+    }
+
+    size_t i = find_closing_brace(p, 0);
+    return i ? p+i : NULL;
+}
+
+
+/*
+ * If word is an assignment word of the form name=value, name+=value,
+ * name[subscript]=value or name[subscript]+=value, return a pointer to the
+ * '=' sign. Otherwise return NULL.
+ */
+char *get_assignment_eq(char *word)
+{
+    char *p = get_subscript_end(word);
+    if(p)
+    {
+        p++;
+    }
+    else
+    {
+        p = word;
+        if(!isalpha(*p) && *p != '_')
+        {
+            return NULL;
+        }
+
+        while(isalnum(*p) || *p == '_')
+        {
+            p++;
+        }
+    }
+
+    if(*p == '+')
+    {
+        p++;
+    }
+    return (*p == '=') ? p : NULL;
+}
+
+
+/*
+ * Evaluate the subscript of an indexed array element reference. Negative
+ * indices count back from the end of the array (bash).
+ *
+ * Returns the index, or -1 if the subscript is invalid (after printing an
+ * error message).
+ */
+long get_array_index(struct array_s *arr, char *sub)
+{
+    char *strend;
+    long index;
+
+    /* most subscripts are plain numbers, which don't need arithmetic expansion */
+    while(isspace(*sub))
+    {
+        sub++;
+    }
+
+    index = strtol(sub, &strend, 10);
+    if(strend == sub || *strend)
+    {
+        /* expand any parameters and command substitutions in the subscript */
+        char *expr = strpbrk(sub, "$`\"'") ? word_expand_to_str(sub, FLAG_REMOVE_QUOTES) : NULL;
+        char *s = arithm_expand_recursive(expr ? expr : sub);
+        if(expr)
+        {
+            free(expr);
+        }
+
+        if(!s)
+        {
+            return -1;
+        }
+        index = strtol(s, NULL, 10);
+        free(s);
+    }
+
+    if(index < 0)
+    {
+        index += array_last_index(arr)+1;
+        if(index < 0)
+        {
+            PRINT_ERROR(SHELL_NAME, "bad array subscript: %s", sub);
+            return -1;
+        }
+    }
+    return index;
+}
+
+
+/*
+ * Expand the subscript of an associative array element reference.
+ *
+ * Returns the malloc'd key, or NULL on error.
+ */
+static char *get_assoc_key(char *sub)
+{
+    return word_expand_to_str(sub, FLAG_REMOVE_QUOTES);
+}
+
+
+/*
+ * Return the value of the array element with the given (unexpanded) subscript,
+ * or NULL if the element is not set. String variables are treated as arrays
+ * with one element, that has index 0 (bash).
+ */
+char *get_array_elem(struct symtab_entry_s *entry, char *sub)
+{
+    char *val = NULL;
+
+    if(entry->val_type == SYM_ASSOC)
+    {
+        char *key = get_assoc_key(sub);
+        if(key)
+        {
+            val = assoc_get(entry->array, key);
+            free(key);
+        }
+    }
+    else
+    {
+        long index = get_array_index(entry->array, sub);
+        if(entry->array)
+        {
+            val = array_get(entry->array, index);
+        }
+        else if(index == 0)
+        {
+            val = entry->val;
+        }
+    }
+
+    return val;
+}
+
+
+/*
+ * Set the value of the array element with the given (unexpanded) subscript,
+ * turning the variable into an indexed array if it is not an array. If append
+ * is non-zero, the value is appended to the element's current value.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int set_array_elem(struct symtab_entry_s *entry, char *sub, char *val, int append)
+{
+    if(flag_set(entry->flags, FLAG_READONLY))
+    {
+        READONLY_ASSIGN_ERROR(SHELL_NAME, entry->name, "variable");
+        return 0;
+    }
+
+    struct array_s *arr = symtab_entry_make_array(entry, 0);
+    if(!arr)
+    {
+        return 0;
+    }
+
+    char *key = NULL, *old = NULL, *s = NULL;
+    long index = 0;
+    int res;
+
+    if(entry->val_type == SYM_ASSOC)
+    {
+        if(!(key = get_assoc_key(sub)))
+        {
+            return 0;
+        }
+        old = assoc_get(arr, key);
+    }
+    else
+    {
+        if((index = get_array_index(arr, sub)) < 0)
+        {
+            return 0;
+        }
+        old = array_get(arr, index);
+    }
+
+    if(append && old && (s = alpha_list_make_str("%s%s", old, val ? val : "")))
+    {
+        val = s;
+    }
+
+    if(key)
+    {
+        res = assoc_set(arr, key, val);
+        free(key);
+    }
+    else
+    {
+        res = array_set(arr, index, val);
+    }
+
+    if(s)
+    {
+        free(s);
+    }
+    return res;
+}
+
+
+/*
+ * Unset the array element with the given (unexpanded) subscript.
+ */
+void unset_array_elem(struct symtab_entry_s *entry, char *sub)
+{
+    if(entry->val_type == SYM_ASSOC)
+    {
+        char *key = get_assoc_key(sub);
+        if(key)
+        {
+            assoc_unset(entry->array, key);
+            free(key);
+        }
+    }
+    else if(entry->array)
+    {
+        long index = get_array_index(entry->array, sub);
+        if(index >= 0)
+        {
+            array_unset(entry->array, index);
+        }
+    }
+    else if(get_array_index(NULL, sub) == 0)
+    {
+        symtab_entry_setval(entry, NULL);
+    }
+}
+
+
+/*
+ * Return the next word from a compound array assignment's list of words, and
+ * advance *pp past the word. Words are separated by unquoted whitespace chars.
+ *
+ * Returns the malloc'd word, or NULL if there are no more words (or if we have
+ * insufficient memory).
+ */
+static char *next_list_word(char **pp)
+{
+    char *p = *pp, *start;
+    size_t i;
+
+    while(isspace(*p))
+    {
+        p++;
+    }
+
+    if(!*p)
+    {
+        *pp = p;
+        return NULL;
+    }
+
+    start = p;
+    while(*p && !isspace(*p))
+    {
+        switch(*p)
+        {
+            case '\\':
+                if(p[1])
+                {
+                    p++;
+                }
+                break;
+
+            case '"':
+            case '\'':
+            case '`':
+                if((i = find_closing_quote(p, 0, 0)))
+                {
+                    p += i;
+                }
+                break;
+
+            case '$':
+                if(p[1] == '{' || p[1] == '(' || p[1] == '[')
+                {
+                    if((i = find_closing_brace(p+1, 0)))
+                    {
+                        p += i+1;
+                    }
+                }
+                break;
+
+            case '[':
+                if((i = find_closing_brace(p, 0)))
+                {
+                    p += i;
+                }
+                break;
+        }
+        p++;
+    }
+
+    *pp = p;
+
+    /* we modify the word when parsing it, so get a private copy */
+    char *word = malloc(p-start+1);
+    if(word)
+    {
+        memcpy(word, start, p-start);
+        word[p-start] = '\0';
+    }
+    return word;
+}
+
+
+/*
+ * Perform a compound array assignment of the form name=(word ...), where list
+ * points to the opening brace. Each word is expanded and assigned to the next
+ * element in turn, while words of the form [subscript]=value set the element
+ * with the given subscript. Associative arrays can also be assigned a list of
+ * alternating keys and values. If append is non-zero, the words are added to
+ * the end of the array, otherwise they replace the array's elements.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int set_array_list(struct symtab_entry_s *entry, char *list, int append)
+{
+    if(flag_set(entry->flags, FLAG_READONLY))
+    {
+        READONLY_ASSIGN_ERROR(SHELL_NAME, entry->name, "variable");
+        return 0;
+    }
+
+    int assoc = (entry->val_type == SYM_ASSOC);
+    int res = 1;
+    size_t len = strlen(list);
+    char *words = malloc(len-1);
+    if(!words)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "array assignment");
+        return 0;
+    }
+    memcpy(words, list+1, len-2);
+    words[len-2] = '\0';
+
+    /*
+     * Unless we are appending, fill a new array and replace the old one when
+     * we're done, as the words might refer to the array's old elements.
+     */
+    struct array_s *arr;
+    if(append)
+    {
+        arr = symtab_entry_make_array(entry, assoc);
+    }
+    else
+    {
+        arr = new_array(assoc);
+    }
+
+    if(!arr)
+    {
+        free(words);
+        return 0;
+    }
+
+    /* for indexed arrays, the index of the next element we'll set */
+    long index = assoc ? 0 : array_last_index(arr)+1;
+    char *p = words, *word, *key = NULL;
+
+    while(res && (word = next_list_word(&p)))
+    {
+        /* [subscript]=value */
+        char *sub_end = (*word == '[') ? word+find_closing_brace(word, 0) : NULL;
+        if(sub_end && sub_end != word && sub_end[1] == '=')
+        {
+            char *val = word_expand_to_str(sub_end+2, FLAG_REMOVE_QUOTES);
+            *sub_end = '\0';
+
+            if(!val)
+            {
+                res = 0;
+            }
+            else if(assoc)
+            {
+                char *k = get_assoc_key(word+1);
+                res = k && assoc_set(arr, k, val);
+                if(k)
+                {
+                    free(k);
+                }
+            }
+            else
+            {
+                index = get_array_index(arr, word+1);
+                res = (index >= 0) && array_set(arr, index++, val);
+            }
+
+            if(val)
+            {
+                free(val);
+            }
+            free(word);
+            continue;
+        }
+
+        /* other words are subject to all expansions */
+        struct word_s *w, *wordlist = word_expand(word, FLAG_PATHNAME_EXPAND |
+                                                        FLAG_REMOVE_QUOTES   |
+                                                        FLAG_FIELD_SPLITTING);
+        for(w = wordlist; w && res; w = w->next)
+        {
+            if(!assoc)
+            {
+                res = array_set(arr, index++, w->data);
+            }
+            else if(key)
+            {
+                res = assoc_set(arr, key, w->data);
+                free_malloced_str(key);
+                key = NULL;
+            }
+            else
+            {
+                key = get_malloced_str(w->data);
+            }
+        }
+        free_all_words(wordlist);
+        free(word);
+    }
+
+    /* a key with no value gets an empty value (bash) */
+    if(key)
+    {
+        res = res && assoc_set(arr, key, "");
+        free_malloced_str(key);
+    }
+    free(words);
+
+    if(!append)
+    {
+        symtab_entry_setval(entry, NULL);
+        entry->array = arr;
+        entry->val_type = assoc ? SYM_ASSOC : SYM_ARRAY;
+    }
+    return res;
+}
+
+
+/*
+ * Return 1 if word is an array assignment word, i.e. one of the forms
+ * name[subscript]=value, name[subscript]+=value, name=(...) or name+=(...),
+ * 0 otherwise.
+ */
+int is_array_assignment(char *word)
+{
+    char *eq = get_assignment_eq(word);
+    if(!eq)
+    {
+        return 0;
+    }
+
+    if(eq[-1] == ']' || (eq[-1] == '+' && eq[-2] == ']'))
+    {
+        return 1;
+    }
+
+    return (eq[1] == '(' && eq[strlen(eq)-1] == ')');
+}
+
+
+/*
+ * Perform the array assignment word (see is_array_assignment() above) on the
+ * given symbol table entry, which should be the entry of the variable named in
+ * the word.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int do_array_assignment(struct symtab_entry_s *entry, char *word)
+{
+    char *eq = get_assignment_eq(word);
+    char *sub_end = get_subscript_end(word);
+    int append = (eq[-1] == '+');
+    int res = 0;
+
+    if(!sub_end)
+    {
+        return set_array_list(entry, eq+1, append);
+    }
+
+    char *sub_start = strchr(word, '[')+1;
+    char *sub = get_malloced_strl(sub_start, 0, sub_end-sub_start);
+    if(!sub)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "array assignment");
+        return 0;
+    }
+
+    char *val = word_expand_to_str(eq+1, FLAG_PATHNAME_EXPAND|FLAG_REMOVE_QUOTES);
+    if(val)
+    {
+        res = set_array_elem(entry, sub, val, append);
+        free(val);
+    }
+    free_malloced_str(sub);
+    return res;
+}
+
+
+/*
+ * Join the values of the array's elements, separated by the given separator
+ * char. A zero separator means the values are concatenated.
+ *
+ * Returns the malloc'd string, or NULL if we have insufficient memory.
+ */
+char *array_join(struct array_s *arr, char separator)
+{
+    size_t pos = 0, len = 0;
+    char *val;
+
+    /* get the total length */
+    while((val = array_next(arr, &pos, NULL, NULL)))
+    {
+        len += strlen(val)+1;
+    }
+
+    char *str = malloc(len+1), *p;
+    if(!str)
+    {
+        return NULL;
+    }
+
+    p = str;
+    pos = 0;
+    while((val = array_next(arr, &pos, NULL, NULL)))
+    {
+        if(p != str && separator)
+        {
+            *p++ = separator;
+        }
+        p = stpcpy(p, val);
+    }
+    *p = '\0';
+    return str;
+}
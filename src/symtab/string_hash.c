@@ -117,6 +117,49 @@ struct hashtab_s *new_hashtable_sz(int size)
 }
 
 
+/*
+ * Double the number of buckets in a hash table when the table holds more than
+ * HASHTABLE_MAX_LOAD items per bucket on average, and move the items to their
+ * new buckets. This keeps the bucket lists short when the table grows large, as
+ * when the string buffer holds the lines of a big file (see mapfile.c).
+ * If we can't alloc memory for the new buckets, we keep using the old ones.
+ */
+static void grow_hashtable(struct hashtab_s *table)
+{
+    if(table->used < table->size*HASHTABLE_MAX_LOAD)
+    {
+        return;
+    }
+
+    int newsz = table->size*2;
+    struct hashitem_s **items = malloc(newsz * sizeof(struct hashitem_s *));
+    if(!items)
+    {
+        return;
+    }
+    memset(items, 0, newsz * sizeof(struct hashitem_s *));
+
+    struct hashitem_s **h1 = table->items;
+    struct hashitem_s **h2 = table->items + table->size;
+    for( ; h1 < h2; h1++)
+    {
+        struct hashitem_s *entry = *h1;
+        while(entry)
+        {
+            struct hashitem_s *next = entry->next;
+            int index = fnv1a(entry->name, fnv1a_seed) % newsz;
+            entry->next = items[index];
+            items[index] = entry;
+            entry = next;
+        }
+    }
+
+    free(table->items);
+    table->items = items;
+    table->size  = newsz;
+}
+
+
 /*
  * Allocate a new hash table and initialize its structure. The table is
  * given the default size, which is the value of the HASHTABLE_INIT_SIZE macro.
@@ -297,6 +340,7 @@ struct hashitem_s *add_hash_item(struct hashtab_s *table, char *key, char *value
      * you are probably going to use it soon, right? Or maybe wrong,
      * but this is how we do it here :)
      */
+    grow_hashtable(table);
     int index = calc_hash(table, key);
     entry->next = table->items[index];
     table->items[index] = entry;
@@ -345,6 +389,7 @@ struct hashitem_s *add_hash_itemb(struct hashtab_s *table, char *key, long value
      * you are probably going to use it soon, right? Or maybe wrong,
      * but this is how we do it here :)
      */
+    grow_hashtable(table);
     int index = calc_hash(table, key);
     entry->next = table->items[index];
     table->items[index] = entry;
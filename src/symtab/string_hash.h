@@ -27,6 +27,10 @@
 #define HASHTABLE_INIT_SIZE     256     /* initial size of the string buffer */
 #endif
 
+#ifndef HASHTABLE_MAX_LOAD
+#define HASHTABLE_MAX_LOAD      4       /* max. average number of items per bucket */
+#endif
+
 /* the structure to hold a hashed string */
 struct hashitem_s
 {
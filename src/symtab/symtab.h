@@ -22,6 +22,8 @@
 #ifndef SYMTAB_H
 #define SYMTAB_H
 
+#include <stdint.h>
+
 /*
  * Use hash tables to implement the symbol table struct. Remove this macro,
  * or set it to 0 if you want to use the linked lists implementation instead.
@@ -31,10 +33,51 @@
 /* the type of a symbol table entry's value */
 enum symbol_type
 {
-    SYM_STR ,
-    SYM_FUNC,
+    SYM_STR  ,
+    SYM_FUNC ,
+    SYM_ARRAY,                        /* indexed array */
+    SYM_ASSOC,                        /* associative array */
+};
+
+/* an element of a sparse indexed array */
+struct array_item_s
+{
+    long   index;
+    char  *val;
+};
+
+/* an element of an associative array */
+struct assoc_item_s
+{
+    char     *key;                    /* NULL if the element was unset */
+    char     *val;
+    uint32_t  hash;
 };
 
+/*
+ * The array structure. Indexed arrays keep their elements in a vector indexed
+ * by the element's index, unless the indices are too far apart, in which case
+ * we switch to a list of (index, value) pairs sorted by index. Associative
+ * arrays keep their elements in insertion order, with an open addressing
+ * table of indices into the elements list that we use for the lookups.
+ */
+struct array_s
+{
+    int       flags;                  /* ARRAY_FLAG_ASSOC, ARRAY_FLAG_SPARSE */
+    size_t    count;                  /* number of elements that are set */
+    size_t    size;                   /* number of allocated slots */
+    size_t    used;                   /* number of used slots */
+    char    **vals;                   /* dense indexed arrays */
+    struct    array_item_s *items;    /* sparse indexed arrays */
+    struct    assoc_item_s *entries;  /* associative arrays */
+    int      *buckets;                /* associative arrays' lookup table */
+    size_t    nbuckets;               /* size of the above table (a power of 2) */
+};
+
+/* values for the flags field of struct array_s */
+#define ARRAY_FLAG_ASSOC    (1 << 0)    /* associative array */
+#define ARRAY_FLAG_SPARSE   (1 << 1)    /* indexed array in the sparse format */
+
 /* the symbol table entry structure */
 struct symtab_entry_s
 {
@@ -44,6 +87,7 @@ struct symtab_entry_s
     unsigned  int flags;              /* flags like readonly, export, ... */
     struct    symtab_entry_s *next;   /* pointer to the next entry */
     struct    node_s *func_body;      /* for functions, the nodetree of the function body */
+    struct    array_s *array;         /* for arrays, the array's elements */
 };
 
 
@@ -107,4 +151,29 @@ void                   free_symtab(struct symtab_s *symtab);
 void                   symtab_entry_setval(struct symtab_entry_s *entry, char *val);
 void                   merge_global(struct symtab_s *symtab);
 
+/* array.c */
+struct array_s        *new_array(int assoc);
+void                   free_array(struct array_s *arr);
+void                   array_clear(struct array_s *arr);
+char                  *array_get(struct array_s *arr, long index);
+int                    array_set(struct array_s *arr, long index, char *val);
+void                   array_unset(struct array_s *arr, long index);
+long                   array_last_index(struct array_s *arr);
+char                  *assoc_get(struct array_s *arr, char *key);
+int                    assoc_set(struct array_s *arr, char *key, char *val);
+void                   assoc_unset(struct array_s *arr, char *key);
+char                  *array_next(struct array_s *arr, size_t *pos, long *index, char **key);
+struct array_s        *symtab_entry_make_array(struct symtab_entry_s *entry, int assoc);
+void                   symtab_entry_free_array(struct symtab_entry_s *entry);
+char                  *get_subscript_end(char *str);
+char                  *get_assignment_eq(char *word);
+long                   get_array_index(struct array_s *arr, char *sub);
+char                  *get_array_elem(struct symtab_entry_s *entry, char *sub);
+int                    set_array_elem(struct symtab_entry_s *entry, char *sub, char *val, int append);
+void                   unset_array_elem(struct symtab_entry_s *entry, char *sub);
+int                    set_array_list(struct symtab_entry_s *entry, char *list, int append);
+int                    is_array_assignment(char *word);
+int                    do_array_assignment(struct symtab_entry_s *entry, char *word);
+char                  *array_join(struct array_s *arr, char separator);
+
 #endif
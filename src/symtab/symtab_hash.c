@@ -212,6 +212,11 @@ void free_symtab(struct symtab_s *symtab)
                 {
                     free_node_tree(entry->func_body);
                 }
+                /* if it's an array, free its elements */
+                if(entry->array)
+                {
+                    free_array(entry->array);
+                }
                 /* free the entry itself and move to the next entry */
                 free(entry);
                 entry = next;
@@ -304,6 +309,11 @@ int rem_from_symtab(struct symtab_entry_s *entry, struct symtab_s *symtab)
             {
                 free_node_tree(entry->func_body);
             }
+            /* if it's an array, free its elements */
+            if(entry->array)
+            {
+                free_array(entry->array);
+            }
             /* free the key string */
             free_malloced_str(entry->name);
             /* free the entry itself */
@@ -505,6 +515,8 @@ void symtab_entry_setval(struct symtab_entry_s *entry, char *val)
     if(!val)
     {
         entry->val = NULL;
+        /* unsetting an array unsets all its elements */
+        symtab_entry_free_array(entry);
     }
     else
     {
@@ -543,7 +555,22 @@ void symtab_entry_setval(struct symtab_entry_s *entry, char *val)
             return;
         }
         
-        entry->val = get_malloced_str(val);
+        /* assigning to an array without a subscript sets element 0 (bash) */
+        if(entry->array)
+        {
+            if(entry->val_type == SYM_ASSOC)
+            {
+                assoc_set(entry->array, "0", val);
+            }
+            else
+            {
+                array_set(entry->array, 0, val);
+            }
+        }
+        else
+        {
+            entry->val = get_malloced_str(val);
+        }
         
         if(free_val && val)
         {
@@ -594,8 +621,22 @@ void merge_global(struct symtab_s *symtab)
                     /* find the global entry for this local entry */
                     struct symtab_entry_s *gentry = add_to_symtab(entry->name);
                         
-                    /* overwrite the global entry's value with the local one */
-                    symtab_entry_setval(gentry, entry->val);
+                    /*
+                     * Overwrite the global entry's value with the local one. Arrays
+                     * are moved, not copied, as the local symbol table is freed
+                     * after we return.
+                     */
+                    if(entry->array)
+                    {
+                        symtab_entry_setval(gentry, NULL);
+                        gentry->array = entry->array;
+                        gentry->val_type = entry->val_type;
+                        entry->array = NULL;
+                    }
+                    else
+                    {
+                        symtab_entry_setval(gentry, entry->val);
+                    }
 
                     /* set the flags */
                     gentry->flags |= entry->flags;
@@ -642,8 +683,16 @@ void dump_local_symtab(void)
             struct symtab_entry_s *entry = *h1;
             while(entry)
             {
-                fprintf(stderr, "%*s[%04d] %-32s '%s'\n", indent, " ", 
-                        i++, entry->name, entry->val);
+                if(entry->array)
+                {
+                    fprintf(stderr, "%*s[%04d] %-32s (array of %zu elements)\n", indent, " ",
+                            i++, entry->name, entry->array->count);
+                }
+                else
+                {
+                    fprintf(stderr, "%*s[%04d] %-32s '%s'\n", indent, " ", 
+                            i++, entry->name, entry->val);
+                }
                 entry = entry->next;
             }
         }
@@ -22,9 +22,14 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pwd.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include "include/cmd.h"
 #include "builtins/builtins.h"
 #include "builtins/setx.h"
@@ -36,21 +41,36 @@
 #define MAX_CMDS    2048
 
 char  *HOSTS_FILE    = "/etc/hosts";    /* default hosts file */
-char **hostnames     = NULL;            /* hostnames buffer */
-int    hn_len        = 0;               /* max number of entries (size of buffer) */
-int    hn_count      = 0;               /* number of entries */
-time_t hn_last_check = 0;               /* last time we accessed the hosts file */
-
 char  *PASSWD_FILE   = "/etc/passwd";   /* default passwd database file */
-char **usernames     = NULL;            /* user names buffer */
-int    un_len        = 0;               /* max number of entries (size of buffer) */
-int    un_count      = 0;               /* number of entries */
-time_t un_last_check = 0;               /* last time we accessed the passwd file */
+
+/* max time (in milliseconds) to wait for a completion source to load */
+#define NAME_SOURCE_WAIT    100
+
+/*
+ * A sorted list of names used in auto-completion (host names and user names).
+ * The names are loaded by a child process, so that reading a big hosts file,
+ * or a slow (LDAP or NIS-backed) passwd database, doesn't block the command
+ * line editor.
+ */
+struct name_source_s
+{
+    char   **names;                     /* sorted list of names */
+    int      count;                     /* number of names */
+    time_t   mtime;                     /* modification time of the file we loaded */
+    int      fd;                        /* pipe we read the names from while loading */
+    char    *buf;                       /* the names we've read so far */
+    size_t   buf_len;
+    void   (*load)(FILE *out, char *path);  /* function that writes out the names */
+};
+
+static void load_hostnames(FILE *out, char *path);
+static void load_usernames(FILE *out, char *path);
+
+static struct name_source_s hostnames = { NULL, 0, 0, -1, NULL, 0, load_hostnames };
+static struct name_source_s usernames = { NULL, 0, 0, -1, NULL, 0, load_usernames };
 
 int    match_hostname(char *name, char **matches, int max);
 int    match_username(char *name, char **matches, int max);
-char **get_hostnames();
-char **get_usernames();
 
 
 /*
@@ -306,6 +326,7 @@ void output_results(char **cmds, size_t count)
     {
         /* we have more lines than can be printed on one screen */
         printf("Show all %d results? [y/N]: ", (int)count);
+        fflush(stdout);
         term_canon(1);
         int c = getc(stdin);
         if(c == 'y' || c == 'Y')
@@ -365,7 +386,7 @@ char *get_common_prefix(char **cmds, int count)
  */
 int do_tab(char *cmdbuf, size_t *__cmdbuf_index, size_t *__cmdbuf_end)
 {
-    extern int start_row, start_col;
+    extern size_t start_row, start_col;
     size_t   cmdbuf_index = *__cmdbuf_index;
     size_t   cmdbuf_end   = *__cmdbuf_end  ;
     size_t   j, k, i    = 0;
@@ -542,7 +563,7 @@ int do_tab(char *cmdbuf, size_t *__cmdbuf_index, size_t *__cmdbuf_end)
             /* free used memory */
             for(j = 0; j < res; j++)
             {
-                free(cmds[j]);
+                free_malloced_str(cmds[j]);
             }
         }
         else        /* no matches found */
@@ -579,7 +600,7 @@ int do_tab(char *cmdbuf, size_t *__cmdbuf_index, size_t *__cmdbuf_end)
             /* free used memory */
             for(j = 0; j < res; j++)
             {
-                free(cmds[j]);
+                free_malloced_str(cmds[j]);
             }
         }
         else        /* no matches found */
@@ -696,15 +717,14 @@ int do_tab(char *cmdbuf, size_t *__cmdbuf_index, size_t *__cmdbuf_end)
         else if(res == 1)   /* one match found */
         {
             p = cmds[0]+strlen(tmp);
-            printf("%s", p);
             strcat(cmdbuf, p);
             if(p[strlen(p)-1] != '/' && optionx_set(OPTION_ADD_SUFFIX))
             {
-                putchar(' ');
                 strcat(cmdbuf, " ");
             }
             *__cmdbuf_index = strlen(cmdbuf);
             *__cmdbuf_end   = *__cmdbuf_index;
+            redraw_cmdline();
             if(!internals)
             {
                 free_malloced_str(cmds[0]);
@@ -844,14 +864,11 @@ int do_tab(char *cmdbuf, size_t *__cmdbuf_index, size_t *__cmdbuf_end)
     update_row_col();
     start_row = get_terminal_row();
     start_col = get_terminal_col();
-    printf("%s", cmdbuf);
+    /* the command line will be redrawn after the prompt */
+    redraw_reset();
+    redraw_cmdline();
     if(!comm_prefix)
     {
-        /* return the cursor to where it was */
-        if(cmdbuf_index != cmdbuf_end)
-        {
-            do_left_key(cmdbuf_end-cmdbuf_index);
-        }
         return res;
     }
     cmds[0] = NULL;
@@ -873,16 +890,9 @@ one_res: ;
             if(*p2 == '$' || *p2 == '`' || *p2 == '"' || *p2 == '\'' || *p2 == '\\' || *p2 == ' ')
             {
                 plen++;
-                putchar('\\');
             }
-            putchar(*p2++);
-        }
-        /* add a space after a file name */
-        if(addsp)
-        {
-            putchar(' ');
+            p2++;
         }
-        printf("%s", cmdbuf+eword);
         /* make some room */
         p2 = cmdbuf+cmdbuf_end;
         char *p3 = p2+plen;
@@ -915,13 +925,6 @@ one_res: ;
     }
     else
     {
-        printf("%s", p);
-        /* add a space after a file name */
-        if(addsp)
-        {
-            putchar(' ');
-        }
-        printf("%s", cmdbuf+eword);
         /* make some room */
         char *p2 = cmdbuf+cmdbuf_end;
         char *p3 = p2+plen;
@@ -943,7 +946,7 @@ one_res: ;
     }
     *__cmdbuf_index = strlen(cmdbuf);
     *__cmdbuf_end   = *__cmdbuf_index;
-    update_row_col();
+    redraw_cmdline();
     if(cmds[0])
     {
         free_malloced_str(cmds[0]);
@@ -956,299 +959,339 @@ one_res: ;
 }
 
 /*
- * Match a partial hostname to the hostnames database entries.
- * 
- * Returns the number of matched names, saving the entries in the matches array.
+ * Write the host names in the given hosts file to the out stream, one per line.
+ * This function runs in the child process that loads the host names.
  */
-int match_hostname(char *name, char **matches, int max)
+static void load_hostnames(FILE *out, char *path)
 {
-    /* get the hostnames */
-    if(!get_hostnames())
+    /*
+     * read the host names from the hosts file. each line in the file
+     * represents an entry in the format:
+     * 
+     *     127.0.0.1   localhost localhost.localdomain localhost4 localhost4.localdomain4
+     *     ^           ^         ^                     ^          ^
+     *     |           |         |---------------------|----------|
+     *     IP address  hostname                     aliases
+     */
+    char *line = NULL;
+    FILE *f = fopen(path, "r");
+    if(!f)
     {
-        return 0;
+        return;
     }
-    int i = 0, j = 0;
-    int len = strlen(name);
-    /* search for matches */
-    for( ; i < hn_count && j < max; i++)
+    int line_max = get_linemax();
+    char buf[line_max];
+    while((line = fgets(buf, line_max, f)))
     {
-        if(strncmp(name, hostnames[i], len) == 0)
+        /* remove comments */
+        char *p = strchr(line, '#'), *p2;
+        if(p)
         {
-            matches[j++] = get_malloced_str(hostnames[i]);
+            *p = '\0';
+        }
+        
+        p = line;
+        /* skip the host address */
+        while(*p && isspace(*p))
+        {
+            p++;
+        }
+        while(*p && !isspace(*p))
+        {
+            p++;
+        }
+        
+        /* get the host name and its aliases */
+        while(*p)
+        {
+            /* skip the spaces */
+            while(*p && isspace(*p))
+            {
+                p++;
+            }
+            /* get the end of the name */
+            p2 = p;
+            while(*p2 && !isspace(*p2))
+            {
+                p2++;
+            }
+            if(p == p2)
+            {
+                break;
+            }
+            fprintf(out, "%.*s\n", (int)(p2-p), p);
+            p = p2;
         }
     }
-    return j;
+    fclose(f);
 }
 
+
 /*
- * Get all the hostnames from the hosts database.
+ * Write the user names in the passwd database to the out stream, one per line.
+ * We use getpwent() instead of reading the passwd file, so that we get the names
+ * from all the sources configured on the system, like LDAP and NIS. This function
+ * runs in the child process that loads the user names.
  */
-char **get_hostnames(void)
+static void load_usernames(FILE *out, char *path __attribute__((unused)))
 {
-    int checkf = 0;
-    int i = 0;
-    char *path = get_shell_varp("HOSTFILE", HOSTS_FILE);
-    struct stat st;
-    /* check the existence and modification time of the file */
-    if((i = stat(path, &st)) == 0)
+    struct passwd *pw;
+    setpwent();
+    while((pw = getpwent()))
     {
-        if(S_ISREG(st.st_mode) && difftime(st.st_mtime, hn_last_check) > 0)
-        {
-            checkf = 1;
-        }
+        /* we add '/' so that the completed name is ready to be followed by a path */
+        fprintf(out, "%s/\n", pw->pw_name);
     }
-    else
+    endpwent();
+}
+
+
+struct load_names_arg_s
+{
+    struct name_source_s *src;
+    char                 *path;
+};
+
+
+/*
+ * Write out the names of a completion source. This function runs in the
+ * background process started by start_loading().
+ */
+static void load_names(int fd, void *arg)
+{
+    struct load_names_arg_s *load_arg = arg;
+    FILE *out = fdopen(fd, "w");
+    if(out)
     {
-        /* invalid hosts file given in $HOSTFILE */
-        if(i && path != HOSTS_FILE)
-        {
-            /* try to check the standard hosts file */
-            path = HOSTS_FILE;
-            if(stat(path, &st) == 0)
-            {
-                if(S_ISREG(st.st_mode) && difftime(st.st_mtime, hn_last_check) > 0)
-                {
-                    checkf = 1;
-                }
-            }
-        }
+        load_arg->src->load(out, load_arg->path);
+        fclose(out);
     }
-    /* first call or hosts file has been modified since our last access */
-    if(!hostnames || checkf)
+}
+
+
+/*
+ * Start loading the names of the given completion source in a child process,
+ * which writes the names to a pipe we read from in read_names().
+ */
+static void start_loading(struct name_source_s *src, char *path)
+{
+    struct load_names_arg_s arg = { src, path };
+    int fd = spawn_pipe_reader(load_names, &arg);
+    if(fd < 0)
     {
-        if(hostnames)
-        {
-            /*
-             * free the entries we have stored in the host names array.
-             * 
-             * TODO: bash adds new entries to the list, instead of overwriting it.
-             *       follow that behaviour.
-             */
-            for(i = 0; i < hn_count; i++)
-            {
-                free_malloced_str(hostnames[i]);
-            }
-            free(hostnames);
-            hostnames = NULL;
-            hn_len    = 0;
-            hn_count  = 0;
-        }        
-        hn_last_check = time(NULL);
-        /*
-         * read the host names from the hosts file. each line in the file
-         * represents an entry in the format:
-         * 
-         *     127.0.0.1   localhost localhost.localdomain localhost4 localhost4.localdomain4
-         *     ^           ^         ^                     ^          ^
-         *     |           |         |---------------------|----------|
-         *     IP address  hostname                     aliases
-         */
-        char *line = NULL;
-        FILE *f = fopen(path, "r");
-        if(!f)
+        return;
+    }
+    src->fd = fd;
+    src->buf_len = 0;
+}
+
+
+/*
+ * Replace the names of the given completion source with the names we've just
+ * loaded, which are sorted so that we can use binary search to find matches.
+ */
+static void finish_loading(struct name_source_s *src)
+{
+    char **names = NULL;
+    int i, count = 0, len = 0;
+    char *p = src->buf, *end = src->buf+src->buf_len, *p2;
+    
+    while(p < end)
+    {
+        p2 = memchr(p, '\n', end-p);
+        if(!p2)
         {
-            return NULL;
+            p2 = end;
         }
-        int line_max = get_linemax();
-        char buf[line_max];
-        while((line = fgets(buf, line_max, f)))
+        
+        if(p2 > p)
         {
-            if(!line[0])    /* empty line. skip */
+            if(!check_buffer_bounds(&count, &len, &names))
             {
-                continue;
+                break;
             }
-            char *p = line, *p2;
-            /* skip the host address */
-            while(*p && !isspace(*p))
+            names[count] = get_malloced_strl(p, 0, p2-p);
+            if(names[count])
             {
-                p++;
+                count++;
             }
-            /* reached the end of line */
-            if(!*p)
+        }
+        p = p2+1;
+    }
+    
+    /* sort the names and remove duplicates */
+    if(count)
+    {
+        sort(names, count);
+        int j = 0;
+        for(i = 1; i < count; i++)
+        {
+            if(strcmp(names[i], names[j]) == 0)
             {
-                continue;
+                free_malloced_str(names[i]);
             }
-            /* get the host name and its aliases */
-            while(*p)
+            else
             {
-                /* extend the buffer */
-                if(!check_buffer_bounds(&hn_count, &hn_len, &hostnames))
-                {
-                    /* insufficient memory. return the list we've got so far */
-                    return hostnames;
-                }
-                /* skip the spaces */
-                while(*p && isspace(*p))
-                {
-                    p++;
-                }
-                /* reached the end of line */
-                if(!*p)
-                {
-                    break;
-                }
-                /* get the end of the name */
-                p2 = p;
-                while(*p2 && !isspace(*p2))
-                {
-                    p2++;
-                }
-                if(p == p2)
-                {
-                    break;
-                }
-                /* get a copy of the hostname */
-                char *host = get_malloced_strl(line, p-line, p2-p);
-                /* don't repeat entries */
-                int found = 0;
-                for(i = 0; i < hn_count; i++)
-                {
-                    if(strcmp(hostnames[i], host) == 0)
-                    {
-                        free_malloced_str(host);
-                        host = NULL;
-                        found = 1;
-                        break;
-                    }
-                }
-                /* add the hostname to the list */
-                if(!found && host)
-                {
-                    hostnames[hn_count++] = host;
-                }
-                p = p2;
+                names[++j] = names[i];
             }
         }
+        count = j+1;
     }
-    /* return the hostnames list */
-    return hostnames;
+    
+    /* replace the old list */
+    for(i = 0; i < src->count; i++)
+    {
+        free_malloced_str(src->names[i]);
+    }
+    if(src->names)
+    {
+        free(src->names);
+    }
+    src->names = names;
+    src->count = count;
+    
+    if(src->buf)
+    {
+        free(src->buf);
+        src->buf = NULL;
+    }
+    src->buf_len = 0;
 }
 
 
 /*
- * Match a partial username to the passwd database entries.
- * 
- * Returns the number of matched names, saving the entries in the matches array.
+ * Read the names written by the child process that is loading the given source,
+ * waiting at most the given number of milliseconds.
  */
-int match_username(char *name, char **matches, int max)
+static void read_names(struct name_source_s *src, int wait)
 {
-    /* get the usernames */
-    if(!get_usernames())
-    {
-        return 0;
-    }
-    int i = 0, j = 0;
-    int len = strlen(name);
-    /* search for the username */
-    for( ; i < un_count && j < max; i++)
+    struct timespec start, now;
+    struct pollfd pfd = { .fd = src->fd, .events = POLLIN };
+    long remaining = wait;
+    char buf[4096];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    while(remaining >= 0 && poll(&pfd, 1, remaining) > 0)
     {
-        if(strncmp(name, usernames[i], len) == 0)
+        ssize_t res = read(src->fd, buf, sizeof(buf));
+        if(res < 0 && errno == EINTR)
         {
-            matches[j++] = get_malloced_str(usernames[i]);
+            continue;
         }
+        
+        if(res <= 0)
+        {
+            /* finished (or failed) */
+            close(src->fd);
+            src->fd = -1;
+            finish_loading(src);
+            return;
+        }
+        
+        char *p = realloc(src->buf, src->buf_len+res);
+        if(!p)
+        {
+            return;
+        }
+        memcpy(p+src->buf_len, buf, res);
+        src->buf = p;
+        src->buf_len += res;
+        
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = wait - (((now.tv_sec-start.tv_sec)*1000) + ((now.tv_nsec-start.tv_nsec)/1000000));
     }
-    return j;
 }
 
+
 /*
- * Get all the usernames from the passwd database.
+ * Bring the given completion source up to date. The names are loaded the first
+ * time we need them, and reloaded when the file they came from is modified. While
+ * the names are loading, we wait a little for the loading to finish, then use the
+ * names we have (if any), so that we never block the command line editor for long.
  */
-char **get_usernames(void)
+static void update_name_source(struct name_source_s *src, char *path)
 {
-    int checkf = 0;
-    int i = 0;
-    char *path = PASSWD_FILE;
     struct stat st;
-    /* check the existence and modification time of the file */
-    if((i = stat(path, &st)) == 0)
+    time_t mtime = (stat(path, &st) == 0) ? st.st_mtime : 0;
+    
+    if(src->fd < 0 && (!src->names || mtime != src->mtime))
     {
-        if(S_ISREG(st.st_mode) && difftime(st.st_mtime, un_last_check) > 0)
-        {
-            checkf = 1;
-        }
+        src->mtime = mtime;
+        start_loading(src, path);
+    }
+    
+    if(src->fd >= 0)
+    {
+        read_names(src, NAME_SOURCE_WAIT);
     }
-    /* first call or passwd file has been modified since our last access */
-    if(!usernames || checkf)
+}
+
+
+/*
+ * Find the names in the given completion source that start with the given prefix.
+ * 
+ * Returns the number of matched names, saving the entries in the matches array.
+ */
+static int match_names(struct name_source_s *src, char *name, char **matches, int max)
+{
+    int lo = 0, hi = src->count, mid, j = 0;
+    size_t len = strlen(name);
+    
+    /* binary search for the first name that is not less than the prefix */
+    while(lo < hi)
     {
-        if(usernames)
+        mid = (lo+hi)/2;
+        if(strcmp(src->names[mid], name) < 0)
         {
-            /*
-             * free the entries we have stored in the user names array.
-             * 
-             * TODO: add new entries to the list, instead of overwriting it.
-             */
-            for(i = 0; i < un_count; i++)
-            {
-                free_malloced_str(usernames[i]);
-            }
-            free(usernames);
-            usernames = NULL;
-            un_len    = 0;
-            un_count  = 0;
-        }        
-        un_last_check = time(NULL);
-        /*
-         * read the user names from the passwd file. each line in the file
-         * represents an entry in the format:
-         * 
-         *     root:x:0:0:root:/root:/bin/bash
-         *     ^    ^ ^ ^ ^    ^     ^
-         *     |    | | | |    |     +---------------+
-         *     |    | | | |    +------------+        |
-         *     |    | | | +----------+      |        |
-         *     |    | | +-------+    |      |        |
-         *     |    | +----+    |    |      |        |
-         *     |    ++     |    |    |      |        |
-         *     |     |     |    |    |      |        |
-         *     user  pass  uid  gid  group  homedir  login shell
-         */
-        char *line = NULL;
-        FILE *f = fopen(path, "r");
-        if(!f)
+            lo = mid+1;
+        }
+        else
         {
-            return NULL;
+            hi = mid;
         }
-        int line_max = get_linemax();
-        char buf[line_max];
-        while((line = fgets(buf, line_max, f)))
+    }
+    
+    /* all the names starting with the prefix come next */
+    for( ; lo < src->count && j < max; lo++)
+    {
+        if(strncmp(name, src->names[lo], len) != 0)
         {
-            if(!line[0])        /* empty line. skip */
-            {
-                continue;
-            }
-            char *p = line;
-            /* get to the first colon */
-            while(*p && *p != ':')
-            {
-                p++;
-            }
-            /* extend the buffer */
-            if(!check_buffer_bounds(&un_count, &un_len, &usernames))
-            {
-                /* insufficient memory. return the list we've got so far */
-                return usernames;
-            }
-            /* get the user name */
-            char *user = get_malloced_strl(line, 0, p-line+1);
-            user[p-line] = '/';
-            /* don't repeat entries */
-            int found = 0;
-            for(i = 0; i < un_count; i++)
-            {
-                if(strcmp(usernames[i], user) == 0)
-                {
-                    free_malloced_str(user);
-                    user = NULL;
-                    found = 1;
-                    break;
-                }
-            }
-            if(!found && user)
-            {
-                usernames[un_count++] = user;
-            }
+            break;
         }
+        matches[j++] = get_malloced_str(src->names[lo]);
     }
-    /* return the usernames list */
-    return usernames;
+    return j;
+}
+
+
+/*
+ * Match a partial hostname to the hostnames database entries.
+ * 
+ * Returns the number of matched names, saving the entries in the matches array.
+ */
+int match_hostname(char *name, char **matches, int max)
+{
+    struct stat st;
+    char *path = get_shell_varp("HOSTFILE", HOSTS_FILE);
+    
+    /* invalid hosts file given in $HOSTFILE. try to check the standard hosts file */
+    if(path != HOSTS_FILE && (stat(path, &st) != 0 || !S_ISREG(st.st_mode)))
+    {
+        path = HOSTS_FILE;
+    }
+    
+    update_name_source(&hostnames, path);
+    return match_names(&hostnames, name, matches, max);
+}
+
+
+/*
+ * Match a partial username to the passwd database entries.
+ * 
+ * Returns the number of matched names, saving the entries in the matches array.
+ */
+int match_username(char *name, char **matches, int max)
+{
+    update_name_source(&usernames, PASSWD_FILE);
+    return match_names(&usernames, name, matches, max);
 }
@@ -32,6 +32,7 @@
 #include "include/cmd.h"
 #include "include/sig.h"
 #include "backend/backend.h"
+#include "builtins/setx.h"
 #include "include/debug.h"
 #include "include/kbdevent.h"
 
@@ -298,6 +299,21 @@ void set_terminal_color(int FG, int BG)
 }
 
 
+/*
+ * Turn the terminal's bracketed paste mode on or off. When on, the terminal
+ * surrounds pasted text with ESC [200~ and ESC [201~, which lets us insert the
+ * text in one go, instead of processing it one key at a time.
+ */
+void bracketed_paste(int on)
+{
+    if(optionx_set(OPTION_BRACKET_PASTE) && isatty(stdout->_fileno))
+    {
+        fprintf(stdout, on ? "\e[?2004h" : "\e[?2004l");
+        fflush(stdout);
+    }
+}
+
+
 /*
  * Read the row or column number from the terminal.
  */
@@ -348,6 +364,9 @@ void update_row_col(void)
     sigset_t intmask;
     SIGNAL_BLOCK(SIGCHLD, intmask);
     
+    /* the cursor position must reflect everything we've printed so far */
+    fflush(stdout);
+    
     /* request terminal cursor position report (CPR) */
     //fprintf(stdout, "\x1b[6n");
     if(write(tty, "\x1b[6n", 4) != 4)
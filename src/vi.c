@@ -43,8 +43,8 @@ extern size_t start_row   ;
 extern size_t start_col   ;
 extern int    insert      ;
 
-/* saved copies of the current row, column, and command buffer index */
-static size_t srow, scol, scmdindex;
+/* saved copy of the command buffer index */
+static size_t scmdindex;
 
 /* flag to indicate if we are in the INSERT mode */
 int   sinsert = 0;
@@ -336,8 +336,6 @@ void find_brace(void)
  */
 void save_curpos(void)
 {
-    srow = terminal_row;
-    scol = terminal_col;
     scmdindex = cmdbuf_index;
 }
 
@@ -347,10 +345,8 @@ void save_curpos(void)
  */
 void restore_curpos(void)
 {
-    terminal_row = srow;
-    terminal_col = scol;
     cmdbuf_index = scmdindex;
-    move_cur(terminal_row, terminal_col);
+    redraw_cmdline();
 }
 
 
@@ -383,15 +379,11 @@ void insert_at(char *s)
     {
         *p1++ = *p2++;
     }
-    /* print the new command line */
-    printf("%s", s);
-    save_curpos();
-    printf("%s", cmdbuf+cmdbuf_index+slen);
     /* adjust our buffer pointers */
     cmdbuf_end   += slen;
     cmdbuf_index += slen;
-    /* move the cursor to where we inserted the new string */
-    do_left_key(cmdbuf_end-cmdbuf_index);
+    /* print the new command line */
+    redraw_cmdline();
 }
 
 
@@ -400,12 +392,10 @@ void insert_at(char *s)
  */
 void replace_with(char *s)
 {
-    clear_cmd(0);
-    move_cur(start_row, start_col);
     strcpy(cmdbuf, s);
     cmdbuf_end = strlen(cmdbuf);
     cmdbuf_index = cmdbuf_end;
-    output_cmd();
+    redraw_cmdline();
 }
 
 
@@ -478,6 +468,15 @@ int vi_cmode()
             continue;
         }
 
+        /* don't interpret pasted text as vi commands */
+        if(c == PASTE_KEY)
+        {
+            size_t len;
+            free(get_pasted_text(tty, &len));
+            beep();
+            continue;
+        }
+
         /* count tabs */
         if(c != '\t')
         {
@@ -1116,9 +1115,7 @@ select:
                         }
                         count = cmdbuf_index;
                         cmdbuf_index = c;
-                        terminal_col = start_col+c;
-                        terminal_row = start_row;
-                        move_cur(terminal_row, terminal_col);
+                        redraw_cmdline();
                         if(lc == 'c')
                         {
                             do_del_key(count-cmdbuf_index);
@@ -1365,7 +1362,6 @@ select:
                 break;
                 
             case 'C':                           /* delete from here to EOL and return to input mode */
-                clear_cmd(cmdbuf_index);
                 cmdbuf[cmdbuf_index] = '\0';
                 cmdbuf_end = cmdbuf_index;
                 restore_curpos();
@@ -1403,9 +1399,9 @@ select:
                 break;
                 
             case 'D':                           /* similar to 'C' without entering input mode */
-                clear_cmd(cmdbuf_index);
                 cmdbuf[cmdbuf_index] = '\0';
                 cmdbuf_end = cmdbuf_index;
+                redraw_cmdline();
                 count = 0;
                 lc = 'D';
                 break;
@@ -1471,9 +1467,8 @@ select:
                         break;
                     }
                     cmdbuf[cmdbuf_index++] = c;
-                    putchar(c);
                 }
-                update_row_col();
+                redraw_cmdline();
                 lc = 'r';
                 break;
 
@@ -1494,8 +1489,6 @@ select:
                 
             case 'V':                           /* print special fc command in buffer */
 #define VSTR    "fc -e ${VISUAL:-${EDITOR:-vi}}"
-                clear_cmd(0);
-                move_cur(start_row, start_col);
                 if(!count)      /* use cur line */
                 {
                     char b[cmdbuf_end+1];
@@ -1508,7 +1501,7 @@ select:
                 }
                 cmdbuf_end = strlen(cmdbuf);
                 cmdbuf_index = cmdbuf_end;
-                output_cmd();
+                redraw_cmdline();
                 break;
                 
             case 'x':                           /* del cur char */
@@ -1632,9 +1625,8 @@ select:
                         c = c-'A'+'a';
                     }
                     cmdbuf[cmdbuf_index++] = c;
-                    putchar(c);
                 }
-                update_row_col();
+                redraw_cmdline();
                 lc = '~';
                 break;
 
@@ -1791,7 +1783,7 @@ select:
                         do_right_key(1);
                     }
                     cmdbuf_index = 0;
-                    move_cur(start_row, start_col);
+                    redraw_cmdline();
                 }
                 else
                 {
@@ -1865,8 +1857,9 @@ select:
                 update_row_col();
                 start_row = get_terminal_row();
                 start_col = get_terminal_col();
-                output_cmd();
                 cmdbuf_index = cmdbuf_end;
+                redraw_reset();
+                redraw_cmdline();
                 break;
                 
             case '\n':
@@ -1883,7 +1876,8 @@ select:
                 update_row_col();
                 start_row = terminal_row;
                 start_col = terminal_col;
-                output_cmd();
+                redraw_reset();
+                redraw_cmdline();
                 break;
                 
         } /* end switch */
@@ -22,79 +22,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include "include/cmd.h"
 #include "include/vi.h"
 #include "include/debug.h"
 
 /* defined in cmdline.c */
 extern size_t    CMD_BUF_SIZE;
-extern int       start_row   ;
-extern int       start_col   ;
+extern size_t    start_row   ;
+extern size_t    start_col   ;
 extern int       insert      ;
 
 /*
- * Clear the command (in whole or part) that's in the command buffer from the
- * screen. We do this when we are processing some keys (backspace, delete, ^W),
- * and when we want to replace the command in the buffer (such as when the user
- * presses UP or DOWN keys to navigate the history list).
+ * NOTE: The functions in this file only modify the command buffer. The screen is
+ *       updated by calling redraw_cmdline() (see redraw.c), which outputs the
+ *       changes when we're about to read the next key.
  */
-void clear_cmd(int startat)
-{
-    /* if we'll clear the whole command, move the cursor to the beginning */
-    if(!startat)
-    {
-        move_cur(start_row, start_col);
-    }
-    char *p = cmdbuf+startat;
-    if(!*p)
-    {
-        return;
-    }
-    /* print out the characters in the buffer */
-    for( ; *p; p++)
-    {
-        if(*p == '\t' || *p == '\r' || *p == '\n')
-        {
-            /* print tabs, newlines and carriage returns */
-            putc(*p , stdout);
-        }
-        else
-        {
-            /* for all other chars, print a space (i.e. clear the char from screen) */
-            putc(' ', stdout);
-        }
-    }
-}
-
-
-/* 
- * Print the command in the command buffer to the screen. We output the
- * command manually so we can calculate how many newlines are there and
- * update the start_row and terminal_row variables correctly.
- */
-void output_cmd(void)
-{
-    update_row_col();
-    char *p = cmdbuf;
-    while(*p)
-    {
-        if(*p == '\n')
-        {
-            if(terminal_row == VGA_HEIGHT)
-            {
-                start_row--;
-            }
-            /*
-            else
-            {
-                terminal_row++;
-            }
-            */
-        }
-        putchar(*p++);
-    }
-    update_row_col();
-}
 
 
 /*
@@ -103,14 +46,13 @@ void output_cmd(void)
 void do_insert(char c)
 {
     /* normal char, add to buffer and print */
-    if(cmdbuf_end >= CMD_BUF_SIZE)
+    if(cmdbuf_end+2 >= cmdbuf_size)
     {
         if(!ext_cmdbuf(&cmdbuf, &cmdbuf_size, CMD_BUF_SIZE+1))     /* TODO: we must handle this error */
         {
             return;
         }
     }
-    printf("%c" , c);
     
     /* overwrite cur char if we are in the INSERT mode */
     if(insert)
@@ -121,10 +63,9 @@ void do_insert(char c)
         {
             /* extend the string */
             cmdbuf_end++;
-            cmdbuf[cmdbuf_index+1] = '\0';
+            cmdbuf[cmdbuf_end] = '\0';
         }
-        /* update the cursor's positon */
-        update_row_col();
+        redraw_cmdline();
         return;
     }
     
@@ -132,20 +73,9 @@ void do_insert(char c)
     if(cmdbuf_index < cmdbuf_end)
     {
         /* make room for the new char */
-        size_t u;
-        for(u = cmdbuf_end+1; u > cmdbuf_index; u--)
-        {
-            cmdbuf[u] = cmdbuf[u-1];
-        }
-        cmdbuf[cmdbuf_end+1] = '\0';
-        /* update the cursor's positon */
-        update_row_col();
-        /* print the string from the current position till the end */
-        printf("%s", cmdbuf+cmdbuf_index+1);
+        memmove(cmdbuf+cmdbuf_index+1, cmdbuf+cmdbuf_index, cmdbuf_end-cmdbuf_index+1);
         /* add char to buffer */
         cmdbuf[cmdbuf_index] = c;
-        /* move the cursor one place to the right */
-        move_cur(terminal_row, terminal_col);
     }
     else
     {
@@ -157,6 +87,7 @@ void do_insert(char c)
     /* update the buffer pointers */
     cmdbuf_index++;
     cmdbuf_end++;
+    redraw_cmdline();
 }
 
 
@@ -170,11 +101,10 @@ void do_kill_key(void)
     {
         return;
     }
-    clear_cmd(0);
-    move_cur(start_row, start_col);
     cmdbuf_end   = 0;
     cmdbuf_index = 0;
     cmdbuf[0]    = '\0';
+    redraw_cmdline();
 }
 
 
@@ -185,33 +115,26 @@ void do_kill_key(void)
  */
 void do_del_key(int count)
 {
-    if(!count)
+    if(count <= 0)
     {
         return;
     }
     if(cmdbuf_index < cmdbuf_end)
     {
+        if((size_t)count > cmdbuf_end-cmdbuf_index)
+        {
+            count = cmdbuf_end-cmdbuf_index;
+        }
         /*
          * shift characters from cursor till the end of the string 'count' positions
          * to the left.
          */
-        size_t u;
-        for(u = cmdbuf_index; u <= cmdbuf_end-count; u++)
-        {
-            cmdbuf[u] = cmdbuf[u+count];
-        }
+        memmove(cmdbuf+cmdbuf_index, cmdbuf+cmdbuf_index+count,
+                cmdbuf_end-cmdbuf_index-count+1);
         /* remove excess characters from the string */
         cmdbuf_end -= count;
         cmdbuf[cmdbuf_end] = '\0';
-        /* update the cursor's positon */
-        update_row_col();
-        /* print the new command string, and replace the deleted chars with spaces */
-        size_t old_row = terminal_row, old_col = terminal_col;
-        printf("%s%*s", cmdbuf+cmdbuf_index, count, " ");
-        /* move the cursor back to where it was */
-        move_cur(old_row, old_col);
-        terminal_row = old_row;
-        terminal_col = old_col;
+        redraw_cmdline();
     }
 }
 
@@ -227,56 +150,51 @@ void do_backspace(size_t count)
     {
         return;
     }
-    update_row_col();
-    /* first column of first row, no place to go back */
-    if(terminal_col == 1 && terminal_row == 1)
-    {
-        return;
-    }
     /* first char in the buffer, no char to delete */
     if(cmdbuf_index == 0)
     {
         return;
     }
+    if(count > cmdbuf_index)
+    {
+        count = cmdbuf_index;
+    }
     cmdbuf_index -= count;
     /*
      * shift characters from cursor till the end of the string 'count' positions
      * to the left.
      */
-    size_t u;
-    for(u = cmdbuf_index; u <= cmdbuf_end-count; u++)
-    {
-        cmdbuf[u] = cmdbuf[u+count];
-    }
+    memmove(cmdbuf+cmdbuf_index, cmdbuf+cmdbuf_index+count,
+            cmdbuf_end-cmdbuf_index-count+1);
     cmdbuf_end -= count;
     cmdbuf[cmdbuf_end] = '\0';
-    /* make sure the cursor doesn't point past the new end of the string */
-    if(cmdbuf_index > cmdbuf_end)
-    {
-        cmdbuf_index = cmdbuf_end;
-    }
-    /* adjust the cursor position */
-    for(u = 0; u < count; u++)
+    redraw_cmdline();
+}
+
+
+/*
+ * Copy the history entry at the given index to the command buffer.
+ */
+static void load_history_entry(int index)
+{
+    size_t len = strlen(cmd_history[index].cmd);
+    if(len >= cmdbuf_size)
     {
-        if(terminal_col == 1)
+        if(!ext_cmdbuf(&cmdbuf, &cmdbuf_size, len-cmdbuf_size+1))
         {
-            if(terminal_row == 1)
-            {
-                break;
-            }
-            terminal_col = VGA_WIDTH;
-            terminal_row--;
-        }
-        else
-        {
-            terminal_col--;
+            return;
         }
     }
-    move_cur(terminal_row, terminal_col);
-    /* print the new command string, and replace the deleted chars with spaces */
-    printf("%s%*s", cmdbuf+cmdbuf_index, (int)count, " ");
-    /* move the cursor back to where it was */
-    move_cur(terminal_row, terminal_col);
+    strcpy(cmdbuf, cmd_history[index].cmd);
+    cmdbuf_end = len;
+    if(cmdbuf_end && cmdbuf[cmdbuf_end-1] == '\n')
+    {
+        cmdbuf[cmdbuf_end-1] = '\0';
+        cmdbuf_end--;
+    }
+    /* position the cursor at the end of the command */
+    cmdbuf_index = cmdbuf_end;
+    redraw_cmdline();
 }
 
 
@@ -292,10 +210,6 @@ void do_up_key(int count)
     {
         return;
     }
-    /* remove the current command from the screen */
-    clear_cmd(0);
-    /* move the cursor to the start of the screen line */
-    move_cur(start_row, start_col);
     cmd_history_index -= count;
     /* make sure we don't go past the first command in the history list */
     if(cmd_history_index < 0)
@@ -303,17 +217,7 @@ void do_up_key(int count)
         cmd_history_index = 0;
     }
     /* copy the command to the buffer */
-    strcpy(cmdbuf, cmd_history[cmd_history_index].cmd);
-    cmdbuf_end = strlen(cmdbuf);
-    if(cmdbuf[cmdbuf_end-1] == '\n')
-    {
-        cmdbuf[cmdbuf_end-1] = '\0';
-        cmdbuf_end--;
-    }
-    /* position the cursor at the end of the command */
-    cmdbuf_index = cmdbuf_end;
-    /* print the new command */
-    output_cmd();
+    load_history_entry(cmd_history_index);
 }
 
 
@@ -329,10 +233,6 @@ void do_down_key(int count)
     {
         return;
     }
-    /* remove the current command from the screen */
-    clear_cmd(0);
-    /* move the cursor to the start of the screen line */
-    move_cur(start_row, start_col);
     cmd_history_index += count;
     if(cmd_history_index >= cmd_history_end)
     {
@@ -342,21 +242,12 @@ void do_down_key(int count)
         cmdbuf_end   = 0;
         cmdbuf_index = 0;
         cmdbuf[0]    = '\0';
+        redraw_cmdline();
     }
     else
     {
         /* copy the command to the buffer */
-        strcpy(cmdbuf, cmd_history[cmd_history_index].cmd);
-        cmdbuf_end = strlen(cmdbuf);
-        if(cmdbuf[cmdbuf_end-1] == '\n')
-        {
-            cmdbuf[cmdbuf_end-1] = '\0';
-            cmdbuf_end--;
-        }
-        /* position the cursor at the end of the command */
-        cmdbuf_index = cmdbuf_end;
-        /* print the new command */
-        output_cmd();
+        load_history_entry(cmd_history_index);
     }
 }
 
@@ -380,22 +271,12 @@ void do_right_key(size_t count)
         return;
     }
 
-    /* calculate the new column index and adjust the row index accordingly */
-    size_t newcol = terminal_col+count;
-    if(newcol > VGA_WIDTH)
-    {
-        terminal_col = newcol-VGA_WIDTH;
-        terminal_row++;
-        cmdbuf_index += count;
-    }
-    else
+    cmdbuf_index += count;
+    if(cmdbuf_index > cmdbuf_end)
     {
-        terminal_col += count;
-        cmdbuf_index += count;
+        cmdbuf_index = cmdbuf_end;
     }
-    
-    /* move the cursor to the new location */
-    move_cur(terminal_row, terminal_col);
+    redraw_cmdline();
 }
 
 
@@ -413,29 +294,17 @@ void do_left_key(int count)
     }
     
     /* invalid (zero) count */
-    if(!count)
+    if(count <= 0)
     {
         return;
     }
 
-    /* calculate the new column index and adjust the row index accordingly */
-    int newcol = terminal_col-count;
-    if(newcol < 1)
-    {
-        if(terminal_row > 1)
-        {
-            terminal_col = VGA_WIDTH+newcol;
-            terminal_row--;
-            cmdbuf_index -= count;
-        }
-    }
-    else
+    if((size_t)count > cmdbuf_index)
     {
-        terminal_col -= count;
-        cmdbuf_index -= count;
+        count = cmdbuf_index;
     }
-    /* move the cursor to the new location */
-    move_cur(terminal_row, terminal_col);
+    cmdbuf_index -= count;
+    redraw_cmdline();
 }
 
 
@@ -450,8 +319,7 @@ void do_home_key(void)
         return;
     }
     cmdbuf_index = 0;
-    /* move the cursor to the new location */
-    move_cur(start_row, start_col);
+    redraw_cmdline();
 }
 
 
@@ -465,20 +333,8 @@ void do_end_key(void)
     {
         return;
     }
-    terminal_row = start_row;
-    /* calculate the new column index and adjust the row index accordingly */
-    if(cmdbuf_end+start_col >= VGA_WIDTH)
-    {
-        terminal_row += ((cmdbuf_end+start_col)/VGA_WIDTH);
-        terminal_col  = ((cmdbuf_end+start_col)%VGA_WIDTH);
-    }
-    else
-    {
-        terminal_col = cmdbuf_end+start_col;
-    }
     cmdbuf_index = cmdbuf_end;
-    /* move the cursor to the new location */
-    move_cur(terminal_row, terminal_col);
+    redraw_cmdline();
 }
 
 
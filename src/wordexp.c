@@ -53,30 +53,32 @@
  */
 struct word_s *make_word(char *str)
 {
-    /* alloc struct memory */
-    struct word_s *word = malloc(sizeof(struct word_s));
+    return make_wordl(str, strlen(str));
+}
+
+
+/*
+ * Make a word struct from the first len chars of str. The word text is stored
+ * right after the struct, so that the word takes only one malloc() call, and is
+ * freed by a single call to free_word().
+ *
+ * Returns the malloc'd word struct, or NULL if insufficient memory.
+ */
+struct word_s *make_wordl(char *str, size_t len)
+{
+    struct word_s *word = malloc(sizeof(struct word_s)+len+1);
     
     if(!word)
     {
         return NULL;
     }
     
-    memset(word, 0, sizeof(struct word_s));
-    
-    /* alloc string memory */
-    size_t  len  = strlen(str);
-    char   *data = malloc(len+1);
-    
-    if(!data)
-    {
-        free(word);
-        return NULL;
-    }
-
-    /* copy string */
-    strcpy(data, str);
-    word->data = data;
-    word->len  = len;
+    word->data  = (char *)(word+1);
+    word->len   = len;
+    word->flags = 0;
+    word->next  = NULL;
+    memcpy(word->data, str, len);
+    word->data[len] = '\0';
 
     /* return struct */
     return word;
@@ -112,14 +114,8 @@ struct word_s *remove_empty_words(struct word_s *w)
                 w = next;
             }
             
-            /* free the word text */
-            if(cur->data)
-            {
-                free(cur->data);
-            }
-            
             /* free the word */
-            free(cur);
+            free_word(cur);
         }
         else
         {
@@ -133,6 +129,16 @@ struct word_s *remove_empty_words(struct word_s *w)
 }
 
 
+/*
+ * Free the memory used by a token. The token text lives in the same memory
+ * block as the token struct (see make_wordl() above).
+ */
+void free_word(struct word_s *word)
+{
+    free(word);
+}
+
+
 /*
  * Free the memory used by a list of tokens.
  */
@@ -142,13 +148,7 @@ void free_all_words(struct word_s *first)
     {
         struct word_s *del = first;
         first = first->next;
-        if(del->data)
-        {
-            /* free the token text */
-            free(del->data);
-        }
-        /* free the token */
-        free(del);
+        free_word(del);
     }
 }
 
@@ -269,6 +269,41 @@ long extract_num(char *buf, int start, int end)
 }
 
 
+/*
+ * Return a private malloc'd copy of the substring of str that starts at index
+ * start and is at most len chars long. Unlike get_malloced_strl(), the result
+ * is not shared via the strings buffer, so the caller can free() it.
+ *
+ * Returns the malloc'd substring, or NULL if we have insufficient memory.
+ */
+static char *get_substr(char *str, long start, long len)
+{
+    long slen = strlen(str);
+    if(start < 0)
+    {
+        start = 0;
+    }
+
+    if(start > slen)
+    {
+        start = slen;
+    }
+
+    if(len < 0 || len > slen-start)
+    {
+        len = (len < 0) ? 0 : slen-start;
+    }
+
+    char *res = malloc(len+1);
+    if(res)
+    {
+        memcpy(res, str+start, len);
+        res[len] = '\0';
+    }
+    return res;
+}
+
+
 /*
  * Check if the given str is a valid name.. POSIX says a names can consist of
  * alphanumeric chars and underscores, and start with an alphabetic char or underscore.
@@ -714,6 +749,8 @@ char *substitute_str(char *s1, char *s2, size_t start, size_t end)
 }
 
 
+static char *quoted_var_expand(char *orig_var_name);
+
 /*
  * Perform word expansion on the word starting at *p and counting len characters.
  * This function calls the function passed in the third parameter to do the actual
@@ -779,6 +816,12 @@ int substitute_word(char **pstart, char **p, size_t len, char *(func)(char *), i
     {
         tmp = quote_val(tmp2, 0, !in_double_quotes);
     }
+    else if(func == quoted_var_expand)
+    {
+        /* already quoted */
+        tmp = tmp2;
+        tmp2 = NULL;
+    }
     else
     {
         tmp = quote_val(tmp2, 0, 0);
@@ -1273,8 +1316,8 @@ char *var_info_expand(char op, char *orig_val, char *var_name, int name_len)
  *       ${parameter#[word]}      Remove Smallest Prefix Pattern
  *       ${parameter##[word]}     Remove Largest Prefix Pattern
  * 
- * TODO: implement the following string match/replace functions, which are
- *       non-POSIX extensions (bash, ksh, ...):
+ * We also implement the following string match/replace functions, which are
+ * non-POSIX extensions (bash, ksh, ...):
  * 
  *       ${parameter/pattern/string}
  *       ${parameter//pattern/string}
@@ -1379,6 +1422,270 @@ void print_unset_var_error(char *var_name, char *msg)
 }
 
 
+/*
+ * Perform the ${parameter/pattern/string} expansion on the given value. sub
+ * points to the char after the first '/', which can be another '/' (replace all
+ * the matches), a '#' (match at the beginning of the value), or a '%' (match at
+ * the end of the value). As with the prefix and suffix matching operations, the
+ * pattern is not expanded (see below), but the replacement string is.
+ *
+ * Returns the malloc'd result, or NULL if the expansion failed.
+ */
+static char *pattern_subst_expand(char *val, char *sub)
+{
+    char anchor = 0;
+    size_t i;
+
+    if(*sub == '/' || *sub == '#' || *sub == '%')
+    {
+        anchor = *sub++;
+    }
+
+    /* find the '/' that separates the pattern from the replacement string */
+    char *p = sub;
+    while(*p && *p != '/')
+    {
+        if(*p == '\\' && p[1])
+        {
+            p++;
+        }
+        else if((*p == '"' || *p == '\'') && (i = find_closing_quote(p, 0, 0)))
+        {
+            p += i;
+        }
+        p++;
+    }
+
+    char pattern[p-sub+1];
+    memcpy(pattern, sub, p-sub);
+    pattern[p-sub] = '\0';
+
+    char *rep = (*p && p[1]) ? word_expand_to_str(p+1, FLAG_REMOVE_QUOTES) : NULL;
+    char *res = replace_pattern(pattern, val, rep ? rep : "", anchor);
+    if(rep)
+    {
+        free(rep);
+    }
+    return res;
+}
+
+
+/*
+ * Free a list returned by array_elems_list().
+ */
+static void free_elems_list(char **list)
+{
+    char **l;
+    for(l = list; *l; l++)
+    {
+        free(*l);
+    }
+    free(list);
+}
+
+
+/*
+ * Collect the values of the elements of an array, or their indices (or keys) if
+ * 'keys' is non-zero. If sub is not NULL, we perform the substring, pattern
+ * matching or pattern substitution operation it describes on each element, as in
+ * the ${name[@]:offset:length}, ${name[@]#pattern}, ${name[@]/pattern/string}
+ * and ${name[@]@Q} expansions.
+ *
+ * Returns a malloc'd, NULL-terminated list of malloc'd strings, or NULL if the
+ * expansion failed.
+ */
+static char **array_elems_list(struct symtab_entry_s *entry, char *name, char *sub, int keys)
+{
+    struct array_s *arr = entry ? entry->array : NULL;
+    int assoc = arr && flag_set(arr->flags, ARRAY_FLAG_ASSOC);
+    size_t count = arr ? arr->count : (entry && entry->val) ? 1 : 0;
+    size_t pos = 0, i = 0, j = 0;
+    long index = 0, off = 0, len = count;
+    int slice = (sub && !strchr("#%/@", *sub));
+    char *val, *key = NULL, *p, buf[32];
+
+    if(slice)
+    {
+        /*
+         * ${name[@]:offset}
+         * ${name[@]:offset:length}
+         *
+         * For indexed arrays, offset is an index, and we start from the first
+         * element whose index is not less than offset (bash).
+         */
+        long last = assoc ? (long)count-1 : arr ? array_last_index(arr) : 0;
+
+        while(isspace(*sub))
+        {
+            sub++;
+        }
+
+        p = strchr(sub, ':');
+        off = extract_num(sub, 0, p ? p-sub : (long)strlen(sub));
+        len = p ? extract_num(sub, (p-sub)+1, strlen(sub)) : (long)count;
+
+        /* negative offsets count from the end of the array */
+        if(off < 0)
+        {
+            off += last+1;
+        }
+
+        if(len < 0)
+        {
+            PRINT_ERROR(SHELL_NAME, "%s: substring expression < 0", sub);
+            return NULL;
+        }
+
+        if(off < 0)
+        {
+            len = 0;
+        }
+    }
+
+    char **list = malloc((count+1)*sizeof(char *));
+    if(!list)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "word expansion");
+        return NULL;
+    }
+
+    while(len > 0 && (val = arr ? array_next(arr, &pos, &index, &key) :
+                                  (j || !count) ? NULL : entry->val))
+    {
+        /* skip the elements before the offset */
+        if(slice && (assoc ? (long)j : index) < off)
+        {
+            j++;
+            continue;
+        }
+        j++;
+
+        if(keys)
+        {
+            if(assoc)
+            {
+                val = key;
+            }
+            else
+            {
+                sprintf(buf, "%ld", index);
+                val = buf;
+            }
+        }
+
+        if(!sub || slice)
+        {
+            p = __get_malloced_str(val);
+        }
+        else if(*sub == '/')
+        {
+            p = pattern_subst_expand(val, sub+1);
+        }
+        else if(*sub == '@')
+        {
+            p = var_info_expand(sub[1], val, name, strlen(name));
+        }
+        else
+        {
+            /* ${name[@]#pattern} and ${name[@]%pattern} */
+            int (*f)(char *, char *, int) = (*sub == '%') ? match_suffix : match_prefix;
+            int longest = (sub[1] == *sub);
+            int k = f(sub+1+longest, val, longest);
+
+            if(*sub == '%')
+            {
+                p = get_substr(val, 0, k ? k : (long)strlen(val));
+            }
+            else
+            {
+                p = get_substr(val, k, strlen(val)-k);
+            }
+        }
+
+        if(!p)
+        {
+            list[i] = NULL;
+            free_elems_list(list);
+            return NULL;
+        }
+        list[i++] = p;
+        len--;
+    }
+    list[i] = NULL;
+    return list;
+}
+
+
+/*
+ * Join the strings of a list returned by array_elems_list(), separated by the
+ * given separator char. If 'fields' is non-zero, we quote the strings and join
+ * them as s1" "s2" "s3, the same way get_pos_params_str() expands "$@", so that
+ * each string gives a separate field when we are inside double quotes.
+ *
+ * Returns the malloc'd result, or NULL if we have insufficient memory.
+ */
+static char *join_elems_list(char **list, char separator, int fields)
+{
+    size_t total = 1, k;
+    char *res, *p;
+
+    for(k = 0; list[k]; k++)
+    {
+        if(fields)
+        {
+            if(!(p = quote_val(list[k], 0, 0)))
+            {
+                return NULL;
+            }
+            free(list[k]);
+            list[k] = p;
+        }
+        total += strlen(list[k])+3;
+    }
+
+    if(!(res = malloc(total)))
+    {
+        return NULL;
+    }
+
+    p = res;
+    for(k = 0; list[k]; k++)
+    {
+        if(k)
+        {
+            if(fields)
+            {
+                p = stpcpy(p, "\" \"");
+            }
+            else if(separator)
+            {
+                *p++ = separator;
+            }
+        }
+        p = stpcpy(p, list[k]);
+    }
+    *p = '\0';
+    return res;
+}
+
+
+/*
+ * Return the char we use to separate array elements when expanding ${name[*]},
+ * which is the first char of $IFS, or space if $IFS is unset.
+ */
+static char get_array_separator(char subscript)
+{
+    if(subscript == '@')
+    {
+        return ' ';
+    }
+    char *IFS = get_shell_varp("IFS", NULL);
+    return IFS ? *IFS : ' ';
+}
+
+
+static char *__var_expand(char *orig_var_name, char **joined, char ***fields);
+
 /*
  * Perform variable (parameter) expansion.
  *
@@ -1386,6 +1693,59 @@ void print_unset_var_error(char *var_name, char *msg)
  * variable is not defined or the expansion failed.
  */
 char *var_expand(char *orig_var_name)
+{
+    /* the joined elements of ${name[@]} and ${name[*]}, if we need them */
+    char *joined = NULL;
+    char *res = __var_expand(orig_var_name, &joined, NULL);
+    if(joined)
+    {
+        free(joined);
+    }
+    return res;
+}
+
+
+/*
+ * Perform variable (parameter) expansion inside double quotes. This is the same
+ * as var_expand(), except for the expansions that give each element of an array
+ * as a separate field, such as "${name[@]}", "${!name[@]}" and "${name[@]:1}",
+ * which we expand the way get_pos_params_str() expands "$@".
+ *
+ * Returns the malloc'd, quoted value (see substitute_word()), NULL if the
+ * variable is not defined or the expansion failed.
+ */
+static char *quoted_var_expand(char *orig_var_name)
+{
+    char *joined = NULL, **fields = NULL;
+    char *res = __var_expand(orig_var_name, &joined, &fields);
+    if(joined)
+    {
+        free(joined);
+    }
+
+    if(fields)
+    {
+        res = join_elems_list(fields, 0, 1);
+        free_elems_list(fields);
+        return res;
+    }
+
+    if(res && res != INVALID_VAR)
+    {
+        char *tmp = quote_val(res, 0, 0);
+        free(res);
+        res = tmp;
+    }
+    return res;
+}
+
+
+/*
+ * If fields is not NULL and we are expanding each element of an array as a
+ * separate field, we store the list of elements in *fields and return NULL
+ * (see array_elems_list()).
+ */
+static char *__var_expand(char *orig_var_name, char **joined, char ***fields)
 {
     /* Sanity check */
     if(!orig_var_name)
@@ -1438,6 +1798,37 @@ char *var_expand(char *orig_var_name)
         }
     }
 
+    /*
+     * Array element references of the form ${name[subscript]}. We save the
+     * subscript and remove it from the name, so that any substitution that
+     * follows is processed as usual. ${!name[@]} and ${!name[*]} expand to
+     * the array's indices (or keys).
+     */
+    char subscript[len+1];
+    int get_keys = 0;
+    char *sub_end = get_subscript_end(orig_var_name + (*orig_var_name == '!'));
+    subscript[0] = '\0';
+    if(sub_end)
+    {
+        char *sub_start = strchr(orig_var_name, '[');
+        *sub_end = '\0';
+        strcpy(subscript, sub_start+1);
+        memmove(sub_start, sub_end+1, strlen(sub_end+1)+1);
+
+        if(*orig_var_name == '!' && !get_length)
+        {
+            if((*subscript != '@' && *subscript != '*') || subscript[1])
+            {
+                PRINT_ERROR(SHELL_NAME, "invalid substitution at: %s", orig_var_name);
+                EXIT_IF_NONINTERACTIVE();
+                return INVALID_VAR;
+            }
+            get_keys = 1;
+            orig_var_name++;
+        }
+    }
+    int all_elems = ((*subscript == '@' || *subscript == '*') && !subscript[1]);
+
     /* Check we don't have an empty varname */
     if(!*orig_var_name)
     {
@@ -1471,7 +1862,7 @@ char *var_expand(char *orig_var_name)
             v++;
         }
         /* Search for the char that indicates what type of substitution we need to do */
-        sub = strchr_any(v, "-=?+%#@");
+        sub = strchr_any(v, "-=?+%#@/");
     }
 
     /* Get the length of the variable name (without the substitution part) */
@@ -1545,44 +1936,126 @@ char *var_expand(char *orig_var_name)
         return get_stdin_var(get_length);
     }
 
-    /* Save a pointer to the variable's value (we'll use it below) */
-    struct symtab_entry_s *entry = get_symtab_entry(var_name);
-    tmp = (entry && entry->val) ? entry->val : NULL;
-    orig_val = tmp;
-    
-    /*
-     * If we have a colon, test for variable existence and non-empty value.
-     * Otherwise, test only for existence.
-     */
-    test = colon ? (tmp && *tmp) : (tmp != NULL);
-    debug ("tmp = '%s', test = %d\n", tmp, test);
-    
     /*
-     * First case: variable is unset or empty.
+     * Save a pointer to the variable's value (we'll use it below). Positional
+     * parameters and $# don't live in the symbol table (see params.c).
      */
-    if(!test)
+    if(var_name[0] == '#' && var_name[1] == '\0')
     {
-        /* Do we have a substitution clause? */
-        if(sub && *sub)
+        sprintf(buf, "%d", pos_param_count());
+        tmp = buf;
+    }
+    else if(var_name[0] != '0' && is_pos_param(var_name))
+    {
+        tmp = get_pos_param(atoi(var_name));
+    }
+    else
+    {
+        struct symtab_entry_s *entry = get_symtab_entry(var_name);
+        if(all_elems)
         {
-            /* Check the substitution operation we need to perform */
-            switch(sub[0])
+            struct array_s *arr = entry ? entry->array : NULL;
+            char separator = get_array_separator(*subscript);
+
+            if(get_length)
             {
-                case '-':
-                    tmp = sub+1;  /* use default value */
-                    break;
-                    
-                case '=':          /* assign the variable a value */
-                    /* 
-                     * only variables, neither positional nor special parameters can be
-                     * assigned this way.
-                     */
-                    if(is_pos_param(var_name) || is_special_param(var_name))
-                    {
-                        PRINT_ERROR(SHELL_NAME, "invalid variable assignment: %s", 
-                                    orig_var_name);
-                        /* NOTE: this is not strict POSIX behaviour. see the table above */
-                        if(!interactive_shell)
+                sprintf(buf, "%zu", arr ? arr->count : (entry && entry->val) ? 1 : 0);
+                return __get_malloced_str(buf);
+            }
+
+            /* ${name[*]} always expands to one field */
+            if(*subscript != '@')
+            {
+                fields = NULL;
+            }
+
+            /*
+             * Substring and pattern operations apply to each element, and so do the
+             * Q, E and P operators. The results (or the indices or keys of the array)
+             * are joined, unless our caller wants each element as a separate field.
+             */
+            int elem_op = sub && *sub && (!strchr("-=?+@", *sub) ||
+                                          (*sub == '@' && sub[1] && strchr("QEP", sub[1])));
+            if(get_keys || elem_op || (fields && !(sub && *sub)))
+            {
+                char **list = array_elems_list(entry, var_name, (elem_op && !get_keys) ? sub : NULL,
+                                               get_keys);
+                if(!list)
+                {
+                    EXIT_IF_NONINTERACTIVE();
+                    return INVALID_VAR;
+                }
+
+                if(fields)
+                {
+                    *fields = list;
+                    return NULL;
+                }
+
+                p = join_elems_list(list, separator, 0);
+                free_elems_list(list);
+                return p ? : INVALID_VAR;
+            }
+
+            if(arr)
+            {
+                tmp = *joined = array_join(arr, separator);
+            }
+            else
+            {
+                tmp = entry ? entry->val : NULL;
+            }
+        }
+        else if(*subscript)
+        {
+            tmp = entry ? get_array_elem(entry, subscript) : NULL;
+        }
+        else if(entry && entry->array)
+        {
+            /* referring to an array without a subscript gives element 0 (bash) */
+            tmp = (entry->val_type == SYM_ASSOC) ? assoc_get(entry->array, "0") :
+                                                   array_get(entry->array, 0);
+        }
+        else
+        {
+            tmp = (entry && entry->val) ? entry->val : NULL;
+        }
+    }
+    orig_val = tmp;
+    
+    /*
+     * If we have a colon, test for variable existence and non-empty value.
+     * Otherwise, test only for existence.
+     */
+    test = colon ? (tmp && *tmp) : (tmp != NULL);
+    debug ("tmp = '%s', test = %d\n", tmp, test);
+    
+    /*
+     * First case: variable is unset or empty.
+     */
+    if(!test)
+    {
+        /* Do we have a substitution clause? */
+        if(sub && *sub)
+        {
+            /* Check the substitution operation we need to perform */
+            switch(sub[0])
+            {
+                case '-':
+                    tmp = sub+1;  /* use default value */
+                    break;
+                    
+                case '=':          /* assign the variable a value */
+                    /* 
+                     * only variables, neither positional nor special parameters can be
+                     * assigned this way.
+                     */
+                    if(is_pos_param(var_name) || is_special_param(var_name))
+                    {
+                        PRINT_ERROR(SHELL_NAME, "invalid variable assignment: %s", 
+                                    orig_var_name);
+                        /* NOTE: this is not strict POSIX behaviour. see the table above */
+                        if(!interactive_shell)
                         {
                             if(option_set('e'))
                             {
@@ -1657,11 +2130,18 @@ char *var_expand(char *orig_var_name)
                     break;
 
                 /*
-                 * TODO: implement the match/replace functions of ${parameter/pattern/string}
-                 *       et al. see bash manual page 35.
+                 * ${parameter/pattern/string}
+                 * ${parameter//pattern/string}
+                 * ${parameter/#pattern/string}
+                 * ${parameter/%pattern/string}
                  */
                 case '/':
-                    break;
+                    p = pattern_subst_expand(orig_val, sub+1);
+                    if(!p)
+                    {
+                        EXIT_IF_NONINTERACTIVE();
+                    }
+                    return p ? : INVALID_VAR;
 
                 /*
                  * bash extension for variable expansion. it takes the form of:
@@ -1718,11 +2198,11 @@ char *var_expand(char *orig_var_name)
                     /* return the match */
                     if(f == match_suffix)
                     {
-                        p2 = get_malloced_strl(p, 0, len);
+                        p2 = get_substr(p, 0, len);
                     }
                     else
                     {
-                        p2 = get_malloced_strl(p, len, strlen(p)-len);
+                        p2 = get_substr(p, len, strlen(p)-len);
                     }
 
                     free(p);
@@ -1769,7 +2249,7 @@ char *var_expand(char *orig_var_name)
                         }
                         len -= off;
                     }
-                    char *var_val = get_malloced_strl(orig_val, off, len);
+                    char *var_val = get_substr(orig_val, off, len);
                     /* POSIX says non-interactive shell should exit on expansion errors */
                     if(!var_val && !interactive_shell)
                     {
@@ -1811,7 +2291,20 @@ char *var_expand(char *orig_var_name)
     /* do we need to set new value to the variable? */
     if(setme)
     {
-        if(do_set(var_name, tmp, 0, 0, 0) == NULL)
+        if(*subscript)
+        {
+            struct symtab_entry_s *entry = get_symtab_entry(var_name);
+            if(!entry)
+            {
+                entry = add_to_symtab(var_name);
+            }
+
+            if(!set_array_elem(entry, subscript, tmp, 0))
+            {
+                goto err;
+            }
+        }
+        else if(do_set(var_name, tmp, 0, 0, 0) == NULL)
         {
             goto err;
         }
@@ -1950,14 +2443,15 @@ char *pos_params_expand(char *tmp, int in_double_quotes)
         
         for(k = 1, l = 0; k <= count; k++)
         {
-            struct symtab_entry_s *p = get_pos_param(k);
+            char *val = get_pos_param(k), name[16];
             
-            if(!p || !p->val)
+            if(!val)
             {
                 continue;
             }
             
-            sub = var_info_expand(op, p->val, p->name, strlen(p->name));
+            sprintf(name, "%d", k);
+            sub = var_info_expand(op, val, name, strlen(name));
             
             if(sub)
             {
@@ -2015,20 +2509,20 @@ char *pos_params_expand(char *tmp, int in_double_quotes)
             
             for(k = 1, l = 0; k <= count; k++)
             {
-                struct symtab_entry_s *p = get_pos_param(k);
+                char *val = get_pos_param(k);
                 
-                if(!p || !p->val)
+                if(!val)
                 {
                     continue;
                 }
                 
-                if((len = func(sub, p->val, longest)) == 0)
+                if((len = func(sub, val, longest)) == 0)
                 {
-                    subs[l++] = __get_malloced_str(p->val);
+                    subs[l++] = __get_malloced_str(val);
                 }
                 else
                 {
-                    subs[l++] = get_malloced_strl(p->val, len, strlen(p->val)-len);
+                    subs[l++] = get_substr(val, len, strlen(val)-len);
                 }
             }
             
@@ -2048,8 +2542,16 @@ char *pos_params_expand(char *tmp, int in_double_quotes)
 fin:
     if(p == NULL)
     {
-        char buf[2] = { *tmp, '\0' };
-        print_unset_var_error(buf, strrchr(tmp, '?'));
+        /*
+         * no positional parameters. this is only an error if we have the
+         * ${@?msg} or ${*?msg} form.
+         */
+        char *msg = strrchr(tmp, '?');
+        if(msg)
+        {
+            char buf[2] = { *tmp, '\0' };
+            print_unset_var_error(buf, msg+1);
+        }
         return __get_malloced_str("");
     }
 
@@ -2829,7 +3331,8 @@ struct word_s *word_expand_one_word(char *orig_word, int flags)
                             break;
                         }
                         /* otherwise, extract the expression and substitute its value */
-                        func = (c == '[') ? arithm_expand : var_expand;
+                        func = (c == '[') ? arithm_expand :
+                               in_double_quotes ? quoted_var_expand : var_expand;
                         /*
                          *  calling var_expand() might return an INVALID_VAR result which
                          *  makes the following call fail.
@@ -3008,6 +3511,111 @@ struct word_s *word_expand_one_word(char *orig_word, int flags)
 }
 
 
+/*
+ * If word is exactly "${name[@]}" (including the double quotes), return the
+ * symbol table entry of the variable name. Otherwise return NULL. This is the
+ * common way of passing around the elements of an array, which expands to a
+ * separate field for each element, and which we handle without joining the
+ * elements and splitting them again (see word_expand() and word_expand_to_args()).
+ */
+static struct symtab_entry_s *get_quoted_array_word(char *word)
+{
+    if(word[0] != '"' || word[1] != '$' || word[2] != '{')
+    {
+        return NULL;
+    }
+
+    char *sub_end = get_subscript_end(word+3);
+    if(!sub_end || sub_end[-1] != '@' || sub_end[-2] != '[' ||
+       sub_end[1] != '}' || sub_end[2] != '"' || sub_end[3] != '\0')
+    {
+        return NULL;
+    }
+
+    size_t len = sub_end-word-5;
+    char name[len+1];
+    memcpy(name, word+3, len);
+    name[len] = '\0';
+    return get_symtab_entry(name);
+}
+
+
+/*
+ * If word is one of the other double-quoted expansions that give each element
+ * of an array as a separate field, such as "${!name[@]}", "${name[@]:1}" or
+ * "${name[@]/pattern/string}" (and nothing else), expand it, and store the
+ * list of fields in *fields (see array_elems_list()). If the expansion gives a
+ * single field, as in "${name[@]:-default}" when the array is empty, we store it
+ * in *field instead. Unlike the expansion of the same word via var_expand(), an
+ * array with no elements gives no fields at all.
+ *
+ * Returns 1 if word is such an expansion, 0 if it isn't, -1 if the expansion
+ * failed.
+ */
+static int quoted_array_expand(char *word, char ***fields, char **field)
+{
+    if(word[0] != '"' || word[1] != '$' || word[2] != '{')
+    {
+        return 0;
+    }
+
+    /* the name must be followed by [@] */
+    char *p = word+3, *name;
+    if(*p == '!')
+    {
+        p++;
+    }
+
+    name = p;
+    while(isalnum(*p) || *p == '_')
+    {
+        p++;
+    }
+
+    if(p == name || strncmp(p, "[@]", 3) != 0)
+    {
+        return 0;
+    }
+
+    /* and the closing brace must end the word */
+    size_t len = find_closing_brace(word+2, 1);
+    if(!len || word[len+3] != '"' || word[len+4] != '\0')
+    {
+        return 0;
+    }
+
+    char tmp[len+3], *joined = NULL;
+    memcpy(tmp, word+1, len+2);
+    tmp[len+2] = '\0';
+
+    *fields = NULL;
+    *field = __var_expand(tmp, &joined, fields);
+    if(joined)
+    {
+        free(joined);
+    }
+
+    if(*field == INVALID_VAR)
+    {
+        *field = NULL;
+        return -1;
+    }
+    return 1;
+}
+
+
+/*
+ * Return 1 if word is exactly "$@" or "${@}" (including the double quotes), 0
+ * otherwise. Like "${name[@]}", this expands to a separate field for each
+ * positional parameter, and to no fields at all if there are no positional
+ * parameters.
+ */
+static int is_quoted_pos_params_word(char *word)
+{
+    return (strcmp(word, "\"$@\"") == 0 || strcmp(word, "\"${@}\"") == 0);
+}
+
+
 /*
  * Perform brace expansion, followed by word expansion on each word that resulted from the
  * brace expansion. If no brace expansion is done, performs word expansion on the given word.
@@ -3021,6 +3629,102 @@ struct word_s *word_expand_one_word(char *orig_word, int flags)
 struct word_s *word_expand(char *orig_word, int flags)
 {
     size_t count = 0, i;
+    struct symtab_entry_s *entry;
+    struct word_s *wordlist = NULL, *listtail = NULL, *w;
+    char **fields, *field;
+    int res;
+
+    /* expand "${name[@]}" directly from the array's elements */
+    if(flag_set(flags, FLAG_REMOVE_QUOTES) && (entry = get_quoted_array_word(orig_word)))
+    {
+        size_t pos = 0;
+        char *val;
+        while((val = entry->array ? array_next(entry->array, &pos, NULL, NULL) :
+                                    (pos++ ? NULL : entry->val)))
+        {
+            if(!(w = make_word(val)))
+            {
+                break;
+            }
+
+            if(wordlist)
+            {
+                listtail->next = w;
+            }
+            else
+            {
+                wordlist = w;
+            }
+            listtail = w;
+        }
+        return wordlist;
+    }
+
+    /* expand "${!name[@]}", "${name[@]:1}" and the like to a field for each element */
+    if(flag_set(flags, FLAG_REMOVE_QUOTES) &&
+       (res = quoted_array_expand(orig_word, &fields, &field)))
+    {
+        if(res < 0)
+        {
+            return NULL;
+        }
+
+        if(!fields)
+        {
+            wordlist = make_word(field ? field : "");
+            if(field)
+            {
+                free(field);
+            }
+            return wordlist;
+        }
+
+        for(i = 0; fields[i]; i++)
+        {
+            if(!(w = make_word(fields[i])))
+            {
+                break;
+            }
+
+            if(wordlist)
+            {
+                listtail->next = w;
+            }
+            else
+            {
+                wordlist = w;
+            }
+            listtail = w;
+        }
+        free_elems_list(fields);
+        return wordlist;
+    }
+
+    /* expand "$@" directly from the positional parameters */
+    if(flag_set(flags, FLAG_REMOVE_QUOTES) && is_quoted_pos_params_word(orig_word))
+    {
+        int k, n = pos_param_count();
+        for(k = 1; k <= n; k++)
+        {
+            char *val = get_pos_param(k);
+            if(!(w = make_word(val ? val : "")))
+            {
+                break;
+            }
+
+            if(wordlist)
+            {
+                listtail->next = w;
+            }
+            else
+            {
+                wordlist = w;
+            }
+            listtail = w;
+        }
+        return wordlist;
+    }
+
     char **list = brace_expand(orig_word, &count);
 
     /* if no braces expanded, go directly to word expansion */
@@ -3038,8 +3742,6 @@ struct word_s *word_expand(char *orig_word, int flags)
     }
 
     /* expand the braces and do word expansion on each resultant field */
-    struct word_s *wordlist = NULL, *listtail = NULL, *w;
-
     for(i = 0; i < count; i++)
     {
         w = word_expand_one_word(list[i], flags);
@@ -3083,6 +3785,17 @@ struct word_s *word_expand(char *orig_word, int flags)
     {
         wordlist = pathnames_expand(wordlist);
     }
+    else if(flag_set(flags, FLAG_PATHNAME_DEFER) && !option_set('f'))
+    {
+        /* let our caller expand the patterns when it needs the pathnames */
+        for(w = wordlist; w; w = w->next)
+        {
+            if(is_glob_pattern(w->data))
+            {
+                w->flags |= FLAG_WORD_PATTERN;
+            }
+        }
+    }
 
     /* perform quote removal */
     if(flag_set(flags, FLAG_REMOVE_QUOTES))
@@ -3120,23 +3833,20 @@ struct word_s *pathnames_expand(struct word_s *words)
     
     while(w)
     {
-        char *p = w->data;
+        struct glob_stream_s *stream = open_glob_stream(w->data);
         
-        /* check if we should perform filename globbing */
-        if(!has_glob_chars(p, strlen(p)))
+        /* not a pattern, no filename globbing */
+        if(!stream)
         {
             pw = w;
             w = w->next;
             continue;
         }
         
-        glob_t glob;
-        char **matches = get_filename_matches(p, &glob);
-        
         /* no matches found */
-        if(!matches || !matches[0])
+        if(!stream->count)
         {
-            globfree(&glob);
+            close_glob_stream(stream);
             
             /* remove the word (bash extension) */
             if(optionx_set(OPTION_NULL_GLOB))
@@ -3162,7 +3872,7 @@ struct word_s *pathnames_expand(struct word_s *words)
             /* print error and bail out (bash extension) */
             if(optionx_set(OPTION_FAIL_GLOB))
             {
-                PRINT_ERROR(SHELL_NAME, "file globbing failed for %s", p);
+                PRINT_ERROR(SHELL_NAME, "file globbing failed for %s", w->data);
                 
                 /* restore the flag to its saved value */
                 set_optionx(OPTION_ADD_SUFFIX, save_addsuffix);
@@ -3174,34 +3884,42 @@ struct word_s *pathnames_expand(struct word_s *words)
         else
         {
             /* save the matches */
-            struct word_s *head = NULL, *tail = NULL;
-            size_t j;
+            struct word_s *head = NULL, *tail = NULL, *w2;
+            char *path;
 
-            for(j = 0; j < glob.gl_pathc; j++)
+            while((path = next_glob_match(stream)))
             {
-                /* skip '..' and '.' */
-                if(matches[j][0] == '.' &&
-                  (matches[j][1] == '.' || matches[j][1] == '\0' || matches[j][1] == '/'))
+                w2 = make_word(path);
+                free(path);
+
+                if(!w2)
                 {
                     continue;
                 }
-                
+
+                /* the path is not subject to quote removal */
+                w2->flags |= FLAG_WORD_PATHNAME;
+
                 /* add the path to the list */
                 if(!head)
                 {
-                    /* first item in the list */
-                    head = make_word(matches[j]);
-                    tail = head;
+                    head = w2;
                 }
                 else
                 {
-                    /* add to the list's tail */
-                    tail->next = make_word(matches[j]);
-                    if(tail->next)
-                    {
-                        tail = tail->next;
-                    }
+                    tail->next = w2;
                 }
+                tail = w2;
+            }
+            
+            close_glob_stream(stream);
+
+            /* insufficient memory */
+            if(!head)
+            {
+                pw = w;
+                w = w->next;
+                continue;
             }
 
             /* add the new list to the existing list */
@@ -3214,7 +3932,6 @@ struct word_s *pathnames_expand(struct word_s *words)
                 pw->next = head;
             }
             
-            pw = tail;
             tail->next = w->next;
             
             /* free the word we've just globbed */
@@ -3222,9 +3939,6 @@ struct word_s *pathnames_expand(struct word_s *words)
             free_all_words(w);
             w = tail;
             
-            /* free the matches list */
-            globfree(&glob);
-            
             /* finished globbing this word */
         }
 
@@ -3241,125 +3955,117 @@ struct word_s *pathnames_expand(struct word_s *words)
 
 
 /*
- * Perform quote removal.
+ * Copy the string src to dest, removing quotes as we go. As the result is never
+ * longer than src, dest can be the same as src. The FLAG_WORD_HAD_QUOTES and
+ * FLAG_WORD_HAD_DOUBLE_QUOTES flags are set in *flags if we removed any quotes.
+ *
+ * Returns the length of the unquoted string.
  */
-void remove_quotes(struct word_s *wordlist)
+static size_t unquote_str(char *dest, char *src, int *flags)
 {
-    if(!wordlist)
-    {
-        return;
-    }
-
     int in_double_quotes = 0;
-    struct word_s *word = wordlist;
-    char *p;
+    char *d = dest, *p = src;
 
-    while(word)
+    while(*p)
     {
-        p = word->data;
-
-        while(*p)
+        switch(*p)
         {
-            switch(*p)
-            {
-                case '"':
-                    /* toggle quote mode */
-                    in_double_quotes = !in_double_quotes;
-                    delete_char_at(p, 0);
-                    word->flags |= FLAG_WORD_HAD_DOUBLE_QUOTES;
-                    break;
-
-                case '\'':
-                    /* don't delete if inside double quotes */
-                    if(in_double_quotes)
-                    {
-                        p++;
-                        break;
-                    }
-                    
-                    delete_char_at(p, 0);
-                    word->flags |= FLAG_WORD_HAD_QUOTES;
-
-                    /* find the closing quote */
-                    while(*p && *p != '\'')
-                    {
-                        p++;
-                    }
+            case '"':
+                /* toggle quote mode */
+                in_double_quotes = !in_double_quotes;
+                p++;
+                (*flags) |= FLAG_WORD_HAD_DOUBLE_QUOTES;
+                break;
 
-                    /* and remove it */
-                    if(*p == '\'')
-                    {
-                        delete_char_at(p, 0);
-                    }
+            case '\'':
+                /* don't delete if inside double quotes */
+                if(in_double_quotes)
+                {
+                    *d++ = *p++;
                     break;
+                }
 
-                case '`':
-                    delete_char_at(p, 0);
-                    word->flags |= FLAG_WORD_HAD_QUOTES;
-                    break;
+                p++;
+                (*flags) |= FLAG_WORD_HAD_QUOTES;
 
-                case '\v':
-                case '\f':
-                case '\t':
-                case '\r':
-                case '\n':
-                    /*
-                     *  convert whitespace chars inside double quotes to spaces,
-                     *  which is non-POSIX, but done by all major shells.
-                     */
-                    /*
-                    if(in_double_quotes)
-                    {
-                     *p = ' ';
-                    }
-                     */
+                /* copy up to the closing quote */
+                while(*p && *p != '\'')
+                {
+                    *d++ = *p++;
+                }
+
+                /* and skip it */
+                if(*p == '\'')
+                {
                     p++;
-                    break;
+                }
+                break;
 
-                case '\\':
-                    if(in_double_quotes)
-                    {
-                        switch(p[1])
-                        {
-                            /*
-                             * in double quotes, backslash preserves its special quoting
-                             * meaning only when followed by one of the following chars.
-                             */
-                            case  '$':
-                            case  '`':
-                            case  '"':
-                            case '\\':
-                            case '\n':
-                                delete_char_at(p, 0);
-                                p++;
-                                word->flags |= FLAG_WORD_HAD_QUOTES;
-                                break;
+            case '`':
+                p++;
+                (*flags) |= FLAG_WORD_HAD_QUOTES;
+                break;
 
-                            default:
-                                p++;
-                                break;
-                        }
-                    }
-                    else
+            case '\\':
+                if(in_double_quotes)
+                {
+                    switch(p[1])
                     {
-                        /* parse single-character backslash quoting. */
-                        delete_char_at(p, 0);
-                        p++;
-                        word->flags |= FLAG_WORD_HAD_QUOTES;
+                        /*
+                         * in double quotes, backslash preserves its special quoting
+                         * meaning only when followed by one of the following chars.
+                         */
+                        case  '$':
+                        case  '`':
+                        case  '"':
+                        case '\\':
+                        case '\n':
+                            p++;
+                            (*flags) |= FLAG_WORD_HAD_QUOTES;
+                            break;
                     }
-                    break;
-
-                default:
+                }
+                else
+                {
+                    /* parse single-character backslash quoting. */
                     p++;
-                    break;
-            }
+                    (*flags) |= FLAG_WORD_HAD_QUOTES;
+                }
+
+                /* copy the escaped char */
+                if(*p)
+                {
+                    *d++ = *p++;
+                }
+                break;
+
+            default:
+                *d++ = *p++;
+                break;
         }
-        
-        /* update the word's length */
-        word->len = strlen(word->data);
-        
-        /* move on to the next word */
-        word = word->next;
+    }
+
+    *d = '\0';
+    return d-dest;
+}
+
+
+/*
+ * Perform quote removal.
+ */
+void remove_quotes(struct word_s *wordlist)
+{
+    struct word_s *word;
+
+    for(word = wordlist; word; word = word->next)
+    {
+        /* pathnames have no quotes, while patterns keep theirs until expanded */
+        if(word->flags & (FLAG_WORD_PATHNAME|FLAG_WORD_PATTERN))
+        {
+            continue;
+        }
+
+        word->len = unquote_str(word->data, word->data, &word->flags);
     }
 }
 
@@ -3385,132 +4091,385 @@ char *word_expand_to_str(char *word, int flags)
 }
 
 
-#if 0
 /*
- * Check if char c is a valid $IFS character.
+ * Make room for an argument of len chars (plus the terminating NULL char) in
+ * the argument list's arena, and for one more pointer (plus the terminating
+ * NULL pointer) in its argv. As the strings in argv point into the arena, we
+ * move them to the new arena if we have to extend it.
  *
- * Returns 1 if char c is an $IFS character, 0 otherwise.
+ * Returns a pointer to the reserved space in the arena, NULL on error.
  */
-int is_IFS_char(char c, char *IFS)
+static char *arg_list_reserve(struct arg_list_s *args, size_t len)
 {
-    if(!*IFS)
+    if(args->argc+1 >= args->argv_size)
     {
-        return 0;
+        int newsz = args->argv_size ? args->argv_size << 1 : 32;
+        char **newv = realloc(args->argv, newsz*sizeof(char *));
+        if(!newv)
+        {
+            return NULL;
+        }
+        args->argv = newv;
+        args->argv_size = newsz;
     }
-    do
+
+    if(args->buf_len+len+1 > args->buf_size)
     {
-        if(c == *IFS)
+        size_t newsz = args->buf_size ? args->buf_size : 512;
+        while(args->buf_len+len+1 > newsz)
         {
-            return 1;
+            newsz <<= 1;
         }
-    } while(*++IFS);
-    return 0;
+
+        char *newbuf = malloc(newsz);
+        if(!newbuf)
+        {
+            return NULL;
+        }
+
+        if(args->buf)
+        {
+            int i;
+            memcpy(newbuf, args->buf, args->buf_len);
+            for(i = 0; i < args->argc; i++)
+            {
+                args->argv[i] = newbuf + (args->argv[i] - args->buf);
+            }
+            free(args->buf);
+        }
+        args->buf = newbuf;
+        args->buf_size = newsz;
+    }
+
+    return args->buf + args->buf_len;
 }
-#endif
 
 
 /*
- * Skip all whitespace characters that are part of the $IFS.
- * It is the caller's responsibility to make sure this function is called only
- * with the "whitespace" part of the $IFS, i.e. that the IFS argument doesn't
- * include any non-whitespace characters.
+ * Add the string that was written to the space arg_list_reserve() returned to
+ * the argument list, given its final length.
  */
-char *skip_IFS_whitespace(char *str, char *IFS)
-// void skip_IFS_whitespace(char **str, char *IFS)
+static char *arg_list_commit(struct arg_list_s *args, size_t len)
 {
-#if 0
-    char *s2 = str;
-    
-    while(strchr_any(s2, IFS))
+    char *arg = args->buf + args->buf_len;
+    arg[len] = '\0';
+    args->buf_len += len+1;
+    args->argv[args->argc++] = arg;
+    args->argv[args->argc] = NULL;
+    return arg;
+}
+
+
+/*
+ * Add a copy of the first len chars of str to the argument list.
+ *
+ * Returns the copy, NULL on error.
+ */
+char *arg_list_add(struct arg_list_s *args, char *str, size_t len)
+{
+    char *arg = arg_list_reserve(args, len);
+    if(!arg)
     {
-        s2++;
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "word expansion");
+        return NULL;
     }
-    
-    do
+
+    memcpy(arg, str, len);
+    return arg_list_commit(args, len);
+}
+
+
+/*
+ * Add a copy of str to the argument list, removing quotes as we copy.
+ *
+ * Returns the copy, NULL on error.
+ */
+char *arg_list_add_unquoted(struct arg_list_s *args, char *str)
+{
+    int flags = 0;
+    char *arg = arg_list_reserve(args, strlen(str));
+    if(!arg)
+    {
+        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "word expansion");
+        return NULL;
+    }
+
+    return arg_list_commit(args, unquote_str(arg, str, &flags));
+}
+
+
+/*
+ * Add the pathnames matching the given pattern word to the argument list.
+ *
+ * Returns 1 if the pathnames were added, 0 if the word is not a pattern or
+ * it matched nothing (in which case the word should be added as-is), or -1 if
+ * pathname expansion failed.
+ */
+static int arg_list_add_pathnames(struct arg_list_s *args, char *word)
+{
+    /*
+     *  Make sure we don't add / after directory names in the expanded fields
+     *  (see pathnames_expand() above).
+     */
+    int save_addsuffix = optionx_set(OPTION_ADD_SUFFIX);
+    set_optionx(OPTION_ADD_SUFFIX, 0);
+
+    struct glob_stream_s *stream = open_glob_stream(word);
+    int res = 0;
+    char *path;
+
+    /* not a pattern, no filename globbing */
+    if(!stream)
+    {
+        set_optionx(OPTION_ADD_SUFFIX, save_addsuffix);
+        return 0;
+    }
+
+    if(stream->count)
     {
-        if(*s2 == *IFS2)
+        /* the paths are not subject to quote removal */
+        while((path = next_glob_match(stream)))
         {
-            s2++;
-            IFS2 = IFS-1;
+            arg_list_add(args, path, strlen(path));
+            free(path);
         }
-    } while(*++IFS2);
-    
-    (*str) = s2;
-#endif
-    
-    while(*str && chrcmp(*str, IFS))
+        res = 1;
+    }
+    /* no matches found. remove the word (bash extension) */
+    else if(optionx_set(OPTION_NULL_GLOB))
     {
-        str++;
+        res = 1;
     }
-    
-    return str;
+    /* print error and bail out (bash extension) */
+    else if(optionx_set(OPTION_FAIL_GLOB))
+    {
+        PRINT_ERROR(SHELL_NAME, "file globbing failed for %s", word);
+        res = -1;
+    }
+
+    close_glob_stream(stream);
+    set_optionx(OPTION_ADD_SUFFIX, save_addsuffix);
+    return res;
 }
 
 
 /*
- * Skip all trailing whitespace characters that are part of $IFS. The function
- * compares characters starting at *strend, going back upto *str, and stops
- * when it hits a character that is not part of the $IFS.
- * It is the caller's responsibility to make sure this function is called only
- * with the "whitespace" part of the $IFS, i.e. that the IFS argument doesn't
- * include any non-whitespace characters.
+ * Word-expand the given word and add the resulting fields to the argument list
+ * of a simple command. This does the same job as word_expand(), except that
+ * brace expansion items are generated one at a time, and pathname expansion
+ * and quote removal write their results directly into the argument list's
+ * string arena, instead of building and rewriting a list of words.
+ *
+ * Returns 1 on success, 0 if word expansion or pathname expansion failed.
  */
-char *skip_trailing_IFS_whitespace(char *str, char *strend, char *IFS)
+int word_expand_to_args(struct arg_list_s *args, char *orig_word, int flags)
 {
-    while(strend > str && chrcmp(*strend, IFS))
+    struct symtab_entry_s *entry;
+    char **fields, *field;
+    int res;
+
+    /* add the elements of "${name[@]}" directly to the list */
+    if(flag_set(flags, FLAG_REMOVE_QUOTES) && (entry = get_quoted_array_word(orig_word)))
     {
-        strend--;
+        size_t pos = 0;
+        char *val;
+        while((val = entry->array ? array_next(entry->array, &pos, NULL, NULL) :
+                                    (pos++ ? NULL : entry->val)))
+        {
+            arg_list_add(args, val, strlen(val));
+        }
+        return 1;
     }
-    
-    return strend;
+
+    /* add a field for each element of "${!name[@]}", "${name[@]:1}" and the like */
+    if(flag_set(flags, FLAG_REMOVE_QUOTES) &&
+       (res = quoted_array_expand(orig_word, &fields, &field)))
+    {
+        if(res < 0)
+        {
+            return 0;
+        }
+
+        if(!fields)
+        {
+            arg_list_add(args, field ? field : "", field ? strlen(field) : 0);
+            if(field)
+            {
+                free(field);
+            }
+            return 1;
+        }
+
+        char **f;
+        for(f = fields; *f; f++)
+        {
+            arg_list_add(args, *f, strlen(*f));
+        }
+        free_elems_list(fields);
+        return 1;
+    }
+
+    /* add the positional parameters of "$@" directly to the list */
+    if(flag_set(flags, FLAG_REMOVE_QUOTES) && is_quoted_pos_params_word(orig_word))
+    {
+        int k, n = pos_param_count();
+        for(k = 1; k <= n; k++)
+        {
+            char *val = get_pos_param(k);
+            if(!val)
+            {
+                val = "";
+            }
+            arg_list_add(args, val, strlen(val));
+        }
+        return 1;
+    }
+
+    struct brace_gen_s *gen = brace_compile(orig_word);
+    char *item = gen ? brace_next(gen) : orig_word;
+    int glob = flag_set(flags, FLAG_PATHNAME_EXPAND) && !option_set('f');
+    int unquote = flag_set(flags, FLAG_REMOVE_QUOTES);
+    /* braces that expand to nothing, as in {,}, give us no fields */
+    int expanded = (gen && !item);
+    struct word_s *words, *w;
+
+    while(item)
+    {
+        words = word_expand_one_word(item, flags);
+        if(words)
+        {
+            expanded = 1;
+        }
+
+        for(w = words; w; w = w->next)
+        {
+            if(glob)
+            {
+                int res = arg_list_add_pathnames(args, w->data);
+                if(res < 0)
+                {
+                    free_all_words(words);
+                    if(gen)
+                    {
+                        brace_free(gen);
+                    }
+                    return 0;
+                }
+                else if(res)
+                {
+                    continue;
+                }
+            }
+
+            if(unquote)
+            {
+                arg_list_add_unquoted(args, w->data);
+            }
+            else
+            {
+                arg_list_add(args, w->data, strlen(w->data));
+            }
+        }
+
+        free_all_words(words);
+        item = gen ? brace_next(gen) : NULL;
+    }
+
+    if(gen)
+    {
+        brace_free(gen);
+    }
+    return expanded;
 }
 
 
 /*
- * Skip $IFS delimiters, which can be whitespace characters as well as other chars.
+ * Return the char class table for the given $IFS. Each entry in the table
+ * tells if the char is an $IFS whitespace char, an $IFS delimiter char, or a
+ * char field splitting has to look at because it quotes or escapes other chars
+ * (or ends the string). The table is rebuilt only when the value of $IFS changes,
+ * which means field splitting doesn't have to scan $IFS for every char it
+ * examines.
  */
-#if 0
-void skip_IFS_delim(char *str, char *IFS_space, char *IFS_delim, size_t *_i, size_t len)
+unsigned char *get_IFS_table(char *IFS)
 {
-    size_t i = *_i;
+    static unsigned char IFS_table[256];
+    static char *table_IFS = NULL;
+    char *p;
 
-    while((i < len) && is_IFS_char(str[i], IFS_space))
+    if(table_IFS && strcmp(table_IFS, IFS) == 0)
     {
-        i++;
+        return IFS_table;
     }
 
-    while((i < len) && is_IFS_char(str[i], IFS_delim))
+    if(table_IFS)
     {
-        i++;
+        free(table_IFS);
     }
-    
-    while((i < len) && is_IFS_char(str[i], IFS_space))
+
+    /* if we can't save a copy, we will rebuild the table on the next call */
+    table_IFS = __get_malloced_str(IFS);
+
+    memset(IFS_table, 0, sizeof(IFS_table));
+
+    for(p = IFS; *p; p++)
     {
-        i++;
+        IFS_table[(unsigned char)*p] = isspace(*p) ? IFS_SPACE : IFS_DELIM;
     }
-    
-    *_i = i;
+
+    IFS_table['\0' ] |= IFS_SPECIAL;
+    IFS_table['\\' ] |= IFS_SPECIAL;
+    IFS_table['\'' ] |= IFS_SPECIAL;
+    IFS_table['"'  ] |= IFS_SPECIAL;
+    IFS_table['`'  ] |= IFS_SPECIAL;
+
+    return IFS_table;
 }
-#endif
 
-char *skip_IFS_delim(char *str, char *IFS_space, char *IFS_delim)
+
+/*
+ * Skip all whitespace characters that are part of the $IFS.
+ */
+char *skip_IFS_whitespace(char *str, unsigned char *IFS_table)
 {
-    while(*str && chrcmp(*str, IFS_space))
+    while(IFS_table[(unsigned char)*str] & IFS_SPACE)
     {
         str++;
     }
     
-    if(*str && chrcmp(*str, IFS_delim))
+    return str;
+}
+
+
+/*
+ * Skip all trailing whitespace characters that are part of $IFS. The function
+ * compares characters starting at *strend, going back upto *str, and stops
+ * when it hits a character that is not part of the $IFS.
+ */
+char *skip_trailing_IFS_whitespace(char *str, char *strend, unsigned char *IFS_table)
+{
+    while(strend > str && (IFS_table[(unsigned char)*strend] & IFS_SPACE))
     {
-        str++;
+        strend--;
     }
     
-    while(*str && chrcmp(*str, IFS_space))
+    return strend;
+}
+
+
+/*
+ * Skip $IFS delimiters, which can be whitespace characters as well as other chars.
+ */
+char *skip_IFS_delim(char *str, unsigned char *IFS_table)
+{
+    str = skip_IFS_whitespace(str, IFS_table);
+    
+    if(IFS_table[(unsigned char)*str] & IFS_DELIM)
     {
         str++;
     }
     
-    return str;
+    return skip_IFS_whitespace(str, IFS_table);
 }
 
 
@@ -3520,19 +4479,19 @@ char *skip_IFS_delim(char *str, char *IFS_space, char *IFS_delim)
  * when it hits a character that is not part of the $IFS. That is, the return
  * result points to the first $IFS char minus 1.
  */
-char *skip_trailing_IFS_delim(char *str, char *strend, char *IFS_space, char *IFS_delim)
+char *skip_trailing_IFS_delim(char *str, char *strend, unsigned char *IFS_table)
 {
-    while(strend >= str && chrcmp(*strend, IFS_space))
+    while(strend >= str && (IFS_table[(unsigned char)*strend] & IFS_SPACE))
     {
         strend--;
     }
     
-    if(strend >= str && chrcmp(*strend, IFS_delim))
+    if(strend >= str && (IFS_table[(unsigned char)*strend] & IFS_DELIM))
     {
         strend--;
     }
     
-    while(strend >= str && chrcmp(*strend, IFS_space))
+    while(strend >= str && (IFS_table[(unsigned char)*strend] & IFS_SPACE))
     {
         strend--;
     }
@@ -3541,50 +4500,10 @@ char *skip_trailing_IFS_delim(char *str, char *strend, char *IFS_space, char *IF
 }
 
 
-/*
- * Given an $IFS, break the string down to retrieve the space and delimiter
- * characters we will use later on to perform field splitting.
- */
-void get_IFS_spaces_and_delims(char *IFS, char *IFS_space, char *IFS_delim)
-{
-    char *p;
-
-    if(strcmp(IFS, " \t\n") == 0)   /* "standard" IFS */
-    {
-        IFS_space[0] = ' ' ;
-        IFS_space[1] = '\t';
-        IFS_space[2] = '\n';
-        IFS_space[3] = '\0';
-        
-        IFS_delim[0] = '\0';
-    }
-    else                            /* "custom" IFS */
-    {
-        p  = IFS;
-        char *sp = IFS_space;
-        char *dp = IFS_delim;
-        
-        do
-        {
-            if(isspace(*p))
-                //if(*p == ' ' || *p == '\t' || *p == '\n')
-            {
-                *sp++ = *p++;
-            }
-            else
-            {
-                *dp++ = *p++;
-            }
-        } while(*p);
-        
-        *sp = '\0';
-        *dp = '\0';
-    }
-}
-
-
 /*
  * Convert the words resulting from a word expansion into separate fields.
+ * The string is scanned once, and each field is copied straight into its
+ * word struct (see make_wordl()).
  *
  * Returns a pointer to the first field, NULL if no field splitting was done.
  */
@@ -3592,7 +4511,6 @@ struct word_s *field_split(char *str)
 {
     struct symtab_entry_s *entry = get_symtab_entry("IFS");
     char *IFS = entry ? entry->val : NULL;
-    char *p;
 
     /* POSIX says no IFS means: "space/tab/NL" */
     if(!IFS)
@@ -3606,194 +4524,109 @@ struct word_s *field_split(char *str)
         return NULL;
     }
     
-    /* get the IFS spaces and delimiters separately */
-    char IFS_space[64];
-    char IFS_delim[64];
-
-    get_IFS_spaces_and_delims(IFS, IFS_space, IFS_delim);
+    unsigned char *IFS_table = get_IFS_table(IFS);
+    struct word_s *first_field = NULL, **tail = &first_field;
+    char *p, *start;
+    char  quote = 0;
 
     /* skip any leading whitespaces in the string */
-    str = skip_IFS_whitespace(str, IFS_space);
-    
-    size_t len    = strlen(str);
-    size_t i      = 0, j = 0, k;
-    char   quote  = 0;
-    
-#if 0
-    int    fields = 1;
-    int    splitting = 0;
-    
-    /* estimate the needed number of fields */
-    do
+    str = skip_IFS_whitespace(str, IFS_table);
+    p = str;
+    start = str;
+
+    /* create the fields */
+    for(;;)
     {
-        switch(str[i])
+        /* skip over the chars that can't end a field */
+        while(!IFS_table[(unsigned char)*p])
         {
-            /* skip escaped chars */
-            case '\\':
-                /* backslash has no effect inside single quotes */
-                if(quote != '\'')
-                {
-                    i++;
-                }
-                break;
-
-            /* don't count whitespaces inside quotes */
-            case '\'':
-            case '"':
-            case '`':
-                if(quote == str[i])
-                {
-                    quote = 0;
-                }
-                else
-                {
-                    quote = str[i];
-                }
-                break;
-
-            default:
-                /* skip normal characters if we're inside quotes */
-                if(quote)
-                {
-                    break;
-                }
-    
-                if(is_IFS_char(str[i], IFS_space) || is_IFS_char(str[i], IFS_delim))
-                {
-                    splitting = 1;
-                    skip_IFS_delim(str, IFS_space, IFS_delim, &i, len);
-                
-                    if(i < len)
-                    {
-                        fields++;
-                    }
-                }
-                break;
+            p++;
         }
-    } while(++i < len);
-
-    /* we have only one field. no field splitting needed */
-    if(fields == 1 && !splitting)
-    {
-        return NULL;
-    }
-#endif
-
-    struct word_s *first_field = NULL;
-    struct word_s *cur         = NULL;
 
-    /* create the fields */
-    i     = 0;
-    j     = 0;
-    quote = 0;
-
-    do
-    {
-        switch(str[i])
+        switch(*p)
         {
             /* skip escaped chars */
             case '\\':
-                /* backslash has no effect inside single quotes */
-                if(quote != '\'')
+                if(p[1])
                 {
-                    i++;
+                    p++;
                 }
-                break;
+                p++;
+                continue;
 
             /* skip single quoted substrings */
             case '\'':
-                p = str+i+1;
-                while(*p && *p != '\'')
+                if(!quote)
                 {
-                    p++;
+                    while(*++p && *p != '\'')
+                    {
+                        ;
+                    }
+
+                    if(!*p)
+                    {
+                        break;
+                    }
                 }
-                i = p-str;
-                break;
+                p++;
+                continue;
 
             /* remember if we're inside/outside double and back quotes */
             case '"':
             case '`':
-                if(quote == str[i])
+                if(!quote)
                 {
-                    quote = 0;
+                    quote = *p;
                 }
-                else
+                else if(quote == *p)
                 {
-                    quote = str[i];
+                    quote = 0;
                 }
-                break;
+                p++;
+                continue;
 
             default:
-                /* skip normal characters if we're inside quotes */
-                if(quote)
+                /* skip $IFS chars if we're inside quotes */
+                if(*p && quote)
                 {
-                    break;
+                    p++;
+                    continue;
                 }
-                
-                /*
-                 * delimit the field if we have an IFS space or delimiter char, or if
-                 * we reached the end of the input string.
-                 */
-                if(chrcmp(str[i], IFS_space) ||
-                   chrcmp(str[i], IFS_delim) || (i == len))
-                {
-                    /* copy the field text */
-                    char *tmp = malloc(i-j+1);
+                break;
+        }
 
-                    /* TODO: do something better than bailing out here */
-                    if(!tmp)
-                    {
-                        INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "making fields");
-                        return first_field;
-                    }
+        /*
+         * delimit the field if we have an IFS space or delimiter char, or if
+         * we reached the end of the input string.
+         */
+        struct word_s *fld = make_wordl(start, p-start);
+        
+        /* TODO: do something better than bailing out here */
+        if(!fld)
+        {
+            INSUFFICIENT_MEMORY_ERROR(SHELL_NAME, "making fields");
+            return first_field;
+        }
+        
+        *tail = fld;
+        tail  = &fld->next;
 
-                    strncpy(tmp, str+j, i-j);
-                    tmp[i-j] = '\0';
-                    
-                    /* create a new struct for the field */
-                    struct word_s *fld = malloc(sizeof(struct word_s));
-                    
-                    /* TODO: do something better than bailing out here */
-                    if(!fld)
-                    {
-                        free(tmp);
-                        return first_field;
-                    }
-                    
-                    memset(fld, 0, sizeof(struct word_s));
-                    fld->data = tmp;
-                    fld->len  = i-j;
-                    
-                    if(!first_field)
-                    {
-                        first_field = fld;
-                    }
-                    
-                    if(!cur)
-                    {
-                        cur  = fld;
-                    }
-                    else
-                    {
-                        cur->next = fld;
-                        cur       = fld;
-                    }
-                    
-                    k = i;
-                    
-                    /* skip trailing IFS spaces/delimiters */
-                    p = skip_IFS_delim(str+i, IFS_space, IFS_delim);
-                    i = p-str;
-                    j = i;
-                    
-                    if(i != k && i < len)
-                    {
-                        i--;     /* go back one step so the loop will work correctly */
-                    }
-                }
-                break;
+        if(!*p)
+        {
+            break;
+        }
+
+        /* skip trailing IFS spaces/delimiters */
+        p = skip_IFS_delim(p, IFS_table);
+
+        /* trailing IFS chars don't make an empty field */
+        if(!*p)
+        {
+            break;
         }
-    } while(++i <= len);
+
+        start = p;
+    }
     
     return first_field;
 }